@@ -1,68 +1,107 @@
 --
--- log service
+-- log service, launched as `node.launch('logger', 'logger.lua', name)`.
 --
-local mq = require 'mq'
-local fs = require 'fs'
+-- lines are written to `logs/<name>_<date>.log` by a buffered native sink,
+-- or printed to console if `name` is empty.
+--
+-- a message starting with the TEXT_TAG byte is a plain text line, such as
+-- sent by `qsf.log`; anything else must be a MessagePack
+-- `{method=..., params={...}}` notify, such as sent by `qsf.notify`.
+--
+local uv = require 'luv'
+local node = require 'node'
+local lfs = require 'lfs'
+local logsink = require 'logsink'
 local mp = require 'MessagePack'
-local dumpstring = require 'dump'.dumpstring
 
-local print, assert, tostring, table, string, io, os
-    = print, assert, tostring, table, string, io, os
+local print, tostring, table, string, os, type, pcall
+    = print, tostring, table, string, os, type, pcall
+
+
+local LOG_DIR = 'logs'
+local POLL_INTERVAL = 10    -- milliseconds
+local TEXT_TAG = '\1'
 
-    
 local service = {}
 
-local writer
+local sink, sink_name
+
+local function write(from, text)
+    if sink then
+        sink:write(sink_name, from, ': ', text)
+    else
+        print(string.format('%s %s: %s', os.date('%H:%M:%S'), from, text))
+    end
+end
 
 function service.print(from, ...)
-    local args = {... }
-    for n=1, #args do
-        args[n] = tostring(args[n]) .. ' '
+    local args = {...}
+    for n = 1, #args do
+        args[n] = tostring(args[n])
+    end
+    write(from, table.concat(args, ' '))
+end
+
+local function dispatch_notify(from, data)
+    local msg = mp.unpack(data)
+    if type(msg) ~= 'table' then
+        error('malformed message')
+    end
+    local func = service[msg.method]
+    if not func then
+        error('method not found: ' .. tostring(msg.method))
+    end
+    local params = msg.params
+    if type(params) == 'table' then
+        func(from, table.unpack(params))
+    else
+        func(from)
     end
-    local timestamp = os.date('%H:%M:%S')
-    local text = string.format('%s %s: %s', timestamp, from, table.concat(args))
-    writer(text)
 end
 
-local function dispatch_message()
-    local from, data = mq.recv()
-    assert(from and data)
-    if from == 'sys' and data == 'exit' then
-        mq.send(from, 'roger')
-        return false
+local function dispatch_message(from, data)
+    if data:sub(1, 1) == TEXT_TAG then
+        write(from, data:sub(2))
     else
-        --print(from .. ' ==> ' .. mq.name(), data)
-        local msg = mp.unpack(data)
-        local func = service[msg.method]
-        if func then
-            func(from, table.unpack(msg.params))
-        else
-            print('method not found', msg.method)
-        end
+        dispatch_notify(from, data)
     end
-    return true
 end
 
-local function main(args)
-    print(dumpstring(args))
-    if args[2] then -- log to file
-        fs.mkdir('logs')
-        local name = (args[2])
-        writer = function(...)
-            local filename = string.format('logs/%s_%s.log', name, os.date('%Y-%m-%d'))
-            local fp = assert(io.open(filename, 'a+'))
-            fp:write(...)
-            fp:write('\n')
-            fp:close()
+-- returns false after exit message
+local function drain()
+    while true do
+        local from, data = node.recv('nowait')
+        if not from then
+            return true
+        end
+        if from == 'sys' and data == 'exit' then
+            node.send(from, 'roger')
+            return false
+        end
+        local ok, err = pcall(dispatch_message, from, data)
+        if not ok then
+            write('logger', string.format('bad message from %s: %s', from, err))
         end
-    else -- log to console
-        writer = print
     end
-    writer = print
-    while dispatch_message() do
-        -- nothing
+end
+
+local function main(name)
+    if name and name ~= '' then
+        lfs.mkdir(LOG_DIR)
+        sink = logsink.open(LOG_DIR)
+        sink_name = name
     end
+    local timer
+    timer = uv.createTimer(0, POLL_INTERVAL, function()
+        if not drain() then
+            timer:stop()
+            if sink then
+                sink:close()
+            end
+        end
+    end)
+    node.run()
     print('logger quit')
 end
 
-main{...}
+main(...)
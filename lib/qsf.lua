@@ -23,8 +23,16 @@ function qsf.launch(name, path, ...)
     node.launch(name, path, ...)
 end
 
+-- plain text line, written by logger without unpacking
 function qsf.log(...)
-    qsf.notify('logger', 'print', ...)
+    local args = {...}
+    for n = 1, select('#', ...) do
+        args[n] = tostring(args[n])
+    end
+    local text = table.concat(args, ' ')
+    if text ~= '' then
+        node_send('logger', '\1' .. text) -- text tag, see logger.lua
+    end
 end
 
 local function dispatch_message()
@@ -121,3 +121,20 @@ solution 'qsf'
                 'jemalloc',
                 'mysqlclient',
             }
+
+    project 'netbench'
+        targetname  'netbench'
+        location    'build'
+        kind        'ConsoleApp'
+        files
+        {
+            'tools/netbench/*.c',
+        }
+
+        filter 'system:windows'
+            includedirs 'deps/include/libuv'
+            libdirs 'deps/lib'
+            links 'libuv'
+
+        filter 'system:linux or macosx'
+            links 'uv'
@@ -18,6 +18,7 @@ extern int luaopen_net(lua_State* L);
 extern int luaopen_luv(lua_State *L);
 extern int luaopen_base64(lua_State* L);
 extern int luaopen_lfs(lua_State *L);
+extern int luaopen_logsink(lua_State* L);
 
 static const luaL_Reg preload_libs[] =
 {
@@ -31,6 +32,7 @@ static const luaL_Reg preload_libs[] =
     { "crypto", luaopen_crypto },
     { "base64", luaopen_base64 },
     { "process", luaopen_process },
+    { "logsink", luaopen_logsink },
     { NULL, NULL },
 };
 
@@ -0,0 +1,308 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <uv.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "qsf.h"
+#include "net/uthash.h"
+
+/**
+ *  buffered log files, one per name, `<dir>/<name>_<YYYY-MM-DD>.log`.
+ *
+ *  lines are stamped with a cached `HH:MM:SS` and kept in memory, a file
+ *  is written when its buffer reaches `flush_size` or by the flush timer,
+ *  and reopened with a new name when date changes.
+ *
+ *  a file failed to open is retried with doubling backoff up to a minute,
+ *  its lines are dropped meanwhile and the failure is logged once.
+ */
+
+#define LOGSINK_HANDLE          "logsink*"
+#define LOGSINK_FLUSH_SIZE      (64 * 1024)
+#define LOGSINK_FLUSH_INTERVAL  1000    // milliseconds
+#define LOGSINK_MAX_NAME        64
+#define LOGSINK_MAX_BACKOFF     60      // seconds
+
+typedef struct log_file_s
+{
+    UT_hash_handle  hh;                 // hash table entry
+    char            name[LOGSINK_MAX_NAME];
+    FILE*           fp;
+    int             day;                // date of opened file, YYYYMMDD
+    int             backoff;            // seconds, 0 if last open succeeded
+    time_t          retry_time;         // next open after failure
+    char*           buf;                // pending lines
+    size_t          size;
+    size_t          capacity;
+}log_file_t;
+
+typedef struct logsink_s
+{
+    uv_timer_t      timer;              // flush timer
+    char            dir[MAX_PATH];
+    size_t          flush_size;         // write file if buffer is larger
+    int             closed;
+    time_t          last_time;          // timestamp cache
+    int             today;              // YYYYMMDD
+    char            date[16];           // YYYY-MM-DD
+    char            stamp[16];          // HH:MM:SS + space
+    uint64_t        lines;
+    uint64_t        flushes;            // file writes
+    log_file_t*     files;              // name to file
+}logsink_t;
+
+#define check_sink(L)   (*(logsink_t**)luaL_checkudata(L, 1, LOGSINK_HANDLE))
+
+
+static void update_clock(logsink_t* sink)
+{
+    time_t now = time(NULL);
+    if (now != sink->last_time)
+    {
+        struct tm date = *localtime(&now);
+        sink->today = (date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday;
+        strftime(sink->date, sizeof(sink->date), "%Y-%m-%d", &date);
+        strftime(sink->stamp, sizeof(sink->stamp), "%H:%M:%S ", &date);
+        sink->last_time = now;
+    }
+}
+
+static void flush_file(logsink_t* sink, log_file_t* file)
+{
+    if (file->size > 0 && file->fp)
+    {
+        fwrite(file->buf, 1, file->size, file->fp);
+        fflush(file->fp);
+        sink->flushes++;
+    }
+    file->size = 0;
+}
+
+// pending lines go to file of their date before reopening
+static int open_file(logsink_t* sink, log_file_t* file)
+{
+    if (file->fp)
+    {
+        flush_file(sink, file);
+        fclose(file->fp);
+    }
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s_%s.log", sink->dir, file->name, sink->date);
+    file->fp = fopen(path, "a");
+    file->day = sink->today;
+    if (file->fp == NULL)
+    {
+        if (file->backoff == 0)
+        {
+            qsf_log("logsink: cannot open %s, %s.\n", path, strerror(errno));
+        }
+        file->backoff = QSF_MIN(QSF_MAX(file->backoff * 2, 1), LOGSINK_MAX_BACKOFF);
+        file->retry_time = sink->last_time + file->backoff;
+        return -1;
+    }
+    if (file->backoff > 0)
+    {
+        qsf_log("logsink: %s opened after failure.\n", path);
+        file->backoff = 0;
+    }
+    return 0;
+}
+
+static void flush_all(logsink_t* sink)
+{
+    log_file_t* file = NULL;
+    log_file_t* tmp = NULL;
+    HASH_ITER(hh, sink->files, file, tmp)
+    {
+        flush_file(sink, file);
+    }
+}
+
+static void on_flush_timer(uv_timer_t* handle)
+{
+    flush_all(handle->data);
+}
+
+static void on_sink_closed(uv_handle_t* handle)
+{
+    qsf_free(handle->data);
+}
+
+static void close_sink(logsink_t* sink)
+{
+    if (sink->closed)
+    {
+        return;
+    }
+    sink->closed = 1;
+    log_file_t* file = NULL;
+    log_file_t* tmp = NULL;
+    HASH_ITER(hh, sink->files, file, tmp)
+    {
+        flush_file(sink, file);
+        if (file->fp)
+        {
+            fclose(file->fp);
+        }
+        HASH_DEL(sink->files, file);
+        qsf_free(file->buf);
+        qsf_free(file);
+    }
+    uv_close((uv_handle_t*)&sink->timer, on_sink_closed);
+}
+
+static log_file_t* find_file(lua_State* L, logsink_t* sink, const char* name, size_t len)
+{
+    log_file_t* file = NULL;
+    HASH_FIND(hh, sink->files, name, len, file);
+    if (file == NULL)
+    {
+        luaL_argcheck(L, len > 0 && len < LOGSINK_MAX_NAME, 2, "invalid log name");
+        file = qsf_malloc(sizeof(log_file_t));
+        memset(file, 0, sizeof(*file));
+        memcpy(file->name, name, len);
+        file->capacity = sink->flush_size + 1024;
+        file->buf = qsf_malloc(file->capacity);
+        HASH_ADD(hh, sink->files, name, len, file);
+    }
+    if (file->day != sink->today ||
+        (file->fp == NULL && sink->last_time >= file->retry_time))
+    {
+        open_file(sink, file);
+    }
+    return file;
+}
+
+static void append(log_file_t* file, const char* data, size_t size)
+{
+    if (file->size + size > file->capacity)
+    {
+        size_t capacity = QSF_MAX(file->capacity * 2, file->size + size);
+        char* buf = qsf_malloc(capacity);
+        memcpy(buf, file->buf, file->size);
+        qsf_free(file->buf);
+        file->buf = buf;
+        file->capacity = capacity;
+    }
+    memcpy(file->buf + file->size, data, size);
+    file->size += size;
+}
+
+// sink:write(name, ...), pieces are joined as one stamped line
+static int sink_write(lua_State* L)
+{
+    logsink_t* sink = check_sink(L);
+    luaL_argcheck(L, !sink->closed, 1, "log sink is closed");
+    size_t len = 0;
+    const char* name = luaL_checklstring(L, 2, &len);
+    update_clock(sink);
+    log_file_t* file = find_file(L, sink, name, len);
+    append(file, sink->stamp, strlen(sink->stamp));
+    int top = lua_gettop(L);
+    for (int i = 3; i <= top; i++)
+    {
+        size_t size = 0;
+        const char* piece = luaL_tolstring(L, i, &size);
+        append(file, piece, size);
+        lua_pop(L, 1);
+    }
+    append(file, "\n", 1);
+    sink->lines++;
+    if (file->size >= sink->flush_size)
+    {
+        flush_file(sink, file);
+    }
+    return 0;
+}
+
+static int sink_flush(lua_State* L)
+{
+    logsink_t* sink = check_sink(L);
+    if (!sink->closed)
+    {
+        flush_all(sink);
+    }
+    return 0;
+}
+
+static int sink_close(lua_State* L)
+{
+    close_sink(check_sink(L));
+    return 0;
+}
+
+// sink:stats(), returns lines written and file writes
+static int sink_stats(lua_State* L)
+{
+    logsink_t* sink = check_sink(L);
+    lua_pushinteger(L, (lua_Integer)sink->lines);
+    lua_pushinteger(L, (lua_Integer)sink->flushes);
+    return 2;
+}
+
+// logsink.open(dir [, flush_size, flush_interval])
+static int sink_open(lua_State* L)
+{
+    qsf_node_t* self = lua_touserdata(L, lua_upvalueindex(1));
+    if (!qsf_node_check_tag(self))
+    {
+        return luaL_error(L, "invalid node object");
+    }
+    size_t len = 0;
+    const char* dir = luaL_checklstring(L, 1, &len);
+    lua_Integer flush_size = luaL_optinteger(L, 2, LOGSINK_FLUSH_SIZE);
+    lua_Integer interval = luaL_optinteger(L, 3, LOGSINK_FLUSH_INTERVAL);
+    luaL_argcheck(L, len > 0 && len < MAX_PATH - LOGSINK_MAX_NAME - 16, 1, "invalid directory");
+    luaL_argcheck(L, flush_size > 0, 2, "invalid flush size");
+    luaL_argcheck(L, interval > 0, 3, "invalid flush interval");
+
+    logsink_t** ud = lua_newuserdata(L, sizeof(logsink_t*));
+    logsink_t* sink = qsf_malloc(sizeof(logsink_t));
+    memset(sink, 0, sizeof(*sink));
+    memcpy(sink->dir, dir, len);
+    sink->flush_size = (size_t)flush_size;
+    uv_timer_init(qsf_node_loop(self), &sink->timer);
+    sink->timer.data = sink;
+    uv_timer_start(&sink->timer, on_flush_timer, interval, interval);
+    uv_unref((uv_handle_t*)&sink->timer); // do not keep loop alive
+    *ud = sink;
+    luaL_setmetatable(L, LOGSINK_HANDLE);
+    return 1;
+}
+
+LUALIB_API int luaopen_logsink(lua_State* L)
+{
+    static const luaL_Reg sink_lib[] =
+    {
+        { "__gc", sink_close },
+        { "write", sink_write },
+        { "flush", sink_flush },
+        { "close", sink_close },
+        { "stats", sink_stats },
+        { NULL, NULL },
+    };
+    luaL_newmetatable(L, LOGSINK_HANDLE);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, sink_lib, 0);
+    lua_pop(L, 1);
+
+    static const luaL_Reg lib[] =
+    {
+        { "open", sink_open },
+        { NULL, NULL },
+    };
+    luaL_newlibtable(L, lib);
+    lua_getfield(L, LUA_REGISTRYINDEX, "qsf_ctx");
+    qsf_node_t* self = lua_touserdata(L, -1);
+    luaL_argcheck(L, self != NULL, 1, "invalid context pointer");
+    luaL_setfuncs(L, lib, 1);
+    return 1;
+}
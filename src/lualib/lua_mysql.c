@@ -3,38 +3,153 @@
 // See accompanying files LICENSE.
 
 #include <stdint.h>
+#include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <mysql.h>
+#include <errmsg.h>
+#include <uv.h>
 #include <lua.h>
 #include <lauxlib.h>
+#include "qsf.h"
+#include "qsf_mysql_pool.h"
 
 
 #define LUAMYSQL_CONN       "Connection*"
 #define LUAMYSQL_CURSOR     "Cursor*"
+#define LUAMYSQL_POOL       "Pool*"
+#define LUAMYSQL_STMT       "Statement*"
+#define LUAMYSQL_CHANNEL    "QueryChannel*"
+#define LUAMYSQL_THREAD     "MysqlThread*"
 
 #define check_conn(L)   ((Connection*)luaL_checkudata(L, 1, LUAMYSQL_CONN))
 #define check_cursor(L) ((Cursor*)luaL_checkudata(L, 1, LUAMYSQL_CURSOR))
+#define check_pool(L)   (*(qsf_mysql_pool_t**)luaL_checkudata(L, 1, LUAMYSQL_POOL))
+#define check_stmt(L)   ((Statement*)luaL_checkudata(L, 1, LUAMYSQL_STMT))
 
+#define push_literal(L, name, value)\
+    lua_pushstring(L, name);        \
+    lua_pushinteger(L, value);      \
+    lua_rawset(L, -3);
+
+#define MYSQL_NULL_VALUE    0xffffffff  // length of NULL column in result buffer
+#define STMT_BUFFER_SIZE    256         // initial size of string column buffer
+#define BATCH_PACKET_MARGIN 1024        // reserved in `max_allowed_packet`
+
+struct _AsyncQuery;
+struct _Statement;
+
+// pool queries completed by pool workers, delivered to node loop
+typedef struct _QueryChannel
+{
+    uv_async_t          async;
+    uv_mutex_t          lock;
+    struct _AsyncQuery* done;       // completed queries
+    int                 inflight;   // submitted, not delivered
+}QueryChannel;
 
 // MySQL connection object
 typedef struct _Connection
 {
     int     closed;
+    int     busy;                   // used by a worker thread
+    struct _AsyncQuery* pending;    // queued async queries
+    struct _AsyncQuery* last;
+    uv_mutex_t  lock;               // held by worker during query
+    MYSQL*  mysql;                  // `my_conn` or borrowed from pool
+    qsf_mysql_pool_t* pool;         // owner of borrowed connection
+    struct _Statement* stmts;       // prepared statements
     MYSQL   my_conn;
 }Connection;
 
+// query run by uv worker thread, result rows are packed as
+// `[type:1 name_len:2 name]...` column headers and `[len:4 bytes]...` values
+typedef struct _AsyncQuery
+{
+    uv_work_t           work;
+    qsf_mysql_job_t     job;            // query run by pool worker
+    QueryChannel*       channel;
+    struct _AsyncQuery* next;
+    Connection*         conn;
+    qsf_mysql_pool_t*   pool;           // query on a pooled connection
+    qsf_node_t*         node;           // waits for query before exit
+    int                 conn_ref;       // keep connection alive
+    int                 callback_ref;
+    int                 alpha_idx;      // alphabetic row index
+    char*               sql;
+    size_t              sql_len;
+    unsigned int        err;            // mysql error number
+    char*               errmsg;
+    my_ulonglong        affected;
+    unsigned int        numcols;
+    my_ulonglong        numrows;
+    char*               buf;            // packed result
+    size_t              size;
+    size_t              capacity;
+}AsyncQuery;
+
 // Cursor object
 typedef struct _Cursor
 {
     int conn;                   // reference to connection
+    int keys;                   // reference to interned column names
     int fetch_all;              // fetch all result in one query
     unsigned int    numcols;    // number of columns
     MYSQL_RES*      my_res;     // mysql result instance
     MYSQL_FIELD*    fields;     // column names and types
 }Cursor;
 
+// how a result column is bound in binary protocol
+enum
+{
+    STMT_COLUMN_INTEGER,
+    STMT_COLUMN_DOUBLE,
+    STMT_COLUMN_DECIMAL,        // fetched as text
+    STMT_COLUMN_STRING,
+};
+
+typedef struct _StmtColumn
+{
+    int             kind;
+    union
+    {
+        long long   i;
+        double      d;
+    }num;
+    char*           buf;        // string value
+    unsigned long   capacity;
+    unsigned long   length;
+    my_bool         is_null;
+    my_bool         error;      // truncated
+    my_bool         is_unsigned;
+}StmtColumn;
+
+typedef union _StmtParam
+{
+    long long   i;
+    double      d;
+    signed char b;
+}StmtParam;
+
+// prepared statement object, closed with its connection
+typedef struct _Statement
+{
+    struct _Statement*  next;
+    Connection*         conn;
+    int                 conn_ref;   // keep connection alive
+    int                 alpha_idx;  // alphabetic row index
+    MYSQL_STMT*         my_stmt;
+    unsigned long       param_count;
+    unsigned int        numcols;
+    MYSQL_RES*          meta;       // result column names and types
+    MYSQL_BIND*         params;
+    StmtParam*          param_values;
+    MYSQL_BIND*         results;
+    StmtColumn*         columns;
+}Statement;
+
 
 static int create_cursor(lua_State* L, int conn, MYSQL_RES* result,
                          int numcols, int fetch_all)
@@ -46,6 +161,7 @@ static int create_cursor(lua_State* L, int conn, MYSQL_RES* result,
     luaL_getmetatable(L, LUAMYSQL_CURSOR);
     lua_setmetatable(L, -2);
     cur->conn = ref;
+    cur->keys = LUA_NOREF;
     cur->numcols = numcols;
     cur->fetch_all = fetch_all;
     cur->fields = NULL;
@@ -68,6 +184,11 @@ static void cursor_nullify(lua_State* L, Cursor* cur)
         luaL_unref(L, LUA_REGISTRYINDEX, cur->conn);
         cur->conn = LUA_NOREF;
     }
+    if (cur->keys != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, cur->keys);
+        cur->keys = LUA_NOREF;
+    }
 }
 
 static int cursor_gc(lua_State *L)
@@ -121,17 +242,44 @@ static void pushvalue(lua_State* L, enum enum_field_types type,
     }
 }
 
+// push column names on stack, they are interned once per cursor.
+// returns stack index of first name.
+static int push_keys(lua_State* L, Cursor* cur)
+{
+    luaL_checkstack(L, cur->numcols + 4, "too many columns");
+    if (cur->keys == LUA_NOREF)
+    {
+        lua_createtable(L, cur->numcols, 0);
+        for (unsigned i = 0; i < cur->numcols; i++)
+        {
+            lua_pushstring(L, cur->fields[i].name);
+            lua_rawseti(L, -2, i + 1);
+        }
+        cur->keys = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    int first = lua_gettop(L) + 1;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cur->keys);
+    for (unsigned i = 0; i < cur->numcols; i++)
+    {
+        lua_rawgeti(L, first, i + 1);
+    }
+    lua_remove(L, first);
+    return first;
+}
+
+// `keys` is stack index of column names, 0 for numeric index
 static void result_to_table(lua_State* L, Cursor* cur, MYSQL_ROW row,
-                            unsigned long* lengths, int alpha_idx)
+                            unsigned long* lengths, int keys)
 {
     assert(L && cur && lengths);
-    if (alpha_idx)
+    if (keys > 0)
     {
         lua_createtable(L, 0, cur->numcols);
         for (unsigned i = 0; i < cur->numcols; i++)
         {
+            lua_pushvalue(L, keys + i);
             pushvalue(L, cur->fields[i].type, row[i], lengths[i]);
-            lua_setfield(L, -2, cur->fields[i].name);
+            lua_rawset(L, -3);
         }
     }
     else // numeric index
@@ -168,23 +316,59 @@ static int cursor_fetch(lua_State* L)
         cur->fields = mysql_fetch_fields(res);
     }
     luaL_argcheck(L, lengths && cur->fields, 1, "fetch fields failed");
-    luaL_checkstack(L, cur->numcols, "too many columns");
-    result_to_table(L, cur, row, lengths, alpha_idx);
+    int keys = (alpha_idx ? push_keys(L, cur) : 0);
+    result_to_table(L, cur, row, lengths, keys);
     return 1;
 }
 
+// one array per column, keyed by column name. returns columns and
+// number of rows, arrays have holes for NULL values.
+static int fetch_columns(lua_State* L, Cursor* cur, MYSQL_ROW row)
+{
+    MYSQL_RES* res = cur->my_res;
+    int keys = push_keys(L, cur);
+    int num_rows = (int)mysql_num_rows(res);
+    int columns = lua_gettop(L) + 1;
+    luaL_checkstack(L, cur->numcols + 4, "too many columns");
+    for (unsigned i = 0; i < cur->numcols; i++)
+    {
+        lua_createtable(L, num_rows, 0);
+    }
+    lua_Integer rownum = 1;
+    while (row)
+    {
+        unsigned long* lengths = mysql_fetch_lengths(res);
+        for (unsigned i = 0; i < cur->numcols; i++)
+        {
+            pushvalue(L, cur->fields[i].type, row[i], lengths[i]);
+            lua_rawseti(L, columns + i, rownum);
+        }
+        rownum++;
+        row = mysql_fetch_row(res);
+    }
+    lua_createtable(L, 0, cur->numcols);
+    for (unsigned i = 0; i < cur->numcols; i++)
+    {
+        lua_pushvalue(L, keys + i);
+        lua_pushvalue(L, columns + i);
+        lua_rawset(L, -3);
+    }
+    lua_replace(L, keys);
+    lua_settop(L, keys);
+    lua_pushinteger(L, rownum - 1);
+    return 2;
+}
+
+// cur:fetchAll([opt]), 'a' for alphabetic row index, 'c' for columns
 static int cursor_fetch_all(lua_State* L)
 {
     Cursor* cur = check_cursor(L);
     luaL_argcheck(L, cur && cur->my_res, 1, "invalid Cursor object");
     luaL_argcheck(L, cur->fetch_all, 1, "not compatible with execute()");
 
-    int alpha_idx = 0;
     const char* opt = lua_tostring(L, 2);
-    if (opt && strcmp(opt, "a") == 0) // alphabetic table index
-    {
-        alpha_idx = 1;
-    }
+    int alpha_idx = (opt && strcmp(opt, "a") == 0); // alphabetic table index
+    int columnar = (opt && strcmp(opt, "c") == 0);
 
     MYSQL_RES* res = cur->my_res;
     MYSQL_ROW row = mysql_fetch_row(res);
@@ -197,14 +381,21 @@ static int cursor_fetch_all(lua_State* L)
     {
         cur->fields = mysql_fetch_fields(res);
     }
-    unsigned long* lengths = mysql_fetch_lengths(res);
-    luaL_argcheck(L, lengths && cur->fields, 1, "fetch fields failed");
+    luaL_argcheck(L, cur->fields, 1, "fetch fields failed");
+    if (columnar)
+    {
+        int r = fetch_columns(L, cur, row);
+        cursor_nullify(L, cur);
+        return r;
+    }
+    int keys = (alpha_idx ? push_keys(L, cur) : 0);
     int num_rows = (int)mysql_num_rows(cur->my_res);
     lua_createtable(L, num_rows, 0);
     int rownum = 1;
     while (row)
     {
-        result_to_table(L, cur, row, lengths, alpha_idx);
+        unsigned long* lengths = mysql_fetch_lengths(res);
+        result_to_table(L, cur, row, lengths, keys);
         lua_rawseti(L, -2, rownum++);
         row = mysql_fetch_row(res);
     }
@@ -216,8 +407,10 @@ static int cursor_fetch_all(lua_State* L)
 static int conn_create(lua_State* L)
 {
     Connection* conn = (Connection*)lua_newuserdata(L, sizeof(Connection));
-    conn->closed = 0;
-    if (mysql_init(&conn->my_conn) == &conn->my_conn)
+    memset(conn, 0, sizeof(*conn));
+    uv_mutex_init(&conn->lock);
+    conn->mysql = &conn->my_conn;
+    if (mysql_init(conn->mysql) == conn->mysql)
     {
         luaL_getmetatable(L, LUAMYSQL_CONN);
         lua_setmetatable(L, -2);
@@ -225,23 +418,73 @@ static int conn_create(lua_State* L)
     }
     else
     {
-        return luaL_error(L, "%s\n", mysql_error(&conn->my_conn));
+        return luaL_error(L, "%s\n", mysql_error(conn->mysql));
     }
 }
 
-static int conn_close(lua_State* L)
+static void release_stmt(Statement* stmt)
+{
+    if (stmt->meta)
+    {
+        mysql_free_result(stmt->meta);
+    }
+    mysql_stmt_close(stmt->my_stmt);
+    for (unsigned int i = 0; i < stmt->numcols; i++)
+    {
+        qsf_free(stmt->columns[i].buf);
+    }
+    qsf_free(stmt->columns);
+    qsf_free(stmt->results);
+    qsf_free(stmt->params);
+    qsf_free(stmt->param_values);
+    stmt->my_stmt = NULL;
+    stmt->meta = NULL;
+    stmt->columns = NULL;
+    stmt->results = NULL;
+    stmt->params = NULL;
+    stmt->param_values = NULL;
+}
+
+// borrowed connection goes back to its pool, statements are closed
+// before it is used by others.
+static void close_conn(Connection* conn)
 {
-    Connection* conn = check_conn(L);
-    luaL_argcheck(L, conn, 1, "invalid Connection object");
     if (!conn->closed)
     {
-        mysql_close(&conn->my_conn);
+        while (conn->stmts)
+        {
+            Statement* stmt = conn->stmts;
+            conn->stmts = stmt->next;
+            release_stmt(stmt);
+        }
+        if (conn->pool)
+            qsf_mysql_pool_release(conn->pool, conn->mysql, QSF_MYSQL_RELEASE_RESET);
+        else
+            mysql_close(conn->mysql);
         conn->closed = 1;
     }
+}
+
+static int conn_close(lua_State* L)
+{
+    Connection* conn = check_conn(L);
+    luaL_argcheck(L, conn, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    close_conn(conn);
     return 0;
 }
 
-#define conn_gc conn_close
+// connections with pending queries are anchored, a busy one is only
+// collected by `lua_close`, wait for its worker before closing.
+static int conn_gc(lua_State* L)
+{
+    Connection* conn = check_conn(L);
+    uv_mutex_lock(&conn->lock);
+    close_conn(conn);
+    uv_mutex_unlock(&conn->lock);
+    uv_mutex_destroy(&conn->lock);
+    return 0;
+}
 
 static int conn_tostring(lua_State* L)
 {
@@ -255,6 +498,7 @@ static int conn_connect(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, conn->pool == NULL, 1, "connection is borrowed from pool");
     luaL_argcheck(L, lua_istable(L, 2), 1, "argument must be table");
 
     lua_getfield(L, 2, "host");
@@ -273,10 +517,10 @@ static int conn_connect(lua_State* L)
     unsigned long flags = (unsigned long)luaL_optinteger(L, -1, 0);
     lua_pop(L, 7);
 
-    if (mysql_real_connect(&conn->my_conn, host, user, passwd, db, port,
-            unix_socket, flags) != &conn->my_conn)
+    if (mysql_real_connect(conn->mysql, host, user, passwd, db, port,
+            unix_socket, flags) != conn->mysql)
     {
-        return luaL_error(L, "connect failed, %s\n", mysql_error(&conn->my_conn));
+        return luaL_error(L, "connect failed, %s\n", mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -285,6 +529,7 @@ static int conn_execute(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
 
     size_t length = 0;
     const char* stmt = luaL_checklstring(L, 2, &length);
@@ -298,7 +543,7 @@ static int conn_execute(lua_State* L)
             fetch_all = 0;
     }
 
-    MYSQL* my_conn = &conn->my_conn;
+    MYSQL* my_conn = conn->mysql;
     int err = mysql_real_query(my_conn, stmt, (unsigned long)length);
     if (err != 0)
     {
@@ -330,9 +575,10 @@ static int conn_commit(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
-    if (mysql_commit(&conn->my_conn) != 0)
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    if (mysql_commit(conn->mysql) != 0)
     {
-        return luaL_error(L, "commit failed, %s\n", mysql_error(&conn->my_conn));
+        return luaL_error(L, "commit failed, %s\n", mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -341,9 +587,10 @@ static int conn_rollback(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
-    if (mysql_rollback(&conn->my_conn) != 0)
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    if (mysql_rollback(conn->mysql) != 0)
     {
-        return luaL_error(L, "rollback failed, %s\n", mysql_error(&conn->my_conn));
+        return luaL_error(L, "rollback failed, %s\n", mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -352,11 +599,12 @@ static int conn_set_charset(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     const char* charset = luaL_checkstring(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_SET_CHARSET_NAME, charset);
+    int err = mysql_options(conn->mysql, MYSQL_SET_CHARSET_NAME, charset);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -365,11 +613,12 @@ static int conn_set_reconnect(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     my_bool val = (my_bool)lua_toboolean(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_RECONNECT, &val);
+    int err = mysql_options(conn->mysql, MYSQL_OPT_RECONNECT, &val);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -378,11 +627,12 @@ static int conn_set_connect_timeout(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     uint32_t timeout = (unsigned int)luaL_checkinteger(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    int err = mysql_options(conn->mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -391,11 +641,12 @@ static int conn_set_read_timeout(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     uint32_t timeout = (unsigned int)luaL_checkinteger(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    int err = mysql_options(conn->mysql, MYSQL_OPT_READ_TIMEOUT, &timeout);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -404,11 +655,12 @@ static int conn_set_write_timeout(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     uint32_t timeout = (unsigned int)luaL_checkinteger(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+    int err = mysql_options(conn->mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -417,10 +669,11 @@ static int conn_set_compress(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_COMPRESS, NULL);
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    int err = mysql_options(conn->mysql, MYSQL_OPT_COMPRESS, NULL);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -429,11 +682,12 @@ static int conn_set_protocol(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     unsigned int protocol = (unsigned int)luaL_checkinteger(L, 2);
-    int err = mysql_options(&conn->my_conn, MYSQL_OPT_PROTOCOL, &protocol);
+    int err = mysql_options(conn->mysql, MYSQL_OPT_PROTOCOL, &protocol);
     if (err != 0)
     {
-        return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+        return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
     }
     return 0;
 }
@@ -442,13 +696,14 @@ static int conn_ping(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
-    MYSQL* my_conn = &conn->my_conn;
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    MYSQL* my_conn = conn->mysql;
     if (my_conn->methods == NULL)
     {
         int err = mysql_ping(my_conn);
         if (err != 0)
         {
-            return luaL_error(L, "%d: %s\n", err, mysql_error(&conn->my_conn));
+            return luaL_error(L, "%d: %s\n", err, mysql_error(conn->mysql));
         }
     }
     return 0;
@@ -458,6 +713,7 @@ static int conn_escape_string(lua_State* L)
 {
     Connection* conn = check_conn(L);
     luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
     size_t length = 0;
     const char* stmt = luaL_checklstring(L, 2, &length);
     char* dest = malloc(length * 2 + 1);
@@ -465,7 +721,7 @@ static int conn_escape_string(lua_State* L)
     {
         return luaL_error(L, "malloc() failed.");
     }
-    unsigned long newlen = mysql_real_escape_string(&conn->my_conn, dest,
+    unsigned long newlen = mysql_real_escape_string(conn->mysql, dest,
         stmt, (unsigned long)length);
     lua_pushlstring(L, dest, newlen);
     free(dest);
@@ -474,97 +730,1421 @@ static int conn_escape_string(lua_State* L)
 
 
 //////////////////////////////////////////////////////////////////////////
+// batch insert
 
-#define push_literal(L, name, value)\
-    lua_pushstring(L, name);        \
-    lua_pushinteger(L, value);      \
-    lua_rawset(L, -3);
+typedef struct _SqlBuffer
+{
+    char*   data;
+    size_t  size;
+    size_t  capacity;
+}SqlBuffer;
 
+typedef struct _BatchInsert
+{
+    MYSQL*      mysql;
+    SqlBuffer   header;         // INSERT INTO `t` (`a`,`b`) VALUES
+    SqlBuffer   packet;         // statements sent in one query
+    SqlBuffer   row;
+    size_t      max_packet;
+    lua_Integer chunk_rows;     // max rows of one statement
+    int         multi;          // pipeline statements in one packet
+    int         multi_on;       // multi statements turned on by us
+    int         counts;         // stack index of affected rows table
+    lua_Integer num_stmts;
+    lua_Integer total;
+}BatchInsert;
 
-static void push_mysql_constant(lua_State* L)
+static void sql_reserve(SqlBuffer* buf, size_t size)
 {
-    // protocol type
-    push_literal(L, "PROTOCOL_DEFAULT", MYSQL_PROTOCOL_DEFAULT);
-    push_literal(L, "PROTOCOL_TCP", MYSQL_PROTOCOL_TCP);
-    push_literal(L, "PROTOCOL_SOCKET", MYSQL_PROTOCOL_SOCKET);
-    push_literal(L, "PROTOCOL_PIPE", MYSQL_PROTOCOL_PIPE);
-    push_literal(L, "PROTOCOL_MEMORY", MYSQL_PROTOCOL_MEMORY);
+    if (buf->size + size > buf->capacity)
+    {
+        size_t capacity = QSF_MAX(buf->capacity * 2, buf->size + size + 4096);
+        char* data = qsf_malloc(capacity);
+        if (buf->data)
+        {
+            memcpy(data, buf->data, buf->size);
+            qsf_free(buf->data);
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+}
 
-    // client flag
-    push_literal(L, "CLIENT_LONG_PASSWORD", CLIENT_LONG_PASSWORD);
-    push_literal(L, "CLIENT_FOUND_ROWS", CLIENT_FOUND_ROWS);
-    push_literal(L, "CLIENT_LONG_FLAG", CLIENT_LONG_FLAG);
-    push_literal(L, "CLIENT_CONNECT_WITH_DB", CLIENT_CONNECT_WITH_DB);
-    push_literal(L, "CLIENT_NO_SCHEMA", CLIENT_NO_SCHEMA);
-    push_literal(L, "CLIENT_COMPRESS", CLIENT_COMPRESS);
-    push_literal(L, "CLIENT_ODBC", CLIENT_ODBC);
-    push_literal(L, "CLIENT_LOCAL_FILES", CLIENT_LOCAL_FILES);
-    push_literal(L, "CLIENT_IGNORE_SPACE", CLIENT_IGNORE_SPACE);
-    push_literal(L, "CLIENT_PROTOCOL_41", CLIENT_PROTOCOL_41);
-    push_literal(L, "CLIENT_INTERACTIVE", CLIENT_INTERACTIVE);
-    push_literal(L, "CLIENT_SSL", CLIENT_SSL);
-    push_literal(L, "CLIENT_IGNORE_SIGPIPE", CLIENT_IGNORE_SIGPIPE);
-    push_literal(L, "CLIENT_TRANSACTIONS", CLIENT_TRANSACTIONS);
-    //push_literal(L, "CLIENT_SECURE_CONNECTION", CLIENT_SECURE_CONNECTION);
-    push_literal(L, "CLIENT_MULTI_STATEMENTS", CLIENT_MULTI_STATEMENTS);
-    push_literal(L, "CLIENT_MULTI_RESULTS", CLIENT_MULTI_RESULTS);
-    push_literal(L, "CLIENT_PS_MULTI_RESULTS", CLIENT_PS_MULTI_RESULTS);
+static void sql_append(SqlBuffer* buf, const char* data, size_t size)
+{
+    sql_reserve(buf, size);
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
 }
 
-static void create_meta(lua_State* L, const char* name, const luaL_Reg* methods)
+// quote identifier with backticks
+static void sql_append_name(SqlBuffer* buf, const char* name, size_t len)
 {
-    assert(L && name && methods);
-    luaL_newmetatable(L, name);
-    lua_pushvalue(L, -1);
-    lua_setfield(L, -2, "__index");
-    luaL_setfuncs(L, methods, 0);
-    lua_pushliteral(L, "__metatable");
-    lua_pushliteral(L, "cannot access this metatable");
-    lua_settable(L, -3);
-    lua_pop(L, 1);  /* pop new metatable */
+    sql_append(buf, "`", 1);
+    for (size_t i = 0; i < len; i++)
+    {
+        sql_append(buf, name + i, 1);
+        if (name[i] == '`')
+        {
+            sql_append(buf, "`", 1);
+        }
+    }
+    sql_append(buf, "`", 1);
 }
 
-static void make_meta(lua_State* L)
+// quote `db.table` as two identifiers, a plain name as one
+static void sql_append_table(SqlBuffer* buf, const char* name, size_t len)
 {
-    static const luaL_Reg conn_methods[] =
+    const char* dot = memchr(name, '.', len);
+    if (dot != NULL)
     {
-        { "__gc", conn_gc },
-        { "__tostring", conn_tostring },
-        { "setCharset", conn_set_charset },
-        { "setReconnect", conn_set_reconnect },
-        { "setConnectTimeout", conn_set_connect_timeout },
-        { "setWriteTimeout", conn_set_write_timeout },
-        { "setReadTimeout", conn_set_read_timeout },
-        { "setProtocol", conn_set_protocol },
-        { "setCompress", conn_set_compress },
-        { "escape", conn_escape_string },
-        { "connect", conn_connect },
-        { "ping", conn_ping },
-        { "close", conn_close },
-        { "execute", conn_execute },
-        { "commit", conn_commit },
-        { "rollback", conn_rollback },
-        { NULL, NULL },
-    };
+        sql_append_name(buf, name, dot - name);
+        sql_append(buf, ".", 1);
+        len -= dot - name + 1;
+        name = dot + 1;
+    }
+    sql_append_name(buf, name, len);
+}
 
-    static const luaL_Reg cursor_methods[] =
+// returns non-zero if value cannot be written as SQL literal
+static int sql_append_value(BatchInsert* b, lua_State* L, int idx)
+{
+    SqlBuffer* buf = &b->row;
+    char tmp[32];
+    int n = 0;
+    switch (lua_type(L, idx))
     {
-        { "__gc", cursor_gc },
-        { "fetch", cursor_fetch },
-        { "fetchAll", cursor_fetch_all },
-        { "numrows", cursor_numrows },
-        { NULL, NULL },
-    };
+    case LUA_TNIL:
+        sql_append(buf, "NULL", 4);
+        break;
+    case LUA_TBOOLEAN:
+        sql_append(buf, lua_toboolean(L, idx) ? "1" : "0", 1);
+        break;
+    case LUA_TNUMBER:
+        if (lua_isinteger(L, idx))
+        {
+            n = snprintf(tmp, sizeof(tmp), "%lld", (long long)lua_tointeger(L, idx));
+        }
+        else
+        {
+            double d = (double)lua_tonumber(L, idx);
+            if (!isfinite(d))
+            {
+                return -1;
+            }
+            n = snprintf(tmp, sizeof(tmp), "%.17g", d);
+        }
+        sql_append(buf, tmp, n);
+        break;
+    case LUA_TSTRING:
+        {
+            size_t len = 0;
+            const char* str = lua_tolstring(L, idx, &len);
+            sql_reserve(buf, len * 2 + 3);
+            buf->data[buf->size++] = '\'';
+            buf->size += mysql_real_escape_string(b->mysql, buf->data + buf->size,
+                str, (unsigned long)len);
+            buf->data[buf->size++] = '\'';
+        }
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
 
-    create_meta(L, LUAMYSQL_CONN, conn_methods);
-    create_meta(L, LUAMYSQL_CURSOR, cursor_methods);
+static void batch_cleanup(BatchInsert* b)
+{
+    if (b->multi_on)
+    {
+        mysql_set_server_option(b->mysql, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+        b->multi_on = 0;
+    }
+    qsf_free(b->header.data);
+    qsf_free(b->packet.data);
+    qsf_free(b->row.data);
+    memset(&b->header, 0, sizeof(SqlBuffer));
+    memset(&b->packet, 0, sizeof(SqlBuffer));
+    memset(&b->row, 0, sizeof(SqlBuffer));
 }
 
-LUALIB_API int luaopen_mysql(lua_State* L)
+// error message is on stack top
+static int batch_error(lua_State* L, BatchInsert* b)
+{
+    batch_cleanup(b);
+    return lua_error(L);
+}
+
+// send packet and collect affected rows of each statement
+static void batch_send(lua_State* L, BatchInsert* b)
+{
+    MYSQL* mysql = b->mysql;
+    if (mysql_real_query(mysql, b->packet.data, (unsigned long)b->packet.size) != 0)
+    {
+        lua_pushfstring(L, "%d: %s\n", mysql_errno(mysql), mysql_error(mysql));
+        batch_error(L, b);
+    }
+    b->packet.size = 0;
+    for (;;)
+    {
+        my_ulonglong affected = mysql_affected_rows(mysql);
+        lua_pushinteger(L, (lua_Integer)affected);
+        lua_rawseti(L, b->counts, ++b->num_stmts);
+        b->total += (lua_Integer)affected;
+        int r = mysql_next_result(mysql);
+        if (r < 0) // no more results
+        {
+            break;
+        }
+        if (r > 0)
+        {
+            lua_pushfstring(L, "%d: %s\n", mysql_errno(mysql), mysql_error(mysql));
+            batch_error(L, b);
+        }
+    }
+}
+
+// session value of `max_allowed_packet`, bounded by client limit
+static size_t server_max_packet(lua_State* L, BatchInsert* b)
+{
+    static const char sql[] = "SELECT @@max_allowed_packet";
+    MYSQL* mysql = b->mysql;
+    size_t size = 0;
+    if (mysql_real_query(mysql, sql, sizeof(sql) - 1) == 0)
+    {
+        MYSQL_RES* res = mysql_store_result(mysql);
+        if (res)
+        {
+            MYSQL_ROW row = mysql_fetch_row(res);
+            if (row && row[0])
+            {
+                size = (size_t)strtoull(row[0], NULL, 10);
+            }
+            mysql_free_result(res);
+        }
+    }
+    if (size == 0)
+    {
+        luaL_error(L, "%d: %s\n", mysql_errno(mysql), mysql_error(mysql));
+    }
+    return QSF_MIN(size, (size_t)max_allowed_packet);
+}
+
+static void batch_options(lua_State* L, BatchInsert* b, int opts)
+{
+    lua_Integer max_packet = 0;
+    if (lua_istable(L, opts))
+    {
+        lua_getfield(L, opts, "max_packet");
+        max_packet = luaL_optinteger(L, -1, 0);
+        lua_getfield(L, opts, "chunk_rows");
+        b->chunk_rows = luaL_optinteger(L, -1, 0);
+        lua_getfield(L, opts, "multi");
+        b->multi = lua_toboolean(L, -1);
+        lua_pop(L, 3);
+    }
+    if (max_packet <= 0)
+    {
+        max_packet = (lua_Integer)server_max_packet(L, b);
+    }
+    b->max_packet = (size_t)QSF_MAX(max_packet - BATCH_PACKET_MARGIN, 1);
+    if (b->chunk_rows <= 0)
+    {
+        b->chunk_rows = LUA_MAXINTEGER;
+    }
+}
+
+// conn:batchInsert(table, columns, rows [, opts]), rows are arrays of values
+// in order of `columns`. `table` may be `db.table`. rows are chunked to multi-row INSERT statements no
+// larger than `max_allowed_packet`, `opts.chunk_rows` limits rows of each
+// statement, `opts.multi` sends several statements in one packet.
+// `opts.ignore` for INSERT IGNORE. returns affected rows of each statement
+// and their sum. statements are not atomic, wrap the call in a transaction.
+static int conn_batch_insert(lua_State* L)
 {
+    Connection* conn = check_conn(L);
+    luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    size_t len = 0;
+    const char* table = luaL_checklstring(L, 2, &len);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    int ncols = (int)lua_rawlen(L, 3);
+    luaL_argcheck(L, ncols > 0, 3, "empty column list");
+    lua_Integer nrows = (lua_Integer)lua_rawlen(L, 4);
+    int ignore = 0;
+    if (lua_istable(L, 5))
+    {
+        lua_getfield(L, 5, "ignore");
+        ignore = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+
+    BatchInsert b;
+    memset(&b, 0, sizeof(b));
+    b.mysql = conn->mysql;
+    batch_options(L, &b, 5);
+    lua_settop(L, 5);
+    lua_createtable(L, 1, 0);
+    b.counts = lua_gettop(L);
+
+    sql_append(&b.header, "INSERT ", 7);
+    if (ignore)
+    {
+        sql_append(&b.header, "IGNORE ", 7);
+    }
+    sql_append(&b.header, "INTO ", 5);
+    sql_append_table(&b.header, table, len);
+    sql_append(&b.header, " (", 2);
+    for (int i = 1; i <= ncols; i++)
+    {
+        lua_rawgeti(L, 3, i);
+        const char* name = lua_tolstring(L, -1, &len);
+        if (name == NULL)
+        {
+            lua_pushfstring(L, "column %d is not a string", i);
+            return batch_error(L, &b);
+        }
+        if (i > 1)
+        {
+            sql_append(&b.header, ",", 1);
+        }
+        sql_append_name(&b.header, name, len);
+        lua_pop(L, 1);
+    }
+    sql_append(&b.header, ") VALUES ", 9);
+
+    if (b.multi && !(b.mysql->client_flag & CLIENT_MULTI_STATEMENTS))
+    {
+        if (mysql_set_server_option(b.mysql, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0)
+        {
+            lua_pushfstring(L, "%d: %s\n", mysql_errno(b.mysql), mysql_error(b.mysql));
+            return batch_error(L, &b);
+        }
+        b.multi_on = 1;
+    }
+
+    lua_Integer stmt_rows = 0;
+    for (lua_Integer n = 1; n <= nrows; n++)
+    {
+        if (lua_rawgeti(L, 4, n) != LUA_TTABLE)
+        {
+            lua_pushfstring(L, "row %d is not a table", (int)n);
+            return batch_error(L, &b);
+        }
+        b.row.size = 0;
+        sql_append(&b.row, "(", 1);
+        for (int i = 1; i <= ncols; i++)
+        {
+            if (i > 1)
+            {
+                sql_append(&b.row, ",", 1);
+            }
+            lua_rawgeti(L, -1, i);
+            if (sql_append_value(&b, L, -1) != 0)
+            {
+                lua_pushfstring(L, "invalid value of row %d column %d", (int)n, i);
+                return batch_error(L, &b);
+            }
+            lua_pop(L, 1);
+        }
+        sql_append(&b.row, ")", 1);
+        lua_pop(L, 1);
+        if (b.header.size + b.row.size > b.max_packet)
+        {
+            lua_pushfstring(L, "row %d exceeds max_allowed_packet", (int)n);
+            return batch_error(L, &b);
+        }
+
+        int new_stmt = (stmt_rows == 0 || stmt_rows >= b.chunk_rows);
+        size_t extra = new_stmt ? b.header.size + b.row.size + 1 : b.row.size + 1;
+        if (b.packet.size > 0 && (b.packet.size + extra > b.max_packet || (new_stmt && !b.multi)))
+        {
+            batch_send(L, &b);
+            new_stmt = 1;
+        }
+        if (new_stmt)
+        {
+            if (b.packet.size > 0)
+            {
+                sql_append(&b.packet, ";", 1);
+            }
+            sql_append(&b.packet, b.header.data, b.header.size);
+            stmt_rows = 0;
+        }
+        else
+        {
+            sql_append(&b.packet, ",", 1);
+        }
+        sql_append(&b.packet, b.row.data, b.row.size);
+        stmt_rows++;
+    }
+    if (b.packet.size > 0)
+    {
+        batch_send(L, &b);
+    }
+    batch_cleanup(&b);
+    lua_pushinteger(L, b.total);
+    return 2;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// prepared statement
+
+static int column_kind(enum enum_field_types type)
+{
+    switch (type)
+    {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_YEAR:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_LONGLONG:
+        return STMT_COLUMN_INTEGER;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+        return STMT_COLUMN_DOUBLE;
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+        return STMT_COLUMN_DECIMAL;
+    default:
+        return STMT_COLUMN_STRING; // BIT, temporal and text columns
+    }
+}
+
+static void bind_columns(Statement* stmt)
+{
+    MYSQL_FIELD* fields = mysql_fetch_fields(stmt->meta);
+    for (unsigned int i = 0; i < stmt->numcols; i++)
+    {
+        StmtColumn* col = &stmt->columns[i];
+        MYSQL_BIND* bind = &stmt->results[i];
+        col->kind = column_kind(fields[i].type);
+        switch (col->kind)
+        {
+        case STMT_COLUMN_INTEGER:
+            bind->buffer_type = MYSQL_TYPE_LONGLONG;
+            bind->buffer = &col->num.i;
+            bind->is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+            col->is_unsigned = bind->is_unsigned;
+            break;
+        case STMT_COLUMN_DOUBLE:
+            bind->buffer_type = MYSQL_TYPE_DOUBLE;
+            bind->buffer = &col->num.d;
+            break;
+        default:
+            col->capacity = STMT_BUFFER_SIZE;
+            col->buf = qsf_malloc(col->capacity);
+            bind->buffer_type = MYSQL_TYPE_STRING;
+            bind->buffer = col->buf;
+            bind->buffer_length = col->capacity;
+            break;
+        }
+        bind->length = &col->length;
+        bind->is_null = &col->is_null;
+        bind->error = &col->error;
+    }
+}
+
+// lua values are bound by their type, strings are not copied
+static void bind_params(lua_State* L, Statement* stmt)
+{
+    memset(stmt->params, 0, sizeof(MYSQL_BIND) * stmt->param_count);
+    for (unsigned long i = 0; i < stmt->param_count; i++)
+    {
+        int idx = (int)i + 2;
+        MYSQL_BIND* bind = &stmt->params[i];
+        StmtParam* value = &stmt->param_values[i];
+        switch (lua_type(L, idx))
+        {
+        case LUA_TNIL:
+            bind->buffer_type = MYSQL_TYPE_NULL;
+            break;
+        case LUA_TBOOLEAN:
+            value->b = (signed char)lua_toboolean(L, idx);
+            bind->buffer_type = MYSQL_TYPE_TINY;
+            bind->buffer = &value->b;
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx))
+            {
+                value->i = (long long)lua_tointeger(L, idx);
+                bind->buffer_type = MYSQL_TYPE_LONGLONG;
+                bind->buffer = &value->i;
+            }
+            else
+            {
+                value->d = (double)lua_tonumber(L, idx);
+                bind->buffer_type = MYSQL_TYPE_DOUBLE;
+                bind->buffer = &value->d;
+            }
+            break;
+        case LUA_TSTRING:
+            {
+                size_t len = 0;
+                bind->buffer = (void*)lua_tolstring(L, idx, &len);
+                bind->buffer_length = (unsigned long)len;
+                bind->buffer_type = MYSQL_TYPE_STRING;
+            }
+            break;
+        default:
+            luaL_argerror(L, idx, "unsupported parameter type");
+        }
+    }
+}
+
+// grow buffers of truncated columns and fetch them again
+static int fetch_truncated(Statement* stmt)
+{
+    int rebind = 0;
+    for (unsigned int i = 0; i < stmt->numcols; i++)
+    {
+        StmtColumn* col = &stmt->columns[i];
+        if (!col->error || col->buf == NULL)
+        {
+            continue;
+        }
+        MYSQL_BIND* bind = &stmt->results[i];
+        qsf_free(col->buf);
+        col->capacity = col->length + 1;
+        col->buf = qsf_malloc(col->capacity);
+        bind->buffer = col->buf;
+        bind->buffer_length = col->capacity;
+        if (mysql_stmt_fetch_column(stmt->my_stmt, bind, i, 0) != 0)
+        {
+            return -1;
+        }
+        rebind = 1;
+    }
+    if (rebind && mysql_stmt_bind_result(stmt->my_stmt, stmt->results) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void push_column(lua_State* L, StmtColumn* col)
+{
+    if (col->is_null)
+    {
+        lua_pushnil(L);
+        return;
+    }
+    switch (col->kind)
+    {
+    case STMT_COLUMN_INTEGER:
+        if (col->is_unsigned && col->num.i < 0) // above LLONG_MAX, float as Lua does
+            lua_pushnumber(L, (lua_Number)(unsigned long long)col->num.i);
+        else
+            lua_pushinteger(L, (lua_Integer)col->num.i);
+        break;
+    case STMT_COLUMN_DOUBLE:
+        lua_pushnumber(L, (lua_Number)col->num.d);
+        break;
+    case STMT_COLUMN_DECIMAL:
+        lua_pushnumber(L, atof(col->buf));
+        break;
+    default:
+        lua_pushlstring(L, col->buf, col->length);
+        break;
+    }
+}
+
+static int stmt_error(lua_State* L, Statement* stmt)
+{
+    MYSQL_STMT* my_stmt = stmt->my_stmt;
+    lua_pushfstring(L, "%d: %s\n", mysql_stmt_errno(my_stmt), mysql_stmt_error(my_stmt));
+    mysql_stmt_free_result(my_stmt);
+    return lua_error(L);
+}
+
+// build rows from stored result, column names are pushed once
+static void fetch_rows(lua_State* L, Statement* stmt)
+{
+    MYSQL_STMT* my_stmt = stmt->my_stmt;
+    luaL_checkstack(L, stmt->numcols + 4, "too many columns");
+    int names = lua_gettop(L) + 1;
+    if (stmt->alpha_idx)
+    {
+        MYSQL_FIELD* fields = mysql_fetch_fields(stmt->meta);
+        for (unsigned int i = 0; i < stmt->numcols; i++)
+        {
+            lua_pushstring(L, fields[i].name);
+        }
+    }
+    lua_createtable(L, (int)mysql_stmt_num_rows(my_stmt), 0);
+    lua_Integer rownum = 1;
+    for (;;)
+    {
+        int r = mysql_stmt_fetch(my_stmt);
+        if (r == MYSQL_NO_DATA)
+        {
+            break;
+        }
+        if (r == 1 || (r == MYSQL_DATA_TRUNCATED && fetch_truncated(stmt) != 0))
+        {
+            stmt_error(L, stmt);
+        }
+        if (stmt->alpha_idx)
+        {
+            lua_createtable(L, 0, stmt->numcols);
+            for (unsigned int i = 0; i < stmt->numcols; i++)
+            {
+                lua_pushvalue(L, names + i);
+                push_column(L, &stmt->columns[i]);
+                lua_rawset(L, -3);
+            }
+        }
+        else
+        {
+            lua_createtable(L, stmt->numcols, 0);
+            for (unsigned int i = 0; i < stmt->numcols; i++)
+            {
+                push_column(L, &stmt->columns[i]);
+                lua_rawseti(L, -2, i + 1);
+            }
+        }
+        lua_rawseti(L, -2, rownum++);
+    }
+    mysql_stmt_free_result(my_stmt);
+    lua_replace(L, names); // result replaces column names
+    lua_settop(L, names);
+}
+
+// stmt:execute(...), returns rows of a query, or number of affected rows
+static int stmt_execute(lua_State* L)
+{
+    Statement* stmt = check_stmt(L);
+    luaL_argcheck(L, stmt->my_stmt != NULL, 1, "statement is closed");
+    luaL_argcheck(L, !stmt->conn->busy, 1, "connection is busy with async query");
+    int nargs = lua_gettop(L) - 1;
+    if (nargs != (int)stmt->param_count)
+    {
+        return luaL_error(L, "expect %d parameters, got %d", (int)stmt->param_count, nargs);
+    }
+    MYSQL_STMT* my_stmt = stmt->my_stmt;
+    bind_params(L, stmt);
+    if ((stmt->param_count > 0 && mysql_stmt_bind_param(my_stmt, stmt->params) != 0)
+        || mysql_stmt_execute(my_stmt) != 0)
+    {
+        return stmt_error(L, stmt);
+    }
+    if (stmt->numcols == 0) // statement does not return data (not SELECT)
+    {
+        lua_pushinteger(L, (lua_Integer)mysql_stmt_affected_rows(my_stmt));
+        return 1;
+    }
+    if (mysql_stmt_bind_result(my_stmt, stmt->results) != 0
+        || mysql_stmt_store_result(my_stmt) != 0)
+    {
+        return stmt_error(L, stmt);
+    }
+    fetch_rows(L, stmt);
+    return 1;
+}
+
+static void close_stmt(lua_State* L, Statement* stmt)
+{
+    if (stmt->my_stmt)
+    {
+        Statement** pp = &stmt->conn->stmts;
+        while (*pp != stmt)
+        {
+            pp = &(*pp)->next;
+        }
+        *pp = stmt->next;
+        release_stmt(stmt);
+    }
+    if (stmt->conn_ref != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, stmt->conn_ref);
+        stmt->conn_ref = LUA_NOREF;
+    }
+}
+
+static int stmt_close(lua_State* L)
+{
+    Statement* stmt = check_stmt(L);
+    luaL_argcheck(L, stmt->my_stmt == NULL || !stmt->conn->busy, 1,
+        "connection is busy with async query");
+    close_stmt(L, stmt);
+    return 0;
+}
+
+// a busy connection is only collected by `lua_close`, wait for its worker
+static int stmt_gc(lua_State* L)
+{
+    Statement* stmt = check_stmt(L);
+    if (stmt->my_stmt)
+    {
+        uv_mutex_lock(&stmt->conn->lock);
+        close_stmt(L, stmt);
+        uv_mutex_unlock(&stmt->conn->lock);
+    }
+    else
+    {
+        close_stmt(L, stmt);
+    }
+    return 0;
+}
+
+// conn:prepare(sql [, 'a']), 'a' for alphabetic row index of query result
+static int conn_prepare(lua_State* L)
+{
+    Connection* conn = check_conn(L);
+    luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    luaL_argcheck(L, !conn->busy, 1, "connection is busy with async query");
+    size_t length = 0;
+    const char* sql = luaL_checklstring(L, 2, &length);
+    const char* opt = lua_tostring(L, 3);
+
+    Statement* stmt = (Statement*)lua_newuserdata(L, sizeof(Statement));
+    memset(stmt, 0, sizeof(*stmt));
+    stmt->conn_ref = LUA_NOREF;
+    luaL_setmetatable(L, LUAMYSQL_STMT);
+    MYSQL_STMT* my_stmt = mysql_stmt_init(conn->mysql);
+    if (my_stmt == NULL)
+    {
+        return luaL_error(L, "%s\n", mysql_error(conn->mysql));
+    }
+    if (mysql_stmt_prepare(my_stmt, sql, (unsigned long)length) != 0)
+    {
+        lua_pushfstring(L, "%d: %s\n", mysql_stmt_errno(my_stmt), mysql_stmt_error(my_stmt));
+        mysql_stmt_close(my_stmt);
+        return lua_error(L);
+    }
+    stmt->conn = conn;
+    stmt->my_stmt = my_stmt;
+    stmt->alpha_idx = (opt && strcmp(opt, "a") == 0);
+    stmt->param_count = mysql_stmt_param_count(my_stmt);
+    if (stmt->param_count > 0)
+    {
+        stmt->params = qsf_malloc(sizeof(MYSQL_BIND) * stmt->param_count);
+        stmt->param_values = qsf_malloc(sizeof(StmtParam) * stmt->param_count);
+    }
+    stmt->meta = mysql_stmt_result_metadata(my_stmt);
+    if (stmt->meta)
+    {
+        stmt->numcols = mysql_num_fields(stmt->meta);
+        stmt->results = qsf_malloc(sizeof(MYSQL_BIND) * stmt->numcols);
+        stmt->columns = qsf_malloc(sizeof(StmtColumn) * stmt->numcols);
+        memset(stmt->results, 0, sizeof(MYSQL_BIND) * stmt->numcols);
+        memset(stmt->columns, 0, sizeof(StmtColumn) * stmt->numcols);
+        bind_columns(stmt);
+    }
+    stmt->next = conn->stmts;
+    conn->stmts = stmt;
+    lua_pushvalue(L, 1);
+    stmt->conn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// async query
+
+static void pack_bytes(AsyncQuery* q, const void* data, size_t size)
+{
+    if (q->size + size > q->capacity)
+    {
+        size_t capacity = QSF_MAX(q->capacity * 2, q->size + size + 4096);
+        char* buf = qsf_malloc(capacity);
+        if (q->buf)
+        {
+            memcpy(buf, q->buf, q->size);
+            qsf_free(q->buf);
+        }
+        q->buf = buf;
+        q->capacity = capacity;
+    }
+    memcpy(q->buf + q->size, data, size);
+    q->size += size;
+}
+
+// values are followed by a NUL, thus can be converted by `pushvalue`
+static void pack_result(AsyncQuery* q, MYSQL_RES* res)
+{
+    MYSQL_FIELD* fields = mysql_fetch_fields(res);
+    for (unsigned int i = 0; i < q->numcols; i++)
+    {
+        uint8_t type = (uint8_t)fields[i].type;
+        uint16_t len = (uint16_t)QSF_MIN(strlen(fields[i].name), UINT16_MAX);
+        pack_bytes(q, &type, sizeof(type));
+        pack_bytes(q, &len, sizeof(len));
+        pack_bytes(q, fields[i].name, len);
+    }
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)) != NULL)
+    {
+        unsigned long* lengths = mysql_fetch_lengths(res);
+        for (unsigned int i = 0; i < q->numcols; i++)
+        {
+            uint32_t len = (row[i] ? (uint32_t)lengths[i] : MYSQL_NULL_VALUE);
+            pack_bytes(q, &len, sizeof(len));
+            if (row[i])
+            {
+                pack_bytes(q, row[i], lengths[i] + 1);
+            }
+        }
+        q->numrows++;
+    }
+}
+
+static void set_query_error(AsyncQuery* q, MYSQL* my_conn)
+{
+    const char* msg = mysql_error(my_conn);
+    size_t len = strlen(msg);
+    q->err = mysql_errno(my_conn);
+    q->errmsg = qsf_malloc(len + 1);
+    memcpy(q->errmsg, msg, len + 1);
+}
+
+static void run_query(AsyncQuery* q, MYSQL* my_conn)
+{
+    if (mysql_real_query(my_conn, q->sql, (unsigned long)q->sql_len) != 0)
+    {
+        set_query_error(q, my_conn);
+    }
+    else
+    {
+        MYSQL_RES* res = mysql_store_result(my_conn);
+        q->numcols = mysql_field_count(my_conn);
+        if (res)
+        {
+            pack_result(q, res);
+            mysql_free_result(res);
+        }
+        else if (q->numcols == 0) // query does not return data (not SELECT)
+        {
+            q->affected = mysql_affected_rows(my_conn);
+        }
+        else
+        {
+            set_query_error(q, my_conn);
+        }
+    }
+}
+
+static void set_pool_error(AsyncQuery* q, const char* msg)
+{
+    size_t len = strlen(msg);
+    qsf_free(q->errmsg);
+    q->err = CR_SERVER_GONE_ERROR;
+    q->errmsg = qsf_malloc(len + 1);
+    memcpy(q->errmsg, msg, len + 1);
+}
+
+// borrow a connection for one query. a query failed with server gone is
+// retried once after reconnect, the request has not reached server.
+// lost connection is not retried, the statement may have been executed.
+static void pool_query(AsyncQuery* q)
+{
+    char err[256];
+    MYSQL* my_conn = qsf_mysql_pool_checkout(q->pool, QSF_MYSQL_CHECKOUT_TIMEOUT,
+        err, sizeof(err));
+    if (my_conn == NULL)
+    {
+        set_pool_error(q, err);
+        return;
+    }
+    run_query(q, my_conn);
+    int broken = (q->err == CR_SERVER_LOST);
+    if (q->err == CR_SERVER_GONE_ERROR)
+    {
+        qsf_free(q->errmsg);
+        q->errmsg = NULL;
+        q->err = 0;
+        if (qsf_mysql_pool_reconnect(q->pool, my_conn, err, sizeof(err)) == 0)
+        {
+            run_query(q, my_conn);
+            broken = (q->err == CR_SERVER_GONE_ERROR || q->err == CR_SERVER_LOST);
+        }
+        else
+        {
+            set_pool_error(q, err);
+            broken = 1;
+        }
+    }
+    qsf_mysql_pool_release(q->pool, my_conn,
+        (broken ? QSF_MYSQL_RELEASE_BROKEN : QSF_MYSQL_RELEASE_IDLE));
+}
+
+// run in uv worker thread
+static void query_work(uv_work_t* req)
+{
+    AsyncQuery* q = req->data;
+    Connection* conn = q->conn;
+    mysql_thread_init();
+    uv_mutex_lock(&conn->lock);
+    run_query(q, conn->mysql);
+    uv_mutex_unlock(&conn->lock);
+}
+
+// build rows table from packed result, column names are pushed once
+static void push_result(lua_State* L, AsyncQuery* q)
+{
+    luaL_checkstack(L, q->numcols + 4, "too many columns");
+    uint8_t* types = qsf_malloc(q->numcols + 1);
+    const char* ptr = q->buf;
+    int names = lua_gettop(L) + 1;
+    for (unsigned int i = 0; i < q->numcols; i++)
+    {
+        uint16_t len = 0;
+        types[i] = (uint8_t)*ptr;
+        memcpy(&len, ptr + 1, sizeof(len));
+        lua_pushlstring(L, ptr + 3, len);
+        ptr += 3 + len;
+    }
+    lua_createtable(L, (int)q->numrows, 0);
+    for (my_ulonglong n = 0; n < q->numrows; n++)
+    {
+        if (q->alpha_idx)
+            lua_createtable(L, 0, q->numcols);
+        else
+            lua_createtable(L, q->numcols, 0);
+        for (unsigned int i = 0; i < q->numcols; i++)
+        {
+            uint32_t len = 0;
+            memcpy(&len, ptr, sizeof(len));
+            ptr += sizeof(len);
+            if (len == MYSQL_NULL_VALUE)
+            {
+                continue; // nil value
+            }
+            if (q->alpha_idx)
+            {
+                lua_pushvalue(L, names + i);
+                pushvalue(L, (enum enum_field_types)types[i], ptr, len);
+                lua_rawset(L, -3);
+            }
+            else
+            {
+                pushvalue(L, (enum enum_field_types)types[i], ptr, len);
+                lua_rawseti(L, -2, i + 1);
+            }
+            ptr += len + 1;
+        }
+        lua_rawseti(L, -2, (lua_Integer)n + 1);
+    }
+    lua_replace(L, names); // result replaces column names
+    lua_settop(L, names);
+    qsf_free(types);
+}
+
+static void free_query(lua_State* L, AsyncQuery* q)
+{
+    luaL_unref(L, LUA_REGISTRYINDEX, q->callback_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, q->conn_ref);
+    qsf_node_work_end(q->node);
+    qsf_free(q->sql);
+    qsf_free(q->errmsg);
+    qsf_free(q->buf);
+    qsf_free(q);
+}
+
+static void after_query(uv_work_t* req, int status);
+static void complete_query(uv_loop_t* loop, AsyncQuery* q, int status);
+
+static void start_query(uv_loop_t* loop, Connection* conn)
+{
+    AsyncQuery* q = conn->pending;
+    if (q != NULL)
+    {
+        conn->pending = q->next;
+        if (conn->pending == NULL)
+        {
+            conn->last = NULL;
+        }
+        conn->busy = 1;
+        int r = uv_queue_work(loop, &q->work, query_work, after_query);
+        qsf_assert(r == 0, "uv_queue_work() failed, %s.", uv_strerror(r));
+    }
+}
+
+// run in loop thread, callback(err, rows|affected)
+static void complete_query(uv_loop_t* loop, AsyncQuery* q, int status)
+{
+    Connection* conn = q->conn;
+    lua_State* L = loop->data;
+    if (qsf_node_closing(q->node)) // node is exiting, drop queued queries
+    {
+        while (conn && conn->pending)
+        {
+            AsyncQuery* next = conn->pending;
+            conn->pending = next->next;
+            free_query(L, next);
+        }
+        if (conn)
+        {
+            conn->busy = 0;
+            conn->last = NULL;
+        }
+        free_query(L, q);
+        return;
+    }
+    if (conn)
+    {
+        conn->busy = 0;
+        start_query(loop, conn);
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, q->callback_ref);
+    if (status != 0)
+    {
+        lua_pushstring(L, uv_strerror(status));
+        lua_pushnil(L);
+    }
+    else if (q->errmsg)
+    {
+        lua_pushfstring(L, "%d: %s", q->err, q->errmsg);
+        lua_pushnil(L);
+    }
+    else if (q->numcols > 0)
+    {
+        lua_pushnil(L);
+        push_result(L, q);
+    }
+    else
+    {
+        lua_pushnil(L);
+        lua_pushinteger(L, (lua_Integer)q->affected);
+    }
+    free_query(L, q);
+    qsf_node_pcall(L, 2, QSF_CALL_OTHER);
+}
+
+static void after_query(uv_work_t* req, int status)
+{
+    complete_query(req->loop, req->data, status);
+}
+
+// copy arguments `(sql, callback [, 'a'])` of executeAsync
+static AsyncQuery* new_query(lua_State* L)
+{
+    size_t length = 0;
+    const char* stmt = luaL_checklstring(L, 2, &length);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+    const char* opt = lua_tostring(L, 4);
+    qsf_node_t* node = *(qsf_node_t**)lua_getextraspace(L);
+    if (qsf_node_closing(node))
+    {
+        luaL_error(L, "node is exiting");
+    }
+
+    AsyncQuery* q = qsf_malloc(sizeof(AsyncQuery));
+    memset(q, 0, sizeof(*q));
+    q->work.data = q;
+    q->node = node;
+    qsf_node_work_begin(node);
+    q->alpha_idx = (opt && strcmp(opt, "a") == 0);
+    q->sql = qsf_malloc(length + 1);
+    memcpy(q->sql, stmt, length + 1);
+    q->sql_len = length;
+    lua_pushvalue(L, 3);
+    q->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, 1);
+    q->conn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return q;
+}
+
+// conn:executeAsync(sql, callback [, 'a']), run query in worker thread,
+// queries of one connection run in order.
+static int conn_execute_async(lua_State* L)
+{
+    Connection* conn = check_conn(L);
+    luaL_argcheck(L, conn && !conn->closed, 1, "invalid Connection object");
+    AsyncQuery* q = new_query(L);
+    q->conn = conn;
+    if (conn->last)
+        conn->last->next = q;
+    else
+        conn->pending = q;
+    conn->last = q;
+    if (!conn->busy)
+    {
+        start_query(qsf_node_loop(q->node), conn);
+    }
+    return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// connection pool
+
+static const char* opt_field_string(lua_State* L, int idx, const char* name)
+{
+    lua_getfield(L, idx, name);
+    const char* value = lua_tostring(L, -1);
+    lua_pop(L, 1); // string is anchored in the table
+    return value;
+}
+
+static lua_Integer opt_field_integer(lua_State* L, int idx, const char* name,
+                                     lua_Integer def)
+{
+    lua_getfield(L, idx, name);
+    lua_Integer value = luaL_optinteger(L, -1, def);
+    lua_pop(L, 1);
+    return value;
+}
+
+static int push_pool(lua_State* L, qsf_mysql_pool_t* pool)
+{
+    qsf_mysql_pool_t** ud = lua_newuserdata(L, sizeof(qsf_mysql_pool_t*));
+    *ud = pool;
+    luaL_setmetatable(L, LUAMYSQL_POOL);
+    return 1;
+}
+
+// mysql.createPool(name, conf), pool of same name created by other node
+// is shared. `conf` takes fields of `connect` and `charset`, `connect_timeout`,
+// `min_size`, `max_size` and `ping_interval`.
+static int pool_create(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    qsf_mysql_conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    lua_getfield(L, 2, "host");
+    conf.host = luaL_checkstring(L, -1);
+    lua_getfield(L, 2, "user");
+    conf.user = luaL_checkstring(L, -1);
+    lua_getfield(L, 2, "passwd");
+    conf.passwd = luaL_checkstring(L, -1);
+    lua_pop(L, 3);
+    conf.db = opt_field_string(L, 2, "db");
+    conf.unix_socket = opt_field_string(L, 2, "unix_socket");
+    conf.charset = opt_field_string(L, 2, "charset");
+    conf.port = (unsigned int)opt_field_integer(L, 2, "port", 3306);
+    conf.client_flag = (unsigned long)opt_field_integer(L, 2, "client_flag", 0);
+    conf.connect_timeout = (unsigned int)opt_field_integer(L, 2, "connect_timeout", 0);
+    conf.min_size = (int)opt_field_integer(L, 2, "min_size", QSF_MYSQL_POOL_MIN_SIZE);
+    conf.max_size = (int)opt_field_integer(L, 2, "max_size", QSF_MYSQL_POOL_MAX_SIZE);
+    conf.ping_interval = (int)opt_field_integer(L, 2, "ping_interval", QSF_MYSQL_PING_INTERVAL);
+
+    char err[256];
+    if (qsf_mysql_pool_create(name, &conf, err, sizeof(err)) != 0)
+    {
+        return luaL_error(L, "create pool '%s' failed, %s", name, err);
+    }
+    return push_pool(L, qsf_mysql_pool_find(name));
+}
+
+// mysql.pool(name), returns nil if not created
+static int pool_get(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    qsf_mysql_pool_t* pool = qsf_mysql_pool_find(name);
+    if (pool == NULL)
+    {
+        return 0;
+    }
+    return push_pool(L, pool);
+}
+
+// run in node loop thread, queries are delivered in completion order
+static void on_channel_async(uv_async_t* handle)
+{
+    QueryChannel* ch = handle->data;
+    uv_mutex_lock(&ch->lock);
+    AsyncQuery* list = ch->done;
+    ch->done = NULL;
+    uv_mutex_unlock(&ch->lock);
+    AsyncQuery* q = NULL;
+    while (list) // reverse to completion order
+    {
+        AsyncQuery* next = list->next;
+        list->next = q;
+        q = list;
+        list = next;
+    }
+    while (q)
+    {
+        AsyncQuery* next = q->next;
+        if (--ch->inflight == 0)
+        {
+            uv_unref((uv_handle_t*)handle); // loop is not kept alive by idle channel
+        }
+        complete_query(handle->loop, q, 0);
+        q = next;
+    }
+}
+
+static void on_channel_closed(uv_handle_t* handle)
+{
+    qsf_free(handle->data);
+}
+
+// all pool queries are delivered before lua state is closed
+static int channel_gc(lua_State* L)
+{
+    QueryChannel* ch = *(QueryChannel**)luaL_checkudata(L, 1, LUAMYSQL_CHANNEL);
+    assert(ch->inflight == 0 && ch->done == NULL);
+    uv_mutex_lock(&ch->lock); // wait for last worker leaving `pool_job_done`
+    uv_mutex_unlock(&ch->lock);
+    uv_mutex_destroy(&ch->lock);
+    uv_close((uv_handle_t*)&ch->async, on_channel_closed);
+    return 0;
+}
+
+// completion channel of node, created on first pool query
+static QueryChannel* get_channel(lua_State* L, qsf_node_t* node)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, LUAMYSQL_CHANNEL);
+    QueryChannel** ud = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (ud != NULL)
+    {
+        return *ud;
+    }
+    ud = lua_newuserdata(L, sizeof(QueryChannel*));
+    QueryChannel* ch = qsf_malloc(sizeof(QueryChannel));
+    memset(ch, 0, sizeof(*ch));
+    uv_mutex_init(&ch->lock);
+    int r = uv_async_init(qsf_node_loop(node), &ch->async, on_channel_async);
+    qsf_assert(r == 0, "uv_async_init() failed, %s.", uv_strerror(r));
+    ch->async.data = ch;
+    uv_unref((uv_handle_t*)&ch->async);
+    *ud = ch;
+    luaL_setmetatable(L, LUAMYSQL_CHANNEL);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUAMYSQL_CHANNEL);
+    return ch;
+}
+
+// run by pool worker
+static void pool_job_work(qsf_mysql_job_t* job)
+{
+    pool_query(job->data);
+}
+
+// run by pool worker, hand query to its node
+static void pool_job_done(qsf_mysql_job_t* job)
+{
+    AsyncQuery* q = job->data;
+    QueryChannel* ch = q->channel;
+    uv_mutex_lock(&ch->lock);
+    q->next = ch->done;
+    ch->done = q;
+    uv_async_send(&ch->async); // under lock, channel may be freed once delivered
+    uv_mutex_unlock(&ch->lock);
+}
+
+// pool:executeAsync(sql, callback [, 'a']), queries run concurrently on
+// borrowed connections by worker threads of pool.
+static int pool_execute_async(lua_State* L)
+{
+    qsf_mysql_pool_t* pool = check_pool(L);
+    AsyncQuery* q = new_query(L);
+    q->pool = pool;
+    q->channel = get_channel(L, q->node);
+    q->job.work = pool_job_work;
+    q->job.done = pool_job_done;
+    q->job.data = q;
+    if (q->channel->inflight++ == 0)
+    {
+        uv_ref((uv_handle_t*)&q->channel->async);
+    }
+    qsf_mysql_pool_submit(pool, &q->job);
+    return 0;
+}
+
+static int thread_gc(lua_State* L)
+{
+    mysql_thread_end();
+    return 0;
+}
+
+// pair `mysql_thread_init` of node thread with `mysql_thread_end` when its
+// lua state is closed. the guard is created before any borrowed connection,
+// so it is finalized after them.
+static void thread_init(lua_State* L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, LUAMYSQL_THREAD);
+    int found = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (!found)
+    {
+        mysql_thread_init();
+        lua_newuserdata(L, 1);
+        luaL_setmetatable(L, LUAMYSQL_THREAD);
+        lua_setfield(L, LUA_REGISTRYINDEX, LUAMYSQL_THREAD);
+    }
+}
+
+// pool:checkout([timeout]), borrow a connection pinned to caller until
+// `close`, blocks node thread up to `timeout` milliseconds.
+// returns nil and message on failure.
+static int pool_checkout(lua_State* L)
+{
+    qsf_mysql_pool_t* pool = check_pool(L);
+    int timeout = (int)luaL_optinteger(L, 2, QSF_MYSQL_CHECKOUT_TIMEOUT);
+    thread_init(L);
+    char err[256];
+    MYSQL* my_conn = qsf_mysql_pool_checkout(pool, timeout, err, sizeof(err));
+    if (my_conn == NULL)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    Connection* conn = (Connection*)lua_newuserdata(L, sizeof(Connection));
+    memset(conn, 0, sizeof(*conn));
+    uv_mutex_init(&conn->lock);
+    conn->mysql = my_conn;
+    conn->pool = pool;
+    luaL_setmetatable(L, LUAMYSQL_CONN);
+    return 1;
+}
+
+static int pool_stats(lua_State* L)
+{
+    qsf_mysql_pool_t* pool = check_pool(L);
+    qsf_mysql_pool_stats_t stats;
+    qsf_mysql_pool_stats(pool, &stats);
+    lua_createtable(L, 0, 6);
+    push_literal(L, "size", stats.size);
+    push_literal(L, "idle", stats.idle);
+    push_literal(L, "waiting", stats.waiting);
+    push_literal(L, "checkouts", (lua_Integer)stats.checkouts);
+    push_literal(L, "reconnects", (lua_Integer)stats.reconnects);
+    push_literal(L, "timeouts", (lua_Integer)stats.timeouts);
+    return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+
+static void push_mysql_constant(lua_State* L)
+{
+    // protocol type
+    push_literal(L, "PROTOCOL_DEFAULT", MYSQL_PROTOCOL_DEFAULT);
+    push_literal(L, "PROTOCOL_TCP", MYSQL_PROTOCOL_TCP);
+    push_literal(L, "PROTOCOL_SOCKET", MYSQL_PROTOCOL_SOCKET);
+    push_literal(L, "PROTOCOL_PIPE", MYSQL_PROTOCOL_PIPE);
+    push_literal(L, "PROTOCOL_MEMORY", MYSQL_PROTOCOL_MEMORY);
+
+    // client flag
+    push_literal(L, "CLIENT_LONG_PASSWORD", CLIENT_LONG_PASSWORD);
+    push_literal(L, "CLIENT_FOUND_ROWS", CLIENT_FOUND_ROWS);
+    push_literal(L, "CLIENT_LONG_FLAG", CLIENT_LONG_FLAG);
+    push_literal(L, "CLIENT_CONNECT_WITH_DB", CLIENT_CONNECT_WITH_DB);
+    push_literal(L, "CLIENT_NO_SCHEMA", CLIENT_NO_SCHEMA);
+    push_literal(L, "CLIENT_COMPRESS", CLIENT_COMPRESS);
+    push_literal(L, "CLIENT_ODBC", CLIENT_ODBC);
+    push_literal(L, "CLIENT_LOCAL_FILES", CLIENT_LOCAL_FILES);
+    push_literal(L, "CLIENT_IGNORE_SPACE", CLIENT_IGNORE_SPACE);
+    push_literal(L, "CLIENT_PROTOCOL_41", CLIENT_PROTOCOL_41);
+    push_literal(L, "CLIENT_INTERACTIVE", CLIENT_INTERACTIVE);
+    push_literal(L, "CLIENT_SSL", CLIENT_SSL);
+    push_literal(L, "CLIENT_IGNORE_SIGPIPE", CLIENT_IGNORE_SIGPIPE);
+    push_literal(L, "CLIENT_TRANSACTIONS", CLIENT_TRANSACTIONS);
+    //push_literal(L, "CLIENT_SECURE_CONNECTION", CLIENT_SECURE_CONNECTION);
+    push_literal(L, "CLIENT_MULTI_STATEMENTS", CLIENT_MULTI_STATEMENTS);
+    push_literal(L, "CLIENT_MULTI_RESULTS", CLIENT_MULTI_RESULTS);
+    push_literal(L, "CLIENT_PS_MULTI_RESULTS", CLIENT_PS_MULTI_RESULTS);
+}
+
+static void create_meta(lua_State* L, const char* name, const luaL_Reg* methods)
+{
+    assert(L && name && methods);
+    luaL_newmetatable(L, name);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, methods, 0);
+    lua_pushliteral(L, "__metatable");
+    lua_pushliteral(L, "cannot access this metatable");
+    lua_settable(L, -3);
+    lua_pop(L, 1);  /* pop new metatable */
+}
+
+static void make_meta(lua_State* L)
+{
+    static const luaL_Reg conn_methods[] =
+    {
+        { "__gc", conn_gc },
+        { "__tostring", conn_tostring },
+        { "setCharset", conn_set_charset },
+        { "setReconnect", conn_set_reconnect },
+        { "setConnectTimeout", conn_set_connect_timeout },
+        { "setWriteTimeout", conn_set_write_timeout },
+        { "setReadTimeout", conn_set_read_timeout },
+        { "setProtocol", conn_set_protocol },
+        { "setCompress", conn_set_compress },
+        { "escape", conn_escape_string },
+        { "connect", conn_connect },
+        { "ping", conn_ping },
+        { "close", conn_close },
+        { "execute", conn_execute },
+        { "executeAsync", conn_execute_async },
+        { "prepare", conn_prepare },
+        { "batchInsert", conn_batch_insert },
+        { "commit", conn_commit },
+        { "rollback", conn_rollback },
+        { NULL, NULL },
+    };
+
+    static const luaL_Reg cursor_methods[] =
+    {
+        { "__gc", cursor_gc },
+        { "fetch", cursor_fetch },
+        { "fetchAll", cursor_fetch_all },
+        { "numrows", cursor_numrows },
+        { NULL, NULL },
+    };
+
+    static const luaL_Reg stmt_methods[] =
+    {
+        { "__gc", stmt_gc },
+        { "execute", stmt_execute },
+        { "close", stmt_close },
+        { NULL, NULL },
+    };
+
+    static const luaL_Reg pool_methods[] =
+    {
+        { "executeAsync", pool_execute_async },
+        { "checkout", pool_checkout },
+        { "stats", pool_stats },
+        { NULL, NULL },
+    };
+
+    create_meta(L, LUAMYSQL_CONN, conn_methods);
+    create_meta(L, LUAMYSQL_CURSOR, cursor_methods);
+    static const luaL_Reg channel_methods[] =
+    {
+        { "__gc", channel_gc },
+        { NULL, NULL },
+    };
+
+    static const luaL_Reg thread_methods[] =
+    {
+        { "__gc", thread_gc },
+        { NULL, NULL },
+    };
+
+    create_meta(L, LUAMYSQL_STMT, stmt_methods);
+    create_meta(L, LUAMYSQL_CHANNEL, channel_methods);
+    create_meta(L, LUAMYSQL_THREAD, thread_methods);
+    create_meta(L, LUAMYSQL_POOL, pool_methods);
+}
+
+static void init_library(void)
+{
+    mysql_library_init(0, NULL, NULL);
+}
+
+LUALIB_API int luaopen_mysql(lua_State* L)
+{
+    static uv_once_t once = UV_ONCE_INIT;
+    uv_once(&once, init_library); // not thread safe in `mysql_init`
+
     static const luaL_Reg lib[] =
     {
         { "createClient", conn_create },
+        { "createPool", pool_create },
+        { "pool", pool_get },
         { NULL, NULL },
     };
 
@@ -6,13 +6,33 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <assert.h>
+#include <string.h>
+#include <ctype.h>
 #include "qsf.h"
 #include "net/qsf_net_def.h"
 #include "net/qsf_net_server.h"
+#include "net/qsf_net_client.h"
+#include "net/qsf_net_cipher.h"
+#include "net/qsf_net_udp.h"
+#include "net/qsf_net_http.h"
 
 
 #define SERVER_HANDLE     "server*"
+#define CLIENT_HANDLE     "client*"
+#define UDP_HANDLE        "udp*"
+#define HTTP_HANDLE       "http*"
+#define CIPHER_HANDLE     "cipher*"
 #define check_server(L)   ((net_server_t*)luaL_checkudata(L, 1, SERVER_HANDLE))
+#define check_client(L)   ((net_client_t*)luaL_checkudata(L, 1, CLIENT_HANDLE))
+#define check_udp(L)      ((net_udp_t*)luaL_checkudata(L, 1, UDP_HANDLE))
+#define check_http(L)     ((net_http_t*)luaL_checkudata(L, 1, HTTP_HANDLE))
+#define check_cipher(L)   ((qsf_net_cipher_t**)luaL_checkudata(L, 1, CIPHER_HANDLE))
+
+// smaller response bodies are copied instead of referenced
+#define HTTP_COPY_BODY    1024
+
+// registry key of last server id of this node
+#define SERVER_ID_KEY     "net.server_id"
 
 
 typedef struct
@@ -20,44 +40,134 @@ typedef struct
     qsf_net_server_t* s;
     lua_State* L;
     int read_ref;
+    qsf_node_t* node;       // node of this server
+    uint16_t id;            // unique within node, carried by forward envelope
+    char* forward_buf;      // envelope of forwarded frames
 }net_server_t;
 
-static uv_loop_t* get_loop(lua_State* L)
+typedef struct
+{
+    qsf_net_client_t* c;
+    lua_State* L;
+    int read_ref;
+}net_client_t;
+
+typedef struct
+{
+    qsf_net_udp_t* u;
+    lua_State* L;
+    int read_ref;
+}net_udp_t;
+
+typedef struct
+{
+    qsf_net_http_t* h;
+    lua_State* L;
+    int request_ref;
+}net_http_t;
+
+static qsf_node_t* get_node(lua_State* L)
 {
     qsf_node_t* self = lua_touserdata(L, lua_upvalueindex(1));
     if (!qsf_node_check_tag(self))
     {
         luaL_error(L, "invalid node object");
     }
-    return qsf_node_loop(self);
+    return self;
+}
+
+static uv_loop_t* get_loop(lua_State* L)
+{
+    return qsf_node_loop(get_node(L));
+}
+
+// backends see a session as `server << 32 | serial`
+#define FORWARD_SESSION(server, serial) (((lua_Integer)(server) << 32) | (serial))
+
+static void forward_pack(char* buf, int type, uint16_t server, uint32_t serial)
+{
+    uint32_t magic = htonl(NET_FORWARD_MAGIC);
+    server = htons(server);
+    serial = htonl(serial);
+    memcpy(buf, &magic, sizeof(magic));
+    buf[4] = (char)type;
+    memcpy(buf + 5, &server, sizeof(server));
+    memcpy(buf + 7, &serial, sizeof(serial));
+}
+
+// returns envelope type, or zero if `data` is not an envelope
+static int forward_unpack(const char* data, int size, uint16_t* server, uint32_t* serial)
+{
+    uint32_t magic;
+    if (size < NET_FORWARD_HEADER)
+    {
+        return 0;
+    }
+    memcpy(&magic, data, sizeof(magic));
+    if (ntohl(magic) != NET_FORWARD_MAGIC)
+    {
+        return 0;
+    }
+    memcpy(server, data + 5, sizeof(*server));
+    *server = ntohs(*server);
+    memcpy(serial, data + 7, sizeof(*serial));
+    *serial = ntohl(*serial);
+    return (uint8_t)data[4];
+}
+
+// ids of servers created by this node, wraps after 65535
+static uint16_t next_server_id(lua_State* L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, SERVER_ID_KEY);
+    lua_Integer id = lua_tointeger(L, -1) % UINT16_MAX + 1;
+    lua_pop(L, 1);
+    lua_pushinteger(L, id);
+    lua_setfield(L, LUA_REGISTRYINDEX, SERVER_ID_KEY);
+    return (uint16_t)id;
 }
 
 //////////////////////////////////////////////////////////////////////////
 // net.server interface
 
+// net.createServer([max_conn, heartbeat, check, 'stream'|'websocket'])
 static int create_server(lua_State* L)
 {
-    uv_loop_t* loop = get_loop(L);
+    static const char* const framings[] = { "stream", "websocket", NULL };
+    qsf_node_t* node = get_node(L);
+    uv_loop_t* loop = qsf_node_loop(node);
     uint32_t max_connections = (uint32_t)luaL_optinteger(L, 1, NET_DEFAULT_MAX_CONN);
     uint16_t heartbeat_sec = (uint16_t)luaL_optinteger(L, 2, NET_DEFAULT_HEARTBEAT);
     uint16_t heartbeat_check_sec = (uint16_t)luaL_optinteger(L, 3, NET_DEFAULT_HEARTBEAT_CHECK);
+    int websocket = luaL_checkoption(L, 4, "stream", framings);
     struct qsf_net_server_s* s = qsf_create_net_server(loop, max_connections,
         heartbeat_sec, heartbeat_check_sec);
+    qsf_net_server_set_websocket(s, websocket);
     net_server_t* server = lua_newuserdata(L, sizeof(net_server_t));
     server->s = s;
     server->L = L;
     server->read_ref = LUA_NOREF;
+    server->node = node;
+    server->id = next_server_id(L);
+    server->forward_buf = NULL;
     qsf_net_set_server_udata(server->s, server);
     luaL_getmetatable(L, SERVER_HANDLE);
     lua_setmetatable(L, -2);
     return 1;
 }
 
+static int on_node_filter(void* ud, const char* name, int len, const char* data, int size);
+
 static int server_gc(lua_State* L)
 {
     net_server_t* server = check_server(L);
+    qsf_net_server_set_forward(server->s, NULL); // dealer may be closed already
     qsf_net_server_destroy(server->s);
     luaL_unref(L, LUA_REGISTRYINDEX, server->read_ref);
+    if (server->forward_buf)
+    {
+        qsf_node_remove_filter(server->node, on_node_filter, server);
+        qsf_free(server->forward_buf);
+    }
     return 0;
 }
 
@@ -80,7 +190,7 @@ static void on_server_read(int err, uint32_t serial, const char* data, uint16_t
         }
         lua_pushinteger(L, serial);
         lua_pushlstring(L, data, size);
-        qsf_trace_pcall(L, 3);
+        qsf_node_pcall(L, 3, QSF_CALL_NET);
     }
 }
 
@@ -119,9 +229,10 @@ static int server_write(lua_State* L)
     uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
     size_t size;
     const char* data = luaL_checklstring(L, 3, &size);
+    int flags = (lua_toboolean(L, 4) ? NET_WRITE_DROPPABLE : 0);
     if (size <= UINT16_MAX)
     {
-        qsf_net_server_write(server->s, serial, data, (uint16_t)size);
+        qsf_net_server_write(server->s, serial, data, (uint16_t)size, flags);
         return 0;
     }
     return luaL_error(L, "too big packet to write: %d/%d", size, UINT16_MAX);
@@ -132,14 +243,291 @@ static int server_broadcast(lua_State* L)
     net_server_t* server = check_server(L);
     size_t size;
     const char* data = luaL_checklstring(L, 2, &size);
+    int flags = (lua_toboolean(L, 3) ? NET_WRITE_DROPPABLE : 0);
     if (size <= UINT16_MAX)
     {
-        qsf_net_server_write_all(server->s, data, (uint16_t)size);
+        qsf_net_server_write_all(server->s, data, (uint16_t)size, flags);
         return 0;
     }
     return luaL_error(L, "too big packet to write: %d/%d", size, UINT16_MAX);
 }
 
+// server:setSendLimit(soft, hard [, 'drop_newest'|'drop_oldest'|'kick'])
+static int server_set_send_limit(lua_State* L)
+{
+    static const char* const policies[] = { "drop_newest", "drop_oldest", "kick", NULL };
+    static const int policy_values[] = { NET_SEND_DROP_NEWEST, NET_SEND_DROP_OLDEST, NET_SEND_KICK };
+    net_server_t* server = check_server(L);
+    uint32_t soft_limit = (uint32_t)luaL_checkinteger(L, 2);
+    uint32_t hard_limit = (uint32_t)luaL_optinteger(L, 3, 0);
+    int policy = luaL_checkoption(L, 4, "drop_newest", policies);
+    qsf_net_server_set_send_limit(server->s, soft_limit, hard_limit, policy_values[policy]);
+    return 0;
+}
+
+// server:setRateLimit(packets, bytes [, 'pause'|'kick']), per second of each session
+static int server_set_rate_limit(lua_State* L)
+{
+    static const char* const policies[] = { "pause", "kick", NULL };
+    static const int policy_values[] = { NET_RATE_PAUSE, NET_RATE_KICK };
+    net_server_t* server = check_server(L);
+    uint32_t packet_rate = (uint32_t)luaL_checkinteger(L, 2);
+    uint32_t byte_rate = (uint32_t)luaL_optinteger(L, 3, 0);
+    int policy = luaL_checkoption(L, 4, "pause", policies);
+    qsf_net_server_set_rate_limit(server->s, packet_rate, byte_rate, policy_values[policy]);
+    return 0;
+}
+
+// server:setCompress(enable [, threshold [, level]]), applies to new sessions
+static int server_set_compress(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    int enable = lua_toboolean(L, 2);
+    uint16_t threshold = (uint16_t)luaL_optinteger(L, 3, NET_DEFAULT_COMPRESS_THRESHOLD);
+    int level = (int)luaL_optinteger(L, 4, NET_DEFAULT_COMPRESS_LEVEL);
+    qsf_net_server_set_compress(server->s, enable, level, threshold);
+    return 0;
+}
+
+static int server_compress(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    int enable = lua_toboolean(L, 3);
+    int r = qsf_net_server_compress(server->s, serial, enable);
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
+// server:setCipher(serial, key, iv [, 'ctr'|'gcm']), nil key removes cipher
+static int server_set_cipher(lua_State* L)
+{
+    static const char* const modes[] = { "ctr", "gcm", NULL };
+    static const int mode_values[] = { NET_CIPHER_CTR, NET_CIPHER_GCM };
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    if (lua_isnoneornil(L, 3))
+    {
+        int r = qsf_net_server_set_cipher(server->s, serial, 0, NULL, 0, NULL);
+        lua_pushboolean(L, r == 0);
+        return 1;
+    }
+    size_t key_len = 0;
+    size_t iv_len = 0;
+    const char* key = luaL_checklstring(L, 3, &key_len);
+    const char* iv = luaL_checklstring(L, 4, &iv_len);
+    int mode = luaL_checkoption(L, 5, "ctr", modes);
+    luaL_argcheck(L, key_len == 16 || key_len == 32, 3, "key must be 16 or 32 bytes");
+    luaL_argcheck(L, iv_len == NET_CIPHER_IV_SIZE, 4, "iv must be 16 bytes");
+    int r = qsf_net_server_set_cipher(server->s, serial, mode_values[mode], 
+        (const uint8_t*)key, (int)key_len, (const uint8_t*)iv);
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
+// net.createCipher(key, iv [, 'ctr'|'gcm' [, server_side]]), the peer of
+// server:setCipher for clients written in lua
+static int create_cipher(lua_State* L)
+{
+    static const char* const modes[] = { "ctr", "gcm", NULL };
+    static const int mode_values[] = { NET_CIPHER_CTR, NET_CIPHER_GCM };
+    size_t key_len = 0;
+    size_t iv_len = 0;
+    const char* key = luaL_checklstring(L, 1, &key_len);
+    const char* iv = luaL_checklstring(L, 2, &iv_len);
+    int mode = luaL_checkoption(L, 3, "ctr", modes);
+    int server_side = lua_toboolean(L, 4);
+    luaL_argcheck(L, key_len == 16 || key_len == 32, 1, "key must be 16 or 32 bytes");
+    luaL_argcheck(L, iv_len == NET_CIPHER_IV_SIZE, 2, "iv must be 16 bytes");
+    qsf_net_cipher_t** ud = lua_newuserdata(L, sizeof(qsf_net_cipher_t*));
+    *ud = qsf_create_net_cipher(mode_values[mode], (const uint8_t*)key, (int)key_len,
+        (const uint8_t*)iv, server_side);
+    if (*ud == NULL)
+    {
+        return luaL_error(L, "create cipher failed");
+    }
+    luaL_setmetatable(L, CIPHER_HANDLE);
+    return 1;
+}
+
+static int cipher_gc(lua_State* L)
+{
+    qsf_net_cipher_t** ud = check_cipher(L);
+    if (*ud)
+    {
+        qsf_net_cipher_destroy(*ud);
+        *ud = NULL;
+    }
+    return 0;
+}
+
+// cipher:encrypt(frame), returns next outbound frame sealed
+static int cipher_encrypt(lua_State* L)
+{
+    qsf_net_cipher_t* c = *check_cipher(L);
+    size_t size;
+    const char* data = luaL_checklstring(L, 2, &size);
+    int capacity = (int)size + qsf_net_cipher_overhead(c);
+    luaL_argcheck(L, capacity <= UINT16_MAX, 2, "frame too large");
+    uint8_t* buf = qsf_malloc(capacity);
+    memcpy(buf, data, size);
+    int len = qsf_net_cipher_encrypt(c, buf, (int)size, capacity);
+    if (len >= 0)
+    {
+        lua_pushlstring(L, (const char*)buf, len);
+    }
+    qsf_free(buf);
+    return (len >= 0 ? 1 : 0);
+}
+
+// cipher:decrypt(frame), returns nil if next inbound frame is not authentic
+static int cipher_decrypt(lua_State* L)
+{
+    qsf_net_cipher_t* c = *check_cipher(L);
+    size_t size;
+    const char* data = luaL_checklstring(L, 2, &size);
+    luaL_argcheck(L, size <= UINT16_MAX, 2, "frame too large");
+    uint8_t* buf = qsf_malloc(size + 1);
+    memcpy(buf, data, size);
+    int len = qsf_net_cipher_decrypt(c, buf, (int)size);
+    if (len >= 0)
+    {
+        lua_pushlstring(L, (const char*)buf, len);
+    }
+    qsf_free(buf);
+    return (len >= 0 ? 1 : 0);
+}
+
+static int server_pending(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    int bytes = qsf_net_server_pending(server->s, serial);
+    if (bytes < 0)
+    {
+        return 0;
+    }
+    lua_pushinteger(L, bytes);
+    return 1;
+}
+
+static int server_join_group(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    uint32_t gid = (uint32_t)luaL_checkinteger(L, 3);
+    int r = qsf_net_server_join_group(server->s, serial, gid);
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
+static int server_leave_group(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    uint32_t gid = (uint32_t)luaL_checkinteger(L, 3);
+    int r = qsf_net_server_leave_group(server->s, serial, gid);
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
+static int server_multicast(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t gid = (uint32_t)luaL_checkinteger(L, 2);
+    size_t size;
+    const char* data = luaL_checklstring(L, 3, &size);
+    int flags = (lua_toboolean(L, 4) ? NET_WRITE_DROPPABLE : 0);
+    if (size <= UINT16_MAX)
+    {
+        qsf_net_server_multicast(server->s, gid, data, (uint16_t)size, flags);
+        return 0;
+    }
+    return luaL_error(L, "too big packet to write: %d/%d", size, UINT16_MAX);
+}
+
+static int server_group_size(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t gid = (uint32_t)luaL_checkinteger(L, 2);
+    lua_pushinteger(L, qsf_net_server_group_size(server->s, gid));
+    return 1;
+}
+
+// frame of a bound session goes to its node without entering Lua
+static void on_server_forward(uint32_t serial, const char* target, int len,
+                              const char* data, uint16_t size, void* ud)
+{
+    net_server_t* server = ud;
+    char* buf = server->forward_buf;
+    if (data == NULL)
+    {
+        forward_pack(buf, NET_FORWARD_CLOSE, server->id, serial);
+        qsf_node_send(server->node, target, len, buf, NET_FORWARD_HEADER);
+        return;
+    }
+    forward_pack(buf, NET_FORWARD_DATA, server->id, serial);
+    memcpy(buf + NET_FORWARD_HEADER, data, size);
+    qsf_node_send(server->node, target, len, buf, NET_FORWARD_HEADER + size);
+}
+
+// write and kick requests from backend nodes, only the node a session
+// is bound to may write to or kick it
+static int on_node_filter(void* ud, const char* name, int len, const char* data, int size)
+{
+    net_server_t* server = ud;
+    uint16_t id = 0;
+    uint32_t serial = 0;
+    int type = forward_unpack(data, size, &id, &serial);
+    if (type != NET_FORWARD_WRITE && type != NET_FORWARD_KICK)
+    {
+        return 0;
+    }
+    if (id != server->id)
+    {
+        return 0; // envelope of another server in this node
+    }
+    if (!qsf_net_server_bound_to(server->s, serial, name, len))
+    {
+        return 1; // drop request of a node this session is not bound to
+    }
+    if (type == NET_FORWARD_WRITE)
+    {
+        int bytes = size - NET_FORWARD_HEADER;
+        if (bytes > 0 && bytes <= UINT16_MAX)
+        {
+            qsf_net_server_write(server->s, serial, data + NET_FORWARD_HEADER,
+                (uint16_t)bytes, 0);
+        }
+        return 1;
+    }
+    else if (type == NET_FORWARD_KICK)
+    {
+        qsf_net_server_close(server->s, serial);
+        return 1;
+    }
+    return 0;
+}
+
+// server:bindSession(serial, node), frames of this session are forwarded
+// to `node` in C, nil `node` gives the session back to read callback.
+static int server_bind_session(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    size_t len = 0;
+    const char* target = luaL_optlstring(L, 3, NULL, &len);
+    if (target && server->forward_buf == NULL)
+    {
+        server->forward_buf = qsf_malloc(NET_FORWARD_HEADER + UINT16_MAX);
+        qsf_net_server_set_forward(server->s, on_server_forward);
+        qsf_node_add_filter(server->node, on_node_filter, server);
+    }
+    int r = qsf_net_server_bind(server->s, serial, target, (int)len);
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
 static int server_shutdown(lua_State* L)
 {
     net_server_t* server = check_server(L);
@@ -160,7 +548,7 @@ static int server_address_of(lua_State* L)
 {
     net_server_t* server = check_server(L);
     uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
-    char address[20] = { '\0' };
+    char address[128] = { '\0' };
     qsf_net_server_session_address(server->s, serial, address, sizeof(address));
     lua_pushstring(L, address);
     return 1;
@@ -174,11 +562,662 @@ static int server_size(lua_State* L)
     return 1;
 }
 
+static void push_histogram(lua_State* L, const uint64_t* buckets, const char* name)
+{
+    lua_createtable(L, NET_STATS_BUCKETS, 0);
+    for (int i = 0; i < NET_STATS_BUCKETS; i++)
+    {
+        lua_pushinteger(L, (lua_Integer)buckets[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, name);
+}
+
+// server:stats(), histogram entry 1 counts zero values and
+// entry i + 1 counts values in [2^(i-1), 2^i)
+static int server_stats(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    qsf_net_server_stats_t stats;
+    qsf_net_server_stats(server->s, &stats);
+    lua_createtable(L, 0, 12);
+    lua_pushinteger(L, qsf_net_server_size(server->s));
+    lua_setfield(L, -2, "sessions");
+    lua_pushinteger(L, (lua_Integer)stats.accepted);
+    lua_setfield(L, -2, "accepted");
+    lua_pushinteger(L, (lua_Integer)stats.rejected);
+    lua_setfield(L, -2, "rejected");
+    lua_pushinteger(L, (lua_Integer)stats.timeouts);
+    lua_setfield(L, -2, "timeouts");
+    lua_pushinteger(L, (lua_Integer)stats.kicked);
+    lua_setfield(L, -2, "kicked");
+    lua_pushinteger(L, (lua_Integer)stats.bytes_in);
+    lua_setfield(L, -2, "bytesIn");
+    lua_pushinteger(L, (lua_Integer)stats.bytes_out);
+    lua_setfield(L, -2, "bytesOut");
+    lua_pushinteger(L, (lua_Integer)stats.frames_in);
+    lua_setfield(L, -2, "framesIn");
+    lua_pushinteger(L, (lua_Integer)stats.frames_out);
+    lua_setfield(L, -2, "framesOut");
+    lua_pushinteger(L, (lua_Integer)stats.pending_bytes);
+    lua_setfield(L, -2, "pendingBytes");
+    push_histogram(L, stats.read_latency, "readLatency");
+    return 1;
+}
+
+static int server_reset_stats(lua_State* L)
+{
+    net_server_t* server = check_server(L);
+    qsf_net_server_reset_stats(server->s);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// net.udp interface
+
+// net.createUdp([max_connections [, heartbeat [, heartbeat_check]]])
+static int create_udp(lua_State* L)
+{
+    uv_loop_t* loop = get_loop(L);
+    uint32_t max_connections = (uint32_t)luaL_optinteger(L, 1, NET_DEFAULT_MAX_CONN);
+    uint16_t heartbeat_sec = (uint16_t)luaL_optinteger(L, 2, NET_DEFAULT_HEARTBEAT);
+    uint16_t heartbeat_check_sec = (uint16_t)luaL_optinteger(L, 3, NET_DEFAULT_HEARTBEAT_CHECK);
+    net_udp_t* udp = lua_newuserdata(L, sizeof(net_udp_t));
+    udp->u = qsf_create_net_udp(loop, max_connections, heartbeat_sec, heartbeat_check_sec);
+    udp->L = L;
+    udp->read_ref = LUA_NOREF;
+    qsf_net_set_udp_udata(udp->u, udp);
+    luaL_getmetatable(L, UDP_HANDLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int udp_gc(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    qsf_net_udp_destroy(udp->u);
+    luaL_unref(L, LUA_REGISTRYINDEX, udp->read_ref);
+    return 0;
+}
+
+static void on_udp_read(int err, uint32_t serial, const char* data, uint16_t size, void* ud)
+{
+    assert(data && size);
+    net_udp_t* udp = ud;
+    lua_State* L = udp->L;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, udp->read_ref);
+    if (lua_isfunction(L, -1))
+    {
+        if (err == 0)
+        {
+            lua_pushnil(L);
+        }
+        else
+        {
+            lua_pushinteger(L, err);
+        }
+        lua_pushinteger(L, serial);
+        lua_pushlstring(L, data, size);
+        qsf_node_pcall(L, 3, QSF_CALL_NET);
+    }
+    else
+    {
+        lua_pop(L, 1);
+    }
+}
+
+// replace read callback by function at index 4
+static void udp_set_callback(lua_State* L, net_udp_t* udp)
+{
+    luaL_argcheck(L, lua_isfunction(L, 4), 4, "read callback must be function type");
+    lua_settop(L, 4);
+    luaL_unref(L, LUA_REGISTRYINDEX, udp->read_ref);
+    udp->read_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    qsf_assert(udp->read_ref != LUA_NOREF, "luaL_ref() failed.");
+    udp->L = L;
+}
+
+// udp:start(host, port, callback), accept sessions
+static int udp_start(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    const char* host = luaL_checkstring(L, 2);
+    int port = (int)luaL_checkinteger(L, 3);
+    udp_set_callback(L, udp);
+    int r = qsf_net_udp_start(udp->u, host, port, on_udp_read);
+    if (r < 0)
+    {
+        return luaL_error(L, "net.udp start failed: %s", uv_strerror(r));
+    }
+    return 0;
+}
+
+// udp:connect(host, port, callback), returns serial of new session
+static int udp_connect(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    const char* host = luaL_checkstring(L, 2);
+    int port = (int)luaL_checkinteger(L, 3);
+    udp_set_callback(L, udp);
+    int64_t serial = qsf_net_udp_connect(udp->u, host, port, on_udp_read);
+    if (serial < 0)
+    {
+        return luaL_error(L, "net.udp connect failed: %s", uv_strerror((int)serial));
+    }
+    lua_pushinteger(L, serial);
+    return 1;
+}
+
+static int udp_stop(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    qsf_net_udp_stop(udp->u);
+    return 0;
+}
+
+static int udp_write(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    size_t size;
+    const char* data = luaL_checklstring(L, 3, &size);
+    if (size > 0 && size <= UINT16_MAX)
+    {
+        int r = qsf_net_udp_write(udp->u, serial, data, (uint16_t)size);
+        lua_pushboolean(L, r == 0);
+        return 1;
+    }
+    return luaL_error(L, "invalid packet size to write: %d/%d", size, UINT16_MAX);
+}
+
+static int udp_pending(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    int count = qsf_net_udp_pending(udp->u, serial);
+    if (count < 0)
+    {
+        return 0;
+    }
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int udp_close(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    qsf_net_udp_close(udp->u, serial);
+    return 0;
+}
+
+static int udp_size(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    lua_pushinteger(L, qsf_net_udp_size(udp->u));
+    return 1;
+}
+
+// udp:setNoDelay(nodelay [, interval [, resend [, nocwnd]]]), applies to new sessions
+static int udp_set_nodelay(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    int nodelay = lua_toboolean(L, 2);
+    int interval = (int)luaL_optinteger(L, 3, -1);
+    int resend = (int)luaL_optinteger(L, 4, -1);
+    int nocwnd = (lua_isnoneornil(L, 5) ? -1 : lua_toboolean(L, 5));
+    qsf_net_udp_set_nodelay(udp->u, nodelay, interval, resend, nocwnd);
+    return 0;
+}
+
+// udp:setWindow(snd_wnd, rcv_wnd), in segments
+static int udp_set_window(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    int snd_wnd = (int)luaL_checkinteger(L, 2);
+    int rcv_wnd = (int)luaL_checkinteger(L, 3);
+    qsf_net_udp_set_window(udp->u, snd_wnd, rcv_wnd);
+    return 0;
+}
+
+static int udp_set_min_rto(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    int min_rto = (int)luaL_checkinteger(L, 2);
+    qsf_net_udp_set_min_rto(udp->u, min_rto);
+    return 0;
+}
+
+// udp:setLoss(percent), simulate packet loss for testing
+static int udp_set_loss(lua_State* L)
+{
+    net_udp_t* udp = check_udp(L);
+    int percent = (int)luaL_checkinteger(L, 2);
+    qsf_net_udp_set_loss(udp->u, percent);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// net.http interface
+
+// net.createHttpServer([max_connections [, idle_timeout]])
+static int create_http(lua_State* L)
+{
+    uv_loop_t* loop = get_loop(L);
+    uint32_t max_connections = (uint32_t)luaL_optinteger(L, 1, NET_DEFAULT_MAX_CONN);
+    uint16_t idle_timeout = (uint16_t)luaL_optinteger(L, 2, NET_HTTP_DEFAULT_TIMEOUT);
+    net_http_t* http = lua_newuserdata(L, sizeof(net_http_t));
+    http->h = qsf_create_net_http(loop, max_connections, idle_timeout);
+    http->L = L;
+    http->request_ref = LUA_NOREF;
+    qsf_net_set_http_udata(http->h, http);
+    luaL_getmetatable(L, HTTP_HANDLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int http_gc(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    qsf_net_http_set_release(http->h, NULL); // registry is gone with the state
+    qsf_net_http_destroy(http->h);
+    luaL_unref(L, LUA_REGISTRYINDEX, http->request_ref);
+    return 0;
+}
+
+// callback(id, method, target, headers, body), header names are lower case
+static void on_http_request(const qsf_net_http_request_t* req, void* ud)
+{
+    net_http_t* http = ud;
+    lua_State* L = http->L;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, http->request_ref);
+    if (!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pushinteger(L, req->serial);
+    lua_pushlstring(L, req->method, req->method_len);
+    lua_pushlstring(L, req->target, req->target_len);
+    lua_createtable(L, 0, req->num_headers);
+    for (int i = 0; i < req->num_headers; i++)
+    {
+        const qsf_net_http_header_t* header = &req->headers[i];
+        luaL_Buffer b;
+        char* name = luaL_buffinitsize(L, &b, header->name_len);
+        for (size_t j = 0; j < header->name_len; j++)
+        {
+            name[j] = (char)tolower((unsigned char)header->name[j]);
+        }
+        luaL_pushresultsize(&b, header->name_len);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, -3) == LUA_TSTRING) // repeated header, join by comma
+        {
+            lua_pushliteral(L, ", ");
+            lua_pushlstring(L, header->value, header->value_len);
+            lua_concat(L, 3);
+        }
+        else
+        {
+            lua_pop(L, 1);
+            lua_pushlstring(L, header->value, header->value_len);
+        }
+        lua_rawset(L, -3);
+    }
+    lua_pushlstring(L, req->body, req->body_size);
+    qsf_node_pcall(L, 5, QSF_CALL_NET);
+}
+
+static void on_http_release(void* body_ref, void* ud)
+{
+    net_http_t* http = ud;
+    luaL_unref(http->L, LUA_REGISTRYINDEX, (int)(intptr_t)body_ref);
+}
+
+// http:start(host, port, callback)
+static int http_start(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    const char* host = luaL_checkstring(L, 2);
+    int port = (int)luaL_checkinteger(L, 3);
+    luaL_argcheck(L, lua_isfunction(L, 4), 4, "request callback must be function type");
+    lua_settop(L, 4);
+    luaL_unref(L, LUA_REGISTRYINDEX, http->request_ref);
+    http->request_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    qsf_assert(http->request_ref != LUA_NOREF, "luaL_ref() failed.");
+    http->L = L;
+    qsf_net_http_set_release(http->h, on_http_release);
+    int r = qsf_net_http_start(http->h, host, port, on_http_request);
+    if (r < 0)
+    {
+        return luaL_error(L, "net.http start failed: %s", uv_strerror(r));
+    }
+    return 0;
+}
+
+static int http_stop(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    qsf_net_http_stop(http->h);
+    return 0;
+}
+
+// http:respond(id, status, body [, headers]), `headers` is a name to value table.
+// large bodies are written from the Lua string without copy.
+static int http_respond(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    uint32_t serial = (uint32_t)luaL_checkinteger(L, 2);
+    int status = (int)luaL_checkinteger(L, 3);
+    size_t body_size = 0;
+    const char* body = luaL_optlstring(L, 4, "", &body_size);
+    luaL_argcheck(L, status >= 100 && status <= 999, 3, "invalid status code");
+    size_t headers_size = 0;
+    const char* headers = NULL;
+    if (!lua_isnoneornil(L, 5))
+    {
+        luaL_checktype(L, 5, LUA_TTABLE);
+        lua_settop(L, 5);
+        lua_pushliteral(L, "");  // header lines at index 6
+        lua_pushnil(L);
+        while (lua_next(L, 5) != 0)
+        {
+            const char* name = luaL_tolstring(L, -2, NULL);
+            const char* value = luaL_tolstring(L, -2, NULL);
+            if (strpbrk(name, "\r\n:") || strpbrk(value, "\r\n"))
+            {
+                return luaL_error(L, "invalid http header: %s", name);
+            }
+            lua_pushvalue(L, 6);
+            lua_pushvalue(L, -3);
+            lua_pushliteral(L, ": ");
+            lua_pushvalue(L, -4);
+            lua_pushliteral(L, "\r\n");
+            lua_concat(L, 5);
+            lua_replace(L, 6);
+            lua_pop(L, 3); // keep key for next iteration
+        }
+        headers = lua_tolstring(L, -1, &headers_size);
+    }
+    void* body_ref = NULL;
+    if (body_size >= HTTP_COPY_BODY)
+    {
+        lua_pushvalue(L, 4);
+        body_ref = (void*)(intptr_t)luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    int r = qsf_net_http_respond(http->h, serial, status, headers, headers_size,
+        body, body_size, body_ref);
+    if (r < 0 && body_ref)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, (int)(intptr_t)body_ref);
+    }
+    lua_pushboolean(L, r == 0);
+    return 1;
+}
+
+static int http_size(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    lua_pushinteger(L, qsf_net_http_size(http->h));
+    return 1;
+}
+
+static int http_set_max_body(lua_State* L)
+{
+    net_http_t* http = check_http(L);
+    uint32_t size = (uint32_t)luaL_checkinteger(L, 2);
+    qsf_net_http_set_max_body(http->h, size);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// net.client interface
+
+static void on_client_read(int err, int index, const char* data, uint16_t size, void* ud)
+{
+    assert(data && size);
+    net_client_t* client = ud;
+    lua_State* L = client->L;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, client->read_ref);
+    if (lua_isfunction(L, -1))
+    {
+        if (err == 0)
+        {
+            lua_pushnil(L);
+        }
+        else
+        {
+            lua_pushinteger(L, err);
+        }
+        lua_pushinteger(L, index + 1);
+        lua_pushlstring(L, data, size);
+        qsf_node_pcall(L, 3, QSF_CALL_NET);
+    }
+    else
+    {
+        lua_pop(L, 1);
+    }
+}
+
+// net.connect(host, port, {pool=1, reconnect=true, min_backoff=500,
+//      max_backoff=30000, coalesce=16384, callback=function(err, index, data) end})
+static int client_connect(lua_State* L)
+{
+    uv_loop_t* loop = get_loop(L);
+    const char* host = luaL_checkstring(L, 1);
+    int port = (int)luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_getfield(L, 3, "pool");
+    uint16_t pool_size = (uint16_t)luaL_optinteger(L, -1, NET_DEFAULT_POOL_SIZE);
+    lua_getfield(L, 3, "reconnect");
+    int reconnect = lua_isnil(L, -1) || lua_toboolean(L, -1);
+    lua_getfield(L, 3, "min_backoff");
+    uint32_t min_delay = (uint32_t)luaL_optinteger(L, -1, NET_DEFAULT_RECONNECT_MIN);
+    lua_getfield(L, 3, "max_backoff");
+    uint32_t max_delay = (uint32_t)luaL_optinteger(L, -1, NET_DEFAULT_RECONNECT_MAX);
+    lua_getfield(L, 3, "coalesce");
+    uint32_t coalesce = (uint32_t)luaL_optinteger(L, -1, NET_DEFAULT_COALESCE);
+    lua_getfield(L, 3, "callback");
+    luaL_argcheck(L, lua_isfunction(L, -1), 3, "read callback must be function type");
+    int read_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    qsf_assert(read_ref != LUA_NOREF, "luaL_ref() failed.");
+    lua_pop(L, 5);
+
+    net_client_t* client = lua_newuserdata(L, sizeof(net_client_t));
+    client->c = qsf_create_net_client(loop, pool_size);
+    client->L = L;
+    client->read_ref = read_ref;
+    luaL_getmetatable(L, CLIENT_HANDLE);
+    lua_setmetatable(L, -2);
+    qsf_net_set_client_udata(client->c, client);
+    qsf_net_client_set_reconnect(client->c, (reconnect ? min_delay : 0), max_delay);
+    qsf_net_client_set_coalesce(client->c, coalesce);
+    int r = qsf_net_client_connect(client->c, host, port, on_client_read);
+    if (r < 0)
+    {
+        return luaL_error(L, "net.connect failed: %s", uv_strerror(r));
+    }
+    return 1;
+}
+
+static int client_gc(lua_State* L)
+{
+    net_client_t* client = check_client(L);
+    if (client->c)
+    {
+        qsf_net_client_destroy(client->c);
+        client->c = NULL;
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, client->read_ref);
+    client->read_ref = LUA_NOREF;
+    return 0;
+}
+
+static int client_close(lua_State* L)
+{
+    net_client_t* client = check_client(L);
+    luaL_argcheck(L, client->c != NULL, 1, "invalid client object");
+    qsf_net_client_close(client->c);
+    return 0;
+}
+
+// client:write(data [, key]), frames of the same key keep their order
+static int client_write(lua_State* L)
+{
+    net_client_t* client = check_client(L);
+    luaL_argcheck(L, client->c != NULL, 1, "invalid client object");
+    size_t size;
+    const char* data = luaL_checklstring(L, 2, &size);
+    int key = (int)luaL_optinteger(L, 3, 0) - 1;
+    if (size <= UINT16_MAX)
+    {
+        int r = qsf_net_client_write(client->c, key, data, (uint16_t)size);
+        lua_pushboolean(L, r == 0);
+        return 1;
+    }
+    return luaL_error(L, "too big packet to write: %d/%d", size, UINT16_MAX);
+}
+
+static int client_flush(lua_State* L)
+{
+    net_client_t* client = check_client(L);
+    luaL_argcheck(L, client->c != NULL, 1, "invalid client object");
+    qsf_net_client_flush(client->c);
+    return 0;
+}
+
+static int client_size(lua_State* L)
+{
+    net_client_t* client = check_client(L);
+    luaL_argcheck(L, client->c != NULL, 1, "invalid client object");
+    lua_pushinteger(L, qsf_net_client_size(client->c));
+    return 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// forward interface of backend nodes
+
+// net.forward(gateway, session [, data]), write to a session bound to this node,
+// nil `data` kicks the session. `session` is as returned by `net.unpackForward`.
+static int forward_write(lua_State* L)
+{
+    qsf_node_t* node = get_node(L);
+    size_t len = 0;
+    size_t size = 0;
+    const char* gateway = luaL_checklstring(L, 1, &len);
+    lua_Integer session = luaL_checkinteger(L, 2);
+    const char* data = luaL_optlstring(L, 3, NULL, &size);
+    if (size > UINT16_MAX)
+    {
+        return luaL_error(L, "too big packet to write: %d/%d", size, UINT16_MAX);
+    }
+    luaL_Buffer b;
+    char* buf = luaL_buffinitsize(L, &b, NET_FORWARD_HEADER + size);
+    forward_pack(buf, (data ? NET_FORWARD_WRITE : NET_FORWARD_KICK),
+        (uint16_t)(session >> 32), (uint32_t)session);
+    if (data)
+    {
+        memcpy(buf + NET_FORWARD_HEADER, data, size);
+    }
+    qsf_node_send(node, gateway, (int)len, buf, (int)(NET_FORWARD_HEADER + size));
+    return 0;
+}
+
+// net.unpackForward(message), returns 'data'|'close', session, content
+static int forward_unpack_message(lua_State* L)
+{
+    size_t size = 0;
+    const char* data = luaL_checklstring(L, 1, &size);
+    uint16_t server = 0;
+    uint32_t serial = 0;
+    int type = forward_unpack(data, (int)size, &server, &serial);
+    if (type == NET_FORWARD_DATA)
+    {
+        lua_pushliteral(L, "data");
+        lua_pushinteger(L, FORWARD_SESSION(server, serial));
+        lua_pushlstring(L, data + NET_FORWARD_HEADER, size - NET_FORWARD_HEADER);
+        return 3;
+    }
+    else if (type == NET_FORWARD_CLOSE)
+    {
+        lua_pushliteral(L, "close");
+        lua_pushinteger(L, FORWARD_SESSION(server, serial));
+        return 2;
+    }
+    return 0;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // net interface 
 
 static void make_meta(lua_State* L)
 {
+    static const luaL_Reg client_lib[] =
+    {
+        { "__gc", client_gc },
+        { "close", client_close },
+        { "write", client_write },
+        { "flush", client_flush },
+        { "size", client_size },
+        { NULL, NULL },
+    };
+    static const luaL_Reg udp_lib[] =
+    {
+        { "__gc", udp_gc },
+        { "start", udp_start },
+        { "connect", udp_connect },
+        { "stop", udp_stop },
+        { "write", udp_write },
+        { "pending", udp_pending },
+        { "kick", udp_close },
+        { "size", udp_size },
+        { "setNoDelay", udp_set_nodelay },
+        { "setWindow", udp_set_window },
+        { "setMinRto", udp_set_min_rto },
+        { "setLoss", udp_set_loss },
+        { NULL, NULL },
+    };
+    luaL_newmetatable(L, UDP_HANDLE);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, udp_lib, 0);
+    lua_pop(L, 1);  /* pop new metatable */
+
+    static const luaL_Reg http_lib[] =
+    {
+        { "__gc", http_gc },
+        { "start", http_start },
+        { "stop", http_stop },
+        { "respond", http_respond },
+        { "size", http_size },
+        { "setMaxBody", http_set_max_body },
+        { NULL, NULL },
+    };
+    luaL_newmetatable(L, HTTP_HANDLE);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, http_lib, 0);
+    lua_pop(L, 1);  /* pop new metatable */
+
+    luaL_newmetatable(L, CLIENT_HANDLE);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, client_lib, 0);
+    lua_pop(L, 1);  /* pop new metatable */
+
+    static const luaL_Reg cipher_lib[] =
+    {
+        { "__gc", cipher_gc },
+        { "encrypt", cipher_encrypt },
+        { "decrypt", cipher_decrypt },
+        { NULL, NULL },
+    };
+    luaL_newmetatable(L, CIPHER_HANDLE);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, cipher_lib, 0);
+    lua_pop(L, 1);  /* pop new metatable */
+
     static const luaL_Reg lib[] =
     {
         { "__gc", server_gc },
@@ -186,10 +1225,23 @@ static void make_meta(lua_State* L)
         { "stop", server_stop },
         { "write", server_write },
         { "broadcast", server_broadcast },
+        { "joinGroup", server_join_group },
+        { "leaveGroup", server_leave_group },
+        { "multicast", server_multicast },
+        { "groupSize", server_group_size },
         { "shutdown", server_shutdown},
         { "kick", server_close },
         { "addressOf", server_address_of},
         { "size", server_size },
+        { "stats", server_stats },
+        { "resetStats", server_reset_stats },
+        { "setSendLimit", server_set_send_limit },
+        { "pending", server_pending },
+        { "setRateLimit", server_set_rate_limit },
+        { "setCompress", server_set_compress },
+        { "compress", server_compress },
+        { "setCipher", server_set_cipher },
+        { "bindSession", server_bind_session },
         { NULL, NULL },
     };
     luaL_newmetatable(L, SERVER_HANDLE);
@@ -204,6 +1256,12 @@ LUALIB_API int luaopen_net(lua_State* L)
     static const luaL_Reg lib[] = 
     {
         { "createServer", create_server },
+        { "connect", client_connect },
+        { "createUdp", create_udp },
+        { "createHttpServer", create_http },
+        { "createCipher", create_cipher },
+        { "forward", forward_write },
+        { "unpackForward", forward_unpack_message },
         {NULL, NULL}
     };
     luaL_newlibtable(L, lib);
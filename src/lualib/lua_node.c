@@ -3,10 +3,12 @@
 // See accompanying files LICENSE.
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include "qsf.h"
+#include "qsf_profile.h"
 
 
 // Send message to a named node
@@ -106,6 +108,249 @@ static int node_run(lua_State* L)
     return 0;
 }
 
+static void set_field(lua_State* L, const char* name, uint64_t value)
+{
+    lua_pushinteger(L, (lua_Integer)value);
+    lua_setfield(L, -2, name);
+}
+
+// times are in microseconds
+static void push_stats(lua_State* L, const qsf_node_stats_t* stats)
+{
+    static const char* const kinds[] = { "other", "timer", "net", "message" };
+    lua_createtable(L, 0, 8);
+    lua_pushstring(L, stats->name);
+    lua_setfield(L, -2, "name");
+    set_field(L, "loops", stats->loop_count);
+    set_field(L, "idleTime", stats->idle_time / 1000);
+    set_field(L, "memory", stats->lua_memory);
+    set_field(L, "errors", stats->call_errors);
+
+    lua_createtable(L, 0, 5);
+    set_field(L, "last", stats->lag_last);
+    set_field(L, "max", stats->lag_max);
+    set_field(L, "avg", stats->lag_samples ? stats->lag_total / stats->lag_samples : 0);
+    lua_createtable(L, QSF_LAG_BUCKETS, 0);
+    for (int i = 0; i < QSF_LAG_BUCKETS; i++)
+    {
+        lua_pushinteger(L, (lua_Integer)stats->lag_histogram[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "histogram");
+    lua_setfield(L, -2, "lag");
+
+    lua_createtable(L, 0, QSF_CALL_KINDS);
+    for (int i = 0; i < QSF_CALL_KINDS; i++)
+    {
+        lua_createtable(L, 0, 3);
+        set_field(L, "count", stats->call_count[i]);
+        set_field(L, "time", stats->call_time[i] / 1000);
+        set_field(L, "max", stats->call_max[i] / 1000);
+        lua_setfield(L, -2, kinds[i]);
+    }
+    lua_setfield(L, -2, "calls");
+}
+
+// node.stats([name]), counters of current or another node
+static int node_stats(lua_State* L)
+{
+    qsf_node_t* self = lua_touserdata(L, lua_upvalueindex(1));
+    if (!qsf_node_check_tag(self))
+    {
+        return luaL_error(L, "invalid node object");
+    }
+    qsf_node_stats_t stats;
+    if (lua_isnoneornil(L, 1))
+    {
+        qsf_node_stats(self, &stats);
+    }
+    else if (qsf_node_query_stats(luaL_checkstring(L, 1), &stats) != 0)
+    {
+        return 0;
+    }
+    push_stats(L, &stats);
+    return 1;
+}
+
+// node.allStats(), name to counters of all nodes
+static int node_all_stats(lua_State* L)
+{
+    int max = qsf_node_count() + 8; // nodes may be launched meanwhile
+    qsf_node_stats_t* all = lua_newuserdata(L, sizeof(qsf_node_stats_t) * max);
+    int count = qsf_node_collect_stats(all, max);
+    lua_createtable(L, 0, count);
+    for (int i = 0; i < count; i++)
+    {
+        push_stats(L, &all[i]);
+        lua_setfield(L, -2, all[i].name);
+    }
+    return 1;
+}
+
+static void add_stack(const char* stack, size_t len, uint64_t count, void* ud)
+{
+    luaL_Buffer* b = ud;
+    luaL_addlstring(b, stack, len);
+    lua_pushfstring(b->L, " %I\n", (lua_Integer)count);
+    luaL_addvalue(b);
+}
+
+// node.profile('start' [, hz]), sample lua stacks of current node
+// node.profile('stop'), returns samples and dropped samples
+// node.profile('dump' [, path]), folded stacks as string or written to file
+static int node_profile(lua_State* L)
+{
+    static const char* const actions[] = { "start", "stop", "dump", NULL };
+    qsf_node_t* self = lua_touserdata(L, lua_upvalueindex(1));
+    if (!qsf_node_check_tag(self))
+    {
+        return luaL_error(L, "invalid node object");
+    }
+    qsf_profile_t* profile = qsf_node_profile(self);
+    int action = luaL_checkoption(L, 1, NULL, actions);
+    if (action == 0)
+    {
+        int hz = (int)luaL_optinteger(L, 2, QSF_PROFILE_DEFAULT_HZ);
+        luaL_argcheck(L, qsf_profile_start(profile, L, hz) == 0, 2, "invalid frequency");
+        return 0;
+    }
+    else if (action == 1)
+    {
+        uint64_t dropped = 0;
+        qsf_profile_stop(profile, L);
+        lua_pushinteger(L, (lua_Integer)qsf_profile_samples(profile, &dropped));
+        lua_pushinteger(L, (lua_Integer)dropped);
+        return 2;
+    }
+    if (lua_isnoneornil(L, 2))
+    {
+        luaL_Buffer b;
+        luaL_buffinit(L, &b);
+        qsf_profile_foreach(profile, add_stack, &b);
+        luaL_pushresult(&b);
+        return 1;
+    }
+    const char* path = luaL_checkstring(L, 2);
+    if (qsf_profile_write(profile, path) != 0)
+    {
+        return luaL_error(L, "cannot write profile to %s", path);
+    }
+    return 0;
+}
+
+// node.trace(name), begin a traced span, returns trace id or nil if disabled
+// node.trace(false), end traced span in progress
+static int node_trace(lua_State* L)
+{
+    qsf_node_t* self = lua_touserdata(L, lua_upvalueindex(1));
+    if (!qsf_node_check_tag(self))
+    {
+        return luaL_error(L, "invalid node object");
+    }
+    if (lua_isboolean(L, 1) && !lua_toboolean(L, 1))
+    {
+        qsf_node_trace_end(self);
+        return 0;
+    }
+    uint64_t id = qsf_node_trace_begin(self, luaL_checkstring(L, 1));
+    if (id == 0)
+    {
+        return 0;
+    }
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)id);
+    lua_pushstring(L, buf);
+    return 1;
+}
+
+#define LOG_SITES       "qsf_log_sites"
+#define LOG_ARGS_SIZE   1024
+
+static int encode_value(char* buf, int size, char tag, const void* value, int len)
+{
+    if (size + 5 + len > LOG_ARGS_SIZE)
+    {
+        return size;
+    }
+    buf[size++] = tag;
+    if (tag == QSF_LOG_ARG_STRING)
+    {
+        uint32_t n = (uint32_t)len;
+        memcpy(buf + size, &n, sizeof(n));
+        size += sizeof(n);
+    }
+    memcpy(buf + size, value, len);
+    return size + len;
+}
+
+// node.log(level, fmt, ...), structured log of a constant printf format,
+// arguments are formatted by log writer thread.
+static int node_log(lua_State* L)
+{
+    int level = (int)luaL_checkinteger(L, 1);
+    if (level < qsf_log_level)
+    {
+        return 0;
+    }
+    const char* fmt = luaL_checkstring(L, 2);
+    lua_getfield(L, LUA_REGISTRYINDEX, LOG_SITES);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    qsf_log_site_t* site = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (site == NULL)
+    {
+        site = qsf_log_register("lua", 0, level, fmt);
+        if (site == NULL)
+        {
+            return 0; // too many sites
+        }
+        lua_pushvalue(L, 2);
+        lua_pushlightuserdata(L, site);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+
+    char buf[LOG_ARGS_SIZE];
+    int size = 0;
+    int top = lua_gettop(L);
+    for (int i = 3; i <= top; i++)
+    {
+        if (lua_isinteger(L, i))
+        {
+            int64_t value = (int64_t)lua_tointeger(L, i);
+            size = encode_value(buf, size, QSF_LOG_ARG_INT, &value, sizeof(value));
+        }
+        else if (lua_type(L, i) == LUA_TNUMBER)
+        {
+            double value = (double)lua_tonumber(L, i);
+            size = encode_value(buf, size, QSF_LOG_ARG_FLOAT, &value, sizeof(value));
+        }
+        else
+        {
+            size_t len = 0;
+            const char* str = luaL_tolstring(L, i, &len);
+            len = QSF_MIN(len, LOG_ARGS_SIZE / 2);
+            size = encode_value(buf, size, QSF_LOG_ARG_STRING, str, (int)len);
+            lua_pop(L, 1);
+        }
+    }
+    qsf_slog_encoded(site, buf, size);
+    return 0;
+}
+
+// node.logLevel([level]), returns previous level
+static int node_log_level(lua_State* L)
+{
+    int level = qsf_log_level;
+    if (!lua_isnoneornil(L, 1))
+    {
+        qsf_log_set_level((int)luaL_checkinteger(L, 1));
+    }
+    lua_pushinteger(L, level);
+    return 1;
+}
+
 LUALIB_API int luaopen_node(lua_State* L)
 {
     static const luaL_Reg lib[] = 
@@ -115,6 +360,12 @@ LUALIB_API int luaopen_node(lua_State* L)
         { "name", node_name },
         { "run", node_run },
         { "launch", node_launch },
+        { "stats", node_stats },
+        { "allStats", node_all_stats },
+        { "profile", node_profile },
+        { "trace", node_trace },
+        { "log", node_log },
+        { "logLevel", node_log_level },
         {NULL, NULL},
     };
 
@@ -123,5 +374,18 @@ LUALIB_API int luaopen_node(lua_State* L)
     qsf_node_t* self = lua_touserdata(L, -1);
     luaL_argcheck(L, self != NULL, 1, "invalid context pointer");
     luaL_setfuncs(L, lib, 1);
+
+    lua_pushinteger(L, QSF_LOG_DEBUG);
+    lua_setfield(L, -2, "DEBUG");
+    lua_pushinteger(L, QSF_LOG_INFO);
+    lua_setfield(L, -2, "INFO");
+    lua_pushinteger(L, QSF_LOG_WARN);
+    lua_setfield(L, -2, "WARN");
+    lua_pushinteger(L, QSF_LOG_ERROR);
+    lua_setfield(L, -2, "ERROR");
+
+    // format string to registered log site
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, LOG_SITES);
     return 1;
 }
@@ -9,22 +9,79 @@
 
 
 #define LUV_TIMER           "luv_timer*"
-#define check_timer(L, idx) (luv_timer_t*)luaL_checkudata(L, idx, LUV_TIMER)
+#define LUV_TIMER_LIST      "luv_timer_list*"
+#define check_timer(L, idx) (luv_timer_box_t*)luaL_checkudata(L, idx, LUV_TIMER)
 
 
-typedef struct luv_timer_s
+typedef struct luv_timer_s luv_timer_t;
+
+// Lua side handle, cleared when either side goes away first
+typedef struct luv_timer_box_s
+{
+    luv_timer_t* timer;
+}luv_timer_box_t;
+
+// All live timers of one lua state, closed when the state goes away
+typedef struct luv_timer_list_s
 {
-    uv_timer_t  handle;
-    int         ref;
-}luv_timer_t;
+    luv_timer_t* head;
+}luv_timer_list_t;
 
+struct luv_timer_s
+{
+    uv_timer_t          handle;
+    int                 ref;
+    luv_timer_box_t*    box;
+    luv_timer_list_t*   list;
+    luv_timer_t*        prev;
+    luv_timer_t*        next;
+};
+
+
+static void unlink_timer(luv_timer_t* timer)
+{
+    if (timer->list == NULL)
+    {
+        return;
+    }
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        timer->list->head = timer->next;
+    }
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    timer->list = NULL;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
 
 static void on_timer_close(uv_handle_t* handle)
 {
     luv_timer_t* timer = (luv_timer_t*)handle->data;
+    unlink_timer(timer);
+    if (timer->box)
+    {
+        timer->box->timer = NULL;
+    }
     qsf_free(timer);
 }
 
+static void close_timer(lua_State* L, luv_timer_t* timer)
+{
+    luaL_unref(L, LUA_REGISTRYINDEX, timer->ref);
+    timer->ref = LUA_NOREF;
+    if (!uv_is_closing((uv_handle_t*)&timer->handle))
+    {
+        uv_close((uv_handle_t*)&timer->handle, on_timer_close);
+    }
+}
+
 static void timeout_cb(uv_timer_t* handle)
 {
     lua_State* L = luv_state(handle->loop);
@@ -32,18 +89,93 @@ static void timeout_cb(uv_timer_t* handle)
     lua_rawgeti(L, LUA_REGISTRYINDEX, timer->ref);
     if (lua_isfunction(L, -1))
     {
-        qsf_trace_pcall(L, 0);
+        qsf_node_pcall(L, 0, QSF_CALL_TIMER);
     }
     int active = uv_is_active((uv_handle_t*)handle);
     if (active == 0)
     {
-        luaL_unref(L, LUA_REGISTRYINDEX, timer->ref);
+        close_timer(L, timer);
+    }
+}
+
+// Stop a timer and release its callback, safe to call more than once
+static int luv_timer_stop(lua_State* L)
+{
+    luv_timer_box_t* box = check_timer(L, 1);
+    luv_timer_t* timer = box->timer;
+    if (timer && !uv_is_closing((uv_handle_t*)&timer->handle))
+    {
+        uv_timer_stop(&timer->handle);
+        close_timer(L, timer);
+    }
+    return 0;
+}
+
+static int luv_timer_gc(lua_State* L)
+{
+    luv_timer_box_t* box = check_timer(L, 1);
+    if (box->timer)
+    {
+        box->timer->box = NULL;
+        box->timer = NULL;
+    }
+    return 0;
+}
+
+// Runs in lua_close(), the loop frees the timers after the state is gone
+static int luv_timer_list_gc(lua_State* L)
+{
+    luv_timer_list_t* list = luaL_checkudata(L, 1, LUV_TIMER_LIST);
+    while (list->head)
+    {
+        luv_timer_t* timer = list->head;
+        unlink_timer(timer);
         timer->ref = LUA_NOREF;
-        if (!uv_is_closing((uv_handle_t*)handle))
+        if (!uv_is_closing((uv_handle_t*)&timer->handle))
         {
-            uv_close((uv_handle_t*)handle, on_timer_close);
+            uv_timer_stop(&timer->handle);
+            uv_close((uv_handle_t*)&timer->handle, on_timer_close);
         }
     }
+    return 0;
+}
+
+static luv_timer_list_t* get_timer_list(lua_State* L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, LUV_TIMER_LIST);
+    luv_timer_list_t* list = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    qsf_assert(list != NULL, "timer list not registered.");
+    return list;
+}
+
+static void make_timer_meta(lua_State* L)
+{
+    static const luaL_Reg methods[] =
+    {
+        { "stop", luv_timer_stop },
+        { "__gc", luv_timer_gc },
+        { NULL, NULL },
+    };
+    luaL_newmetatable(L, LUV_TIMER);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, methods, 0);
+    lua_pop(L, 1);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LUV_TIMER_LIST);
+    int registered = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (!registered)
+    {
+        luv_timer_list_t* list = lua_newuserdata(L, sizeof(*list));
+        list->head = NULL;
+        luaL_newmetatable(L, LUV_TIMER_LIST);
+        lua_pushcfunction(L, luv_timer_list_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, LUV_TIMER_LIST);
+    }
 }
 
 static int luv_new_timer(lua_State* L) 
@@ -68,8 +200,20 @@ static int luv_new_timer(lua_State* L)
     if (r < 0)
     {
         luaL_unref(L, LUA_REGISTRYINDEX, timer->ref);
-        qsf_free(timer);
+        uv_close((uv_handle_t*)&timer->handle, on_timer_close);
         return luv_error(L, r);
     }
-    return 0;
+    luv_timer_list_t* list = get_timer_list(L);
+    timer->list = list;
+    timer->next = list->head;
+    if (list->head)
+    {
+        list->head->prev = timer;
+    }
+    list->head = timer;
+    luv_timer_box_t* box = lua_newuserdata(L, sizeof(*box));
+    box->timer = timer;
+    timer->box = box;
+    luaL_setmetatable(L, LUV_TIMER);
+    return 1;
 }
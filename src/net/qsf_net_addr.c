@@ -0,0 +1,48 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_addr.h"
+#include <string.h>
+#include <assert.h>
+
+
+const char* qsf_net_pipe_name(const char* host)
+{
+    assert(host);
+    size_t len = sizeof(NET_UNIX_PREFIX) - 1;
+    if (strncmp(host, NET_UNIX_PREFIX, len) == 0)
+    {
+        return host + len;
+    }
+    return NULL;
+}
+
+int qsf_net_resolve(const char* host, int port, struct sockaddr_storage* addr)
+{
+    assert(host && addr);
+    memset(addr, 0, sizeof(*addr));
+    if (strchr(host, ':') != NULL) // IPv6 literal, brackets are optional
+    {
+        char buf[64];
+        size_t len = strlen(host);
+        if (host[0] == '[' && len > 2 && host[len - 1] == ']' && len - 2 < sizeof(buf))
+        {
+            memcpy(buf, host + 1, len - 2);
+            buf[len - 2] = '\0';
+            host = buf;
+        }
+        return uv_ip6_addr(host, port, (struct sockaddr_in6*)addr);
+    }
+    return uv_ip4_addr(host, port, (struct sockaddr_in*)addr);
+}
+
+int qsf_net_addr_name(const struct sockaddr_storage* addr, char* name, int length)
+{
+    assert(addr && name && length > 0);
+    if (addr->ss_family == AF_INET6)
+    {
+        return uv_ip6_name((const struct sockaddr_in6*)addr, name, length);
+    }
+    return uv_ip4_name((const struct sockaddr_in*)addr, name, length);
+}
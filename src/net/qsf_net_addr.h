@@ -0,0 +1,27 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <uv.h>
+
+// host prefix of unix domain socket (named pipe on windows)
+#define NET_UNIX_PREFIX     "unix:"
+
+// stream handle of a tcp or pipe endpoint
+typedef union net_stream_u
+{
+    uv_stream_t stream;
+    uv_tcp_t    tcp;
+    uv_pipe_t   pipe;
+}net_stream_t;
+
+// path of `unix:/path` host, NULL if not an unix domain socket
+const char* qsf_net_pipe_name(const char* host);
+
+// parse IPv4 or IPv6 host
+int qsf_net_resolve(const char* host, int port, struct sockaddr_storage* addr);
+
+// printable host of an IPv4 or IPv6 address
+int qsf_net_addr_name(const struct sockaddr_storage* addr, char* name, int length);
@@ -0,0 +1,869 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_arq.h"
+#include <string.h>
+#include <assert.h>
+#include "qsf.h"
+
+#define ARQ_CMD_PUSH        81      // data segment
+#define ARQ_CMD_ACK         82      // acknowledgement
+#define ARQ_CMD_WASK        83      // ask remote window size
+#define ARQ_CMD_WINS        84      // tell local window size
+
+#define ARQ_ASK_SEND        1       // need to send ARQ_CMD_WASK
+#define ARQ_ASK_TELL        2       // need to send ARQ_CMD_WINS
+
+#define ARQ_RTO_NODELAY     30      // minimal RTO of nodelay mode
+#define ARQ_RTO_MIN         100     // normal minimal RTO
+#define ARQ_RTO_DEFAULT     200
+#define ARQ_RTO_MAX         60000
+#define ARQ_THRESH_INIT     2
+#define ARQ_THRESH_MIN      2
+#define ARQ_PROBE_INIT      7000    // first window probe delay
+#define ARQ_PROBE_LIMIT     120000  // maximal window probe delay
+#define ARQ_DEAD_LINK       20      // retransmissions to give up
+#define ARQ_MAX_FRAGMENTS   255
+#define ARQ_MIN_RCVWND      (ARQ_MAX_FRAGMENTS / 4) // smallest window of any peer
+
+// signed distance of sequence numbers or timestamps, wrap around safe
+#define ARQ_DIFF(later, earlier)    ((int32_t)((later) - (earlier)))
+
+// circular doubly linked list
+typedef struct arq_list_s
+{
+    struct arq_list_s*  prev;
+    struct arq_list_s*  next;
+}arq_list_t;
+
+typedef struct arq_segment_s
+{
+    arq_list_t  node;       // must be the first member
+    uint32_t    conv;
+    uint32_t    cmd;
+    uint32_t    frg;
+    uint32_t    wnd;
+    uint32_t    ts;
+    uint32_t    sn;
+    uint32_t    una;
+    uint32_t    len;
+    uint32_t    resendts;   // time to retransmit
+    uint32_t    rto;        // retransmission timeout of this segment
+    uint32_t    fastack;    // acks of later segments
+    uint32_t    xmit;       // transmission count
+    char        data[];
+}arq_segment_t;
+
+struct qsf_net_arq_s
+{
+    uint32_t    conv;           // conversation id
+    uint32_t    mtu;            // maximal datagram size
+    uint32_t    mss;            // maximal segment content size
+    uint32_t    snd_una;        // first unacknowledged sn
+    uint32_t    snd_nxt;        // next sn to send
+    uint32_t    rcv_nxt;        // next sn to receive
+    uint32_t    ssthresh;       // slow start threshold
+    int32_t     rx_rttval;      // RTT variation
+    int32_t     rx_srtt;        // smoothed RTT
+    int32_t     rx_rto;         // retransmission timeout
+    int32_t     rx_minrto;      // minimal RTO
+    uint32_t    snd_wnd;        // local send window
+    uint32_t    rcv_wnd;        // local receive window
+    uint32_t    rmt_wnd;        // remote receive window
+    uint32_t    rmt_max_wnd;    // largest window remote advertised
+    uint32_t    cwnd;           // congestion window
+    uint32_t    incr;           // congestion window bytes
+    uint32_t    probe;          // ARQ_ASK_* flags
+    uint32_t    current;        // current clock
+    uint32_t    interval;       // flush interval
+    uint32_t    ts_flush;       // next flush time
+    uint32_t    ts_probe;       // next window probe time
+    uint32_t    probe_wait;     // window probe delay
+    uint32_t    nodelay;        // nodelay mode
+    uint32_t    updated;        // update called once
+    uint32_t    fastresend;     // duplicated acks to fast retransmit
+    uint32_t    nocwnd;         // ignore congestion window
+    int         dead;           // retransmitted too many times
+    uint32_t    nsnd_que;       // segments in snd_queue
+    uint32_t    nrcv_que;       // segments in rcv_queue
+    uint32_t    nsnd_buf;       // segments in snd_buf
+    arq_list_t  snd_queue;      // segments not sent yet
+    arq_list_t  snd_buf;        // segments sent but not acknowledged
+    arq_list_t  rcv_queue;      // ordered segments to be read
+    arq_list_t  rcv_buf;        // out of order segments
+    uint32_t*   acklist;        // pending acks, (sn, ts) pairs
+    uint32_t    ackcount;       // pending ack count
+    uint32_t    ackcapacity;    // ack pairs of `acklist`
+    char*       buffer;         // datagram being built
+    arq_output_cb output;       // datagram output
+    void*       udata;          // output user data
+};
+
+
+static void list_init(arq_list_t* head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+static int list_empty(const arq_list_t* head)
+{
+    return head->next == head;
+}
+
+// insert `node` before `pos`
+static void list_insert(arq_list_t* node, arq_list_t* pos)
+{
+    node->next = pos;
+    node->prev = pos->prev;
+    pos->prev->next = node;
+    pos->prev = node;
+}
+
+static void list_remove(arq_list_t* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static arq_segment_t* segment_create(uint32_t size)
+{
+    arq_segment_t* seg = qsf_malloc(sizeof(arq_segment_t) + size);
+    memset(seg, 0, sizeof(arq_segment_t));
+    seg->len = size;
+    return seg;
+}
+
+static void list_free(arq_list_t* head)
+{
+    while (!list_empty(head))
+    {
+        arq_list_t* node = head->next;
+        list_remove(node);
+        qsf_free(node);
+    }
+}
+
+static char* encode32(char* p, uint32_t v)
+{
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+    return p + 4;
+}
+
+static const char* decode32(const char* p, uint32_t* v)
+{
+    const uint8_t* u = (const uint8_t*)p;
+    *v = ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+    return p + 4;
+}
+
+static char* encode_segment(char* p, const arq_segment_t* seg)
+{
+    p = encode32(p, seg->conv);
+    *p++ = (char)seg->cmd;
+    *p++ = (char)seg->frg;
+    *p++ = (char)(seg->wnd >> 8);
+    *p++ = (char)seg->wnd;
+    p = encode32(p, seg->ts);
+    p = encode32(p, seg->sn);
+    p = encode32(p, seg->una);
+    p = encode32(p, seg->len);
+    return p;
+}
+
+qsf_net_arq_t* qsf_create_net_arq(uint32_t conv, arq_output_cb output, void* ud)
+{
+    assert(output);
+    qsf_net_arq_t* a = qsf_malloc(sizeof(qsf_net_arq_t));
+    memset(a, 0, sizeof(*a));
+    a->conv = conv;
+    a->output = output;
+    a->udata = ud;
+    a->mtu = NET_ARQ_DEFAULT_MTU;
+    a->mss = a->mtu - NET_ARQ_HEADER;
+    a->snd_wnd = NET_ARQ_DEFAULT_SNDWND;
+    a->rcv_wnd = NET_ARQ_DEFAULT_RCVWND;
+    a->rmt_wnd = NET_ARQ_DEFAULT_RCVWND;
+    a->rmt_max_wnd = ARQ_MIN_RCVWND;
+    a->rx_rto = ARQ_RTO_DEFAULT;
+    a->rx_minrto = ARQ_RTO_MIN;
+    a->interval = NET_ARQ_DEFAULT_INTERVAL;
+    a->ts_flush = NET_ARQ_DEFAULT_INTERVAL;
+    a->ssthresh = ARQ_THRESH_INIT;
+    a->cwnd = 1;
+    a->incr = a->mss;
+    a->buffer = qsf_malloc((a->mtu + NET_ARQ_HEADER) * 3);
+    list_init(&a->snd_queue);
+    list_init(&a->snd_buf);
+    list_init(&a->rcv_queue);
+    list_init(&a->rcv_buf);
+    return a;
+}
+
+void qsf_net_arq_destroy(qsf_net_arq_t* a)
+{
+    assert(a);
+    list_free(&a->snd_queue);
+    list_free(&a->snd_buf);
+    list_free(&a->rcv_queue);
+    list_free(&a->rcv_buf);
+    qsf_free(a->acklist);
+    qsf_free(a->buffer);
+    qsf_free(a);
+}
+
+void qsf_net_arq_set_nodelay(qsf_net_arq_t* a,
+                             int nodelay,
+                             int interval,
+                             int resend,
+                             int nocwnd)
+{
+    assert(a);
+    if (nodelay >= 0)
+    {
+        a->nodelay = nodelay;
+        a->rx_minrto = (nodelay ? ARQ_RTO_NODELAY : ARQ_RTO_MIN);
+    }
+    if (interval >= 0)
+    {
+        a->interval = QSF_MIN(QSF_MAX(interval, 10), 5000);
+    }
+    if (resend >= 0)
+    {
+        a->fastresend = resend;
+    }
+    if (nocwnd >= 0)
+    {
+        a->nocwnd = nocwnd;
+    }
+}
+
+void qsf_net_arq_set_window(qsf_net_arq_t* a, int snd_wnd, int rcv_wnd)
+{
+    assert(a);
+    if (snd_wnd > 0)
+    {
+        a->snd_wnd = snd_wnd;
+    }
+    if (rcv_wnd > 0) // peers never split a message beyond it
+    {
+        a->rcv_wnd = QSF_MAX(rcv_wnd, ARQ_MIN_RCVWND);
+    }
+}
+
+void qsf_net_arq_set_min_rto(qsf_net_arq_t* a, int min_rto)
+{
+    assert(a);
+    if (min_rto > 0)
+    {
+        a->rx_minrto = min_rto;
+    }
+}
+
+int qsf_net_arq_send(qsf_net_arq_t* a, const char* data, int size)
+{
+    assert(a && data);
+    if (size <= 0)
+    {
+        return -1;
+    }
+    // fragments of a message must fit in remote receive window at once,
+    // which is known to be at least the largest window it advertised
+    int count = (size + a->mss - 1) / a->mss;
+    if (count > (int)QSF_MIN(ARQ_MAX_FRAGMENTS, a->rmt_max_wnd))
+    {
+        return -2;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int len = QSF_MIN(size, (int)a->mss);
+        arq_segment_t* seg = segment_create(len);
+        memcpy(seg->data, data, len);
+        seg->frg = count - i - 1;
+        list_insert(&seg->node, &a->snd_queue);
+        a->nsnd_que++;
+        data += len;
+        size -= len;
+    }
+    return 0;
+}
+
+// RFC 6298 RTO estimation
+static void update_ack(qsf_net_arq_t* a, int32_t rtt)
+{
+    if (a->rx_srtt == 0)
+    {
+        a->rx_srtt = rtt;
+        a->rx_rttval = rtt / 2;
+    }
+    else
+    {
+        int32_t delta = (rtt > a->rx_srtt ? rtt - a->rx_srtt : a->rx_srtt - rtt);
+        a->rx_rttval = (3 * a->rx_rttval + delta) / 4;
+        a->rx_srtt = (7 * a->rx_srtt + rtt) / 8;
+        if (a->rx_srtt < 1)
+        {
+            a->rx_srtt = 1;
+        }
+    }
+    int32_t rto = a->rx_srtt + QSF_MAX((int32_t)a->interval, 4 * a->rx_rttval);
+    a->rx_rto = QSF_MIN(QSF_MAX(a->rx_minrto, rto), ARQ_RTO_MAX);
+}
+
+static void shrink_buf(qsf_net_arq_t* a)
+{
+    if (!list_empty(&a->snd_buf))
+    {
+        a->snd_una = ((arq_segment_t*)a->snd_buf.next)->sn;
+    }
+    else
+    {
+        a->snd_una = a->snd_nxt;
+    }
+}
+
+static void parse_ack(qsf_net_arq_t* a, uint32_t sn)
+{
+    if (ARQ_DIFF(sn, a->snd_una) < 0 || ARQ_DIFF(sn, a->snd_nxt) >= 0)
+    {
+        return;
+    }
+    for (arq_list_t* p = a->snd_buf.next; p != &a->snd_buf; p = p->next)
+    {
+        arq_segment_t* seg = (arq_segment_t*)p;
+        if (sn == seg->sn)
+        {
+            list_remove(p);
+            qsf_free(seg);
+            a->nsnd_buf--;
+            break;
+        }
+        if (ARQ_DIFF(sn, seg->sn) < 0)
+        {
+            break;
+        }
+    }
+}
+
+static void parse_una(qsf_net_arq_t* a, uint32_t una)
+{
+    while (!list_empty(&a->snd_buf))
+    {
+        arq_segment_t* seg = (arq_segment_t*)a->snd_buf.next;
+        if (ARQ_DIFF(una, seg->sn) <= 0)
+        {
+            break;
+        }
+        list_remove(&seg->node);
+        qsf_free(seg);
+        a->nsnd_buf--;
+    }
+}
+
+static void parse_fastack(qsf_net_arq_t* a, uint32_t sn)
+{
+    if (ARQ_DIFF(sn, a->snd_una) < 0 || ARQ_DIFF(sn, a->snd_nxt) >= 0)
+    {
+        return;
+    }
+    for (arq_list_t* p = a->snd_buf.next; p != &a->snd_buf; p = p->next)
+    {
+        arq_segment_t* seg = (arq_segment_t*)p;
+        if (ARQ_DIFF(sn, seg->sn) < 0)
+        {
+            break;
+        }
+        else if (sn != seg->sn)
+        {
+            seg->fastack++;
+        }
+    }
+}
+
+static void ack_push(qsf_net_arq_t* a, uint32_t sn, uint32_t ts)
+{
+    if (a->ackcount == a->ackcapacity)
+    {
+        uint32_t capacity = QSF_MAX(a->ackcapacity * 2, 16);
+        uint32_t* acklist = qsf_malloc(capacity * 2 * sizeof(uint32_t));
+        if (a->acklist)
+        {
+            memcpy(acklist, a->acklist, a->ackcount * 2 * sizeof(uint32_t));
+            qsf_free(a->acklist);
+        }
+        a->acklist = acklist;
+        a->ackcapacity = capacity;
+    }
+    a->acklist[a->ackcount * 2] = sn;
+    a->acklist[a->ackcount * 2 + 1] = ts;
+    a->ackcount++;
+}
+
+// move in-order segments from rcv_buf to rcv_queue
+static void move_ready(qsf_net_arq_t* a)
+{
+    while (!list_empty(&a->rcv_buf))
+    {
+        arq_segment_t* seg = (arq_segment_t*)a->rcv_buf.next;
+        if (seg->sn != a->rcv_nxt || a->nrcv_que >= a->rcv_wnd)
+        {
+            break;
+        }
+        list_remove(&seg->node);
+        list_insert(&seg->node, &a->rcv_queue);
+        a->nrcv_que++;
+        a->rcv_nxt++;
+    }
+}
+
+static void parse_data(qsf_net_arq_t* a, arq_segment_t* newseg)
+{
+    uint32_t sn = newseg->sn;
+    if (ARQ_DIFF(sn, a->rcv_nxt + a->rcv_wnd) >= 0 || ARQ_DIFF(sn, a->rcv_nxt) < 0)
+    {
+        qsf_free(newseg);
+        return;
+    }
+    // rcv_buf is sorted by sn, search backward since segments mostly come in order
+    arq_list_t* p = a->rcv_buf.prev;
+    for (; p != &a->rcv_buf; p = p->prev)
+    {
+        arq_segment_t* seg = (arq_segment_t*)p;
+        if (seg->sn == sn) // duplicated
+        {
+            qsf_free(newseg);
+            return;
+        }
+        if (ARQ_DIFF(sn, seg->sn) > 0)
+        {
+            break;
+        }
+    }
+    list_insert(&newseg->node, p->next);
+    move_ready(a);
+}
+
+int qsf_net_arq_input(qsf_net_arq_t* a, const char* data, int size)
+{
+    assert(a && data);
+    uint32_t prev_una = a->snd_una;
+    uint32_t maxack = 0;
+    int has_ack = 0;
+    if (size < NET_ARQ_HEADER)
+    {
+        return -1;
+    }
+    while (size >= NET_ARQ_HEADER)
+    {
+        uint32_t conv, ts, sn, una, len;
+        const uint8_t* u = (const uint8_t*)data;
+        data = decode32(data, &conv);
+        uint32_t cmd = u[4];
+        uint32_t frg = u[5];
+        uint32_t wnd = ((uint32_t)u[6] << 8) | u[7];
+        data += 4;
+        data = decode32(data, &ts);
+        data = decode32(data, &sn);
+        data = decode32(data, &una);
+        data = decode32(data, &len);
+        size -= NET_ARQ_HEADER;
+        if (conv != a->conv)
+        {
+            return -1;
+        }
+        if ((int)len > size || len > a->mss)
+        {
+            return -2;
+        }
+        if (cmd != ARQ_CMD_PUSH && cmd != ARQ_CMD_ACK &&
+            cmd != ARQ_CMD_WASK && cmd != ARQ_CMD_WINS)
+        {
+            return -3;
+        }
+        a->rmt_wnd = wnd;
+        if (wnd > a->rmt_max_wnd)
+        {
+            a->rmt_max_wnd = wnd;
+        }
+        parse_una(a, una);
+        shrink_buf(a);
+        if (cmd == ARQ_CMD_ACK)
+        {
+            if (ARQ_DIFF(a->current, ts) >= 0)
+            {
+                update_ack(a, ARQ_DIFF(a->current, ts));
+            }
+            parse_ack(a, sn);
+            shrink_buf(a);
+            if (!has_ack || ARQ_DIFF(sn, maxack) > 0)
+            {
+                has_ack = 1;
+                maxack = sn;
+            }
+        }
+        else if (cmd == ARQ_CMD_PUSH)
+        {
+            if (frg >= a->rcv_wnd) // message could never be reassembled
+            {
+                return -4;
+            }
+            if (ARQ_DIFF(sn, a->rcv_nxt + a->rcv_wnd) < 0)
+            {
+                ack_push(a, sn, ts);
+                if (ARQ_DIFF(sn, a->rcv_nxt) >= 0)
+                {
+                    arq_segment_t* seg = segment_create(len);
+                    seg->conv = conv;
+                    seg->cmd = cmd;
+                    seg->frg = frg;
+                    seg->wnd = wnd;
+                    seg->ts = ts;
+                    seg->sn = sn;
+                    seg->una = una;
+                    memcpy(seg->data, data, len);
+                    parse_data(a, seg);
+                }
+            }
+        }
+        else if (cmd == ARQ_CMD_WASK)
+        {
+            a->probe |= ARQ_ASK_TELL;
+        }
+        data += len;
+        size -= len;
+    }
+    if (has_ack)
+    {
+        parse_fastack(a, maxack);
+    }
+    // grow congestion window
+    if (ARQ_DIFF(a->snd_una, prev_una) > 0 && a->cwnd < a->rmt_wnd)
+    {
+        uint32_t mss = a->mss;
+        if (a->cwnd < a->ssthresh)
+        {
+            a->cwnd++;
+            a->incr += mss;
+        }
+        else
+        {
+            if (a->incr < mss)
+            {
+                a->incr = mss;
+            }
+            a->incr += (mss * mss) / a->incr + (mss / 16);
+            if ((a->cwnd + 1) * mss <= a->incr)
+            {
+                a->cwnd++;
+            }
+        }
+        if (a->cwnd > a->rmt_wnd)
+        {
+            a->cwnd = a->rmt_wnd;
+            a->incr = a->rmt_wnd * mss;
+        }
+    }
+    return 0;
+}
+
+// size of the first complete message, -1 if not complete
+static int peek_size(qsf_net_arq_t* a)
+{
+    if (list_empty(&a->rcv_queue))
+    {
+        return -1;
+    }
+    arq_segment_t* seg = (arq_segment_t*)a->rcv_queue.next;
+    if (seg->frg == 0)
+    {
+        return seg->len;
+    }
+    if (a->nrcv_que < seg->frg + 1)
+    {
+        return -1;
+    }
+    int size = 0;
+    for (arq_list_t* p = a->rcv_queue.next; p != &a->rcv_queue; p = p->next)
+    {
+        seg = (arq_segment_t*)p;
+        size += seg->len;
+        if (seg->frg == 0)
+        {
+            break;
+        }
+    }
+    return size;
+}
+
+int qsf_net_arq_recv(qsf_net_arq_t* a, char* buf, int capacity)
+{
+    assert(a && buf);
+    int size = peek_size(a);
+    if (size < 0)
+    {
+        return -1;
+    }
+    if (size > capacity)
+    {
+        return -2;
+    }
+    int recover = (a->nrcv_que >= a->rcv_wnd);
+    char* p = buf;
+    while (!list_empty(&a->rcv_queue))
+    {
+        arq_segment_t* seg = (arq_segment_t*)a->rcv_queue.next;
+        uint32_t frg = seg->frg;
+        memcpy(p, seg->data, seg->len);
+        p += seg->len;
+        list_remove(&seg->node);
+        qsf_free(seg);
+        a->nrcv_que--;
+        if (frg == 0)
+        {
+            break;
+        }
+    }
+    move_ready(a);
+    if (recover && a->nrcv_que < a->rcv_wnd) // tell remote our window reopened
+    {
+        a->probe |= ARQ_ASK_TELL;
+    }
+    return size;
+}
+
+static uint32_t wnd_unused(qsf_net_arq_t* a)
+{
+    return (a->nrcv_que < a->rcv_wnd ? a->rcv_wnd - a->nrcv_que : 0);
+}
+
+// output pending bytes of buffer if `extra` bytes cannot be appended
+static char* reserve(qsf_net_arq_t* a, char* ptr, int extra)
+{
+    int used = (int)(ptr - a->buffer);
+    if (used + extra > (int)a->mtu && used > 0)
+    {
+        a->output(a->buffer, used, a->udata);
+        return a->buffer;
+    }
+    return ptr;
+}
+
+void qsf_net_arq_flush(qsf_net_arq_t* a)
+{
+    assert(a);
+    if (!a->updated)
+    {
+        return;
+    }
+    uint32_t current = a->current;
+    char* ptr = a->buffer;
+    arq_segment_t seg;
+    memset(&seg, 0, sizeof(seg));
+    seg.conv = a->conv;
+    seg.cmd = ARQ_CMD_ACK;
+    seg.wnd = wnd_unused(a);
+    seg.una = a->rcv_nxt;
+
+    // acknowledgements
+    for (uint32_t i = 0; i < a->ackcount; i++)
+    {
+        ptr = reserve(a, ptr, NET_ARQ_HEADER);
+        seg.sn = a->acklist[i * 2];
+        seg.ts = a->acklist[i * 2 + 1];
+        ptr = encode_segment(ptr, &seg);
+    }
+    a->ackcount = 0;
+
+    // probe remote window if it is zero
+    if (a->rmt_wnd == 0)
+    {
+        if (a->probe_wait == 0)
+        {
+            a->probe_wait = ARQ_PROBE_INIT;
+            a->ts_probe = current + a->probe_wait;
+        }
+        else if (ARQ_DIFF(current, a->ts_probe) >= 0)
+        {
+            a->probe_wait = QSF_MIN(QSF_MAX(a->probe_wait, ARQ_PROBE_INIT)
+                + a->probe_wait / 2, ARQ_PROBE_LIMIT);
+            a->ts_probe = current + a->probe_wait;
+            a->probe |= ARQ_ASK_SEND;
+        }
+    }
+    else
+    {
+        a->ts_probe = 0;
+        a->probe_wait = 0;
+    }
+    seg.sn = 0;
+    seg.ts = 0;
+    if (a->probe & ARQ_ASK_SEND)
+    {
+        seg.cmd = ARQ_CMD_WASK;
+        ptr = reserve(a, ptr, NET_ARQ_HEADER);
+        ptr = encode_segment(ptr, &seg);
+    }
+    if (a->probe & ARQ_ASK_TELL)
+    {
+        seg.cmd = ARQ_CMD_WINS;
+        ptr = reserve(a, ptr, NET_ARQ_HEADER);
+        ptr = encode_segment(ptr, &seg);
+    }
+    a->probe = 0;
+
+    // move new segments into send window
+    uint32_t cwnd = QSF_MIN(a->snd_wnd, a->rmt_wnd);
+    if (!a->nocwnd)
+    {
+        cwnd = QSF_MIN(a->cwnd, cwnd);
+    }
+    while (ARQ_DIFF(a->snd_nxt, a->snd_una + cwnd) < 0 && !list_empty(&a->snd_queue))
+    {
+        arq_segment_t* newseg = (arq_segment_t*)a->snd_queue.next;
+        list_remove(&newseg->node);
+        list_insert(&newseg->node, &a->snd_buf);
+        a->nsnd_que--;
+        a->nsnd_buf++;
+        newseg->conv = a->conv;
+        newseg->cmd = ARQ_CMD_PUSH;
+        newseg->wnd = seg.wnd;
+        newseg->ts = current;
+        newseg->sn = a->snd_nxt++;
+        newseg->una = a->rcv_nxt;
+        newseg->resendts = current;
+        newseg->rto = a->rx_rto;
+        newseg->fastack = 0;
+        newseg->xmit = 0;
+    }
+
+    // transmit new, timed out and fast retransmitted segments
+    uint32_t resent = (a->fastresend > 0 ? a->fastresend : 0xffffffff);
+    uint32_t rtomin = (a->nodelay == 0 ? (a->rx_rto >> 3) : 0);
+    int change = 0;
+    int lost = 0;
+    for (arq_list_t* p = a->snd_buf.next; p != &a->snd_buf; p = p->next)
+    {
+        arq_segment_t* segment = (arq_segment_t*)p;
+        int needsend = 0;
+        if (segment->xmit == 0)
+        {
+            needsend = 1;
+            segment->xmit++;
+            segment->rto = a->rx_rto;
+            segment->resendts = current + segment->rto + rtomin;
+        }
+        else if (ARQ_DIFF(current, segment->resendts) >= 0)
+        {
+            needsend = 1;
+            segment->xmit++;
+            if (a->nodelay == 0)
+            {
+                segment->rto += QSF_MAX(segment->rto, (uint32_t)a->rx_rto);
+            }
+            else
+            {
+                segment->rto += a->rx_rto / 2;
+            }
+            segment->resendts = current + segment->rto;
+            lost = 1;
+        }
+        else if (segment->fastack >= resent)
+        {
+            needsend = 1;
+            segment->xmit++;
+            segment->fastack = 0;
+            segment->resendts = current + segment->rto;
+            change = 1;
+        }
+        if (needsend)
+        {
+            segment->ts = current;
+            segment->wnd = seg.wnd;
+            segment->una = a->rcv_nxt;
+            ptr = reserve(a, ptr, NET_ARQ_HEADER + segment->len);
+            ptr = encode_segment(ptr, segment);
+            memcpy(ptr, segment->data, segment->len);
+            ptr += segment->len;
+            if (segment->xmit >= ARQ_DEAD_LINK)
+            {
+                a->dead = 1;
+            }
+        }
+    }
+    if (ptr > a->buffer)
+    {
+        a->output(a->buffer, (int)(ptr - a->buffer), a->udata);
+    }
+
+    // shrink congestion window on loss
+    if (change)
+    {
+        uint32_t inflight = a->snd_nxt - a->snd_una;
+        a->ssthresh = QSF_MAX(inflight / 2, ARQ_THRESH_MIN);
+        a->cwnd = a->ssthresh + resent;
+        a->incr = a->cwnd * a->mss;
+    }
+    if (lost)
+    {
+        a->ssthresh = QSF_MAX(a->cwnd / 2, ARQ_THRESH_MIN);
+        a->cwnd = 1;
+        a->incr = a->mss;
+    }
+    if (a->cwnd < 1)
+    {
+        a->cwnd = 1;
+        a->incr = a->mss;
+    }
+}
+
+void qsf_net_arq_update(qsf_net_arq_t* a, uint32_t current)
+{
+    assert(a);
+    a->current = current;
+    if (!a->updated)
+    {
+        a->updated = 1;
+        a->ts_flush = current;
+    }
+    int32_t slap = ARQ_DIFF(current, a->ts_flush);
+    if (slap >= 10000 || slap < -10000) // clock jumped
+    {
+        a->ts_flush = current;
+        slap = 0;
+    }
+    if (slap >= 0)
+    {
+        a->ts_flush += a->interval;
+        if (ARQ_DIFF(current, a->ts_flush) >= 0)
+        {
+            a->ts_flush = current + a->interval;
+        }
+        qsf_net_arq_flush(a);
+    }
+}
+
+int qsf_net_arq_pending(qsf_net_arq_t* a)
+{
+    assert(a);
+    return (int)(a->nsnd_buf + a->nsnd_que);
+}
+
+int qsf_net_arq_is_dead(qsf_net_arq_t* a)
+{
+    assert(a);
+    return a->dead;
+}
+
+uint32_t qsf_net_arq_conv(const char* data, int size)
+{
+    uint32_t conv = 0;
+    if (size >= NET_ARQ_HEADER)
+    {
+        decode32(data, &conv);
+    }
+    return conv;
+}
@@ -0,0 +1,82 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+
+struct qsf_net_arq_s;
+typedef struct qsf_net_arq_s qsf_net_arq_t;
+
+/**
+ *  automatic repeat request over unreliable datagrams, in the spirit of KCP.
+ *
+ *  each datagram holds one or more segments:
+ *
+ *  +------+-----+-----+-----+----+----+-----+-----+---------+
+ *  | conv | cmd | frg | wnd | ts | sn | una | len | content |
+ *  +------+-----+-----+-----+----+----+-----+-----+---------+
+ *     4      1     1     2    4    4    4     4
+ *
+ *  integers are in network order. a message larger than MSS is split into
+ *  fragments, `frg` counts down to zero at the last fragment.
+ *
+ *  the caller feeds received datagrams by `qsf_net_arq_input` and drives
+ *  retransmission by calling `qsf_net_arq_update` every few milliseconds.
+ */
+
+#define NET_ARQ_HEADER          24
+#define NET_ARQ_DEFAULT_MTU     1400
+#define NET_ARQ_DEFAULT_SNDWND  32
+#define NET_ARQ_DEFAULT_RCVWND  128
+#define NET_ARQ_DEFAULT_INTERVAL 100
+
+// output a datagram, (data, size, udata)
+typedef void(*arq_output_cb)(const char*, int, void*);
+
+qsf_net_arq_t* qsf_create_net_arq(uint32_t conv, arq_output_cb output, void* ud);
+
+void qsf_net_arq_destroy(qsf_net_arq_t* a);
+
+// `nodelay` lowers minimal RTO and slows RTO growth, `interval` of flushing
+// in milliseconds, `resend` is duplicated acks to fast retransmit, zero to
+// disable. `nocwnd` ignores congestion window.
+void qsf_net_arq_set_nodelay(qsf_net_arq_t* a,
+                             int nodelay,
+                             int interval,
+                             int resend,
+                             int nocwnd);
+
+// send and receive window in segments
+void qsf_net_arq_set_window(qsf_net_arq_t* a, int snd_wnd, int rcv_wnd);
+
+// minimal retransmission timeout in milliseconds
+void qsf_net_arq_set_min_rto(qsf_net_arq_t* a, int min_rto);
+
+// queue a message, returns 0 or negative if too big. a message is split
+// into no more fragments than remote receive window can hold.
+int qsf_net_arq_send(qsf_net_arq_t* a, const char* data, int size);
+
+// feed a received datagram, returns 0 or negative if malformed or if
+// a message has more fragments than local receive window
+int qsf_net_arq_input(qsf_net_arq_t* a, const char* data, int size);
+
+// pop a complete message into `buf`, returns its size,
+// -1 if none and -2 if `capacity` is too small.
+int qsf_net_arq_recv(qsf_net_arq_t* a, char* buf, int capacity);
+
+// update clock in milliseconds, flush acks and due segments
+void qsf_net_arq_update(qsf_net_arq_t* a, uint32_t current);
+
+// flush acks and new segments right now
+void qsf_net_arq_flush(qsf_net_arq_t* a);
+
+// segments waiting to be sent or acknowledged
+int qsf_net_arq_pending(qsf_net_arq_t* a);
+
+// non-zero if a segment was retransmitted too many times
+int qsf_net_arq_is_dead(qsf_net_arq_t* a);
+
+// conversation id of a datagram, zero if too short
+uint32_t qsf_net_arq_conv(const char* data, int size);
@@ -0,0 +1,185 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_cipher.h"
+#include <string.h>
+#include <assert.h>
+#include <openssl/evp.h>
+#include "qsf.h"
+
+#define GCM_NONCE_SIZE  12
+
+struct qsf_net_cipher_s
+{
+    int             mode;           // NET_CIPHER_*
+    EVP_CIPHER_CTX* encrypt;        // outbound context
+    EVP_CIPHER_CTX* decrypt;        // inbound context
+    uint64_t        send_seq;       // outbound frame counter
+    uint64_t        recv_seq;       // inbound frame counter
+    uint8_t         send_iv[NET_CIPHER_IV_SIZE];
+    uint8_t         recv_iv[NET_CIPHER_IV_SIZE];
+};
+
+
+static const EVP_CIPHER* select_cipher(int mode, int key_len)
+{
+    if (mode == NET_CIPHER_CTR)
+    {
+        if (key_len == 16)
+            return EVP_aes_128_ctr();
+        if (key_len == 32)
+            return EVP_aes_256_ctr();
+    }
+    else if (mode == NET_CIPHER_GCM)
+    {
+        if (key_len == 16)
+            return EVP_aes_128_gcm();
+        if (key_len == 32)
+            return EVP_aes_256_gcm();
+    }
+    return NULL;
+}
+
+// nonce of frame `seq`: first 12 bytes of direction IV with the big-endian
+// counter xor-ed into its last 8 bytes. a counter never repeats in one
+// direction and IVs of two directions differ in bit 0x80 of first byte,
+// which the counter never reaches, so no nonce is used twice with a key.
+static void make_nonce(const uint8_t* iv, uint64_t seq, uint8_t* nonce)
+{
+    memcpy(nonce, iv, GCM_NONCE_SIZE);
+    for (int i = 0; i < 8; i++)
+    {
+        nonce[GCM_NONCE_SIZE - 1 - i] ^= (uint8_t)(seq >> (i * 8));
+    }
+}
+
+qsf_net_cipher_t* qsf_create_net_cipher(int mode,
+                                        const uint8_t* key,
+                                        int key_len,
+                                        const uint8_t* iv,
+                                        int server_side)
+{
+    assert(key && iv);
+    const EVP_CIPHER* cipher = select_cipher(mode, key_len);
+    if (cipher == NULL)
+    {
+        return NULL;
+    }
+    qsf_net_cipher_t* c = qsf_malloc(sizeof(qsf_net_cipher_t));
+    memset(c, 0, sizeof(*c));
+    c->mode = mode;
+    c->encrypt = EVP_CIPHER_CTX_new();
+    c->decrypt = EVP_CIPHER_CTX_new();
+    memcpy(c->send_iv, iv, NET_CIPHER_IV_SIZE);
+    memcpy(c->recv_iv, iv, NET_CIPHER_IV_SIZE);
+    if (server_side) // server to client direction uses flipped IV
+    {
+        c->send_iv[0] ^= 0x80;
+    }
+    else
+    {
+        c->recv_iv[0] ^= 0x80;
+    }
+    int ok = (c->encrypt != NULL && c->decrypt != NULL);
+    if (ok && mode == NET_CIPHER_CTR)
+    {
+        ok = EVP_EncryptInit_ex(c->encrypt, cipher, NULL, key, c->send_iv) == 1 &&
+             EVP_DecryptInit_ex(c->decrypt, cipher, NULL, key, c->recv_iv) == 1;
+    }
+    else if (ok) // nonce is set per frame
+    {
+        ok = EVP_EncryptInit_ex(c->encrypt, cipher, NULL, key, NULL) == 1 &&
+             EVP_DecryptInit_ex(c->decrypt, cipher, NULL, key, NULL) == 1;
+    }
+    if (!ok)
+    {
+        qsf_net_cipher_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+void qsf_net_cipher_destroy(qsf_net_cipher_t* c)
+{
+    assert(c);
+    if (c->encrypt)
+    {
+        EVP_CIPHER_CTX_free(c->encrypt);
+    }
+    if (c->decrypt)
+    {
+        EVP_CIPHER_CTX_free(c->decrypt);
+    }
+    qsf_free(c);
+}
+
+int qsf_net_cipher_overhead(qsf_net_cipher_t* c)
+{
+    assert(c);
+    return (c->mode == NET_CIPHER_GCM ? NET_CIPHER_TAG_SIZE : 0);
+}
+
+int qsf_net_cipher_encrypt(qsf_net_cipher_t* c,
+                           uint8_t* data,
+                           int size,
+                           int capacity)
+{
+    assert(c && data && size > 0);
+    int len = 0;
+    if (c->mode == NET_CIPHER_CTR)
+    {
+        if (EVP_EncryptUpdate(c->encrypt, data, &len, data, size) != 1)
+        {
+            return -1;
+        }
+        return len;
+    }
+    if (size + NET_CIPHER_TAG_SIZE > capacity)
+    {
+        return -1;
+    }
+    uint8_t nonce[GCM_NONCE_SIZE];
+    make_nonce(c->send_iv, c->send_seq++, nonce);
+    int final_len = 0;
+    if (EVP_EncryptInit_ex(c->encrypt, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(c->encrypt, data, &len, data, size) != 1 ||
+        EVP_EncryptFinal_ex(c->encrypt, data + len, &final_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c->encrypt, EVP_CTRL_GCM_GET_TAG,
+            NET_CIPHER_TAG_SIZE, data + size) != 1)
+    {
+        return -1;
+    }
+    return size + NET_CIPHER_TAG_SIZE;
+}
+
+int qsf_net_cipher_decrypt(qsf_net_cipher_t* c, uint8_t* data, int size)
+{
+    assert(c && data);
+    int len = 0;
+    if (c->mode == NET_CIPHER_CTR)
+    {
+        if (size <= 0 || EVP_DecryptUpdate(c->decrypt, data, &len, data, size) != 1)
+        {
+            return -1;
+        }
+        return len;
+    }
+    int plain_size = size - NET_CIPHER_TAG_SIZE;
+    if (plain_size <= 0)
+    {
+        return -1;
+    }
+    uint8_t nonce[GCM_NONCE_SIZE];
+    make_nonce(c->recv_iv, c->recv_seq++, nonce);
+    int final_len = 0;
+    if (EVP_DecryptInit_ex(c->decrypt, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c->decrypt, EVP_CTRL_GCM_SET_TAG,
+            NET_CIPHER_TAG_SIZE, data + plain_size) != 1 ||
+        EVP_DecryptUpdate(c->decrypt, data, &len, data, plain_size) != 1 ||
+        EVP_DecryptFinal_ex(c->decrypt, data + len, &final_len) != 1)
+    {
+        return -1;
+    }
+    return plain_size;
+}
@@ -0,0 +1,49 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+
+struct qsf_net_cipher_s;
+typedef struct qsf_net_cipher_s qsf_net_cipher_t;
+
+/**
+ *  stream cipher state of one connection, AES key schedule is computed once.
+ *
+ *  NET_CIPHER_CTR: frames are one continuous AES-CTR stream per direction.
+ *  NET_CIPHER_GCM: each frame is sealed by AES-GCM with a 16 bytes tag
+ *                  appended, nonce is the first 12 bytes of IV with its
+ *                  last 8 bytes xor-ed by the frame counter of that direction.
+ *
+ *  server to client direction flips the highest bit of IV,
+ *  so the two directions never share a key stream.
+ */
+#define NET_CIPHER_CTR      1
+#define NET_CIPHER_GCM      2
+
+#define NET_CIPHER_IV_SIZE      16
+#define NET_CIPHER_TAG_SIZE     16
+
+// create cipher by 16 or 32 bytes key, `server_side` choose IV of direction
+qsf_net_cipher_t* qsf_create_net_cipher(int mode,
+                                        const uint8_t* key,
+                                        int key_len,
+                                        const uint8_t* iv,
+                                        int server_side);
+
+void qsf_net_cipher_destroy(qsf_net_cipher_t* c);
+
+// bytes appended to each encrypted frame
+int qsf_net_cipher_overhead(qsf_net_cipher_t* c);
+
+// encrypt in place, `capacity` must hold the overhead.
+// returns encrypted size or negative if failed.
+int qsf_net_cipher_encrypt(qsf_net_cipher_t* c,
+                           uint8_t* data,
+                           int size,
+                           int capacity);
+
+// decrypt in place, returns plain size or negative if failed.
+int qsf_net_cipher_decrypt(qsf_net_cipher_t* c, uint8_t* data, int size);
@@ -0,0 +1,495 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_client.h"
+#include <string.h>
+#include <assert.h>
+#include <uv.h>
+#include "qsf.h"
+#include "qsf_net_def.h"
+#include "qsf_net_addr.h"
+
+#define DEFAULT_RECV_BUF_SIZE   128
+
+enum
+{
+    CONN_STATE_IDLE,        // tcp handle closed
+    CONN_STATE_CONNECTING,  // connect request pending
+    CONN_STATE_CONNECTED,   // ready to read and write
+};
+
+// coalesced frames sent by one write request
+typedef struct coalesce_buffer_s
+{
+    uv_write_t  req;        // request handle
+    uv_buf_t    buf;        // buffer object
+    uint32_t    size;       // used bytes
+    uint32_t    capacity;   // total bytes
+    char        data[];     // frames
+}coalesce_buffer_t;
+
+// a pooled connection to remote endpoint
+typedef struct qsf_net_conn_s
+{
+    qsf_net_client_t*   client;         // client pointer, NULL after destroyed
+    int                 index;          // index in pool
+    int                 state;          // connection state
+    int                 closing;        // handles pending close
+    uint32_t            backoff;        // next reconnect delay
+    net_stream_t        handle;         // tcp or pipe handle
+    uv_connect_t        req;            // connect request
+    uv_timer_t          timer;          // reconnect timer
+    coalesce_buffer_t*  out;            // frames not sent yet
+    uint32_t            buf_size;       // recv buffer size
+    uint16_t            recv_bytes;     // total recieved bytes
+    uint16_t            body_size;      // body bytes
+    char*               recv_buf;       // recv buffer
+}qsf_net_conn_t;
+
+// net client object
+struct qsf_net_client_s
+{
+    uv_loop_t*          loop;           // event loop
+    uint16_t            pool_size;      // connection count
+    uint16_t            next;           // next round-robin index
+    int                 closed;         // is client closed
+    uint32_t            min_delay;      // minimal reconnect delay
+    uint32_t            max_delay;      // maximal reconnect delay
+    uint32_t            coalesce;       // coalescing bytes
+    void*               udata;          // user data pointer
+    c_read_cb           on_read;        // read handler
+    struct sockaddr_storage addr;       // remote address
+    char*               pipe_name;      // remote unix domain socket
+    uv_prepare_t        prepare;        // flush coalesced frames before poll
+    qsf_net_conn_t**    conns;          // connection pool
+};
+
+
+static void conn_connect(qsf_net_conn_t* conn);
+
+static void on_reconnect_timer(uv_timer_t* timer)
+{
+    qsf_net_conn_t* conn = timer->data;
+    assert(conn);
+    conn_connect(conn);
+}
+
+static void on_conn_handle_close(uv_handle_t* handle)
+{
+    qsf_net_conn_t* conn = handle->data;
+    assert(conn && conn->closing > 0);
+    conn->closing--;
+    qsf_net_client_t* c = conn->client;
+    if (c == NULL)
+    {
+        if (conn->closing == 0)
+        {
+            qsf_free(conn->recv_buf);
+            qsf_free(conn);
+        }
+        return;
+    }
+    if (handle == (uv_handle_t*)&conn->handle && !c->closed && c->min_delay > 0)
+    {
+        uv_timer_start(&conn->timer, on_reconnect_timer, conn->backoff, 0);
+        conn->backoff = QSF_MIN(conn->backoff * 2, c->max_delay);
+    }
+}
+
+static void conn_close_handle(qsf_net_conn_t* conn)
+{
+    if (conn->state != CONN_STATE_IDLE)
+    {
+        conn->state = CONN_STATE_IDLE;
+        conn->closing++;
+        uv_close((uv_handle_t*)&conn->handle, on_conn_handle_close);
+    }
+    qsf_free(conn->out);
+    conn->out = NULL;
+    conn->recv_bytes = 0;
+    conn->body_size = 0;
+}
+
+static void conn_error(qsf_net_conn_t* conn, int err)
+{
+    qsf_net_client_t* c = conn->client;
+    assert(c && c->on_read);
+    conn_close_handle(conn);
+    const char* msg = uv_strerror(err);
+    c->on_read(err, conn->index, msg, (uint16_t)strlen(msg), c->udata);
+}
+
+static void on_conn_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf)
+{
+    qsf_net_conn_t* conn = handle->data;
+    assert(conn);
+    uint16_t bytes = conn->recv_bytes;
+    buf->base = conn->recv_buf + bytes;
+    if (conn->body_size == 0) // header not filled
+    {
+        assert(sizeof(conn->body_size) >= bytes);
+        buf->len = sizeof(conn->body_size) - bytes;
+    }
+    else // read body content
+    {
+        buf->len = conn->body_size - bytes;
+    }
+}
+
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    qsf_net_conn_t* conn = stream->data;
+    qsf_net_client_t* c = conn->client;
+    assert(conn && c && c->on_read);
+    if (nread <= 0)
+    {
+        if (nread < 0)
+        {
+            conn_error(conn, (int)nread);
+        }
+        return;
+    }
+    conn->recv_bytes += (uint16_t)nread;
+    uint16_t size = conn->body_size;
+    if (size == 0) // header not full-filled
+    {
+        if (conn->recv_bytes == sizeof(size))
+        {
+            memcpy(&size, conn->recv_buf, sizeof(size));
+            conn->body_size = ntohs(size); // network order
+            conn->recv_bytes = 0;
+            if (conn->body_size > conn->buf_size) // extending recv buffer
+            {
+                qsf_free(conn->recv_buf);
+                conn->recv_buf = qsf_malloc(conn->body_size);
+                conn->buf_size = conn->body_size;
+            }
+        }
+    }
+    else // fill body content
+    {
+        if (conn->recv_bytes == size)
+        {
+            conn->recv_bytes = 0;
+            conn->body_size = 0;
+            c->on_read(0, conn->index, conn->recv_buf, size, c->udata);
+        }
+    }
+}
+
+static void on_conn_connect(uv_connect_t* req, int status)
+{
+    qsf_net_conn_t* conn = req->data;
+    assert(conn);
+    if (status == UV_ECANCELED) // closed before connected
+    {
+        return;
+    }
+    if (status < 0)
+    {
+        conn_error(conn, status);
+        return;
+    }
+    int r = uv_read_start((uv_stream_t*)&conn->handle, on_conn_alloc, on_conn_read);
+    if (r < 0)
+    {
+        conn_error(conn, r);
+        return;
+    }
+    if (conn->handle.stream.type == UV_TCP)
+    {
+        uv_tcp_nodelay(&conn->handle.tcp, 1);
+    }
+    conn->state = CONN_STATE_CONNECTED;
+    conn->backoff = conn->client->min_delay;
+}
+
+static void conn_connect(qsf_net_conn_t* conn)
+{
+    qsf_net_client_t* c = conn->client;
+    assert(c && conn->state == CONN_STATE_IDLE);
+    conn->req.data = conn;
+    conn->state = CONN_STATE_CONNECTING;
+    if (c->pipe_name)
+    {
+        int r = uv_pipe_init(c->loop, &conn->handle.pipe, 0);
+        qsf_assert(r == 0, "client: uv_pipe_init() failed");
+        conn->handle.stream.data = conn;
+        uv_pipe_connect(&conn->req, &conn->handle.pipe, c->pipe_name, on_conn_connect);
+        return;
+    }
+    int r = uv_tcp_init(c->loop, &conn->handle.tcp);
+    qsf_assert(r == 0, "client: uv_tcp_init() failed");
+    conn->handle.stream.data = conn;
+    r = uv_tcp_connect(&conn->req, &conn->handle.tcp, (const struct sockaddr*)&c->addr,
+        on_conn_connect);
+    if (r < 0)
+    {
+        conn_error(conn, r);
+    }
+}
+
+static qsf_net_conn_t* conn_create(qsf_net_client_t* c, int index)
+{
+    qsf_net_conn_t* conn = qsf_malloc(sizeof(qsf_net_conn_t));
+    memset(conn, 0, sizeof(*conn));
+    int r = uv_timer_init(c->loop, &conn->timer);
+    qsf_assert(r == 0, "client: uv_timer_init() failed");
+    conn->timer.data = conn;
+    conn->client = c;
+    conn->index = index;
+    conn->state = CONN_STATE_IDLE;
+    conn->buf_size = DEFAULT_RECV_BUF_SIZE;
+    conn->recv_buf = qsf_malloc(DEFAULT_RECV_BUF_SIZE);
+    return conn;
+}
+
+static void conn_destroy(qsf_net_conn_t* conn)
+{
+    conn_close_handle(conn);
+    conn->client = NULL;
+    uv_timer_stop(&conn->timer);
+    conn->closing++;
+    uv_close((uv_handle_t*)&conn->timer, on_conn_handle_close);
+}
+
+static void conn_write_cb(uv_write_t* req, int err)
+{
+    coalesce_buffer_t* out = req->data;
+    qsf_free(out);
+}
+
+static int conn_flush(qsf_net_conn_t* conn)
+{
+    coalesce_buffer_t* out = conn->out;
+    if (out == NULL)
+    {
+        return 0;
+    }
+    conn->out = NULL;
+    out->req.data = out;
+    out->buf.base = out->data;
+    out->buf.len = out->size;
+    int r = uv_write(&out->req, (uv_stream_t*)&conn->handle, &out->buf, 1, conn_write_cb);
+    if (r < 0)
+    {
+        qsf_free(out);
+        return r;
+    }
+    return 0;
+}
+
+static void on_client_prepare(uv_prepare_t* handle)
+{
+    qsf_net_client_t* c = handle->data;
+    assert(c);
+    qsf_net_client_flush(c);
+}
+
+static void on_client_close(uv_handle_t* handle)
+{
+    qsf_net_client_t* c = handle->data;
+    assert(c);
+    qsf_free(c->pipe_name);
+    qsf_free(c->conns);
+    qsf_free(c);
+}
+
+qsf_net_client_t* qsf_create_net_client(uv_loop_t* loop, uint16_t pool_size)
+{
+    assert(loop);
+    qsf_net_client_t* c = qsf_malloc(sizeof(qsf_net_client_t));
+    qsf_assert(c != NULL, "create_client() failed.");
+    memset(c, 0, sizeof(*c));
+    int r = uv_prepare_init(loop, &c->prepare);
+    qsf_assert(r == 0, "uv_prepare_init() failed.");
+    c->prepare.data = c;
+    c->loop = loop;
+    c->pool_size = QSF_MAX(pool_size, 1);
+    c->min_delay = NET_DEFAULT_RECONNECT_MIN;
+    c->max_delay = NET_DEFAULT_RECONNECT_MAX;
+    c->coalesce = NET_DEFAULT_COALESCE;
+    c->conns = qsf_malloc(sizeof(qsf_net_conn_t*) * c->pool_size);
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        c->conns[i] = conn_create(c, i);
+    }
+    return c;
+}
+
+void qsf_net_client_destroy(qsf_net_client_t* c)
+{
+    assert(c);
+    qsf_net_client_close(c);
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        conn_destroy(c->conns[i]);
+    }
+    uv_close((uv_handle_t*)&c->prepare, on_client_close);
+}
+
+void qsf_net_client_set_reconnect(qsf_net_client_t* c,
+                                  uint32_t min_delay,
+                                  uint32_t max_delay)
+{
+    assert(c);
+    c->min_delay = min_delay;
+    c->max_delay = QSF_MAX(min_delay, max_delay);
+}
+
+void qsf_net_client_set_coalesce(qsf_net_client_t* c, uint32_t max_bytes)
+{
+    assert(c);
+    c->coalesce = max_bytes;
+}
+
+int qsf_net_client_connect(qsf_net_client_t* c,
+                           const char* host,
+                           int port,
+                           c_read_cb on_read)
+{
+    assert(c && host && on_read);
+    const char* path = qsf_net_pipe_name(host);
+    qsf_free(c->pipe_name);
+    c->pipe_name = NULL;
+    if (path)
+    {
+        size_t len = strlen(path) + 1;
+        c->pipe_name = qsf_malloc(len);
+        memcpy(c->pipe_name, path, len);
+    }
+    else
+    {
+        int r = qsf_net_resolve(host, port, &c->addr);
+        if (r < 0)
+        {
+            return r;
+        }
+    }
+    c->on_read = on_read;
+    c->closed = 0;
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        qsf_net_conn_t* conn = c->conns[i];
+        conn->backoff = c->min_delay;
+        if (conn->state == CONN_STATE_IDLE && conn->closing == 0)
+        {
+            conn_connect(conn);
+        }
+    }
+    return 0;
+}
+
+void qsf_net_client_close(qsf_net_client_t* c)
+{
+    assert(c);
+    c->closed = 1;
+    uv_prepare_stop(&c->prepare);
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        qsf_net_conn_t* conn = c->conns[i];
+        uv_timer_stop(&conn->timer);
+        conn_close_handle(conn);
+    }
+}
+
+static qsf_net_conn_t* pick_conn(qsf_net_client_t* c, int key)
+{
+    if (key >= 0)
+    {
+        qsf_net_conn_t* conn = c->conns[key % c->pool_size];
+        return (conn->state == CONN_STATE_CONNECTED ? conn : NULL);
+    }
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        qsf_net_conn_t* conn = c->conns[c->next++ % c->pool_size];
+        if (conn->state == CONN_STATE_CONNECTED)
+        {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+int qsf_net_client_write(qsf_net_client_t* c,
+                         int key,
+                         const void* data,
+                         uint16_t size)
+{
+    assert(c && data && size);
+    qsf_net_conn_t* conn = pick_conn(c, key);
+    if (conn == NULL)
+    {
+        return UV_ENOTCONN;
+    }
+    uint32_t need = sizeof(size) + size;
+    coalesce_buffer_t* out = conn->out;
+    if (out != NULL && out->size + need > out->capacity)
+    {
+        int r = conn_flush(conn);
+        if (r < 0)
+        {
+            return r;
+        }
+        out = NULL;
+    }
+    if (out == NULL)
+    {
+        uint32_t capacity = QSF_MAX(need, c->coalesce);
+        out = qsf_malloc(sizeof(coalesce_buffer_t) + capacity);
+        out->size = 0;
+        out->capacity = capacity;
+        conn->out = out;
+    }
+    uint16_t header = htons(size); // network order
+    memcpy(out->data + out->size, &header, sizeof(header));
+    memcpy(out->data + out->size + sizeof(header), data, size);
+    out->size += need;
+    if (out->size >= c->coalesce)
+    {
+        return conn_flush(conn);
+    }
+    return uv_prepare_start(&c->prepare, on_client_prepare);
+}
+
+void qsf_net_client_flush(qsf_net_client_t* c)
+{
+    assert(c);
+    uv_prepare_stop(&c->prepare);
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        qsf_net_conn_t* conn = c->conns[i];
+        int r = conn_flush(conn);
+        if (r < 0)
+        {
+            conn_error(conn, r);
+        }
+    }
+}
+
+int qsf_net_client_size(qsf_net_client_t* c)
+{
+    assert(c);
+    int count = 0;
+    for (int i = 0; i < c->pool_size; i++)
+    {
+        if (c->conns[i]->state == CONN_STATE_CONNECTED)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+void qsf_net_set_client_udata(qsf_net_client_t* c, void* ud)
+{
+    assert(c);
+    c->udata = ud;
+}
+
+void* qsf_net_get_client_udata(qsf_net_client_t* c)
+{
+    assert(c);
+    return c->udata;
+}
@@ -0,0 +1,58 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+
+struct uv_loop_s;
+struct qsf_net_client_s;
+typedef struct qsf_net_client_s qsf_net_client_t;
+
+
+// callbacks, (error, connection index, data, size, udata)
+typedef void(*c_read_cb)(int, int, const char*, uint16_t, void*);
+
+// create an net client instance with `pool_size` connections to one endpoint
+qsf_net_client_t* qsf_create_net_client(struct uv_loop_s* loop, uint16_t pool_size);
+
+// destroy this instance
+void qsf_net_client_destroy(qsf_net_client_t* c);
+
+// reconnect delay in milliseconds, doubled on each failure.
+// zero `min_delay` disables reconnecting
+void qsf_net_client_set_reconnect(qsf_net_client_t* c,
+                                  uint32_t min_delay,
+                                  uint32_t max_delay);
+
+// frames written in one loop iteration are sent by one write request,
+// flushed earlier when `max_bytes` reached. zero disables coalescing
+void qsf_net_client_set_coalesce(qsf_net_client_t* c, uint32_t max_bytes);
+
+// start connecting to remote endpoint, `host` is IPv4, IPv6 or `unix:/path`
+int qsf_net_client_connect(qsf_net_client_t* c,
+                           const char* host,
+                           int port,
+                           c_read_cb on_read);
+
+// close all connections and stop reconnecting
+void qsf_net_client_close(qsf_net_client_t* c);
+
+// send message by a pooled connection.
+// a non-negative `key` always picks the same connection to keep message order,
+// otherwise connections are picked round-robin.
+int qsf_net_client_write(qsf_net_client_t* c,
+                         int key,
+                         const void* data,
+                         uint16_t size);
+
+// send coalesced frames now
+void qsf_net_client_flush(qsf_net_client_t* c);
+
+// established connection count
+int qsf_net_client_size(qsf_net_client_t* c);
+
+// client reference
+void qsf_net_set_client_udata(qsf_net_client_t* c, void* ud);
+void* qsf_net_get_client_udata(qsf_net_client_t* c);
@@ -11,6 +11,10 @@
  *  |    Header     |     content          |
  *  +---------------+----------------------+
  *
+ *  content of a compressed session starts with one flag byte, 
+ *  NET_FRAME_RAW or NET_FRAME_DEFLATED. deflated content is flushed 
+ *  by Z_SYNC_FLUSH from one zlib stream per direction.
+ *
  */
  
 // max alive connections per server
@@ -22,7 +26,66 @@
 // default check heart beat seconds
 #define NET_DEFAULT_HEARTBEAT_CHECK     10
 
+// default connections per client endpoint
+#define NET_DEFAULT_POOL_SIZE   1
+
+// default client reconnect delay range, in milliseconds
+#define NET_DEFAULT_RECONNECT_MIN   500
+#define NET_DEFAULT_RECONNECT_MAX   30000
+
+// default client write coalescing bytes
+#define NET_DEFAULT_COALESCE    (16 * 1024)
+
+// write flags
+#define NET_WRITE_DROPPABLE     1   // frame may be discarded for slow session
+
+// policies when pending write bytes of a session exceed its soft limit
+#define NET_SEND_DROP_NEWEST    0   // discard the new droppable frame
+#define NET_SEND_DROP_OLDEST    1   // hold frames back, discard oldest droppable ones
+#define NET_SEND_KICK           2   // close the session
+
+// policies when a session exceeds its receive rate
+#define NET_RATE_PAUSE          0   // stop reading until tokens refilled
+#define NET_RATE_KICK           1   // close the session
+
+// interval of resuming paused sessions, in milliseconds
+#define NET_RATE_TICK           50
+
+// compressed frame flags
+#define NET_FRAME_RAW           0
+#define NET_FRAME_DEFLATED      1
+
+// zlib window bits of compressed sessions, peers must use the same value
+#define NET_COMPRESS_WINDOW_BITS    12
+
+// default compress level and minimal frame size to compress
+#define NET_DEFAULT_COMPRESS_LEVEL      6
+#define NET_DEFAULT_COMPRESS_THRESHOLD  128
+
+/**
+ *  frames of a bound session are forwarded between nodes with an envelope:
+ *
+ *  +---------+--------+----------+----------+--------------+
+ *  |  magic  |  type  |  server  |  serial  |   content    |
+ *  +---------+--------+----------+----------+--------------+
+ *    4 bytes   1 byte   2 bytes    4 bytes
+ *
+ *  magic, server and serial are in network order. server identifies the
+ *  listening server within its node, as serials are only unique per server.
+ */
+#define NET_FORWARD_MAGIC       0x51534657  // "QSFW"
+#define NET_FORWARD_HEADER      11
+
+// forward envelope types
+#define NET_FORWARD_DATA        1   // gateway to backend, client frame
+#define NET_FORWARD_CLOSE       2   // gateway to backend, session closed
+#define NET_FORWARD_WRITE       3   // backend to gateway, write to session
+#define NET_FORWARD_KICK        4   // backend to gateway, close session
+
 // error code
 #define NET_ERR_CONN_LIMIT      100001
 #define NET_ERR_TIMEOUT         100002
 #define NET_ERR_INVALID_SIZE    100003
+#define NET_ERR_SEND_OVERFLOW   100004
+#define NET_ERR_BAD_FRAME       100005
+#define NET_ERR_RATE_LIMIT      100006
@@ -0,0 +1,830 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_http.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <uv.h>
+#include "uthash.h"
+#include "qsf.h"
+#include "qsf_net_addr.h"
+
+#define START_SERIAL_NUMBER     1
+#define RECV_BUF_SIZE           4096
+#define MAX_RESPONSE_LINES      128     // status line, Content-Length and Connection
+
+// an accepted connection
+typedef struct http_conn_s
+{
+    UT_hash_handle  hh;             // hash table entry
+    uint32_t        serial;         // serial no.
+    qsf_net_http_t* http;           // server pointer
+    net_stream_t    handle;         // tcp or pipe handle
+    uint64_t        last_active;    // last read or response time
+    char*           buf;            // unparsed inbound bytes
+    uint32_t        size;           // bytes in `buf`
+    uint32_t        capacity;       // size of `buf`
+    uint32_t        scanned;        // bytes searched for end of head
+    uint32_t        head_size;      // size of complete head, 0 if not found
+    uint64_t        content_length; // body size of complete head
+    int             waiting;        // request delivered, not responded yet
+    int             keep_alive;     // keep connection after current response
+    int             head_only;      // current request is HEAD
+    int             reading;        // read started
+    int             processing;     // in request loop
+    int             closed;         // removed from server
+    int             lingering;      // in linger map, shutdown pending
+}http_conn_t;
+
+// http server object
+struct qsf_net_http_s
+{
+    uv_loop_t*      loop;           // event loop
+    uint32_t        max_connection; // maximum alive connections
+    uint16_t        idle_timeout;   // idle keep-alive seconds
+    uint32_t        max_body;       // maximum request body size
+    uint32_t        next_serial;    // next connection serial no.
+    int             stopped;        // is server stopped
+    int             closing;        // handles pending close
+    int             destroyed;      // free after handles closed
+    void*           udata;          // user data pointer
+    http_request_cb on_request;     // request handler
+    http_release_cb on_release;     // body reference handler
+    net_stream_t    acceptor;       // tcp or pipe accept handle
+    uv_timer_t      timer;          // idle checking timer
+    http_conn_t*    conn_map;       // connection hash map
+    http_conn_t*    linger_map;     // closed connections flushing responses
+};
+
+// write request of one response
+typedef struct http_write_s
+{
+    uv_write_t      req;            // request handle
+    void*           body_ref;       // referenced body
+    uv_buf_t        bufs[2];        // head and referenced body
+    char            data[];         // head and copied body
+}http_write_t;
+
+
+static const char* status_reason(int status)
+{
+    switch (status)
+    {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "Unknown";
+    }
+}
+
+static int token_is(const char* s, size_t len, const char* str)
+{
+    size_t n = strlen(str);
+    if (len != n)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        if (tolower((unsigned char)s[i]) != tolower((unsigned char)str[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// case-insensitive search in a comma separated list
+static int list_has(const char* s, size_t len, const char* str)
+{
+    const char* end = s + len;
+    while (s < end)
+    {
+        const char* comma = memchr(s, ',', end - s);
+        const char* stop = (comma ? comma : end);
+        const char* p = s;
+        while (p < stop && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+        const char* q = stop;
+        while (q > p && (q[-1] == ' ' || q[-1] == '\t'))
+        {
+            q--;
+        }
+        if (token_is(p, q - p, str))
+        {
+            return 1;
+        }
+        s = stop + 1;
+    }
+    return 0;
+}
+
+// parse request line and headers of a complete head,
+// returns 0 or the status code of error response.
+static int parse_head(const char* data,
+                      uint32_t size,
+                      qsf_net_http_request_t* req,
+                      int* expect_continue)
+{
+    const char* end = data + size - 2; // final empty line
+    const char* eol = memchr(data, '\r', end - data);
+    const char* sp1 = memchr(data, ' ', eol - data);
+    const char* sp2 = (sp1 ? memchr(sp1 + 1, ' ', eol - sp1 - 1) : NULL);
+    memset(req, 0, sizeof(*req));
+    if (sp1 == NULL || sp2 == NULL || sp1 == data || sp2 == sp1 + 1 || eol[1] != '\n')
+    {
+        return 400;
+    }
+    req->method = data;
+    req->method_len = sp1 - data;
+    req->target = sp1 + 1;
+    req->target_len = sp2 - sp1 - 1;
+    const char* version = sp2 + 1;
+    if (eol - version != 8 || memcmp(version, "HTTP/1.", 7) != 0)
+    {
+        return (memcmp(version, "HTTP/", 5) == 0 ? 505 : 400);
+    }
+    if (version[7] != '0' && version[7] != '1')
+    {
+        return 505;
+    }
+    req->minor_version = version[7] - '0';
+    req->keep_alive = (req->minor_version == 1);
+    *expect_continue = 0;
+
+    int has_length = 0;
+    const char* line = eol + 2;
+    while (line < end)
+    {
+        eol = memchr(line, '\r', end - line + 1);
+        if (eol == NULL || eol[1] != '\n' || *line == ' ' || *line == '\t') // no line folding
+        {
+            return 400;
+        }
+        const char* colon = memchr(line, ':', eol - line);
+        if (colon == NULL || colon == line || colon[-1] == ' ' || colon[-1] == '\t')
+        {
+            return 400;
+        }
+        if (req->num_headers == NET_HTTP_MAX_HEADERS)
+        {
+            return 431;
+        }
+        const char* value = colon + 1;
+        const char* value_end = eol;
+        while (value < value_end && (*value == ' ' || *value == '\t'))
+        {
+            value++;
+        }
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+        {
+            value_end--;
+        }
+        qsf_net_http_header_t* header = &req->headers[req->num_headers++];
+        header->name = line;
+        header->name_len = colon - line;
+        header->value = value;
+        header->value_len = value_end - value;
+
+        if (token_is(header->name, header->name_len, "Content-Length"))
+        {
+            uint64_t length = 0;
+            if (header->value_len == 0 || header->value_len > 15)
+            {
+                return 400;
+            }
+            for (size_t i = 0; i < header->value_len; i++)
+            {
+                if (!isdigit((unsigned char)value[i]))
+                {
+                    return 400;
+                }
+                length = length * 10 + (value[i] - '0');
+            }
+            if (has_length && length != req->body_size)
+            {
+                return 400;
+            }
+            has_length = 1;
+            req->body_size = (size_t)length;
+        }
+        else if (token_is(header->name, header->name_len, "Transfer-Encoding"))
+        {
+            return 501;
+        }
+        else if (token_is(header->name, header->name_len, "Connection"))
+        {
+            if (list_has(value, header->value_len, "close"))
+            {
+                req->keep_alive = 0;
+            }
+            else if (list_has(value, header->value_len, "keep-alive"))
+            {
+                req->keep_alive = 1;
+            }
+        }
+        else if (token_is(header->name, header->name_len, "Expect"))
+        {
+            *expect_continue = token_is(value, header->value_len, "100-continue");
+        }
+        line = eol + 2;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static void http_free(qsf_net_http_t* h)
+{
+    qsf_free(h);
+}
+
+// one of server or connection handles is closed
+static void http_handle_closed(qsf_net_http_t* h)
+{
+    assert(h->closing > 0);
+    h->closing--;
+    if (h->closing == 0 && h->destroyed)
+    {
+        http_free(h);
+    }
+}
+
+static void on_http_close(uv_handle_t* handle)
+{
+    http_handle_closed(handle->data);
+}
+
+static void on_conn_close(uv_handle_t* handle)
+{
+    http_conn_t* conn = handle->data;
+    qsf_net_http_t* h = conn->http;
+    qsf_free(conn->buf);
+    qsf_free(conn);
+    http_handle_closed(h);
+}
+
+static void conn_detach(http_conn_t* conn)
+{
+    qsf_net_http_t* h = conn->http;
+    HASH_DEL(h->conn_map, conn);
+    conn->closed = 1;
+    h->closing++;
+}
+
+static void conn_close(http_conn_t* conn)
+{
+    if (!conn->closed)
+    {
+        conn_detach(conn);
+        uv_close((uv_handle_t*)&conn->handle, on_conn_close);
+    }
+}
+
+// close a lingering connection, by shutdown or timeout
+static void linger_close(http_conn_t* conn)
+{
+    if (conn->lingering)
+    {
+        HASH_DEL(conn->http->linger_map, conn);
+        conn->lingering = 0;
+        uv_close((uv_handle_t*)&conn->handle, on_conn_close);
+    }
+}
+
+static void on_conn_shutdown(uv_shutdown_t* req, int err)
+{
+    http_conn_t* conn = req->data;
+    qsf_free(req);
+    linger_close(conn); // canceled if timed out already
+}
+
+// close connection after pending responses are sent
+static void conn_linger(http_conn_t* conn)
+{
+    if (conn->closed)
+    {
+        return;
+    }
+    qsf_net_http_t* h = conn->http;
+    conn_detach(conn);
+    conn->lingering = 1;
+    HASH_ADD_INT(h->linger_map, serial, conn);
+    uv_read_stop((uv_stream_t*)&conn->handle);
+    uv_shutdown_t* req = qsf_malloc(sizeof(uv_shutdown_t));
+    req->data = conn;
+    int r = uv_shutdown(req, (uv_stream_t*)&conn->handle, on_conn_shutdown);
+    if (r < 0)
+    {
+        qsf_free(req);
+        linger_close(conn);
+    }
+}
+
+static void on_conn_write(uv_write_t* req, int err)
+{
+    http_write_t* w = req->data;
+    http_conn_t* conn = req->handle->data;
+    qsf_net_http_t* h = conn->http;
+    if (w->body_ref && h->on_release)
+    {
+        h->on_release(w->body_ref, h->udata);
+    }
+    qsf_free(w);
+    if (err < 0)
+    {
+        conn_close(conn);
+    }
+}
+
+// interim response of `Expect: 100-continue`, queued in order with responses
+static int conn_continue(http_conn_t* conn)
+{
+    static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    size_t size = sizeof(continue_line) - 1;
+    http_write_t* w = qsf_malloc(sizeof(http_write_t) + size);
+    w->req.data = w;
+    w->body_ref = NULL;
+    memcpy(w->data, continue_line, size);
+    w->bufs[0] = uv_buf_init(w->data, (unsigned)size);
+    int r = uv_write(&w->req, (uv_stream_t*)&conn->handle, w->bufs, 1, on_conn_write);
+    if (r < 0)
+    {
+        qsf_free(w);
+        conn_close(conn);
+    }
+    return r;
+}
+
+static int conn_send(http_conn_t* conn,
+                     int status,
+                     const char* headers,
+                     size_t headers_size,
+                     const char* body,
+                     size_t body_size,
+                     void* body_ref)
+{
+    size_t copy = (body_ref || conn->head_only ? 0 : body_size);
+    http_write_t* w = qsf_malloc(sizeof(http_write_t) + MAX_RESPONSE_LINES + headers_size + copy);
+    w->req.data = w;
+    w->body_ref = body_ref;
+    int len = snprintf(w->data, MAX_RESPONSE_LINES,
+        "HTTP/1.1 %d %s\r\nContent-Length: %llu\r\nConnection: %s\r\n",
+        status, status_reason(status), (unsigned long long)body_size,
+        (conn->keep_alive ? "keep-alive" : "close"));
+    assert(len > 0 && len < MAX_RESPONSE_LINES - 2);
+    size_t size = len;
+    if (headers_size > 0)
+    {
+        memcpy(w->data + size, headers, headers_size);
+        size += headers_size;
+    }
+    memcpy(w->data + size, "\r\n", 2);
+    size += 2;
+    if (copy > 0)
+    {
+        memcpy(w->data + size, body, copy);
+        size += copy;
+    }
+    unsigned nbufs = 1;
+    w->bufs[0] = uv_buf_init(w->data, (unsigned)size);
+    if (body_ref && body_size > 0 && !conn->head_only)
+    {
+        w->bufs[1] = uv_buf_init((char*)body, (unsigned)body_size);
+        nbufs = 2;
+    }
+    int r = uv_write(&w->req, (uv_stream_t*)&conn->handle, w->bufs, nbufs, on_conn_write);
+    if (r < 0)
+    {
+        qsf_free(w);
+        conn_close(conn);
+        return r;
+    }
+    conn->last_active = uv_now(conn->http->loop);
+    if (!conn->keep_alive)
+    {
+        conn_linger(conn);
+    }
+    return 0;
+}
+
+// answer a malformed request and close connection
+static void conn_reject(http_conn_t* conn, int status)
+{
+    const char* reason = status_reason(status);
+    conn->keep_alive = 0;
+    conn->head_only = 0;
+    conn_send(conn, status, "Content-Type: text/plain\r\n", 26, reason, strlen(reason), NULL);
+}
+
+static uint32_t conn_max_buffer(http_conn_t* conn)
+{
+    return NET_HTTP_MAX_HEAD + conn->http->max_body;
+}
+
+static void on_conn_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf);
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+
+// deliver buffered requests until one is waiting for its response
+static void conn_process(http_conn_t* conn)
+{
+    qsf_net_http_t* h = conn->http;
+    if (conn->processing)
+    {
+        return;
+    }
+    conn->processing = 1;
+    while (!conn->waiting && !conn->closed)
+    {
+        qsf_net_http_request_t request;
+        int expect_continue = 0;
+        int parsed = 0;
+        if (conn->head_size == 0)
+        {
+            uint32_t i = (conn->scanned >= 3 ? conn->scanned - 3 : 0);
+            for (; i + 4 <= conn->size; i++)
+            {
+                if (memcmp(conn->buf + i, "\r\n\r\n", 4) == 0)
+                {
+                    conn->head_size = i + 4;
+                    break;
+                }
+            }
+            conn->scanned = conn->size;
+            if (conn->head_size == 0)
+            {
+                if (conn->size > NET_HTTP_MAX_HEAD)
+                {
+                    conn_reject(conn, 431);
+                }
+                break;
+            }
+            int status = parse_head(conn->buf, conn->head_size, &request, &expect_continue);
+            if (status == 0 && request.body_size > h->max_body)
+            {
+                status = 413;
+            }
+            if (status != 0)
+            {
+                conn_reject(conn, status);
+                break;
+            }
+            parsed = 1;
+            conn->content_length = request.body_size;
+            if (expect_continue && conn->size < conn->head_size + conn->content_length)
+            {
+                if (conn_continue(conn) < 0)
+                {
+                    break;
+                }
+            }
+        }
+        uint32_t consumed = conn->head_size + (uint32_t)conn->content_length;
+        if (conn->size < consumed)
+        {
+            break;
+        }
+        if (!parsed) // buffer may be moved since head was found
+        {
+            parse_head(conn->buf, conn->head_size, &request, &expect_continue);
+        }
+        request.serial = conn->serial;
+        request.body = conn->buf + conn->head_size;
+        conn->waiting = 1;
+        conn->keep_alive = request.keep_alive;
+        conn->head_only = token_is(request.method, request.method_len, "HEAD");
+        h->on_request(&request, h->udata);
+        if (conn->closed)
+        {
+            break;
+        }
+        conn->size -= consumed;
+        memmove(conn->buf, conn->buf + consumed, conn->size);
+        conn->head_size = 0;
+        conn->scanned = 0;
+        conn->content_length = 0;
+    }
+    conn->processing = 0;
+    if (!conn->closed && !conn->reading && conn->size < conn_max_buffer(conn))
+    {
+        int r = uv_read_start((uv_stream_t*)&conn->handle, on_conn_alloc, on_conn_read);
+        if (r < 0)
+        {
+            conn_close(conn);
+            return;
+        }
+        conn->reading = 1;
+    }
+}
+
+static void on_conn_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf)
+{
+    http_conn_t* conn = handle->data;
+    uint32_t limit = conn_max_buffer(conn);
+    if (conn->capacity - conn->size < RECV_BUF_SIZE / 2 && conn->capacity < limit)
+    {
+        uint32_t capacity = QSF_MIN(conn->capacity * 2, limit);
+        char* data = qsf_malloc(capacity);
+        memcpy(data, conn->buf, conn->size);
+        qsf_free(conn->buf);
+        conn->buf = data;
+        conn->capacity = capacity;
+    }
+    buf->base = conn->buf + conn->size;
+    buf->len = conn->capacity - conn->size;
+}
+
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    http_conn_t* conn = stream->data;
+    if (nread < 0)
+    {
+        conn_close(conn);
+        return;
+    }
+    if (nread == 0)
+    {
+        return;
+    }
+    conn->size += (uint32_t)nread;
+    conn->last_active = uv_now(stream->loop);
+    conn_process(conn);
+    // buffer is full while a request waits for its response
+    if (!conn->closed && conn->size == conn_max_buffer(conn))
+    {
+        uv_read_stop(stream);
+        conn->reading = 0;
+    }
+}
+
+static void on_refused_close(uv_handle_t* handle)
+{
+    qsf_free(handle);
+}
+
+// accept and drop a connection, or it waits in backlog forever
+static void refuse_connection(qsf_net_http_t* h, uv_stream_t* stream)
+{
+    net_stream_t* handle = qsf_malloc(sizeof(net_stream_t));
+    int r = 0;
+    if (h->acceptor.stream.type == UV_NAMED_PIPE)
+    {
+        r = uv_pipe_init(h->loop, &handle->pipe, 0);
+    }
+    else
+    {
+        r = uv_tcp_init(h->loop, &handle->tcp);
+    }
+    qsf_assert(r == 0, "uv_tcp_init() failed.");
+    uv_accept(stream, &handle->stream);
+    uv_close((uv_handle_t*)handle, on_refused_close);
+}
+
+static void on_connection(uv_stream_t* stream, int err)
+{
+    if (err != 0)
+    {
+        qsf_log("http listen failed, %d: %s\n", err, uv_strerror(err));
+        return;
+    }
+    qsf_net_http_t* h = stream->data;
+    if (h->stopped || HASH_COUNT(h->conn_map) >= h->max_connection)
+    {
+        refuse_connection(h, stream);
+        return;
+    }
+    http_conn_t* conn = qsf_malloc(sizeof(http_conn_t));
+    memset(conn, 0, sizeof(*conn));
+    conn->http = h;
+    conn->capacity = RECV_BUF_SIZE;
+    conn->buf = qsf_malloc(conn->capacity);
+    conn->last_active = uv_now(h->loop);
+    int r = 0;
+    if (h->acceptor.stream.type == UV_NAMED_PIPE)
+    {
+        r = uv_pipe_init(h->loop, &conn->handle.pipe, 0);
+    }
+    else
+    {
+        r = uv_tcp_init(h->loop, &conn->handle.tcp);
+    }
+    qsf_assert(r == 0, "uv_tcp_init() failed.");
+    conn->handle.stream.data = conn;
+    conn->serial = h->next_serial++;
+    HASH_ADD_INT(h->conn_map, serial, conn);
+    r = uv_accept(stream, &conn->handle.stream);
+    if (r < 0)
+    {
+        qsf_log("http accept failed, %d: %s\n", r, uv_strerror(r));
+        conn_close(conn);
+        return;
+    }
+    if (h->acceptor.stream.type == UV_TCP)
+    {
+        uv_tcp_nodelay(&conn->handle.tcp, 1);
+    }
+    conn_process(conn); // start reading
+}
+
+// close idle keep-alive connections and stuck lingering ones
+static void idle_timer_cb(uv_timer_t* timer)
+{
+    qsf_net_http_t* h = timer->data;
+    http_conn_t* conn = NULL;
+    http_conn_t* tmp = NULL;
+    uint64_t now = uv_now(timer->loop);
+    uint64_t timeout = h->idle_timeout * 1000;
+    HASH_ITER(hh, h->conn_map, conn, tmp)
+    {
+        if (!conn->waiting && now - conn->last_active > timeout)
+        {
+            conn_close(conn);
+        }
+    }
+    HASH_ITER(hh, h->linger_map, conn, tmp)
+    {
+        if (now - conn->last_active > timeout)
+        {
+            linger_close(conn);
+        }
+    }
+}
+
+qsf_net_http_t* qsf_create_net_http(uv_loop_t* loop,
+                                    uint32_t max_connection,
+                                    uint16_t idle_timeout)
+{
+    assert(loop);
+    qsf_net_http_t* h = qsf_malloc(sizeof(qsf_net_http_t));
+    memset(h, 0, sizeof(*h));
+    int r = uv_timer_init(loop, &h->timer);
+    qsf_assert(r == 0, "uv_timer_init() failed.");
+    h->timer.data = h;
+    h->loop = loop;
+    h->max_connection = max_connection;
+    h->idle_timeout = (idle_timeout > 0 ? idle_timeout : NET_HTTP_DEFAULT_TIMEOUT);
+    h->max_body = NET_HTTP_DEFAULT_MAX_BODY;
+    h->next_serial = START_SERIAL_NUMBER;
+    return h;
+}
+
+void qsf_net_http_destroy(qsf_net_http_t* h)
+{
+    assert(h);
+    qsf_net_http_stop(h);
+    h->destroyed = 1;
+    if (h->closing == 0)
+    {
+        http_free(h);
+    }
+}
+
+int qsf_net_http_start(qsf_net_http_t* h,
+                       const char* host,
+                       int port,
+                       http_request_cb on_request)
+{
+    assert(h && host && on_request);
+    if (h->acceptor.stream.type != UV_UNKNOWN_HANDLE)
+    {
+        return UV_EALREADY;
+    }
+    h->on_request = on_request;
+    int r = 0;
+    const char* path = qsf_net_pipe_name(host);
+    if (path)
+    {
+        r = uv_pipe_init(h->loop, &h->acceptor.pipe, 0);
+        qsf_assert(r == 0, "uv_pipe_init() failed.");
+        r = uv_pipe_bind(&h->acceptor.pipe, path);
+    }
+    else
+    {
+        struct sockaddr_storage addr;
+        r = uv_tcp_init(h->loop, &h->acceptor.tcp);
+        qsf_assert(r == 0, "uv_tcp_init() failed.");
+        r = qsf_net_resolve(host, port, &addr);
+        if (r == 0)
+        {
+            r = uv_tcp_bind(&h->acceptor.tcp, (const struct sockaddr*)&addr, 0);
+        }
+    }
+    h->acceptor.stream.data = h;
+    if (r < 0)
+    {
+        return r;
+    }
+    r = uv_listen(&h->acceptor.stream, SOMAXCONN, on_connection);
+    if (r < 0)
+    {
+        return r;
+    }
+    uint64_t interval = QSF_MAX(h->idle_timeout * 1000 / 2, 1000);
+    return uv_timer_start(&h->timer, idle_timer_cb, interval, interval);
+}
+
+void qsf_net_http_stop(qsf_net_http_t* h)
+{
+    assert(h);
+    http_conn_t* conn = NULL;
+    http_conn_t* tmp = NULL;
+    h->stopped = 1;
+    HASH_ITER(hh, h->conn_map, conn, tmp)
+    {
+        conn_close(conn);
+    }
+    HASH_ITER(hh, h->linger_map, conn, tmp) // no timer to bound them
+    {
+        linger_close(conn);
+    }
+    uv_handle_t* timer = (uv_handle_t*)&h->timer;
+    uv_handle_t* acceptor = (uv_handle_t*)&h->acceptor;
+    if (!uv_is_closing(timer))
+    {
+        uv_close(timer, on_http_close);
+        h->closing++;
+    }
+    if (acceptor->type != UV_UNKNOWN_HANDLE && !uv_is_closing(acceptor))
+    {
+        uv_close(acceptor, on_http_close);
+        h->closing++;
+    }
+}
+
+void qsf_net_http_set_max_body(qsf_net_http_t* h, uint32_t size)
+{
+    assert(h);
+    h->max_body = size;
+}
+
+void qsf_net_http_set_release(qsf_net_http_t* h, http_release_cb on_release)
+{
+    assert(h);
+    h->on_release = on_release;
+}
+
+int qsf_net_http_respond(qsf_net_http_t* h,
+                         uint32_t serial,
+                         int status,
+                         const char* headers,
+                         size_t headers_size,
+                         const char* body,
+                         size_t body_size,
+                         void* body_ref)
+{
+    assert(h);
+    http_conn_t* conn = NULL;
+    HASH_FIND_INT(h->conn_map, &serial, conn);
+    if (conn == NULL || !conn->waiting)
+    {
+        return UV_ENOENT;
+    }
+    conn->waiting = 0;
+    int r = conn_send(conn, status, headers, headers_size, body, body_size, body_ref);
+    if (r == 0 && !conn->closed)
+    {
+        conn_process(conn); // next pipelined request
+    }
+    return r;
+}
+
+int qsf_net_http_size(qsf_net_http_t* h)
+{
+    assert(h);
+    return HASH_COUNT(h->conn_map);
+}
+
+void qsf_net_set_http_udata(qsf_net_http_t* h, void* ud)
+{
+    assert(h);
+    h->udata = ud;
+}
+
+void* qsf_net_get_http_udata(qsf_net_http_t* h)
+{
+    assert(h);
+    return h->udata;
+}
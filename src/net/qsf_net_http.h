@@ -0,0 +1,98 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct uv_loop_s;
+struct qsf_net_http_s;
+typedef struct qsf_net_http_s qsf_net_http_t;
+
+/**
+ *  a minimal HTTP/1.1 server for admin and metrics endpoints.
+ *
+ *  requests of a connection are delivered one at a time, the next pipelined
+ *  request is parsed after the response of current one is sent, so responses
+ *  keep the order of requests. bodies must have a Content-Length, chunked
+ *  requests are answered with 501.
+ */
+
+#define NET_HTTP_MAX_HEADERS        32
+#define NET_HTTP_MAX_HEAD           8192                // request line and headers
+#define NET_HTTP_DEFAULT_MAX_BODY   (1024 * 1024)
+#define NET_HTTP_DEFAULT_TIMEOUT    30                  // idle keep-alive seconds
+
+typedef struct qsf_net_http_header_s
+{
+    const char* name;
+    size_t      name_len;
+    const char* value;
+    size_t      value_len;
+}qsf_net_http_header_t;
+
+// a parsed request, only valid in request callback
+typedef struct qsf_net_http_request_s
+{
+    uint32_t    serial;         // connection serial, used to respond
+    const char* method;
+    size_t      method_len;
+    const char* target;         // path and query
+    size_t      target_len;
+    int         minor_version;  // HTTP/1.x
+    int         keep_alive;     // connection is kept after response
+    int         num_headers;
+    qsf_net_http_header_t headers[NET_HTTP_MAX_HEADERS];
+    const char* body;
+    size_t      body_size;
+}qsf_net_http_request_t;
+
+// (request, udata)
+typedef void(*http_request_cb)(const qsf_net_http_request_t*, void*);
+
+// response body passed by reference is sent or dropped, (body_ref, udata)
+typedef void(*http_release_cb)(void*, void*);
+
+// create an http server instance
+qsf_net_http_t* qsf_create_net_http(struct uv_loop_s* loop,
+                                    uint32_t max_connection,
+                                    uint16_t idle_timeout);
+
+// destroy this instance
+void qsf_net_http_destroy(qsf_net_http_t* h);
+
+// listen on IPv4, IPv6 or `unix:/path` host
+int qsf_net_http_start(qsf_net_http_t* h,
+                       const char* host,
+                       int port,
+                       http_request_cb on_request);
+
+// close all connections and the listener
+void qsf_net_http_stop(qsf_net_http_t* h);
+
+// larger request bodies are answered with 413
+void qsf_net_http_set_max_body(qsf_net_http_t* h, uint32_t size);
+
+void qsf_net_http_set_release(qsf_net_http_t* h, http_release_cb on_release);
+
+// respond current request of a connection. `headers` are complete header
+// lines, Content-Length and Connection are added. if `body_ref` is not NULL
+// `body` is written without copy and must be valid until released, otherwise
+// it is copied. returns 0 if sent, body is not released on failure.
+int qsf_net_http_respond(qsf_net_http_t* h,
+                         uint32_t serial,
+                         int status,
+                         const char* headers,
+                         size_t headers_size,
+                         const char* body,
+                         size_t body_size,
+                         void* body_ref);
+
+// connection count
+int qsf_net_http_size(qsf_net_http_t* h);
+
+// http server reference
+void qsf_net_set_http_udata(qsf_net_http_t* h, void* ud);
+void* qsf_net_get_http_udata(qsf_net_http_t* h);
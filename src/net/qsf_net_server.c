@@ -7,12 +7,51 @@
 #include <string.h>
 #include <assert.h>
 #include <uv.h>
+#include <zlib.h>
 #include "uthash.h"
 #include "qsf.h"
 #include "qsf_net_def.h"
+#include "qsf_net_cipher.h"
+#include "qsf_net_addr.h"
+#include "qsf_net_ws.h"
 
 #define START_SERIAL_NUMBER     1000
 #define DEFAULT_RECV_BUF_SIZE   128
+#define COMPRESS_MEM_LEVEL      5
+#define WS_RECV_BUF_SIZE        4096
+#define WS_MAX_RECV_BUF         (NET_WS_MAX_HEADER + UINT16_MAX + 1)
+
+// websocket session states
+#define WS_STATE_HANDSHAKE      0
+#define WS_STATE_OPEN           1
+#define WS_STATE_CLOSING        2
+
+// internal write flag, content is compressed by permessage-deflate
+#define WRITE_WS_DEFLATED       0x100
+
+// zlib streams of a compressed session
+typedef struct net_zstream_s
+{
+    z_stream    deflate;    // outbound stream
+    z_stream    inflate;    // inbound stream
+}net_zstream_t;
+
+// websocket state of a session
+typedef struct net_ws_s
+{
+    int         state;          // WS_STATE_*
+    net_ws_options_t options;   // negotiated extensions
+    z_stream    deflate;        // outbound permessage-deflate stream
+    z_stream    inflate;        // inbound permessage-deflate stream
+    char*       buf;            // unparsed inbound bytes
+    uint32_t    size;           // bytes in `buf`
+    uint32_t    capacity;       // size of `buf`
+    char*       message;        // fragments of current message
+    uint32_t    message_size;   // bytes in `message`
+    int         fragmented;     // a fragmented message in progress
+    int         compressed;     // current message is compressed
+    uint64_t    ping_time;      // last ping sent
+}net_ws_t;
 
 #pragma pack(push, 4)
 // a session object presents a client connection
@@ -22,37 +61,136 @@ typedef struct qsf_net_session_s
     uint32_t            serial;             // serial no.
     qsf_net_server_t*   server;             // server pointer
     uint64_t            last_recv_time;     // last recv time
-    uv_tcp_t            handle;             // tcp handle
-    struct sockaddr_in  peer_addr;          // peer address
+    net_stream_t        handle;             // tcp or pipe handle
+    struct sockaddr_storage peer_addr;      // peer address of tcp session
     uint32_t            buf_size;           // recv buffer size
     uint16_t            recv_bytes;         // total recieved bytes
     uint16_t            body_size;          // body bytes
     char*               recv_buf;           // recv buffer
+    uint32_t            backlog_bytes;      // bytes of held back frames
+    struct write_buffer_s* backlog_head;    // frames held back by send limit
+    struct write_buffer_s* backlog_tail;    // last held back frame
+    net_zstream_t*      zstream;            // compression streams
+    net_ws_t*           ws;                 // websocket state
+    qsf_net_cipher_t*   cipher;             // stream cipher
+    uint32_t*           groups;             // joined group ids
+    uint16_t            group_count;        // joined group count
+    uint16_t            group_capacity;     // size of group id array
+    int64_t             packet_tokens;      // frame tokens, in 1/1000 frame
+    int64_t             byte_tokens;        // byte tokens, in 1/1000 byte
+    uint64_t            refill_time;        // last token refill time
+    int                 paused;             // reading stopped by rate limit
+    char*               route;              // bound target name
+    int                 route_len;          // size of target name
+    uint64_t            linger_time;        // shutdown start, 0 if not lingering
+    int                 received;           // any byte received
+    int                 dispatching;        // reader runs for a frame of session
 }qsf_net_session_t;
 
+// kick reported to reader on next loop iteration
+typedef struct net_kick_s
+{
+    struct net_kick_s*  next;
+    uint32_t            serial;             // serial of removed session
+    int                 err;                // error code
+    const char*         msg;                // static message
+}net_kick_t;
+
+// sessions to receive multicast frames
+typedef struct qsf_net_group_s
+{
+    UT_hash_handle      hh;                 // hash table entry
+    uint32_t            gid;                // group id
+    uint32_t            size;               // member count
+    uint32_t            capacity;           // size of member array
+    qsf_net_session_t** members;            // member sessions
+}qsf_net_group_t;
+
 // net server object
 struct qsf_net_server_s
 {
+    uv_loop_t*  loop;               // event loop
+    int         pipe;               // listen on unix domain socket
     uint32_t    max_connection;     // maximum alive connections
     uint16_t    max_heart_beat;     // maximum heart-beat seconds
     uint16_t    heart_beat_check;   // maximum heart-beat checking seconds
     int         stopped;            // is server stopped
+    int         closing;            // handles pending close
+    int         destroyed;          // free after handles closed
     uint32_t    next_serial;        // next session serial no.
+    uint32_t    soft_limit;         // soft limit of pending write bytes
+    uint32_t    hard_limit;         // hard limit of pending write bytes
+    int         send_policy;        // policy above soft limit
+    uint32_t    packet_rate;        // received frames per second
+    uint32_t    byte_rate;          // received bytes per second
+    int         rate_policy;        // policy above receive rate
+    uint32_t    paused_count;       // sessions paused by rate limit
+    int         websocket;          // websocket framing of new sessions
+    int         compress;           // compress new sessions
+    int         compress_level;     // zlib compress level
+    uint16_t    compress_threshold; // minimal frame size to compress
+    char*       inflate_buf;        // inflated frame of any session
     void*       udata;              // user data pointer
     s_read_cb   on_read;            // read handler
-    uv_tcp_t    acceptor;           // tcp accept handle
+    s_forward_cb on_forward;        // handler of bound sessions
+    net_stream_t acceptor;          // tcp or pipe accept handle
     uv_timer_t  timer;              // heart-beat timer handle
+    uv_timer_t  rate_timer;         // resume paused sessions
+    uv_timer_t  kick_timer;         // report deferred kicks
+    net_kick_t* kick_head;          // kicks not reported yet
+    net_kick_t* kick_tail;
     qsf_net_session_t* session_map; // session hash map
+    qsf_net_session_t* linger_map;  // removed sessions flushing writes
+    qsf_net_group_t* group_map;     // multicast group hash map
+    qsf_net_server_stats_t stats;   // statistic counters
 };
 #pragma pack(pop)
 
+// index of histogram bucket of `value`
+static int stats_bucket(uint64_t value)
+{
+    int bucket = 0;
+    while (value > 0 && bucket < NET_STATS_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// a socket read is handled
+static void stats_read_done(qsf_net_server_t* server, ssize_t nread)
+{
+    server->stats.bytes_in += nread;
+}
+
+// room before content for the 2 bytes size prefix or a websocket header,
+// which is at most 4 bytes as server frames are unmasked and below 64KB
+#define WRITE_HEADROOM          4
+
 typedef struct write_buffer_s
 {
     uv_write_t  req;        // request handle
     uv_buf_t    buf;        // buffer object
+    struct write_buffer_s* next;    // next held back frame
+    int         flags;      // write flags
+    uint32_t    charged;    // bytes counted in backlog
+    uint32_t    capacity;   // content buffer size
+    uint16_t    size;       // content size
+    char*       data;       // content, WRITE_HEADROOM bytes into `mem`
+    char        mem[];      // headroom and content
+}write_buffer_t;
+
+// one frame shared by write requests of many sessions
+typedef struct multicast_buffer_s
+{
+    int         refcount;   // pending write requests
+    uv_buf_t    buf;        // shared frame
+    uv_write_t* reqs;       // one request per receiver
+    qsf_net_session_t** receivers; // receivers snapshot
     uint16_t    size;       // data size
     char        data[];     // data buffer
-}write_buffer_t;
+}multicast_buffer_t;
 
 
 // set a unique serial number to this session
@@ -81,10 +219,122 @@ static void set_session_serial(qsf_net_server_t* server, qsf_net_session_t* sess
     server->next_serial = serial + 1;
 }
 
+static qsf_net_group_t* group_find(qsf_net_server_t* server, uint32_t gid)
+{
+    qsf_net_group_t* group = NULL;
+    HASH_FIND_INT(server->group_map, &gid, group);
+    return group;
+}
+
+static void group_free(qsf_net_server_t* server, qsf_net_group_t* group)
+{
+    HASH_DEL(server->group_map, group);
+    qsf_free(group->members);
+    qsf_free(group);
+}
+
+// remove session from group, returns 0 if not a member
+static int group_remove(qsf_net_server_t* server, qsf_net_group_t* group, qsf_net_session_t* session)
+{
+    for (uint32_t i = 0; i < group->size; i++)
+    {
+        if (group->members[i] == session)
+        {
+            group->members[i] = group->members[--group->size];
+            if (group->size == 0)
+            {
+                group_free(server, group);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void session_leave_all(qsf_net_session_t* session)
+{
+    qsf_net_server_t* server = session->server;
+    for (uint16_t i = 0; i < session->group_count; i++)
+    {
+        qsf_net_group_t* group = group_find(server, session->groups[i]);
+        if (group)
+        {
+            group_remove(server, group, session);
+        }
+    }
+    session->group_count = 0;
+}
+
+static int session_compress_init(qsf_net_session_t* session)
+{
+    assert(session->zstream == NULL);
+    net_zstream_t* z = qsf_malloc(sizeof(net_zstream_t));
+    memset(z, 0, sizeof(*z));
+    int r = deflateInit2(&z->deflate, session->server->compress_level, Z_DEFLATED,
+        NET_COMPRESS_WINDOW_BITS, COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (r != Z_OK)
+    {
+        qsf_free(z);
+        return r;
+    }
+    r = inflateInit2(&z->inflate, NET_COMPRESS_WINDOW_BITS);
+    if (r != Z_OK)
+    {
+        deflateEnd(&z->deflate);
+        qsf_free(z);
+        return r;
+    }
+    session->zstream = z;
+    return 0;
+}
+
+static void session_compress_free(qsf_net_session_t* session)
+{
+    net_zstream_t* z = session->zstream;
+    if (z)
+    {
+        deflateEnd(&z->deflate);
+        inflateEnd(&z->inflate);
+        qsf_free(z);
+        session->zstream = NULL;
+    }
+}
+
+static void session_ws_free(qsf_net_session_t* session)
+{
+    net_ws_t* ws = session->ws;
+    if (ws)
+    {
+        if (ws->options.deflate)
+        {
+            deflateEnd(&ws->deflate);
+            inflateEnd(&ws->inflate);
+        }
+        qsf_free(ws->message);
+        qsf_free(ws->buf);
+        qsf_free(ws);
+        session->ws = NULL;
+    }
+}
+
 static void on_session_close(uv_handle_t* handle)
 {
     qsf_net_session_t* session = handle->data;
     assert(session);
+    session_compress_free(session);
+    session_ws_free(session);
+    if (session->cipher)
+    {
+        qsf_net_cipher_destroy(session->cipher);
+    }
+    while (session->backlog_head)
+    {
+        write_buffer_t* buffer = session->backlog_head;
+        session->backlog_head = buffer->next;
+        qsf_free(buffer);
+    }
+    qsf_free(session->groups);
+    qsf_free(session->route);
     qsf_free(session->recv_buf);
     qsf_free(session);
 }
@@ -99,22 +349,373 @@ static void session_destroy(qsf_net_session_t* session)
     }
 }
 
+// remove session from server, its handle is closed by caller
+static void session_detach(qsf_net_session_t* session)
+{
+    qsf_net_server_t* server = session->server;
+    if (session->paused)
+    {
+        session->paused = 0;
+        server->paused_count--;
+    }
+    if (session->route && server->on_forward)
+    {
+        server->on_forward(session->serial, session->route, session->route_len,
+            NULL, 0, server->udata);
+    }
+    session_leave_all(session);
+    HASH_DEL(server->session_map, session);
+}
+
+// remove session from server and close it
+static void session_remove(qsf_net_session_t* session)
+{
+    session_detach(session);
+    session_destroy(session);
+}
+
+// close a lingering session, by shutdown or timeout
+static void linger_close(qsf_net_session_t* session)
+{
+    if (session->linger_time > 0)
+    {
+        HASH_DEL(session->server->linger_map, session);
+        session->linger_time = 0;
+        session_destroy(session);
+    }
+}
+
+static void on_session_linger(uv_shutdown_t* req, int err)
+{
+    qsf_net_session_t* session = req->data;
+    qsf_free(req);
+    linger_close(session); // canceled if timed out already
+}
+
+// remove session from server, close it after pending writes are sent
+// or heart-beat timeout elapsed, whichever comes first
+static void session_linger(qsf_net_session_t* session)
+{
+    qsf_net_server_t* server = session->server;
+    session_detach(session);
+    session->linger_time = QSF_MAX(uv_now(server->loop), 1);
+    HASH_ADD_INT(server->linger_map, serial, session);
+    uv_read_stop((uv_stream_t*)&session->handle);
+    uv_shutdown_t* req = qsf_malloc(sizeof(uv_shutdown_t));
+    req->data = session;
+    int r = uv_shutdown(req, (uv_stream_t*)&session->handle, on_session_linger);
+    if (r < 0)
+    {
+        qsf_free(req);
+        linger_close(session);
+    }
+}
+
+// remove session and report the reason to reader
+static void session_kick(qsf_net_session_t* session, int err, const char* msg)
+{
+    qsf_net_server_t* server = session->server;
+    uint32_t serial = session->serial;
+    server->stats.kicked++;
+    session_remove(session);
+    server->on_read(err, serial, msg, (uint16_t)strlen(msg), server->udata);
+}
+
+static void kick_timer_cb(uv_timer_t* timer)
+{
+    qsf_net_server_t* server = timer->data;
+    net_kick_t* kick = server->kick_head;
+    server->kick_head = NULL;
+    server->kick_tail = NULL;
+    while (kick)
+    {
+        net_kick_t* next = kick->next;
+        server->on_read(kick->err, kick->serial, kick->msg, 
+            (uint16_t)strlen(kick->msg), server->udata);
+        qsf_free(kick);
+        kick = next;
+    }
+}
+
+// report a removed session to reader on next loop iteration
+static void report_later(qsf_net_server_t* server, uint32_t serial, int err, const char* msg)
+{
+    net_kick_t* kick = qsf_malloc(sizeof(net_kick_t));
+    kick->next = NULL;
+    kick->serial = serial;
+    kick->err = err;
+    kick->msg = msg;
+    if (server->kick_tail)
+    {
+        server->kick_tail->next = kick;
+    }
+    else
+    {
+        server->kick_head = kick;
+        uv_timer_start(&server->kick_timer, kick_timer_cb, 0, 0);
+    }
+    server->kick_tail = kick;
+}
+
+// remove session now and report the reason on next loop iteration,
+// used by write paths so reader is never run inside a write call.
+static void session_kick_later(qsf_net_session_t* session, int err, const char* msg)
+{
+    qsf_net_server_t* server = session->server;
+    uint32_t serial = session->serial;
+    server->stats.kicked++;
+    session_remove(session);
+    report_later(server, serial, err, msg);
+}
+
+// decode content of a compressed session in place or into `inflate_buf`
+static int session_inflate(qsf_net_session_t* session, char** data, uint16_t* size)
+{
+    const char* body = *data;
+    uint16_t len = *size;
+    if (len == 0)
+    {
+        return Z_DATA_ERROR;
+    }
+    if (body[0] == NET_FRAME_RAW)
+    {
+        *data += 1;
+        *size -= 1;
+        return 0;
+    }
+    if (body[0] != NET_FRAME_DEFLATED)
+    {
+        return Z_DATA_ERROR;
+    }
+    qsf_net_server_t* server = session->server;
+    if (server->inflate_buf == NULL)
+    {
+        server->inflate_buf = qsf_malloc(UINT16_MAX);
+    }
+    z_stream* strm = &session->zstream->inflate;
+    strm->next_in = (Bytef*)body + 1;
+    strm->avail_in = len - 1;
+    strm->next_out = (Bytef*)server->inflate_buf;
+    strm->avail_out = UINT16_MAX;
+    int r = inflate(strm, Z_SYNC_FLUSH);
+    if (r != Z_OK || strm->avail_in != 0)
+    {
+        return (r != Z_OK ? r : Z_BUF_ERROR);
+    }
+    *data = server->inflate_buf;
+    *size = (uint16_t)(UINT16_MAX - strm->avail_out);
+    return 0;
+}
+
 // create an session
 static qsf_net_session_t* session_create(uv_loop_t* loop, qsf_net_server_t* server)
 {
     assert(loop && server);
     qsf_net_session_t* session = qsf_malloc(sizeof(qsf_net_session_t));
     memset(session, 0, sizeof(*session));
-    int r = uv_tcp_init(loop, &session->handle);
-    qsf_assert(r == 0, "session: uv_tcp_init() failed");
-    session->handle.data = session;
+    int r = (server->pipe ? uv_pipe_init(loop, &session->handle.pipe, 0) 
+        : uv_tcp_init(loop, &session->handle.tcp));
+    qsf_assert(r == 0, "session: init handle failed");
+    session->handle.stream.data = session;
     session->server = server;
     session->last_recv_time = uv_now(loop);
+    session->refill_time = session->last_recv_time;
+    session->packet_tokens = (int64_t)server->packet_rate * 1000;
+    session->byte_tokens = (int64_t)server->byte_rate * 1000;
     session->buf_size = DEFAULT_RECV_BUF_SIZE;
     session->recv_buf = qsf_malloc(DEFAULT_RECV_BUF_SIZE);
     return session;
 }
 
+// refill token buckets by elapsed time, one second of tokens at most
+static void session_refill(qsf_net_session_t* session, uint64_t now)
+{
+    qsf_net_server_t* server = session->server;
+    uint64_t elapsed = now - session->refill_time;
+    session->refill_time = now;
+    if (server->packet_rate > 0)
+    {
+        int64_t limit = (int64_t)server->packet_rate * 1000;
+        session->packet_tokens += (int64_t)(elapsed * server->packet_rate);
+        if (session->packet_tokens > limit)
+        {
+            session->packet_tokens = limit;
+        }
+    }
+    if (server->byte_rate > 0)
+    {
+        int64_t limit = (int64_t)server->byte_rate * 1000;
+        session->byte_tokens += (int64_t)(elapsed * server->byte_rate);
+        if (session->byte_tokens > limit)
+        {
+            session->byte_tokens = limit;
+        }
+    }
+}
+
+static int session_in_debt(qsf_net_session_t* session)
+{
+    return session->packet_tokens < 0 || session->byte_tokens < 0;
+}
+
+static void on_session_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf);
+static void on_session_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+static void on_ws_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf);
+static void on_ws_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+static net_ws_t* ws_create(void);
+static void session_ws_process(qsf_net_session_t* session);
+static int session_ws_control(qsf_net_session_t* session, 
+                              int opcode, 
+                              const char* payload,
+                              uint16_t size);
+static void rate_timer_cb(uv_timer_t* timer);
+
+// charge a frame of `size` bytes before its body is read, 
+// returns non-zero if the session was kicked.
+static int session_charge(qsf_net_session_t* session, uint16_t size)
+{
+    qsf_net_server_t* server = session->server;
+    if (server->packet_rate == 0 && server->byte_rate == 0)
+    {
+        return 0;
+    }
+    session_refill(session, uv_now(session->handle.stream.loop));
+    if (server->packet_rate > 0)
+    {
+        session->packet_tokens -= 1000;
+    }
+    if (server->byte_rate > 0)
+    {
+        session->byte_tokens -= (int64_t)(size + sizeof(uint16_t)) * 1000;
+    }
+    if (!session_in_debt(session))
+    {
+        return 0;
+    }
+    if (server->rate_policy == NET_RATE_KICK)
+    {
+        session_kick(session, NET_ERR_RATE_LIMIT, "receive rate limit");
+        return 1;
+    }
+    // body is read after tokens are paid back
+    uv_read_stop((uv_stream_t*)&session->handle);
+    session->paused = 1;
+    if (server->paused_count++ == 0)
+    {
+        uv_timer_start(&server->rate_timer, rate_timer_cb, NET_RATE_TICK, NET_RATE_TICK);
+    }
+    return 0;
+}
+
+static void session_resume(qsf_net_session_t* session)
+{
+    qsf_net_server_t* server = session->server;
+    session->paused = 0;
+    server->paused_count--;
+    if (session->ws) // frames left in buffer go first
+    {
+        session_ws_process(session);
+        if (session->paused || uv_is_closing((uv_handle_t*)&session->handle) ||
+            session->ws->state != WS_STATE_OPEN)
+        {
+            return;
+        }
+    }
+    int r = uv_read_start((uv_stream_t*)&session->handle, 
+        (session->ws ? on_ws_alloc : on_session_alloc), 
+        (session->ws ? on_ws_read : on_session_read));
+    if (r < 0)
+    {
+        session_kick(session, r, uv_strerror(r));
+    }
+}
+
+// decode message of a permessage-deflate session into `inflate_buf`
+static int session_ws_inflate(qsf_net_session_t* session, char** data, uint16_t* size)
+{
+    qsf_net_server_t* server = session->server;
+    if (server->inflate_buf == NULL)
+    {
+        server->inflate_buf = qsf_malloc(UINT16_MAX);
+    }
+    z_stream* strm = &session->ws->inflate;
+    strm->next_in = (Bytef*)*data;
+    strm->avail_in = *size;
+    strm->next_out = (Bytef*)server->inflate_buf;
+    strm->avail_out = UINT16_MAX;
+    int r = inflate(strm, Z_SYNC_FLUSH);
+    if (r == Z_OK || r == Z_BUF_ERROR) // restore the removed flush marker
+    {
+        strm->next_in = (Bytef*)NET_WS_DEFLATE_TAIL;
+        strm->avail_in = sizeof(NET_WS_DEFLATE_TAIL) - 1;
+        r = inflate(strm, Z_SYNC_FLUSH);
+    }
+    if (r == Z_STREAM_END) // final block, peer starts a new stream
+    {
+        r = inflateReset(strm);
+    }
+    if ((r != Z_OK && r != Z_BUF_ERROR) || strm->avail_in != 0)
+    {
+        return (r != Z_OK ? r : Z_BUF_ERROR);
+    }
+    *data = server->inflate_buf;
+    *size = (uint16_t)(UINT16_MAX - strm->avail_out);
+    return 0;
+}
+
+// decode a received frame and pass it to reader or forward handler
+static void session_dispatch(qsf_net_session_t* session, char* data, uint16_t size)
+{
+    qsf_net_server_t* server = session->server;
+    if (session->cipher)
+    {
+        int len = qsf_net_cipher_decrypt(session->cipher, (uint8_t*)data, size);
+        if (len < 0)
+        {
+            session_kick(session, NET_ERR_BAD_FRAME, "decrypt frame failed");
+            return;
+        }
+        size = (uint16_t)len;
+    }
+    if (session->ws)
+    {
+        if (session->ws->compressed && session_ws_inflate(session, &data, &size) != 0)
+        {
+            session_kick(session, NET_ERR_BAD_FRAME, "invalid compressed message");
+            return;
+        }
+    }
+    else if (session->zstream && session_inflate(session, &data, &size) != 0)
+    {
+        session_kick(session, NET_ERR_BAD_FRAME, "invalid compressed frame");
+        return;
+    }
+    if (size == 0)
+    {
+        return;
+    }
+    server->stats.frames_in++;
+    if (session->route && server->on_forward)
+    {
+        server->on_forward(session->serial, session->route, session->route_len,
+            data, size, server->udata);
+    }
+    else
+    {
+        uint64_t start = uv_hrtime();
+        uint32_t serial = session->serial;
+        session->dispatching = 1;
+        server->on_read(0, serial, data, size, server->udata);
+        HASH_FIND_INT(server->session_map, &serial, session);
+        if (session) // reader may close it
+        {
+            session->dispatching = 0;
+        }
+        uint64_t elapsed = (uv_hrtime() - start) / 1000;
+        server->stats.read_latency[stats_bucket(elapsed)]++;
+    }
+}
+
 static void on_session_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf)
 {
     qsf_net_session_t* s = handle->data;
@@ -143,13 +744,14 @@ static void on_session_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t*
         if (nread < 0)
         {
             const char* msg = uv_strerror((int)nread);
-            cb((int)nread, session->serial, msg, (uint16_t)strlen(msg), server->udata);
-            HASH_DEL(server->session_map, session);
-            session_destroy(session);
+            uint32_t serial = session->serial;
+            session_remove(session); // reader sees it gone, as in session_kick
+            cb((int)nread, serial, msg, (uint16_t)strlen(msg), server->udata);
         }
         return;
     }
     session->last_recv_time = uv_now(stream->loop);
+    session->received = 1;
     session->recv_bytes += (uint16_t)nread;
     uint16_t size = session->body_size;
     if (size == 0) // header not full-filled
@@ -159,6 +761,11 @@ static void on_session_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t*
             memcpy(&size, session->recv_buf, sizeof(size));
             session->body_size = ntohs(size); // network order
             session->recv_bytes = 0;
+            if (session_charge(session, session->body_size) != 0)
+            {
+                stats_read_done(server, nread);
+                return;
+            }
             if (session->body_size > session->buf_size) // extending recv buffer
             {
                 qsf_free(session->recv_buf);
@@ -173,9 +780,10 @@ static void on_session_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t*
         {
             session->recv_bytes = 0;
             session->body_size = 0;
-            cb(0, session->serial, session->recv_buf, size, server->udata);
+            session_dispatch(session, session->recv_buf, size);
         }
     }
+    stats_read_done(server, nread);
 }
 
 // on client accept
@@ -196,6 +804,7 @@ static void on_connection(uv_stream_t* stream, int err)
     if (count >= server->max_connection)
     {
         const char* msg = "max connection count limit";
+        server->stats.rejected++;
         server->on_read(NET_ERR_CONN_LIMIT, 0, msg, (uint16_t)strlen(msg), server->udata);
         return;
     }
@@ -208,23 +817,45 @@ static void on_connection(uv_stream_t* stream, int err)
         qsf_log("accept failed, %d: %s\n", r, uv_strerror(r));
         return;
     }
-    int namelen = sizeof(session->peer_addr);
-    r = uv_tcp_getpeername(&session->handle, (struct sockaddr*)&session->peer_addr, &namelen);
-    if (r < 0)
+    if (!server->pipe)
     {
-        session_destroy(session);
-        qsf_log("getpeername failed, %d: %s\n", r, uv_strerror(r));
-        return;
+        int namelen = sizeof(session->peer_addr);
+        r = uv_tcp_getpeername(&session->handle.tcp, (struct sockaddr*)&session->peer_addr, &namelen);
+        if (r < 0)
+        {
+            session_destroy(session);
+            qsf_log("getpeername failed, %d: %s\n", r, uv_strerror(r));
+            return;
+        }
+    }
+    if (server->websocket)
+    {
+        session->ws = ws_create();
+        r = uv_read_start(handle, on_ws_alloc, on_ws_read);
+    }
+    else
+    {
+        r = uv_read_start(handle, on_session_alloc, on_session_read);
     }
-    r = uv_read_start(handle, on_session_alloc, on_session_read);
     if (r < 0)
     {
         session_destroy(session);
         qsf_log("start read failed, %d: %s\n", r, uv_strerror(r));
         return;
     }
+    if (server->compress && !server->websocket)
+    {
+        r = session_compress_init(session);
+        if (r != 0)
+        {
+            session_destroy(session);
+            qsf_log("compress init failed, %d\n", r);
+            return;
+        }
+    }
     set_session_serial(server, session);
     HASH_ADD_INT(server->session_map, serial, session);
+    server->stats.accepted++;
 }
 
 // heart beat checking
@@ -240,34 +871,99 @@ static void hearbeat_timer_cb(uv_timer_t* timer)
     {
         if (now - session->last_recv_time > max_expire)
         {
-            const char* msg = "session timeout";
-            server->on_read(NET_ERR_TIMEOUT, session->serial, msg, (uint16_t)strlen(msg), server->udata);
-            HASH_DEL(server->session_map, session);
-            session_destroy(session);
+            // reader may close other sessions, not run while iterating
+            uint32_t serial = session->serial;
+            server->stats.timeouts++;
+            session_remove(session);
+            report_later(server, serial, NET_ERR_TIMEOUT, "session timeout");
+        }
+        else if (session->ws && session->ws->state == WS_STATE_OPEN &&
+            now - session->last_recv_time > max_expire / 2 &&
+            session->ws->ping_time < session->last_recv_time)
+        {
+            // browsers answer ping without application code
+            session->ws->ping_time = now;
+            session_ws_control(session, NET_WS_OP_PING, NULL, 0);
+        }
+    }
+    HASH_ITER(hh, server->linger_map, session, tmp)
+    {
+        if (now - session->linger_time > max_expire)
+        {
+            linger_close(session);
         }
     }
 }
 
-qsf_net_server_t* qsf_create_net_server(uv_loop_t* loop,
-                                        uint32_t max_connection,
-                                        uint16_t max_heart_beat,
-                                        uint16_t heart_beat_check)
+// resume paused sessions which paid back their tokens
+static void rate_timer_cb(uv_timer_t* timer)
 {
-    assert(loop);
+    qsf_net_server_t* server = timer->data;
+    assert(server);
+    qsf_net_session_t* session = NULL;
+    qsf_net_session_t* tmp = NULL;
+    uint64_t now = uv_now(timer->loop);
+    HASH_ITER(hh, server->session_map, session, tmp)
+    {
+        if (session->paused)
+        {
+            session_refill(session, now);
+            if (!session_in_debt(session))
+            {
+                session_resume(session);
+            }
+        }
+    }
+    if (server->paused_count == 0)
+    {
+        uv_timer_stop(timer);
+    }
+}
+
+static void server_free(qsf_net_server_t* s)
+{
+    qsf_free(s->inflate_buf);
+    qsf_free(s);
+}
+
+// server handles are closed before it is freed
+static void on_server_close(uv_handle_t* handle)
+{
+    qsf_net_server_t* s = handle->data;
+    assert(s && s->closing > 0);
+    s->closing--;
+    if (s->closing == 0 && s->destroyed)
+    {
+        server_free(s);
+    }
+}
+
+qsf_net_server_t* qsf_create_net_server(uv_loop_t* loop,
+                                        uint32_t max_connection,
+                                        uint16_t max_heart_beat,
+                                        uint16_t heart_beat_check)
+{
+    assert(loop);
     qsf_net_server_t* server = qsf_malloc(sizeof(qsf_net_server_t));
     qsf_assert(server != NULL, "create_server() failed.");
     memset(server, 0, sizeof(*server));
-    int r = uv_tcp_init(loop, &server->acceptor);
-    qsf_assert(r == 0, "uv_tcp_init() failed."); 
-    r = uv_timer_init(loop, &server->timer);
+    int r = uv_timer_init(loop, &server->timer);
     qsf_assert(r == 0, "uv_tcp_init() failed.");
+    r = uv_timer_init(loop, &server->rate_timer);
+    qsf_assert(r == 0, "uv_timer_init() failed.");
+    server->rate_timer.data = server;
+    r = uv_timer_init(loop, &server->kick_timer);
+    qsf_assert(r == 0, "uv_timer_init() failed.");
+    server->kick_timer.data = server;
     
-    server->acceptor.data = server;
+    server->loop = loop;
     server->timer.data = server;
     server->max_connection = max_connection;
     server->max_heart_beat = max_heart_beat;
     server->heart_beat_check = heart_beat_check;
     server->next_serial = START_SERIAL_NUMBER;
+    server->compress_level = NET_DEFAULT_COMPRESS_LEVEL;
+    server->compress_threshold = NET_DEFAULT_COMPRESS_THRESHOLD;
     return server;
 }
 
@@ -275,7 +971,11 @@ void qsf_net_server_destroy(qsf_net_server_t* s)
 {
     assert(s);
     qsf_net_server_stop(s);
-    qsf_free(s);
+    s->destroyed = 1;
+    if (s->closing == 0)
+    {
+        server_free(s);
+    }
 }
 
 int qsf_net_server_start(qsf_net_server_t* s,
@@ -285,18 +985,37 @@ int qsf_net_server_start(qsf_net_server_t* s,
 {
     assert(s && host && on_read);
     s->on_read = on_read;
-    struct sockaddr_in addr;
-    int r = uv_ip4_addr(host, port, &addr);
-    if (r < 0)
+    if (s->acceptor.stream.type != UV_UNKNOWN_HANDLE)
     {
-        return r;
+        return UV_EALREADY;
+    }
+    int r = 0;
+    const char* path = qsf_net_pipe_name(host);
+    if (path)
+    {
+        r = uv_pipe_init(s->loop, &s->acceptor.pipe, 0);
+        qsf_assert(r == 0, "uv_pipe_init() failed.");
+        s->pipe = 1;
+        r = uv_pipe_bind(&s->acceptor.pipe, path);
+    }
+    else
+    {
+        struct sockaddr_storage addr;
+        r = uv_tcp_init(s->loop, &s->acceptor.tcp);
+        qsf_assert(r == 0, "uv_tcp_init() failed.");
+        s->pipe = 0;
+        r = qsf_net_resolve(host, port, &addr);
+        if (r == 0)
+        {
+            r = uv_tcp_bind(&s->acceptor.tcp, (const struct sockaddr*)&addr, 0);
+        }
     }
-    r = uv_tcp_bind(&s->acceptor, (const struct sockaddr*)&addr, 0);
+    s->acceptor.stream.data = s;
     if (r < 0)
     {
         return r;
     }
-    r =  uv_listen((uv_stream_t*)&s->acceptor, SOMAXCONN, on_connection);
+    r = uv_listen(&s->acceptor.stream, SOMAXCONN, on_connection);
     if (r < 0)
     {
         return r;
@@ -318,37 +1037,249 @@ void qsf_net_server_stop(qsf_net_server_t* s)
     s->stopped = 1;
     HASH_ITER(hh, s->session_map, session, tmp)
     {
-        HASH_DEL(s->session_map, session);
-        session_destroy(session);
+        session_remove(session);
+    }
+    HASH_ITER(hh, s->linger_map, session, tmp) // no timer to bound them
+    {
+        linger_close(session);
     }
     uv_timer_stop(&s->timer);
+    uv_timer_stop(&s->rate_timer);
+    uv_timer_stop(&s->kick_timer);
+    while (s->kick_head) // not reported after stop
+    {
+        net_kick_t* kick = s->kick_head;
+        s->kick_head = kick->next;
+        qsf_free(kick);
+    }
+    s->kick_tail = NULL;
     uv_handle_t* acceptor = (uv_handle_t*)&s->acceptor;
     uv_handle_t* timer = (uv_handle_t*)&s->timer;
+    uv_handle_t* rate_timer = (uv_handle_t*)&s->rate_timer;
+    uv_handle_t* kick_timer = (uv_handle_t*)&s->kick_timer;
     if (!uv_is_closing(timer))
     {
-        uv_close(timer, NULL);
+        uv_close(timer, on_server_close);
+        s->closing++;
     }
-    if (!uv_is_closing(acceptor))
+    if (!uv_is_closing(rate_timer))
     {
-        uv_close(acceptor, NULL);
+        uv_close(rate_timer, on_server_close);
+        s->closing++;
+    }
+    if (!uv_is_closing(kick_timer))
+    {
+        uv_close(kick_timer, on_server_close);
+        s->closing++;
+    }
+    if (acceptor->type != UV_UNKNOWN_HANDLE && !uv_is_closing(acceptor))
+    {
+        uv_close(acceptor, on_server_close);
+        s->closing++;
     }
 }
 
+static uint32_t session_pending(qsf_net_session_t* session)
+{
+    return (uint32_t)session->handle.stream.write_queue_size + session->backlog_bytes;
+}
+
+static void session_flush_backlog(qsf_net_session_t* session);
+static write_buffer_t* session_ws_deflate(qsf_net_session_t* session, write_buffer_t* buffer);
+static void session_ws_seal(write_buffer_t* buffer);
+
 static void session_write_cb(uv_write_t* req, int err)
 {
     write_buffer_t* buffer = req->data;
+    qsf_net_session_t* session = req->handle->data;
     qsf_free(buffer);
+    if (err == 0 && session->backlog_head != NULL && 
+        !uv_is_closing((uv_handle_t*)req->handle))
+    {
+        session_flush_backlog(session);
+    }
 }
 
-int do_session_write(qsf_net_session_t* session, const void* data, uint16_t size)
+static write_buffer_t* write_buffer_alloc(uint32_t capacity, int flags)
 {
-    assert(session && data && size);
-    write_buffer_t* buffer = qsf_malloc(sizeof(write_buffer_t) + size);
+    write_buffer_t* buffer = qsf_malloc(sizeof(write_buffer_t) + WRITE_HEADROOM + capacity);
     buffer->req.data = buffer;
-    buffer->size = htons(size); //network order
+    buffer->data = buffer->mem + WRITE_HEADROOM;
+    buffer->size = 0;
+    buffer->next = NULL;
+    buffer->flags = flags;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+// set frame header of `size` content bytes
+static void write_buffer_seal(write_buffer_t* buffer, uint16_t size)
+{
+    uint16_t header = htons(size); //network order
+    buffer->size = size;
+    buffer->buf.base = buffer->data - sizeof(header);
+    buffer->buf.len = sizeof(header) + size;
+    memcpy(buffer->buf.base, &header, sizeof(header));
+}
+
+// `extra` bytes are reserved for cipher overhead
+static write_buffer_t* write_buffer_create(const void* data, 
+                                           uint16_t size, 
+                                           uint32_t extra, 
+                                           int flags)
+{
+    write_buffer_t* buffer = write_buffer_alloc(size + extra, flags);
     memcpy(buffer->data, data, size);
-    buffer->buf.base = (char*)&buffer->size; // memory layout dependency
-    buffer->buf.len = sizeof(size) + size;
+    write_buffer_seal(buffer, size);
+    return buffer;
+}
+
+// content size of a sealed buffer
+static uint16_t write_buffer_size(write_buffer_t* buffer)
+{
+    return buffer->size;
+}
+
+// bytes appended to each frame by session cipher
+static uint32_t session_overhead(qsf_net_session_t* session)
+{
+    if (session->cipher)
+    {
+        return (uint32_t)qsf_net_cipher_overhead(session->cipher);
+    }
+    return 0;
+}
+
+// bytes a frame of `size` takes on the wire, counting frame type byte of
+// compression, cipher tag and websocket header. deflate savings are not
+// known before encoding and are ignored.
+static uint32_t session_frame_bytes(qsf_net_session_t* session, uint16_t size)
+{
+    uint32_t len = size + session_overhead(session);
+    if (session->zstream)
+    {
+        len += 1;
+    }
+    if (session->ws)
+    {
+        return len + (len < 126 ? 2 : 4);
+    }
+    return len + sizeof(size);
+}
+
+// encrypt frame in place, reallocate if no room for overhead. NULL if failed
+static write_buffer_t* session_encrypt(qsf_net_session_t* session, write_buffer_t* buffer)
+{
+    uint16_t size = write_buffer_size(buffer);
+    uint32_t overhead = session_overhead(session);
+    if (size + overhead > UINT16_MAX)
+    {
+        qsf_free(buffer);
+        return NULL;
+    }
+    if (size + overhead > buffer->capacity) // cipher installed after queued
+    {
+        write_buffer_t* out = write_buffer_create(buffer->data, size, overhead, buffer->flags);
+        qsf_free(buffer);
+        buffer = out;
+    }
+    int len = qsf_net_cipher_encrypt(session->cipher, (uint8_t*)buffer->data, size,
+        (int)buffer->capacity);
+    if (len < 0)
+    {
+        qsf_free(buffer);
+        return NULL;
+    }
+    write_buffer_seal(buffer, (uint16_t)len);
+    return buffer;
+}
+
+// encode frame by the session's deflate stream, NULL if failed
+static write_buffer_t* session_deflate(qsf_net_session_t* session, write_buffer_t* buffer)
+{
+    z_stream* strm = &session->zstream->deflate;
+    uint16_t size = write_buffer_size(buffer);
+    int deflated = (size >= session->server->compress_threshold);
+    uint32_t overhead = session_overhead(session);
+    uint32_t capacity = 1 + size;
+    if (deflated)
+    {
+        // sync flush marker and block headers are not counted by deflateBound()
+        capacity = 1 + (uint32_t)deflateBound(strm, size) + 16;
+    }
+    capacity = QSF_MIN(capacity, UINT16_MAX - overhead);
+    write_buffer_t* out = write_buffer_alloc(capacity + overhead, buffer->flags);
+    uint32_t length = 1 + size;
+    if (deflated)
+    {
+        out->data[0] = NET_FRAME_DEFLATED;
+        strm->next_in = (Bytef*)buffer->data;
+        strm->avail_in = size;
+        strm->next_out = (Bytef*)out->data + 1;
+        strm->avail_out = capacity - 1;
+        int r = deflate(strm, Z_SYNC_FLUSH);
+        if (r != Z_OK || strm->avail_in != 0 || strm->avail_out == 0)
+        {
+            qsf_free(out);
+            return NULL;
+        }
+        length = capacity - strm->avail_out;
+    }
+    else
+    {
+        if (length > capacity)
+        {
+            qsf_free(out);
+            return NULL;
+        }
+        out->data[0] = NET_FRAME_RAW;
+        memcpy(out->data + 1, buffer->data, size);
+    }
+    write_buffer_seal(out, (uint16_t)length);
+    qsf_free(buffer);
+    return out;
+}
+
+static int session_transmit(qsf_net_session_t* session, write_buffer_t* buffer)
+{
+    net_ws_t* ws = session->ws;
+    if (ws && ws->options.deflate && 
+        write_buffer_size(buffer) >= session->server->compress_threshold)
+    {
+        write_buffer_t* out = session_ws_deflate(session, buffer);
+        if (out == NULL)
+        {
+            qsf_free(buffer);
+            session_kick_later(session, NET_ERR_BAD_FRAME, "compress message failed");
+            return NET_ERR_BAD_FRAME;
+        }
+        buffer = out;
+    }
+    else if (session->zstream)
+    {
+        write_buffer_t* out = session_deflate(session, buffer);
+        if (out == NULL)
+        {
+            qsf_free(buffer);
+            session_kick_later(session, NET_ERR_BAD_FRAME, "compress frame failed");
+            return NET_ERR_BAD_FRAME;
+        }
+        buffer = out;
+    }
+    if (session->cipher)
+    {
+        buffer = session_encrypt(session, buffer);
+        if (buffer == NULL)
+        {
+            session_kick_later(session, NET_ERR_BAD_FRAME, "encrypt frame failed");
+            return NET_ERR_BAD_FRAME;
+        }
+    }
+    if (ws)
+    {
+        session_ws_seal(buffer);
+    }
+    size_t len = buffer->buf.len;
     int r = uv_write(&buffer->req, (uv_stream_t*)&session->handle, &buffer->buf,
         1, session_write_cb);
     if (r < 0)
@@ -356,13 +1287,547 @@ int do_session_write(qsf_net_session_t* session, const void* data, uint16_t size
         qsf_free(buffer);
         return r;
     }
+    session->server->stats.frames_out++;
+    session->server->stats.bytes_out += len;
     return 0;
 }
 
+// send held back frames while under soft limit
+static void session_flush_backlog(qsf_net_session_t* session)
+{
+    uint32_t soft_limit = session->server->soft_limit;
+    while (session->backlog_head != NULL)
+    {
+        if (uv_is_closing((uv_handle_t*)&session->handle) ||
+            (soft_limit > 0 && session->handle.stream.write_queue_size >= soft_limit))
+        {
+            break;
+        }
+        write_buffer_t* buffer = session->backlog_head;
+        session->backlog_head = buffer->next;
+        if (session->backlog_head == NULL)
+        {
+            session->backlog_tail = NULL;
+        }
+        session->backlog_bytes -= buffer->charged;
+        session_transmit(session, buffer);
+    }
+}
+
+// discard oldest droppable frames until `need` bytes fit in hard limit
+static void session_drop_backlog(qsf_net_session_t* session, uint32_t need)
+{
+    uint32_t hard_limit = session->server->hard_limit;
+    write_buffer_t** pptr = &session->backlog_head;
+    write_buffer_t* prev = NULL;
+    while (*pptr && session_pending(session) + need > hard_limit)
+    {
+        write_buffer_t* buffer = *pptr;
+        if (buffer->flags & NET_WRITE_DROPPABLE)
+        {
+            *pptr = buffer->next;
+            if (buffer->next == NULL)
+            {
+                session->backlog_tail = prev;
+            }
+            session->backlog_bytes -= buffer->charged;
+            qsf_free(buffer);
+        }
+        else
+        {
+            prev = buffer;
+            pptr = &buffer->next;
+        }
+    }
+}
+
+// apply send limit to a frame of `size` bytes.
+// returns 0 to send it now, 1 to hold it back, otherwise frame is rejected
+static int session_admit(qsf_net_session_t* session, uint16_t size, int flags)
+{
+    qsf_net_server_t* server = session->server;
+    if (uv_is_closing((uv_handle_t*)&session->handle))
+    {
+        return UV_EPIPE;
+    }
+    if (session->ws && session->ws->state != WS_STATE_OPEN)
+    {
+        return UV_EAGAIN;
+    }
+    uint32_t need = session_frame_bytes(session, size);
+    uint32_t pending = session_pending(session) + need;
+    int hold = (session->backlog_head != NULL); // keep frames in order
+    if (server->soft_limit > 0 && pending > server->soft_limit)
+    {
+        switch (server->send_policy)
+        {
+        case NET_SEND_KICK:
+            session_kick_later(session, NET_ERR_SEND_OVERFLOW, "send queue overflow");
+            return NET_ERR_SEND_OVERFLOW;
+        case NET_SEND_DROP_NEWEST:
+            if (flags & NET_WRITE_DROPPABLE)
+            {
+                return NET_ERR_SEND_OVERFLOW;
+            }
+            break;
+        case NET_SEND_DROP_OLDEST:
+            hold = 1;
+            break;
+        }
+    }
+    if (server->hard_limit > 0 && pending > server->hard_limit)
+    {
+        if (server->send_policy == NET_SEND_DROP_OLDEST)
+        {
+            session_drop_backlog(session, need);
+        }
+        if (session_pending(session) + need > server->hard_limit)
+        {
+            if (!(flags & NET_WRITE_DROPPABLE))
+            {
+                session_kick_later(session, NET_ERR_SEND_OVERFLOW, "send queue overflow");
+            }
+            return NET_ERR_SEND_OVERFLOW;
+        }
+    }
+    return hold;
+}
+
+static void session_hold(qsf_net_session_t* session, write_buffer_t* buffer)
+{
+    if (session->backlog_tail)
+    {
+        session->backlog_tail->next = buffer;
+    }
+    else
+    {
+        session->backlog_head = buffer;
+    }
+    session->backlog_tail = buffer;
+    buffer->charged = session_frame_bytes(session, write_buffer_size(buffer));
+    session->backlog_bytes += buffer->charged;
+}
+
+static int do_session_write(qsf_net_session_t* session, 
+                            const void* data, 
+                            uint16_t size,
+                            int flags)
+{
+    assert(session && data && size);
+    int r = session_admit(session, size, flags);
+    if (r != 0 && r != 1)
+    {
+        return r;
+    }
+    write_buffer_t* buffer = write_buffer_create(data, size, session_overhead(session), flags);
+    if (r == 1)
+    {
+        session_hold(session, buffer);
+        return 0;
+    }
+    return session_transmit(session, buffer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// websocket framing
+
+static net_ws_t* ws_create(void)
+{
+    net_ws_t* ws = qsf_malloc(sizeof(net_ws_t));
+    memset(ws, 0, sizeof(*ws));
+    ws->state = WS_STATE_HANDSHAKE;
+    ws->capacity = WS_RECV_BUF_SIZE;
+    ws->buf = qsf_malloc(ws->capacity);
+    return ws;
+}
+
+// write bytes without framing, send limit is not applied
+static int session_write_raw(qsf_net_session_t* session, const char* data, uint32_t size)
+{
+    write_buffer_t* buffer = write_buffer_alloc(size, 0);
+    memcpy(buffer->data, data, size);
+    buffer->buf = uv_buf_init(buffer->data, size);
+    int r = uv_write(&buffer->req, (uv_stream_t*)&session->handle, &buffer->buf,
+        1, session_write_cb);
+    if (r < 0)
+    {
+        qsf_free(buffer);
+    }
+    return r;
+}
+
+static int session_ws_control(qsf_net_session_t* session, 
+                              int opcode, 
+                              const char* payload,
+                              uint16_t size)
+{
+    assert(size <= NET_WS_MAX_CONTROL);
+    write_buffer_t* buffer = write_buffer_alloc(size, 0);
+    if (size > 0)
+    {
+        memcpy(buffer->data, payload, size);
+    }
+    int len = qsf_net_ws_header(buffer->data, opcode, 0, size);
+    assert(len <= WRITE_HEADROOM);
+    buffer->buf = uv_buf_init(buffer->data - len, len + size);
+    int r = uv_write(&buffer->req, (uv_stream_t*)&session->handle, &buffer->buf,
+        1, session_write_cb);
+    if (r < 0)
+    {
+        qsf_free(buffer);
+    }
+    return r;
+}
+
+// send close frame, then remove session after it is flushed
+static void session_ws_close(qsf_net_session_t* session, 
+                             uint16_t code, 
+                             int err, 
+                             const char* msg)
+{
+    qsf_net_server_t* server = session->server;
+    uint32_t serial = session->serial;
+    char payload[2];
+    payload[0] = (char)(code >> 8);
+    payload[1] = (char)code;
+    session->ws->state = WS_STATE_CLOSING;
+    session_ws_control(session, NET_WS_OP_CLOSE, payload, sizeof(payload));
+    session_linger(session);
+    server->on_read(err, serial, msg, (uint16_t)strlen(msg), server->udata);
+}
+
+static void session_ws_handshake(qsf_net_session_t* session)
+{
+    static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+    net_ws_t* ws = session->ws;
+    qsf_net_server_t* server = session->server;
+    uint32_t length = 0;
+    for (uint32_t i = 3; i < ws->size; i++)
+    {
+        if (memcmp(ws->buf + i - 3, "\r\n\r\n", 4) == 0)
+        {
+            length = i + 1;
+            break;
+        }
+    }
+    if (length == 0)
+    {
+        if (ws->size >= NET_WS_MAX_REQUEST)
+        {
+            session_write_raw(session, bad_request, sizeof(bad_request) - 1);
+            session_linger(session);
+        }
+        return;
+    }
+    char response[256];
+    int r = qsf_net_ws_handshake(ws->buf, length, server->compress, response,
+        sizeof(response), &ws->options);
+    if (r > 0 && ws->options.deflate)
+    {
+        if (deflateInit2(&ws->deflate, server->compress_level, Z_DEFLATED,
+                -ws->options.window_bits, COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            r = -1;
+        }
+        else if (inflateInit2(&ws->inflate, -15) != Z_OK)
+        {
+            deflateEnd(&ws->deflate);
+            r = -1;
+        }
+        ws->options.deflate = (r > 0);
+    }
+    if (r < 0) // peer is not a websocket client, no reader notification
+    {
+        session_write_raw(session, bad_request, sizeof(bad_request) - 1);
+        session_linger(session);
+        return;
+    }
+    session_write_raw(session, response, r);
+    ws->state = WS_STATE_OPEN;
+    ws->size -= length;
+    memmove(ws->buf, ws->buf + length, ws->size);
+}
+
+static void session_ws_append(qsf_net_session_t* session, const char* payload, uint16_t size)
+{
+    net_ws_t* ws = session->ws;
+    if (ws->message == NULL)
+    {
+        ws->message = qsf_malloc(UINT16_MAX);
+    }
+    memcpy(ws->message + ws->message_size, payload, size);
+    ws->message_size += size;
+}
+
+// handle one unmasked frame
+static void session_ws_frame(qsf_net_session_t* session, 
+                             const net_ws_frame_t* frame, 
+                             char* payload, 
+                             uint16_t size)
+{
+    net_ws_t* ws = session->ws;
+    switch (frame->opcode)
+    {
+    case NET_WS_OP_PING:
+        session_ws_control(session, NET_WS_OP_PONG, payload, size);
+        return;
+    case NET_WS_OP_PONG: // receive time is refreshed already
+        return;
+    case NET_WS_OP_CLOSE:
+        session_ws_close(session, NET_WS_CLOSE_NORMAL, UV_EOF, "websocket closed");
+        return;
+    case NET_WS_OP_TEXT:
+    case NET_WS_OP_BINARY:
+        if (ws->fragmented || (frame->rsv1 && !ws->options.deflate))
+        {
+            break;
+        }
+        ws->compressed = frame->rsv1;
+        if (frame->fin) // not fragmented, decode in place
+        {
+            session_dispatch(session, payload, size);
+            return;
+        }
+        ws->fragmented = 1;
+        ws->message_size = 0;
+        session_ws_append(session, payload, size);
+        return;
+    case NET_WS_OP_CONTINUATION:
+        if (!ws->fragmented || frame->rsv1)
+        {
+            break;
+        }
+        if (ws->message_size + size > UINT16_MAX)
+        {
+            session_ws_close(session, NET_WS_CLOSE_TOO_BIG, NET_ERR_INVALID_SIZE, 
+                "websocket message too big");
+            return;
+        }
+        session_ws_append(session, payload, size);
+        if (frame->fin)
+        {
+            ws->fragmented = 0;
+            session_dispatch(session, ws->message, (uint16_t)ws->message_size);
+        }
+        return;
+    }
+    session_ws_close(session, NET_WS_CLOSE_PROTOCOL, NET_ERR_BAD_FRAME, "websocket protocol error");
+}
+
+// parse buffered frames until incomplete, closed or paused by rate limit
+static void session_ws_process(qsf_net_session_t* session)
+{
+    net_ws_t* ws = session->ws;
+    uv_handle_t* handle = (uv_handle_t*)&session->handle;
+    uint32_t offset = 0;
+    while (ws->state == WS_STATE_OPEN && !session->paused && !uv_is_closing(handle))
+    {
+        net_ws_frame_t frame;
+        char* data = ws->buf + offset;
+        uint32_t avail = ws->size - offset;
+        int r = qsf_net_ws_parse(data, avail, &frame);
+        if (r == 0)
+        {
+            break;
+        }
+        if (r < 0 || !frame.masked) // client frames must be masked
+        {
+            session_ws_close(session, NET_WS_CLOSE_PROTOCOL, NET_ERR_BAD_FRAME, 
+                "websocket protocol error");
+            return;
+        }
+        if (frame.payload_size > UINT16_MAX)
+        {
+            session_ws_close(session, NET_WS_CLOSE_TOO_BIG, NET_ERR_INVALID_SIZE, 
+                "websocket frame too big");
+            return;
+        }
+        uint32_t total = frame.header_size + (uint32_t)frame.payload_size;
+        if (avail < total)
+        {
+            break;
+        }
+        uint16_t size = (uint16_t)frame.payload_size;
+        char* payload = data + frame.header_size;
+        offset += total;
+        // a paused session still handles the charged frame, then stops
+        if (frame.opcode < NET_WS_OP_CLOSE && session_charge(session, size) != 0)
+        {
+            return;
+        }
+        qsf_net_ws_unmask(payload, size, frame.mask);
+        session_ws_frame(session, &frame, payload, size);
+    }
+    // buffer is released in close callback, safe to compact here
+    ws->size -= offset;
+    memmove(ws->buf, ws->buf + offset, ws->size);
+}
+
+static void on_ws_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf)
+{
+    qsf_net_session_t* session = handle->data;
+    net_ws_t* ws = session->ws;
+    if (ws->capacity - ws->size < WS_RECV_BUF_SIZE / 4 && ws->capacity < WS_MAX_RECV_BUF)
+    {
+        uint32_t capacity = QSF_MIN(ws->capacity * 2, WS_MAX_RECV_BUF);
+        char* data = qsf_malloc(capacity);
+        memcpy(data, ws->buf, ws->size);
+        qsf_free(ws->buf);
+        ws->buf = data;
+        ws->capacity = capacity;
+    }
+    buf->base = ws->buf + ws->size;
+    buf->len = ws->capacity - ws->size;
+}
+
+static void on_ws_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    qsf_net_session_t* session = stream->data;
+    qsf_net_server_t* server = session->server;
+    net_ws_t* ws = session->ws;
+    if (nread <= 0)
+    {
+        if (nread < 0)
+        {
+            const char* msg = uv_strerror((int)nread);
+            uint32_t serial = session->serial;
+            int opened = (ws->state == WS_STATE_OPEN);
+            session_remove(session);
+            if (opened)
+            {
+                server->on_read((int)nread, serial, msg, (uint16_t)strlen(msg), server->udata);
+            }
+        }
+        return;
+    }
+    session->last_recv_time = uv_now(stream->loop);
+    ws->size += (uint32_t)nread;
+    if (ws->state == WS_STATE_HANDSHAKE)
+    {
+        session_ws_handshake(session);
+    }
+    if (ws->state == WS_STATE_OPEN && !uv_is_closing((uv_handle_t*)stream))
+    {
+        session_ws_process(session);
+    }
+    stats_read_done(server, nread);
+}
+
+// compress content by permessage-deflate, NULL if failed
+static write_buffer_t* session_ws_deflate(qsf_net_session_t* session, write_buffer_t* buffer)
+{
+    net_ws_t* ws = session->ws;
+    z_stream* strm = &ws->deflate;
+    uint16_t size = write_buffer_size(buffer);
+    uint32_t overhead = session_overhead(session);
+    uint32_t capacity = (uint32_t)deflateBound(strm, size) + 16;
+    write_buffer_t* out = write_buffer_alloc(capacity + overhead, buffer->flags);
+    strm->next_in = (Bytef*)buffer->data;
+    strm->avail_in = size;
+    strm->next_out = (Bytef*)out->data;
+    strm->avail_out = capacity;
+    int r = deflate(strm, Z_SYNC_FLUSH);
+    uint32_t length = capacity - strm->avail_out;
+    if (r != Z_OK || strm->avail_in != 0 || strm->avail_out == 0 || length < 4 ||
+        length - 4 + overhead > UINT16_MAX)
+    {
+        qsf_free(out);
+        return NULL;
+    }
+    if (ws->options.no_context_takeover)
+    {
+        deflateReset(strm);
+    }
+    write_buffer_seal(out, (uint16_t)(length - 4)); // strip 00 00 ff ff
+    out->flags |= WRITE_WS_DEFLATED;
+    qsf_free(buffer);
+    return out;
+}
+
+// replace length header by websocket header, `reserved` gives the room
+static void session_ws_seal(write_buffer_t* buffer)
+{
+    uint16_t size = write_buffer_size(buffer);
+    int len = qsf_net_ws_header(buffer->data, NET_WS_OP_BINARY, 
+        (buffer->flags & WRITE_WS_DEFLATED), size);
+    assert(len <= WRITE_HEADROOM);
+    buffer->buf.base = buffer->data - len;
+    buffer->buf.len = len + size;
+}
+
+static void multicast_write_cb(uv_write_t* req, int err)
+{
+    multicast_buffer_t* mb = req->data;
+    qsf_net_session_t* session = req->handle->data;
+    if (--mb->refcount == 0)
+    {
+        qsf_free(mb);
+    }
+    if (err == 0 && session->backlog_head != NULL &&
+        !uv_is_closing((uv_handle_t*)req->handle))
+    {
+        session_flush_backlog(session);
+    }
+}
+
+// build frame once for `count` receivers
+static multicast_buffer_t* multicast_buffer_create(const void* data, uint16_t size, uint32_t count)
+{
+    size_t offset = (sizeof(multicast_buffer_t) + size + 15) & ~(size_t)15;
+    size_t bytes = offset + (sizeof(uv_write_t) + sizeof(qsf_net_session_t*)) * count;
+    multicast_buffer_t* mb = qsf_malloc(bytes);
+    mb->refcount = 0;
+    mb->reqs = (uv_write_t*)((char*)mb + offset);
+    mb->receivers = (qsf_net_session_t**)(mb->reqs + count);
+    mb->size = htons(size); // network order
+    memcpy(mb->data, data, size);
+    mb->buf.base = (char*)&mb->size; // memory layout dependency
+    mb->buf.len = sizeof(size) + size;
+    return mb;
+}
+
+// send shared frame to snapshot of receivers, 
+// sessions need their own encoding fall back to a private copy.
+static void multicast_send(multicast_buffer_t* mb, uint32_t count, 
+                           const void* data, uint16_t size, int flags)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        qsf_net_session_t* session = mb->receivers[i];
+        if (session->zstream || session->cipher || session->ws)
+        {
+            do_session_write(session, data, size, flags);
+            continue;
+        }
+        int r = session_admit(session, size, flags);
+        if (r == 1)
+        {
+            session_hold(session, write_buffer_create(data, size, 0, flags));
+        }
+        else if (r == 0)
+        {
+            uv_write_t* req = &mb->reqs[i];
+            req->data = mb;
+            r = uv_write(req, (uv_stream_t*)&session->handle, &mb->buf, 1, multicast_write_cb);
+            if (r == 0)
+            {
+                mb->refcount++;
+                session->server->stats.frames_out++;
+                session->server->stats.bytes_out += mb->buf.len;
+            }
+        }
+    }
+    if (mb->refcount == 0)
+    {
+        qsf_free(mb);
+    }
+}
+
 int qsf_net_server_write(qsf_net_server_t* s,
                          uint32_t serial,
                          const void* data,
-                         uint16_t size)
+                         uint16_t size,
+                         int flags)
 {
     assert(s && data && size);
     qsf_net_session_t* session = NULL;
@@ -371,21 +1836,119 @@ int qsf_net_server_write(qsf_net_server_t* s,
     {
         return -1;
     }
-    return do_session_write(session, data, size);
+    return do_session_write(session, data, size, flags);
 }
 
-int qsf_net_server_write_all(qsf_net_server_t* s, const void* data, uint16_t size)
+int qsf_net_server_write_all(qsf_net_server_t* s, 
+                             const void* data, 
+                             uint16_t size, 
+                             int flags)
 {
     assert(s && data && size);
+    uint32_t count = HASH_COUNT(s->session_map);
+    if (count == 0)
+    {
+        return 0;
+    }
+    multicast_buffer_t* mb = multicast_buffer_create(data, size, count);
     qsf_net_session_t* session = NULL;
     qsf_net_session_t* tmp = NULL;
+    uint32_t i = 0;
     HASH_ITER(hh, s->session_map, session, tmp)
     {
-        do_session_write(session, data, size);
+        mb->receivers[i++] = session;
     }
+    multicast_send(mb, count, data, size, flags);
     return 0;
 }
 
+void qsf_net_server_set_send_limit(qsf_net_server_t* s,
+                                   uint32_t soft_limit,
+                                   uint32_t hard_limit,
+                                   int policy)
+{
+    assert(s);
+    s->soft_limit = soft_limit;
+    s->hard_limit = hard_limit;
+    s->send_policy = policy;
+}
+
+void qsf_net_server_set_rate_limit(qsf_net_server_t* s,
+                                   uint32_t packet_rate,
+                                   uint32_t byte_rate,
+                                   int policy)
+{
+    assert(s);
+    s->packet_rate = packet_rate;
+    s->byte_rate = byte_rate;
+    s->rate_policy = policy;
+    qsf_net_session_t* session = NULL;
+    qsf_net_session_t* tmp = NULL;
+    uint64_t now = uv_now(s->rate_timer.loop);
+    HASH_ITER(hh, s->session_map, session, tmp)
+    {
+        session->packet_tokens = (int64_t)packet_rate * 1000;
+        session->byte_tokens = (int64_t)byte_rate * 1000;
+        session->refill_time = now;
+        if (session->paused)
+        {
+            session_resume(session);
+        }
+    }
+}
+
+int qsf_net_server_pending(qsf_net_server_t* s, uint32_t serial)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    return (int)session_pending(session);
+}
+
+void qsf_net_server_set_compress(qsf_net_server_t* s,
+                                 int enable,
+                                 int level,
+                                 uint16_t threshold)
+{
+    assert(s);
+    s->compress = enable;
+    s->compress_level = level;
+    s->compress_threshold = threshold;
+}
+
+int qsf_net_server_compress(qsf_net_server_t* s, uint32_t serial, int enable)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL || session->ws) // negotiated in websocket handshake
+    {
+        return -1;
+    }
+    // both sides switch right after one frame, or peer may send a frame
+    // in old format before it learns the switch
+    if (session->received && !session->dispatching)
+    {
+        return -1;
+    }
+    session_compress_free(session);
+    if (enable)
+    {
+        return session_compress_init(session);
+    }
+    return 0;
+}
+
+void qsf_net_server_set_websocket(qsf_net_server_t* s, int enable)
+{
+    assert(s);
+    s->websocket = enable;
+}
+
 static void on_session_shutdown(uv_shutdown_t* req, int err)
 {
     qsf_net_session_t* session = req->data;
@@ -413,6 +1976,48 @@ void qsf_net_server_shutdown(qsf_net_server_t* s, uint32_t serial)
     }
 }
 
+void qsf_net_server_set_forward(qsf_net_server_t* s, s_forward_cb on_forward)
+{
+    assert(s);
+    s->on_forward = on_forward;
+}
+
+int qsf_net_server_bind(qsf_net_server_t* s,
+                        uint32_t serial,
+                        const char* target,
+                        int len)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    qsf_free(session->route);
+    session->route = NULL;
+    session->route_len = 0;
+    if (target && len > 0)
+    {
+        session->route = qsf_malloc(len);
+        memcpy(session->route, target, len);
+        session->route_len = len;
+    }
+    return 0;
+}
+
+int qsf_net_server_bound_to(qsf_net_server_t* s,
+                            uint32_t serial,
+                            const char* target,
+                            int len)
+{
+    assert(s && target);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    return (session && session->route_len == len 
+        && memcmp(session->route, target, len) == 0);
+}
+
 void qsf_net_server_close(qsf_net_server_t* s, uint32_t serial)
 {
     assert(s);
@@ -420,8 +2025,7 @@ void qsf_net_server_close(qsf_net_server_t* s, uint32_t serial)
     HASH_FIND_INT(s->session_map, &serial, session);
     if (session)
     {
-        HASH_DEL(s->session_map, session);
-        session_destroy(session);
+        session_remove(session);
     }
 }
 
@@ -437,7 +2041,33 @@ int qsf_net_server_session_address(qsf_net_server_t* s,
     {
         return -1;
     }
-    return uv_ip4_name(&session->peer_addr, address, length);
+    if (s->pipe) // peer of unix domain socket has no name, use the bound path
+    {
+        size_t len = length - 1;
+        int r = uv_pipe_getsockname(&session->handle.pipe, address, &len);
+        address[(r == 0 ? len : 0)] = '\0';
+        return r;
+    }
+    return qsf_net_addr_name(&session->peer_addr, address, length);
+}
+
+void qsf_net_server_stats(qsf_net_server_t* s, qsf_net_server_stats_t* stats)
+{
+    assert(s && stats);
+    qsf_net_session_t* session = NULL;
+    qsf_net_session_t* tmp = NULL;
+    *stats = s->stats;
+    stats->pending_bytes = 0;
+    HASH_ITER(hh, s->session_map, session, tmp)
+    {
+        stats->pending_bytes += session_pending(session);
+    }
+}
+
+void qsf_net_server_reset_stats(qsf_net_server_t* s)
+{
+    assert(s);
+    memset(&s->stats, 0, sizeof(s->stats));
 }
 
 int qsf_net_server_size(qsf_net_server_t* s)
@@ -457,3 +2087,123 @@ void* qsf_net_get_server_udata(qsf_net_server_t* s)
     assert(s);
     return s->udata;
 }
+
+int qsf_net_server_set_cipher(qsf_net_server_t* s,
+                              uint32_t serial,
+                              int mode,
+                              const uint8_t* key,
+                              int key_len,
+                              const uint8_t* iv)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    if (session->cipher)
+    {
+        qsf_net_cipher_destroy(session->cipher);
+        session->cipher = NULL;
+    }
+    if (mode != 0)
+    {
+        session->cipher = qsf_create_net_cipher(mode, key, key_len, iv, 1);
+        if (session->cipher == NULL)
+        {
+            return -2;
+        }
+    }
+    return 0;
+}
+
+int qsf_net_server_join_group(qsf_net_server_t* s, uint32_t serial, uint32_t gid)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    for (uint16_t i = 0; i < session->group_count; i++)
+    {
+        if (session->groups[i] == gid)
+        {
+            return 0; // already joined
+        }
+    }
+    qsf_net_group_t* group = group_find(s, gid);
+    if (group == NULL)
+    {
+        group = qsf_malloc(sizeof(qsf_net_group_t));
+        memset(group, 0, sizeof(*group));
+        group->gid = gid;
+        HASH_ADD_INT(s->group_map, gid, group);
+    }
+    if (group->size == group->capacity)
+    {
+        group->capacity = QSF_MAX(group->capacity * 2, 8);
+        group->members = qsf_realloc(group->members, sizeof(qsf_net_session_t*) * group->capacity);
+    }
+    group->members[group->size++] = session;
+    if (session->group_count == session->group_capacity)
+    {
+        session->group_capacity = QSF_MAX(session->group_capacity * 2, 4);
+        session->groups = qsf_realloc(session->groups, sizeof(uint32_t) * session->group_capacity);
+    }
+    session->groups[session->group_count++] = gid;
+    return 0;
+}
+
+int qsf_net_server_leave_group(qsf_net_server_t* s, uint32_t serial, uint32_t gid)
+{
+    assert(s);
+    qsf_net_session_t* session = NULL;
+    HASH_FIND_INT(s->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    for (uint16_t i = 0; i < session->group_count; i++)
+    {
+        if (session->groups[i] == gid)
+        {
+            session->groups[i] = session->groups[--session->group_count];
+            qsf_net_group_t* group = group_find(s, gid);
+            if (group)
+            {
+                group_remove(s, group, session);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int qsf_net_server_multicast(qsf_net_server_t* s,
+                             uint32_t gid,
+                             const void* data,
+                             uint16_t size,
+                             int flags)
+{
+    assert(s && data && size);
+    qsf_net_group_t* group = group_find(s, gid);
+    if (group == NULL)
+    {
+        return -1;
+    }
+    uint32_t count = group->size;
+    multicast_buffer_t* mb = multicast_buffer_create(data, size, count);
+    memcpy(mb->receivers, group->members, sizeof(qsf_net_session_t*) * count);
+    multicast_send(mb, count, data, size, flags);
+    return 0;
+}
+
+int qsf_net_server_group_size(qsf_net_server_t* s, uint32_t gid)
+{
+    assert(s);
+    qsf_net_group_t* group = group_find(s, gid);
+    return (group ? (int)group->size : 0);
+}
@@ -11,9 +11,32 @@ struct qsf_net_server_s;
 typedef struct qsf_net_server_s qsf_net_server_t;
 
 
+// buckets of statistic histograms. bucket 0 counts zero values and
+// bucket i counts values in [2^(i-1), 2^i), the last one has no upper bound.
+#define NET_STATS_BUCKETS   20
+
+// counters since server creation or last reset
+typedef struct qsf_net_server_stats_s
+{
+    uint64_t    accepted;           // accepted sessions
+    uint64_t    rejected;           // refused by connection limit
+    uint64_t    timeouts;           // closed by heart beat checking
+    uint64_t    kicked;             // closed by protocol error or limits
+    uint64_t    bytes_in;           // bytes received
+    uint64_t    bytes_out;          // bytes written, including frame headers
+    uint64_t    frames_in;          // frames received
+    uint64_t    frames_out;         // frames written
+    uint64_t    pending_bytes;      // current pending write bytes of all sessions
+    uint64_t    read_latency[NET_STATS_BUCKETS];    // read handler time, microseconds
+}qsf_net_server_stats_t;
+
 // callbacks
 typedef void(*s_read_cb)(int, uint32_t, const char*, uint16_t, void*);
 
+// frame of a bound session, (serial, target, target_len, data, size, udata).
+// `data` is NULL when the session is closed.
+typedef void(*s_forward_cb)(uint32_t, const char*, int, const char*, uint16_t, void*);
+
 // create an net server instance
 qsf_net_server_t* qsf_create_net_server(struct uv_loop_s* loop,
                                         uint32_t max_connection, 
@@ -23,7 +46,7 @@ qsf_net_server_t* qsf_create_net_server(struct uv_loop_s* loop,
 // destroy this instance
 void qsf_net_server_destroy(struct qsf_net_server_s* s);
 
-// start net server
+// start net server, `host` is IPv4, IPv6 or `unix:/path` whose port is ignored
 int qsf_net_server_start(qsf_net_server_t* s,
                          const char* host, 
                          int port,
@@ -32,16 +55,95 @@ int qsf_net_server_start(qsf_net_server_t* s,
 // stop net server
 void qsf_net_server_stop(qsf_net_server_t* s);
 
-// send message to specified session
+// send message to specified session, `flags` is combination of NET_WRITE_*
 int qsf_net_server_write(qsf_net_server_t* s,
                          uint32_t serial, 
                          const void* data,
-                         uint16_t size);
+                         uint16_t size,
+                         int flags);
 
 // send message to all sessions
 int qsf_net_server_write_all(qsf_net_server_t* s,
                              const void* data,
-                             uint16_t size);
+                             uint16_t size,
+                             int flags);
+
+// limit pending write bytes per session, zero means no limit.
+// `policy` is one of NET_SEND_* applied above `soft_limit`. above
+// `hard_limit` a droppable frame is discarded, and a session is kicked
+// if a frame not droppable does not fit. kicks of a write are reported
+// to read handler on next loop iteration, never inside the write call.
+void qsf_net_server_set_send_limit(qsf_net_server_t* s,
+                                   uint32_t soft_limit,
+                                   uint32_t hard_limit,
+                                   int policy);
+
+// pending write bytes of a session, -1 if not found
+int qsf_net_server_pending(qsf_net_server_t* s, uint32_t serial);
+
+// limit received frames and bytes per second of each session, zero means 
+// no limit. one second of tokens can be used in a burst. `policy` is one
+// of NET_RATE_* applied before an over-limit frame is read.
+void qsf_net_server_set_rate_limit(qsf_net_server_t* s,
+                                   uint32_t packet_rate,
+                                   uint32_t byte_rate,
+                                   int policy);
+
+// compress frames of new sessions whose size reach `threshold`
+void qsf_net_server_set_compress(qsf_net_server_t* s,
+                                 int enable,
+                                 int level,
+                                 uint16_t threshold);
+
+// enable or disable compression of a session, 
+// peer must reset its zlib streams at the same frame.
+// allowed before session receives anything, or in reader of the frame
+// after which peer switches. returns -1 otherwise.
+int qsf_net_server_compress(qsf_net_server_t* s, uint32_t serial, int enable);
+
+// accept new sessions as websocket clients, each frame carries one message.
+// compression setting offers permessage-deflate in handshake.
+void qsf_net_server_set_websocket(qsf_net_server_t* s, int enable);
+
+// install stream cipher of a session, `mode` is NET_CIPHER_* or zero to remove.
+// inbound frames are decrypted before inflated, outbound encrypted after deflated.
+int qsf_net_server_set_cipher(qsf_net_server_t* s,
+                              uint32_t serial,
+                              int mode,
+                              const uint8_t* key,
+                              int key_len,
+                              const uint8_t* iv);
+
+// add session to a multicast group, sessions leave all groups when closed
+int qsf_net_server_join_group(qsf_net_server_t* s, uint32_t serial, uint32_t gid);
+
+// remove session from a multicast group
+int qsf_net_server_leave_group(qsf_net_server_t* s, uint32_t serial, uint32_t gid);
+
+// send message to all sessions of a group, frame is built once and shared
+int qsf_net_server_multicast(qsf_net_server_t* s,
+                             uint32_t gid,
+                             const void* data,
+                             uint16_t size,
+                             int flags);
+
+// member count of a group
+int qsf_net_server_group_size(qsf_net_server_t* s, uint32_t gid);
+
+// frames of bound sessions are passed to `on_forward` instead of read handler
+void qsf_net_server_set_forward(qsf_net_server_t* s, s_forward_cb on_forward);
+
+// bind session to a target name, NULL `target` to unbind
+int qsf_net_server_bind(qsf_net_server_t* s,
+                        uint32_t serial,
+                        const char* target,
+                        int len);
+
+// non-zero if session is bound to `target`
+int qsf_net_server_bound_to(qsf_net_server_t* s,
+                            uint32_t serial,
+                            const char* target,
+                            int len);
 
 // shutdown read and send
 void qsf_net_server_shutdown(qsf_net_server_t* s, uint32_t serial);
@@ -54,6 +156,12 @@ int qsf_net_server_session_address(qsf_net_server_t* s,
                                    uint32_t serial,
                                    char* address,
                                    int length);
+// copy statistic counters
+void qsf_net_server_stats(qsf_net_server_t* s, qsf_net_server_stats_t* stats);
+
+// clear statistic counters
+void qsf_net_server_reset_stats(qsf_net_server_t* s);
+
 // session count
 int qsf_net_server_size(qsf_net_server_t* s);
 
@@ -0,0 +1,567 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_udp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <uv.h>
+#include "uthash.h"
+#include "qsf.h"
+#include "qsf_net_def.h"
+#include "qsf_net_arq.h"
+#include "qsf_net_addr.h"
+
+#define UDP_RECV_BUF_SIZE   65536
+
+// a session object presents a remote conversation
+typedef struct udp_session_s
+{
+    UT_hash_handle      hh;                 // hash table entry
+    uint32_t            serial;             // conversation id
+    qsf_net_udp_t*      udp;                // endpoint pointer
+    qsf_net_arq_t*      arq;                // ARQ state
+    uint64_t            last_recv_time;     // last recv time
+    struct sockaddr_storage addr;           // peer address
+}udp_session_t;
+
+// udp endpoint object
+struct qsf_net_udp_s
+{
+    uv_loop_t*  loop;               // event loop
+    uint32_t    max_connection;     // maximum alive sessions
+    uint16_t    max_heart_beat;     // maximum heart-beat seconds
+    uint16_t    heart_beat_check;   // maximum heart-beat checking seconds
+    int         listening;          // accept new conversations
+    int         receiving;          // socket is bound and reading
+    int         closing;            // handles pending close
+    int         destroyed;          // free after handles closed
+    int         nodelay;            // ARQ nodelay mode
+    int         interval;           // ARQ flush interval
+    int         resend;             // ARQ fast retransmit acks
+    int         nocwnd;             // ARQ ignore congestion window
+    int         snd_wnd;            // ARQ send window
+    int         rcv_wnd;            // ARQ receive window
+    int         min_rto;            // ARQ minimal RTO, zero for default
+    int         loss;               // simulated loss percent
+    uint64_t    next_check;         // next heart-beat checking time
+    void*       udata;              // user data pointer
+    s_read_cb   on_read;            // read handler
+    char*       recv_buf;           // datagram buffer
+    char*       frame_buf;          // reassembled frame
+    uv_udp_t    handle;             // udp handle
+    uv_timer_t  timer;              // ARQ clock
+    udp_session_t* session_map;     // session hash map
+};
+
+
+static void udp_free(qsf_net_udp_t* u)
+{
+    qsf_free(u->recv_buf);
+    qsf_free(u->frame_buf);
+    qsf_free(u);
+}
+
+static void on_udp_close(uv_handle_t* handle)
+{
+    qsf_net_udp_t* u = handle->data;
+    assert(u && u->closing > 0);
+    u->closing--;
+    if (u->closing == 0 && u->destroyed)
+    {
+        udp_free(u);
+    }
+}
+
+// simulated packet loss
+static int udp_drop(qsf_net_udp_t* u)
+{
+    return u->loss > 0 && rand() % 100 < u->loss;
+}
+
+static void session_output(const char* data, int size, void* ud)
+{
+    udp_session_t* session = ud;
+    qsf_net_udp_t* u = session->udp;
+    if (udp_drop(u))
+    {
+        return;
+    }
+    uv_buf_t buf = uv_buf_init((char*)data, size);
+    // datagram lost on EAGAIN is retransmitted by ARQ
+    uv_udp_try_send(&u->handle, &buf, 1, (const struct sockaddr*)&session->addr);
+}
+
+static udp_session_t* session_create(qsf_net_udp_t* u,
+                                     uint32_t serial,
+                                     const struct sockaddr* addr)
+{
+    udp_session_t* session = qsf_malloc(sizeof(udp_session_t));
+    memset(session, 0, sizeof(*session));
+    session->serial = serial;
+    session->udp = u;
+    session->last_recv_time = uv_now(u->loop);
+    if (addr->sa_family == AF_INET6)
+    {
+        memcpy(&session->addr, addr, sizeof(struct sockaddr_in6));
+    }
+    else
+    {
+        memcpy(&session->addr, addr, sizeof(struct sockaddr_in));
+    }
+    session->arq = qsf_create_net_arq(serial, session_output, session);
+    qsf_net_arq_set_nodelay(session->arq, u->nodelay, u->interval, u->resend, u->nocwnd);
+    qsf_net_arq_set_window(session->arq, u->snd_wnd, u->rcv_wnd);
+    qsf_net_arq_set_min_rto(session->arq, u->min_rto);
+    HASH_ADD_INT(u->session_map, serial, session);
+    return session;
+}
+
+static void session_remove(udp_session_t* session)
+{
+    qsf_net_udp_t* u = session->udp;
+    HASH_DEL(u->session_map, session);
+    qsf_net_arq_destroy(session->arq);
+    qsf_free(session);
+}
+
+// remove session and report the reason to reader
+static void session_kick(udp_session_t* session, int err, const char* msg)
+{
+    qsf_net_udp_t* u = session->udp;
+    uint32_t serial = session->serial;
+    session_remove(session);
+    u->on_read(err, serial, msg, (uint16_t)strlen(msg), u->udata);
+}
+
+static int same_address(const struct sockaddr_storage* a, const struct sockaddr* b)
+{
+    if (a->ss_family != b->sa_family)
+    {
+        return 0;
+    }
+    if (b->sa_family == AF_INET6)
+    {
+        const struct sockaddr_in6* x = (const struct sockaddr_in6*)a;
+        const struct sockaddr_in6* y = (const struct sockaddr_in6*)b;
+        return x->sin6_port == y->sin6_port &&
+            memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+    const struct sockaddr_in* x = (const struct sockaddr_in*)a;
+    const struct sockaddr_in* y = (const struct sockaddr_in*)b;
+    return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+}
+
+// pass complete frames to reader, session may be closed by reader
+static void session_deliver(udp_session_t* session)
+{
+    qsf_net_udp_t* u = session->udp;
+    uint32_t serial = session->serial;
+    for (;;)
+    {
+        int size = qsf_net_arq_recv(session->arq, u->frame_buf, UINT16_MAX);
+        if (size == -1)
+        {
+            break;
+        }
+        if (size < 0)
+        {
+            session_kick(session, NET_ERR_INVALID_SIZE, "too big frame");
+            return;
+        }
+        if (size > 0)
+        {
+            u->on_read(0, serial, u->frame_buf, (uint16_t)size, u->udata);
+            HASH_FIND_INT(u->session_map, &serial, session);
+            if (session == NULL)
+            {
+                return;
+            }
+        }
+    }
+}
+
+static void on_udp_alloc(uv_handle_t* handle, size_t size, uv_buf_t* buf)
+{
+    qsf_net_udp_t* u = handle->data;
+    buf->base = u->recv_buf;
+    buf->len = UDP_RECV_BUF_SIZE;
+}
+
+static void on_udp_recv(uv_udp_t* handle,
+                        ssize_t nread,
+                        const uv_buf_t* buf,
+                        const struct sockaddr* addr,
+                        unsigned flags)
+{
+    qsf_net_udp_t* u = handle->data;
+    assert(u && u->on_read);
+    if (nread < 0)
+    {
+        qsf_log("udp recv failed, %d: %s\n", (int)nread, uv_strerror((int)nread));
+        return;
+    }
+    if (nread == 0 || addr == NULL || (flags & UV_UDP_PARTIAL) || udp_drop(u))
+    {
+        return;
+    }
+    uint32_t serial = qsf_net_arq_conv(buf->base, (int)nread);
+    if (serial == 0)
+    {
+        return;
+    }
+    int created = 0;
+    udp_session_t* session = NULL;
+    HASH_FIND_INT(u->session_map, &serial, session);
+    if (session == NULL)
+    {
+        if (!u->listening)
+        {
+            return;
+        }
+        if (HASH_COUNT(u->session_map) >= u->max_connection)
+        {
+            const char* msg = "max connection count limit";
+            u->on_read(NET_ERR_CONN_LIMIT, 0, msg, (uint16_t)strlen(msg), u->udata);
+            return;
+        }
+        session = session_create(u, serial, addr);
+        created = 1;
+    }
+    else if (!same_address(&session->addr, addr)) // conversation owned by other peer
+    {
+        return;
+    }
+    if (qsf_net_arq_input(session->arq, buf->base, (int)nread) < 0)
+    {
+        if (created)
+        {
+            session_remove(session);
+        }
+        return;
+    }
+    session->last_recv_time = uv_now(handle->loop);
+    if (u->nodelay) // acknowledge right now
+    {
+        qsf_net_arq_flush(session->arq);
+    }
+    session_deliver(session);
+}
+
+// drive ARQ clock and check heart beat
+// kick sessions by serial, each is looked up again as reader may have
+// closed others or stopped the endpoint meanwhile
+static void kick_expired(qsf_net_udp_t* u, const uint32_t* serials, uint32_t count,
+                         const char* msg)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        udp_session_t* session = NULL;
+        HASH_FIND_INT(u->session_map, &serials[i], session);
+        if (session)
+        {
+            session_kick(session, NET_ERR_TIMEOUT, msg);
+        }
+    }
+}
+
+static void udp_timer_cb(uv_timer_t* timer)
+{
+    qsf_net_udp_t* u = timer->data;
+    assert(u);
+    udp_session_t* session = NULL;
+    udp_session_t* tmp = NULL;
+    uint64_t now = uv_now(timer->loop);
+    uint32_t total = HASH_COUNT(u->session_map);
+    if (total == 0)
+    {
+        return;
+    }
+    uint32_t* serials = qsf_malloc(total * sizeof(uint32_t));
+    uint32_t count = 0;
+    HASH_ITER(hh, u->session_map, session, tmp)
+    {
+        qsf_net_arq_update(session->arq, (uint32_t)now);
+        if (qsf_net_arq_is_dead(session->arq))
+        {
+            serials[count++] = session->serial;
+        }
+    }
+    kick_expired(u, serials, count, "session dead link");
+    if (now >= u->next_check)
+    {
+        u->next_check = now + u->heart_beat_check * 1000;
+        uint64_t max_expire = u->max_heart_beat * 1000;
+        count = 0;
+        HASH_ITER(hh, u->session_map, session, tmp)
+        {
+            if (now - session->last_recv_time > max_expire && count < total)
+            {
+                serials[count++] = session->serial;
+            }
+        }
+        kick_expired(u, serials, count, "session timeout");
+    }
+    qsf_free(serials);
+}
+
+// bind socket and start reading
+static int udp_open(qsf_net_udp_t* u, const struct sockaddr* addr)
+{
+    if (u->receiving)
+    {
+        return UV_EALREADY;
+    }
+    int r = uv_udp_bind(&u->handle, addr, 0);
+    if (r < 0)
+    {
+        return r;
+    }
+    r = uv_udp_recv_start(&u->handle, on_udp_alloc, on_udp_recv);
+    if (r < 0)
+    {
+        return r;
+    }
+    u->receiving = 1;
+    uint64_t interval = QSF_MAX(u->interval, 10);
+    u->next_check = uv_now(u->loop) + u->heart_beat_check * 1000;
+    return uv_timer_start(&u->timer, udp_timer_cb, interval, interval);
+}
+
+qsf_net_udp_t* qsf_create_net_udp(uv_loop_t* loop,
+                                  uint32_t max_connection,
+                                  uint16_t max_heart_beat,
+                                  uint16_t heart_beat_check)
+{
+    assert(loop);
+    qsf_net_udp_t* u = qsf_malloc(sizeof(qsf_net_udp_t));
+    memset(u, 0, sizeof(*u));
+    int r = uv_udp_init(loop, &u->handle);
+    qsf_assert(r == 0, "uv_udp_init() failed.");
+    r = uv_timer_init(loop, &u->timer);
+    qsf_assert(r == 0, "uv_timer_init() failed.");
+    u->handle.data = u;
+    u->timer.data = u;
+    u->loop = loop;
+    u->max_connection = max_connection;
+    u->max_heart_beat = max_heart_beat;
+    u->heart_beat_check = heart_beat_check;
+    u->nodelay = 0;
+    u->interval = NET_ARQ_DEFAULT_INTERVAL;
+    u->resend = 0;
+    u->nocwnd = 0;
+    u->snd_wnd = NET_ARQ_DEFAULT_SNDWND;
+    u->rcv_wnd = NET_ARQ_DEFAULT_RCVWND;
+    u->recv_buf = qsf_malloc(UDP_RECV_BUF_SIZE);
+    u->frame_buf = qsf_malloc(UINT16_MAX);
+    return u;
+}
+
+void qsf_net_udp_destroy(qsf_net_udp_t* u)
+{
+    assert(u);
+    u->destroyed = 1;
+    qsf_net_udp_stop(u);
+    if (u->closing == 0) // handles closed before
+    {
+        udp_free(u);
+    }
+}
+
+int qsf_net_udp_start(qsf_net_udp_t* u,
+                      const char* host,
+                      int port,
+                      s_read_cb on_read)
+{
+    assert(u && host && on_read);
+    struct sockaddr_storage addr;
+    int r = qsf_net_resolve(host, port, &addr);
+    if (r < 0)
+    {
+        return r;
+    }
+    u->on_read = on_read;
+    r = udp_open(u, (const struct sockaddr*)&addr);
+    if (r < 0)
+    {
+        return r;
+    }
+    u->listening = 1;
+    return 0;
+}
+
+int64_t qsf_net_udp_connect(qsf_net_udp_t* u,
+                            const char* host,
+                            int port,
+                            s_read_cb on_read)
+{
+    assert(u && host && on_read);
+    struct sockaddr_storage addr;
+    int r = qsf_net_resolve(host, port, &addr);
+    if (r < 0)
+    {
+        return r;
+    }
+    u->on_read = on_read;
+    if (!u->receiving) // bind to an ephemeral port
+    {
+        struct sockaddr_storage local;
+        qsf_net_resolve((addr.ss_family == AF_INET6 ? "::" : "0.0.0.0"), 0, &local);
+        r = udp_open(u, (const struct sockaddr*)&local);
+        if (r < 0)
+        {
+            return r;
+        }
+    }
+    uint32_t serial = 0;
+    udp_session_t* session = NULL;
+    do
+    {
+        serial = (uint32_t)(uv_hrtime() ^ ((uint64_t)rand() << 16));
+        HASH_FIND_INT(u->session_map, &serial, session);
+    } while (serial == 0 || session != NULL);
+    session_create(u, serial, (const struct sockaddr*)&addr);
+    return serial;
+}
+
+void qsf_net_udp_stop(qsf_net_udp_t* u)
+{
+    assert(u);
+    udp_session_t* session = NULL;
+    udp_session_t* tmp = NULL;
+    u->listening = 0;
+    HASH_ITER(hh, u->session_map, session, tmp)
+    {
+        session_remove(session);
+    }
+    uv_timer_stop(&u->timer);
+    uv_handle_t* handle = (uv_handle_t*)&u->handle;
+    uv_handle_t* timer = (uv_handle_t*)&u->timer;
+    if (!uv_is_closing(handle))
+    {
+        uv_udp_recv_stop(&u->handle);
+        uv_close(handle, on_udp_close);
+        u->closing++;
+    }
+    if (!uv_is_closing(timer))
+    {
+        uv_close(timer, on_udp_close);
+        u->closing++;
+    }
+}
+
+void qsf_net_udp_set_nodelay(qsf_net_udp_t* u,
+                             int nodelay,
+                             int interval,
+                             int resend,
+                             int nocwnd)
+{
+    assert(u);
+    if (nodelay >= 0)
+    {
+        u->nodelay = nodelay;
+    }
+    if (interval >= 0)
+    {
+        u->interval = QSF_MAX(interval, 10);
+        if (u->receiving)
+        {
+            uv_timer_set_repeat(&u->timer, u->interval);
+        }
+    }
+    if (resend >= 0)
+    {
+        u->resend = resend;
+    }
+    if (nocwnd >= 0)
+    {
+        u->nocwnd = nocwnd;
+    }
+}
+
+void qsf_net_udp_set_window(qsf_net_udp_t* u, int snd_wnd, int rcv_wnd)
+{
+    assert(u);
+    if (snd_wnd > 0)
+    {
+        u->snd_wnd = snd_wnd;
+    }
+    if (rcv_wnd > 0)
+    {
+        u->rcv_wnd = rcv_wnd;
+    }
+}
+
+void qsf_net_udp_set_min_rto(qsf_net_udp_t* u, int min_rto)
+{
+    assert(u);
+    u->min_rto = min_rto;
+}
+
+void qsf_net_udp_set_loss(qsf_net_udp_t* u, int percent)
+{
+    assert(u);
+    u->loss = QSF_MIN(QSF_MAX(percent, 0), 100);
+}
+
+int qsf_net_udp_write(qsf_net_udp_t* u,
+                      uint32_t serial,
+                      const void* data,
+                      uint16_t size)
+{
+    assert(u && data && size);
+    udp_session_t* session = NULL;
+    HASH_FIND_INT(u->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    int r = qsf_net_arq_send(session->arq, data, size);
+    if (r == 0 && u->nodelay) // do not wait for next tick
+    {
+        qsf_net_arq_flush(session->arq);
+    }
+    return r;
+}
+
+int qsf_net_udp_pending(qsf_net_udp_t* u, uint32_t serial)
+{
+    assert(u);
+    udp_session_t* session = NULL;
+    HASH_FIND_INT(u->session_map, &serial, session);
+    if (session == NULL)
+    {
+        return -1;
+    }
+    return qsf_net_arq_pending(session->arq);
+}
+
+void qsf_net_udp_close(qsf_net_udp_t* u, uint32_t serial)
+{
+    assert(u);
+    udp_session_t* session = NULL;
+    HASH_FIND_INT(u->session_map, &serial, session);
+    if (session)
+    {
+        session_remove(session);
+    }
+}
+
+int qsf_net_udp_size(qsf_net_udp_t* u)
+{
+    assert(u);
+    return HASH_COUNT(u->session_map);
+}
+
+void qsf_net_set_udp_udata(qsf_net_udp_t* u, void* ud)
+{
+    assert(u);
+    u->udata = ud;
+}
+
+void* qsf_net_get_udp_udata(qsf_net_udp_t* u)
+{
+    assert(u);
+    return u->udata;
+}
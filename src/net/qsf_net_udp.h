@@ -0,0 +1,77 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+#include "qsf_net_server.h"
+
+struct uv_loop_s;
+struct qsf_net_udp_s;
+typedef struct qsf_net_udp_s qsf_net_udp_t;
+
+/**
+ *  reliable sessions over one UDP socket, see qsf_net_arq.h for the protocol.
+ *  a session is identified by conversation id of its datagrams, which is
+ *  chosen by the connecting side and used as session serial.
+ *
+ *  frames are delivered to the same `s_read_cb` as qsf_net_server_t.
+ */
+
+// create an udp endpoint instance
+qsf_net_udp_t* qsf_create_net_udp(struct uv_loop_s* loop,
+                                  uint32_t max_connection,
+                                  uint16_t max_heart_beat,
+                                  uint16_t heart_beat_check);
+
+// destroy this instance
+void qsf_net_udp_destroy(qsf_net_udp_t* u);
+
+// accept sessions on IPv4 or IPv6 address
+int qsf_net_udp_start(qsf_net_udp_t* u,
+                      const char* host,
+                      int port,
+                      s_read_cb on_read);
+
+// open a session to remote endpoint, returns its serial or negative if failed
+int64_t qsf_net_udp_connect(qsf_net_udp_t* u,
+                            const char* host,
+                            int port,
+                            s_read_cb on_read);
+
+// close all sessions and the socket
+void qsf_net_udp_stop(qsf_net_udp_t* u);
+
+// ARQ options of new sessions, negative value keeps current one
+void qsf_net_udp_set_nodelay(qsf_net_udp_t* u,
+                             int nodelay,
+                             int interval,
+                             int resend,
+                             int nocwnd);
+
+void qsf_net_udp_set_window(qsf_net_udp_t* u, int snd_wnd, int rcv_wnd);
+
+void qsf_net_udp_set_min_rto(qsf_net_udp_t* u, int min_rto);
+
+// drop `percent` of inbound and outbound datagrams, for testing only
+void qsf_net_udp_set_loss(qsf_net_udp_t* u, int percent);
+
+// send message to specified session
+int qsf_net_udp_write(qsf_net_udp_t* u,
+                      uint32_t serial,
+                      const void* data,
+                      uint16_t size);
+
+// segments not acknowledged of a session, -1 if not found
+int qsf_net_udp_pending(qsf_net_udp_t* u, uint32_t serial);
+
+// forget this session, peer finds out by heart beat timeout
+void qsf_net_udp_close(qsf_net_udp_t* u, uint32_t serial);
+
+// session count
+int qsf_net_udp_size(qsf_net_udp_t* u);
+
+// udp endpoint reference
+void qsf_net_set_udp_udata(qsf_net_udp_t* u, void* ud);
+void* qsf_net_get_udp_udata(qsf_net_udp_t* u);
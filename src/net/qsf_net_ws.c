@@ -0,0 +1,362 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_net_ws.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#define WS_GUID         "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_SIZE     24      // base64 of 16 bytes nonce
+
+// a slice of request text
+typedef struct ws_token_s
+{
+    const char* s;
+    size_t      len;
+}ws_token_t;
+
+
+static ws_token_t trim(const char* s, size_t len)
+{
+    while (len > 0 && (*s == ' ' || *s == '\t'))
+    {
+        s++;
+        len--;
+    }
+    while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t'))
+    {
+        len--;
+    }
+    ws_token_t t = { s, len };
+    return t;
+}
+
+// case-insensitive equality
+static int token_is(ws_token_t t, const char* str)
+{
+    size_t len = strlen(str);
+    if (t.len != len)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (tolower((unsigned char)t.s[i]) != tolower((unsigned char)str[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// case-insensitive search in a comma separated list
+static int list_has(ws_token_t t, const char* str)
+{
+    const char* end = t.s + t.len;
+    const char* p = t.s;
+    while (p < end)
+    {
+        const char* comma = memchr(p, ',', end - p);
+        const char* stop = (comma ? comma : end);
+        if (token_is(trim(p, stop - p), str))
+        {
+            return 1;
+        }
+        p = stop + 1;
+    }
+    return 0;
+}
+
+// accept the first permessage-deflate offer whose parameters are known
+static void negotiate_deflate(ws_token_t value, net_ws_options_t* options)
+{
+    const char* end = value.s + value.len;
+    const char* offer = value.s;
+    while (offer < end && !options->deflate)
+    {
+        const char* comma = memchr(offer, ',', end - offer);
+        const char* offer_end = (comma ? comma : end);
+        const char* p = offer;
+        int index = 0;
+        int valid = 1;
+        net_ws_options_t opts = { 1, 15, 0 };
+        while (p < offer_end && valid)
+        {
+            const char* semi = memchr(p, ';', offer_end - p);
+            const char* stop = (semi ? semi : offer_end);
+            ws_token_t param = trim(p, stop - p);
+            const char* eq = memchr(param.s, '=', param.len);
+            ws_token_t name = trim(param.s, (eq ? (size_t)(eq - param.s) : param.len));
+            if (index == 0)
+            {
+                valid = token_is(name, "permessage-deflate");
+            }
+            else if (token_is(name, "server_no_context_takeover"))
+            {
+                opts.no_context_takeover = 1;
+            }
+            else if (token_is(name, "server_max_window_bits"))
+            {
+                int bits = (eq ? atoi(eq + 1 + (eq[1] == '"')) : 0);
+                valid = (bits >= 8 && bits <= 15);
+                opts.window_bits = (bits < 9 ? 9 : bits); // zlib does not support 8
+            }
+            else if (!token_is(name, "client_no_context_takeover") &&
+                     !token_is(name, "client_max_window_bits"))
+            {
+                valid = 0;
+            }
+            index++;
+            p = stop + 1;
+        }
+        if (valid)
+        {
+            *options = opts;
+        }
+        offer = offer_end + 1;
+    }
+}
+
+int qsf_net_ws_handshake(const char* request,
+                         int size,
+                         int allow_deflate,
+                         char* response,
+                         int capacity,
+                         net_ws_options_t* options)
+{
+    assert(request && response && options);
+    memset(options, 0, sizeof(*options));
+    const char* end = request + size;
+    const char* line = request;
+    const char* eol = NULL;
+    int upgrade = 0;
+    int connection = 0;
+    int version = 0;
+    ws_token_t key = { NULL, 0 };
+    if (size < 4 || memcmp(request, "GET ", 4) != 0)
+    {
+        return -1;
+    }
+    for (; line < end; line = eol + 2)
+    {
+        eol = line;
+        while (eol + 1 < end && !(eol[0] == '\r' && eol[1] == '\n'))
+        {
+            eol++;
+        }
+        if (eol + 1 >= end || eol == line) // end of headers
+        {
+            break;
+        }
+        if (line == request) // request line
+        {
+            continue;
+        }
+        const char* colon = memchr(line, ':', eol - line);
+        if (colon == NULL)
+        {
+            return -1;
+        }
+        ws_token_t name = trim(line, colon - line);
+        ws_token_t value = trim(colon + 1, eol - colon - 1);
+        if (token_is(name, "Upgrade"))
+        {
+            upgrade = token_is(value, "websocket");
+        }
+        else if (token_is(name, "Connection"))
+        {
+            connection = list_has(value, "upgrade");
+        }
+        else if (token_is(name, "Sec-WebSocket-Version"))
+        {
+            version = token_is(value, "13");
+        }
+        else if (token_is(name, "Sec-WebSocket-Key"))
+        {
+            key = value;
+        }
+        else if (token_is(name, "Sec-WebSocket-Extensions") && allow_deflate)
+        {
+            negotiate_deflate(value, options);
+        }
+    }
+    if (!upgrade || !connection || !version || key.len != WS_KEY_SIZE)
+    {
+        return -1;
+    }
+
+    // Sec-WebSocket-Accept = base64(SHA1(key + GUID))
+    char text[WS_KEY_SIZE + sizeof(WS_GUID)];
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    char accept[32];
+    memcpy(text, key.s, WS_KEY_SIZE);
+    memcpy(text + WS_KEY_SIZE, WS_GUID, sizeof(WS_GUID) - 1);
+    SHA1((const unsigned char*)text, WS_KEY_SIZE + sizeof(WS_GUID) - 1, digest);
+    EVP_EncodeBlock((unsigned char*)accept, digest, SHA_DIGEST_LENGTH);
+
+    char extension[128] = { '\0' };
+    if (options->deflate)
+    {
+        snprintf(extension, sizeof(extension),
+            "Sec-WebSocket-Extensions: permessage-deflate%s%s\r\n",
+            (options->no_context_takeover ? "; server_no_context_takeover" : ""),
+            (options->window_bits < 15 ? "; server_max_window_bits=" : ""));
+        if (options->window_bits < 15)
+        {
+            size_t len = strlen(extension) - 2; // before CRLF
+            snprintf(extension + len, sizeof(extension) - len, "%d\r\n", options->window_bits);
+        }
+    }
+    int len = snprintf(response, capacity,
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "%s\r\n", accept, extension);
+    if (len < 0 || len >= capacity)
+    {
+        return -1;
+    }
+    return len;
+}
+
+int qsf_net_ws_parse(const char* data, size_t size, net_ws_frame_t* frame)
+{
+    assert(data && frame);
+    const uint8_t* p = (const uint8_t*)data;
+    if (size < 2)
+    {
+        return 0;
+    }
+    if (p[0] & 0x30) // RSV2 and RSV3 are not negotiated
+    {
+        return -1;
+    }
+    frame->fin = (p[0] & 0x80) != 0;
+    frame->rsv1 = (p[0] & 0x40) != 0;
+    frame->opcode = p[0] & 0x0F;
+    frame->masked = (p[1] & 0x80) != 0;
+    uint64_t len = p[1] & 0x7F;
+    uint32_t header_size = 2;
+    if (len == 126)
+    {
+        if (size < 4)
+        {
+            return 0;
+        }
+        len = ((uint64_t)p[2] << 8) | p[3];
+        header_size = 4;
+    }
+    else if (len == 127)
+    {
+        if (size < 10)
+        {
+            return 0;
+        }
+        len = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            len = (len << 8) | p[2 + i];
+        }
+        if (len >> 63)
+        {
+            return -1;
+        }
+        header_size = 10;
+    }
+    if (frame->masked)
+    {
+        if (size < header_size + 4)
+        {
+            return 0;
+        }
+        memcpy(frame->mask, p + header_size, 4);
+        header_size += 4;
+    }
+    frame->header_size = header_size;
+    frame->payload_size = len;
+    switch (frame->opcode)
+    {
+    case NET_WS_OP_CONTINUATION:
+    case NET_WS_OP_TEXT:
+    case NET_WS_OP_BINARY:
+        return 1;
+    case NET_WS_OP_CLOSE:
+    case NET_WS_OP_PING:
+    case NET_WS_OP_PONG:
+        // control frames must not be fragmented or compressed
+        return (frame->fin && !frame->rsv1 && len <= NET_WS_MAX_CONTROL) ? 1 : -1;
+    default:
+        return -1;
+    }
+}
+
+void qsf_net_ws_unmask(char* data, size_t size, const uint8_t mask[4])
+{
+    assert(data && mask);
+    uint8_t* p = (uint8_t*)data;
+    size_t i = 0;
+    while (i < size && ((uintptr_t)(p + i) & 7) != 0)
+    {
+        p[i] ^= mask[i & 3];
+        i++;
+    }
+    if (size - i >= 8)
+    {
+        // mask rotated to the aligned position, compilers vectorize this loop
+        uint8_t rotated[8];
+        uint64_t key;
+        for (int k = 0; k < 8; k++)
+        {
+            rotated[k] = mask[(i + k) & 3];
+        }
+        memcpy(&key, rotated, sizeof(key));
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            word ^= key;
+            memcpy(p + i, &word, sizeof(word));
+        }
+    }
+    for (; i < size; i++)
+    {
+        p[i] ^= mask[i & 3];
+    }
+}
+
+int qsf_net_ws_header(char* end, int opcode, int rsv1, size_t payload_size)
+{
+    assert(end);
+    uint8_t b0 = (uint8_t)(0x80 | (rsv1 ? 0x40 : 0) | (opcode & 0x0F));
+    uint8_t* p = NULL;
+    if (payload_size < 126)
+    {
+        p = (uint8_t*)end - 2;
+        p[1] = (uint8_t)payload_size;
+    }
+    else if (payload_size <= 0xFFFF)
+    {
+        p = (uint8_t*)end - 4;
+        p[1] = 126;
+        p[2] = (uint8_t)(payload_size >> 8);
+        p[3] = (uint8_t)payload_size;
+    }
+    else
+    {
+        p = (uint8_t*)end - 10;
+        p[1] = 127;
+        for (int i = 0; i < 8; i++)
+        {
+            p[9 - i] = (uint8_t)(payload_size >> (i * 8));
+        }
+    }
+    p[0] = b0;
+    return (int)((uint8_t*)end - p);
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  server side of RFC 6455 websocket framing and RFC 7692 permessage-deflate.
+ */
+
+#define NET_WS_OP_CONTINUATION  0x0
+#define NET_WS_OP_TEXT          0x1
+#define NET_WS_OP_BINARY        0x2
+#define NET_WS_OP_CLOSE         0x8
+#define NET_WS_OP_PING          0x9
+#define NET_WS_OP_PONG          0xA
+
+#define NET_WS_MAX_HEADER       14      // 2 + 8 bytes length + 4 bytes mask
+#define NET_WS_MAX_CONTROL      125     // maximal control frame payload
+#define NET_WS_MAX_REQUEST      4096    // maximal handshake request size
+
+// status code of close frame
+#define NET_WS_CLOSE_NORMAL     1000
+#define NET_WS_CLOSE_PROTOCOL   1002
+#define NET_WS_CLOSE_TOO_BIG    1009
+
+// tail of a deflated message removed by sender, RFC 7692 7.2.1
+#define NET_WS_DEFLATE_TAIL     "\x00\x00\xff\xff"
+
+typedef struct net_ws_frame_s
+{
+    int         fin;            // last frame of a message
+    int         rsv1;           // compressed message
+    int         opcode;         // NET_WS_OP_*
+    int         masked;         // payload is masked
+    uint8_t     mask[4];        // masking key
+    uint32_t    header_size;    // bytes before payload
+    uint64_t    payload_size;   // payload bytes
+}net_ws_frame_t;
+
+// negotiated options of a handshake
+typedef struct net_ws_options_s
+{
+    int         deflate;        // permessage-deflate accepted
+    int         window_bits;    // server deflate window bits
+    int         no_context_takeover; // reset deflate stream per message
+}net_ws_options_t;
+
+// build handshake response of a complete request ending with an empty line.
+// returns response size, or negative if request is invalid.
+int qsf_net_ws_handshake(const char* request,
+                         int size,
+                         int allow_deflate,
+                         char* response,
+                         int capacity,
+                         net_ws_options_t* options);
+
+// parse frame header, returns 1 if parsed, 0 if more bytes needed, negative if invalid
+int qsf_net_ws_parse(const char* data, size_t size, net_ws_frame_t* frame);
+
+// XOR masking of whole payload in place, a machine word at a time
+void qsf_net_ws_unmask(char* data, size_t size, const uint8_t mask[4]);
+
+// write unmasked frame header ending at `end`, returns header size
+int qsf_net_ws_header(char* end, int opcode, int rsv1, size_t payload_size);
@@ -40,6 +40,7 @@
 # endif
 # define _USE_ATTRIBUTES_FOR_SAL 1
 # include <sal.h>
+# include <intrin.h>
 # define PRINTF_FORMAT  _Printf_format_string_
 # define PRINTF_FORMAT_ATTR(format_param, dots_param) /**/
 #else
@@ -55,3 +56,14 @@
 #ifndef MAX_PATH
 #define MAX_PATH    260
 #endif
+
+// index published by one thread and read by another
+#if defined(_MSC_VER)
+#define qsf_load_acquire(p)     (*(volatile uint32_t*)(p))
+#define qsf_store_release(p, v) (*(volatile uint32_t*)(p) = (v))
+#define qsf_fence()             _ReadWriteBarrier()
+#else
+#define qsf_load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define qsf_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define qsf_fence()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
@@ -8,48 +8,842 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <uv.h>
 
 #ifdef _WIN32
 #include <Windows.h>
 #endif
 
 
+#define LOG_RING_SIZE           (64 * 1024)
+#define LOG_MAX_FILE_SIZE       (64 * 1024 * 1024)
+#define LOG_FLUSH_INTERVAL      100     // milliseconds
+#define LOG_SKIP_RECORD         0xffffffff
+#define LOG_BINARY_RECORD       0x80000000  // flag of structured record size
+#define LOG_STDERR_RECORD       0x40000000  // flag of record not for log file
+#define LOG_RECORD_FLAGS        (LOG_BINARY_RECORD | LOG_STDERR_RECORD)
+#define LOG_MAX_SITES           4096
+#define LOG_INVALID_SITE        0xffffffff
+#define LOG_MAX_STRING          1024
+#define LOG_ENCODE_SIZE         2048
+#define LOG_LINE_SIZE           2048
+
 static const char* qsf_file_name = "qsf.log";
 static volatile int qsf_enable_log_to_file = 0;
 
+// header of a log line in ring, 8 bytes aligned
+typedef struct log_record_s
+{
+    uint32_t    size;       // bytes of line, or LOG_SKIP_RECORD to wrap
+    uint32_t    time;       // seconds since epoch
+}log_record_t;
+
+// lines of one thread, single producer single consumer
+typedef struct log_ring_s
+{
+    struct log_ring_s*  next;
+    int                 closed;     // owner thread exited
+    int                 reaped;     // drained after close, writer only
+    uint32_t            dropped;    // lines dropped on full ring
+    uint32_t            mask;       // capacity - 1
+    uint32_t            head;       // written by producer
+    uint32_t            tail;       // written by writer
+    char                data[];
+}log_ring_t;
+
+struct log_context_s
+{
+    int             started;
+    int             quit;
+    uint32_t        ring_size;
+    uint64_t        interval;       // nanoseconds
+    int64_t         max_size;       // rotate if file is larger
+    int64_t         file_size;
+    int             file_day;       // rotate if date changed, 0 if unknown
+    FILE*           fp;
+    time_t          last_time;      // timestamp cache
+    char            timestamp[40];
+    size_t          timestamp_len;
+    uint64_t        dropped;        // of freed rings
+    uint64_t        reported;       // dropped lines reported in file
+    log_ring_t*     rings;
+    uv_key_t        key;            // ring of current thread
+    uv_mutex_t      mutex;          // guards ring list, never held across I/O
+    uv_mutex_t      io_mutex;       // one drainer at a time, guards file
+    uv_cond_t       cond;
+    uv_thread_t     writer;
+};
+
+static struct log_context_s log_ctx;
+
+volatile int qsf_log_level = QSF_LOG_DEBUG;
+
+// registered structured log sites, id is index + 1
+static qsf_log_site_t* log_sites[LOG_MAX_SITES];
+static uint32_t log_site_count;
+static uv_mutex_t log_site_mutex;
+static uv_once_t log_site_once = UV_ONCE_INIT;
+
+
+static uint32_t record_bytes(uint32_t size)
+{
+    return (sizeof(log_record_t) + size + 7) & ~7u;
+}
+
+static log_ring_t* thread_ring(void)
+{
+    log_ring_t* ring = uv_key_get(&log_ctx.key);
+    if (ring == NULL)
+    {
+        ring = qsf_malloc(sizeof(log_ring_t) + log_ctx.ring_size);
+        memset(ring, 0, sizeof(log_ring_t));
+        ring->mask = log_ctx.ring_size - 1;
+        uv_mutex_lock(&log_ctx.mutex);
+        ring->next = log_ctx.rings;
+        log_ctx.rings = ring;
+        uv_mutex_unlock(&log_ctx.mutex);
+        uv_key_set(&log_ctx.key, ring);
+    }
+    return ring;
+}
+
+// copy record into ring of calling thread, never blocks
+static void push_record(const char* msg, uint32_t size, uint32_t flags)
+{
+    log_ring_t* ring = thread_ring();
+    uint32_t capacity = ring->mask + 1;
+    uint32_t need = record_bytes(size);
+    uint32_t head = ring->head;
+    uint32_t used = head - qsf_load_acquire(&ring->tail);
+    uint32_t pos = head & ring->mask;
+    uint32_t skip = (capacity - pos < need ? capacity - pos : 0);
+    if (used + skip + need > capacity)
+    {
+        ring->dropped++;
+        return;
+    }
+    if (skip > 0) // no room at end, wrap to beginning
+    {
+        ((log_record_t*)(ring->data + pos))->size = LOG_SKIP_RECORD;
+        head += skip;
+        pos = 0;
+    }
+    log_record_t* record = (log_record_t*)(ring->data + pos);
+    record->size = size | flags;
+    record->time = (uint32_t)time(NULL);
+    memcpy(record + 1, msg, size);
+    qsf_store_release(&ring->head, head + need);
+    if (used < capacity / 2 && used + skip + need >= capacity / 2)
+    {
+        uv_cond_signal(&log_ctx.cond); // wake writer early
+    }
+}
 
 static void write_log_to_file(const char* msg, int size)
 {
-    FILE* fp = fopen(qsf_file_name, "a");
-    if (fp)
+    push_record(msg, (uint32_t)size, 0);
+}
+
+static int day_of(const struct tm* date)
+{
+    return (date->tm_year + 1900) * 1000 + date->tm_yday;
+}
+
+// open or create log file, day of a file left by last run is its mtime
+static void open_log_file(void)
+{
+    log_ctx.fp = fopen(qsf_file_name, "a");
+    log_ctx.file_size = 0;
+    log_ctx.file_day = 0;
+    if (log_ctx.fp)
+    {
+        fseek(log_ctx.fp, 0, SEEK_END);
+        log_ctx.file_size = ftell(log_ctx.fp);
+        struct stat st;
+        if (log_ctx.file_size > 0 && stat(qsf_file_name, &st) == 0)
+        {
+            log_ctx.file_day = day_of(localtime(&st.st_mtime));
+        }
+    }
+}
+
+// rename full or outdated log file with a time suffix, and a sequence
+// number if it is rotated more than once in a second
+static void rotate_log_file(const struct tm* date)
+{
+    char path[MAX_PATH];
+    int len = snprintf(path, sizeof(path) - 12, "%s.%04d%02d%02d-%02d%02d%02d", qsf_file_name,
+        date->tm_year + 1900, date->tm_mon + 1, date->tm_mday,
+        date->tm_hour, date->tm_min, date->tm_sec);
+    len = QSF_MIN(len, (int)sizeof(path) - 13);
+    struct stat st;
+    for (int seq = 1; stat(path, &st) == 0; seq++)
+    {
+        snprintf(path + len, sizeof(path) - len, ".%d", seq);
+    }
+    if (log_ctx.fp)
+    {
+        fclose(log_ctx.fp);
+    }
+    rename(qsf_file_name, path);
+    open_log_file();
+}
+
+static void write_line(time_t now, const char* line, uint32_t size)
+{
+    if (now != log_ctx.last_time)
     {
-        time_t now = time(NULL);
         struct tm date = *localtime(&now);
-        char timestamp[40];
-        size_t bytes = strftime(timestamp, 40, "%Y-%m-%d %H:%M:%S ", &date);
-        assert(bytes > 0);
-        fwrite(timestamp, 1, bytes, fp);
-        fwrite(msg, 1, size, fp);
-        fclose(fp);
+        int day = day_of(&date);
+        if (log_ctx.fp == NULL)
+        {
+            open_log_file();
+        }
+        if (log_ctx.fp && log_ctx.file_day != 0 && day != log_ctx.file_day)
+        {
+            rotate_log_file(&date);
+        }
+        log_ctx.file_day = day;
+        log_ctx.timestamp_len = strftime(log_ctx.timestamp, sizeof(log_ctx.timestamp),
+            "%Y-%m-%d %H:%M:%S ", &date);
+        log_ctx.last_time = now;
+    }
+    if (log_ctx.max_size > 0 && log_ctx.file_size >= log_ctx.max_size)
+    {
+        struct tm date = *localtime(&now);
+        rotate_log_file(&date);
+    }
+    if (log_ctx.fp)
+    {
+        fwrite(log_ctx.timestamp, 1, log_ctx.timestamp_len, log_ctx.fp);
+        fwrite(line, 1, size, log_ctx.fp);
+        log_ctx.file_size += log_ctx.timestamp_len + size;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// structured log
+
+static void init_log_sites(void)
+{
+    qsf_assert(uv_mutex_init(&log_site_mutex) == 0, "log: uv_mutex_init() failed.");
+}
+
+static int is_int_conversion(char c)
+{
+    return c != '\0' && strchr("diouxXc", c) != NULL;
+}
+
+static int is_float_conversion(char c)
+{
+    return c != '\0' && strchr("fFeEgGaA", c) != NULL;
+}
+
+// `va_arg` type of each argument consumed by printf format, -1 if unsupported
+static int parse_types(const char* fmt, char* types)
+{
+    int n = 0;
+    for (const char* p = fmt; *p; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p++;
+        if (*p == '%')
+        {
+            continue;
+        }
+        while (*p && strchr("-+ #0", *p))
+        {
+            p++;
+        }
+        for (int pass = 0; pass < 2; pass++) // width and precision
+        {
+            if (pass == 1)
+            {
+                if (*p != '.')
+                    break;
+                p++;
+            }
+            if (*p == '*')
+            {
+                if (n == QSF_LOG_MAX_ARGS)
+                    return -1;
+                types[n++] = 'i';
+                p++;
+            }
+            while (*p >= '0' && *p <= '9')
+            {
+                p++;
+            }
+        }
+        char length = 0;
+        if (*p == 'h')
+        {
+            p += (p[1] == 'h' ? 2 : 1);
+        }
+        else if (*p == 'l')
+        {
+            length = (p[1] == 'l' ? 'q' : 'l');
+            p += (p[1] == 'l' ? 2 : 1);
+        }
+        else if (*p == 'z' || *p == 'j' || *p == 't' || *p == 'L')
+        {
+            length = (*p == 'L' ? 'q' : *p);
+            p++;
+        }
+        char type = 0;
+        if (*p == 'd' || *p == 'i' || *p == 'c')
+            type = (length ? length : 'i');
+        else if (*p == 'u' || *p == 'o' || *p == 'x' || *p == 'X')
+            type = (length == 'l' ? 'K' : (length ? length : 'I'));
+        else if (is_float_conversion(*p))
+            type = (length == 'q' ? 'D' : 'd');
+        else if (*p == 's' || *p == 'p')
+            type = *p;
+        if (type == 0 || n == QSF_LOG_MAX_ARGS)
+        {
+            return -1;
+        }
+        types[n++] = type;
+    }
+    types[n] = '\0';
+    return n;
+}
+
+static uint32_t add_site(qsf_log_site_t* site)
+{
+    uv_once(&log_site_once, init_log_sites);
+    uv_mutex_lock(&log_site_mutex);
+    if (site->id == 0 && log_site_count < LOG_MAX_SITES)
+    {
+        log_sites[log_site_count] = site;
+        qsf_store_release(&log_site_count, log_site_count + 1);
+        qsf_store_release(&site->id, log_site_count);
+    }
+    uv_mutex_unlock(&log_site_mutex);
+    return site->id;
+}
+
+qsf_log_site_t* qsf_log_register(const char* file, int line, int level, const char* fmt)
+{
+    assert(file && fmt);
+    size_t len = strlen(fmt);
+    qsf_log_site_t* site = qsf_malloc(sizeof(qsf_log_site_t) + len + 1);
+    memset(site, 0, sizeof(*site));
+    char* copy = (char*)(site + 1);
+    memcpy(copy, fmt, len + 1);
+    site->file = file;
+    site->line = line;
+    site->level = level;
+    site->fmt = copy;
+    if (add_site(site) == 0)
+    {
+        qsf_free(site);
+        return NULL;
+    }
+    return site;
+}
+
+void qsf_log_set_level(int level)
+{
+    qsf_log_level = level;
+}
+
+static int put_int(char* buf, int size, int64_t value)
+{
+    buf[size] = QSF_LOG_ARG_INT;
+    memcpy(buf + size + 1, &value, sizeof(value));
+    return size + 1 + sizeof(value);
+}
+
+static int put_float(char* buf, int size, double value)
+{
+    buf[size] = QSF_LOG_ARG_FLOAT;
+    memcpy(buf + size + 1, &value, sizeof(value));
+    return size + 1 + sizeof(value);
+}
+
+static int put_string(char* buf, int size, const char* str)
+{
+    if (str == NULL)
+    {
+        str = "(null)";
+    }
+    size_t len = strlen(str);
+    size_t room = LOG_ENCODE_SIZE - size - 5;
+    uint32_t n = (uint32_t)QSF_MIN(len, QSF_MIN(room, LOG_MAX_STRING));
+    buf[size] = QSF_LOG_ARG_STRING;
+    memcpy(buf + size + 1, &n, sizeof(n));
+    memcpy(buf + size + 5, str, n);
+    return size + 5 + n;
+}
+
+// format one argument by conversion `spec`, returns bytes written
+static int format_arg(char* spec, int n, char conv, const char** parg, const char* end,
+                      char* out, int room)
+{
+    const char* arg = *parg;
+    int len = 0;
+    if (arg >= end)
+    {
+        len = snprintf(out, room, "<missing>");
+    }
+    else if (*arg == QSF_LOG_ARG_INT || *arg == QSF_LOG_ARG_FLOAT || *arg == QSF_LOG_ARG_POINTER)
+    {
+        int64_t i = 0;
+        double f = 0;
+        char tag = *arg;
+        memcpy((tag == QSF_LOG_ARG_FLOAT ? (void*)&f : (void*)&i), arg + 1, 8);
+        *parg = arg + 9;
+        if (tag == QSF_LOG_ARG_POINTER)
+        {
+            len = snprintf(out, room, "%p", (void*)(intptr_t)i);
+        }
+        else if (is_float_conversion(conv))
+        {
+            snprintf(spec + n, 4, "%c", conv);
+            len = snprintf(out, room, spec, (tag == QSF_LOG_ARG_INT ? (double)i : f));
+        }
+        else if (conv == 'c')
+        {
+            len = snprintf(out, room, "%c", (int)(tag == QSF_LOG_ARG_INT ? i : (int64_t)f));
+        }
+        else if (is_int_conversion(conv))
+        {
+            snprintf(spec + n, 4, "ll%c", conv);
+            len = snprintf(out, room, spec, (long long)(tag == QSF_LOG_ARG_INT ? i : (int64_t)f));
+        }
+        else if (tag == QSF_LOG_ARG_INT)
+        {
+            len = snprintf(out, room, "%lld", (long long)i);
+        }
+        else
+        {
+            len = snprintf(out, room, "%.14g", f);
+        }
+    }
+    else if (*arg == QSF_LOG_ARG_STRING)
+    {
+        uint32_t size = 0;
+        char tmp[LOG_MAX_STRING + 1];
+        memcpy(&size, arg + 1, sizeof(size));
+        size = (uint32_t)QSF_MIN(size, (uint32_t)(end - arg - 5));
+        *parg = arg + 5 + size;
+        size = QSF_MIN(size, LOG_MAX_STRING);
+        memcpy(tmp, arg + 5, size);
+        tmp[size] = '\0';
+        if (conv == 's')
+        {
+            snprintf(spec + n, 4, "s");
+            len = snprintf(out, room, spec, tmp);
+        }
+        else
+        {
+            len = snprintf(out, room, "%s", tmp);
+        }
+    }
+    else
+    {
+        *parg = end;
+        len = snprintf(out, room, "<bad>");
+    }
+    return (len < 0 ? 0 : QSF_MIN(len, room - 1));
+}
+
+// format structured record as a log line, sites are registered by other
+// threads so their count is read with acquire
+static int format_record(const char* data, uint32_t size, char* out, int outsize)
+{
+    uint32_t id = 0;
+    memcpy(&id, data, sizeof(id));
+    uint32_t count = qsf_load_acquire(&log_site_count);
+    qsf_log_site_t* site = (id > 0 && id <= count ? log_sites[id - 1] : NULL);
+    if (site == NULL)
+    {
+        return snprintf(out, outsize, "log: unknown site %u\n", id);
+    }
+    const char* arg = data + sizeof(id);
+    const char* end = data + size;
+    int len = snprintf(out, outsize, "%s[%d]: ", site->file, site->line);
+    len = QSF_MIN(QSF_MAX(len, 0), outsize - 2);
+    for (const char* p = site->fmt; *p && len < outsize - 2; p++)
+    {
+        if (*p != '%')
+        {
+            out[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out[len++] = *++p;
+            continue;
+        }
+        char spec[40] = "%";
+        int n = 1;
+        for (p++; *p && strchr("-+ #0", *p) && n < 6; p++)
+        {
+            spec[n++] = *p;
+        }
+        for (int pass = 0; pass < 2; pass++) // width and precision
+        {
+            if (pass == 1)
+            {
+                if (*p != '.')
+                    break;
+                spec[n++] = *p++;
+            }
+            if (*p == '*')
+            {
+                int64_t value = 0;
+                if (arg + 9 <= end && *arg == QSF_LOG_ARG_INT)
+                {
+                    memcpy(&value, arg + 1, sizeof(value));
+                    arg += 9;
+                }
+                n += snprintf(spec + n, 12, "%d", (int)value);
+                p++;
+            }
+            for (; *p >= '0' && *p <= '9'; p++)
+            {
+                if (n < 24)
+                    spec[n++] = *p;
+            }
+        }
+        while (*p && strchr("hlLzjt", *p))
+        {
+            p++;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        spec[n] = '\0';
+        len += format_arg(spec, n, *p, &arg, end, out + len, outsize - len - 1);
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+// write record to ring, writer formats it for log file or stderr.
+// it is formatted now only before writer is started.
+static void submit_record(const char* data, int size)
+{
+    if (log_ctx.started)
+    {
+        uint32_t flags = (qsf_enable_log_to_file ? 0 : LOG_STDERR_RECORD);
+        push_record(data, (uint32_t)size, LOG_BINARY_RECORD | flags);
+    }
+    else
+    {
+        char line[LOG_LINE_SIZE];
+        int len = format_record(data, (uint32_t)size, line, sizeof(line));
+        fwrite(line, 1, len, stderr);
+    }
+}
+
+// first record of a static site, threads may race here. types are parsed
+// into a local buffer and published together with id under the lock.
+static uint32_t add_static_site(qsf_log_site_t* site)
+{
+    char types[QSF_LOG_MAX_ARGS + 1];
+    int n = parse_types(site->fmt, types);
+    int invalid = 0;
+    uv_once(&log_site_once, init_log_sites);
+    uv_mutex_lock(&log_site_mutex);
+    if (site->id == 0)
+    {
+        if (n < 0)
+        {
+            qsf_store_release(&site->id, LOG_INVALID_SITE);
+            invalid = 1;
+        }
+        else if (log_site_count < LOG_MAX_SITES)
+        {
+            memcpy(site->types, types, n + 1);
+            log_sites[log_site_count] = site;
+            qsf_store_release(&log_site_count, log_site_count + 1);
+            qsf_store_release(&site->id, log_site_count);
+        }
+    }
+    uint32_t id = site->id;
+    uv_mutex_unlock(&log_site_mutex);
+    if (invalid)
+    {
+        qsf_log("invalid structured log format: %s", site->fmt);
+    }
+    return id;
+}
+
+void qsf_slog_write(qsf_log_site_t* site, ...)
+{
+    uint32_t id = qsf_load_acquire(&site->id);
+    if (UNLIKELY(id == 0))
+    {
+        id = add_static_site(site);
+    }
+    if (id == 0 || id == LOG_INVALID_SITE)
+    {
+        return;
+    }
+    char buf[LOG_ENCODE_SIZE];
+    int size = sizeof(id);
+    memcpy(buf, &id, sizeof(id));
+    va_list ap;
+    va_start(ap, site);
+    for (const char* type = site->types; *type && size < LOG_ENCODE_SIZE - 16; type++)
+    {
+        switch (*type)
+        {
+        case 'i': size = put_int(buf, size, va_arg(ap, int)); break;
+        case 'I': size = put_int(buf, size, va_arg(ap, unsigned int)); break;
+        case 'l': size = put_int(buf, size, va_arg(ap, long)); break;
+        case 'K': size = put_int(buf, size, (int64_t)va_arg(ap, unsigned long)); break;
+        case 'q': size = put_int(buf, size, va_arg(ap, long long)); break;
+        case 'z': size = put_int(buf, size, (int64_t)va_arg(ap, size_t)); break;
+        case 'j': size = put_int(buf, size, va_arg(ap, intmax_t)); break;
+        case 't': size = put_int(buf, size, va_arg(ap, ptrdiff_t)); break;
+        case 'd': size = put_float(buf, size, va_arg(ap, double)); break;
+        case 'D': size = put_float(buf, size, (double)va_arg(ap, long double)); break;
+        case 's': size = put_string(buf, size, va_arg(ap, const char*)); break;
+        case 'p':
+            size = put_int(buf, size, (int64_t)(intptr_t)va_arg(ap, void*));
+            buf[size - 9] = QSF_LOG_ARG_POINTER;
+            break;
+        }
     }
+    va_end(ap);
+    submit_record(buf, size);
+}
+
+void qsf_slog_encoded(qsf_log_site_t* site, const char* args, int size)
+{
+    assert(site && args && size >= 0);
+    char buf[LOG_ENCODE_SIZE];
+    uint32_t id = site->id;
+    size = QSF_MIN(size, (int)(sizeof(buf) - sizeof(id)));
+    memcpy(buf, &id, sizeof(id));
+    memcpy(buf + sizeof(id), args, size);
+    submit_record(buf, (int)sizeof(id) + size);
+}
+
+// write lines of a ring, returns dropped count
+static uint32_t drain_ring(log_ring_t* ring)
+{
+    uint32_t capacity = ring->mask + 1;
+    uint32_t head = qsf_load_acquire(&ring->head);
+    uint32_t tail = ring->tail;
+    while (tail != head)
+    {
+        uint32_t pos = tail & ring->mask;
+        const log_record_t* record = (const log_record_t*)(ring->data + pos);
+        if (record->size == LOG_SKIP_RECORD)
+        {
+            tail += capacity - pos;
+            continue;
+        }
+        uint32_t size = record->size & ~LOG_RECORD_FLAGS;
+        if (record->size & LOG_BINARY_RECORD)
+        {
+            char line[LOG_LINE_SIZE];
+            int len = format_record((const char*)(record + 1), size, line, sizeof(line));
+            if (record->size & LOG_STDERR_RECORD)
+                fwrite(line, 1, len, stderr);
+            else
+                write_line(record->time, line, len);
+        }
+        else
+        {
+            write_line(record->time, (const char*)(record + 1), size);
+        }
+        tail += record_bytes(size);
+    }
+    qsf_store_release(&ring->tail, tail);
+    return ring->dropped;
+}
+
+// write lines of all rings and free rings of exited threads, io_mutex is held.
+// threads only prepend rings, so the list is walked from a snapshot of its
+// head without the mutex, which is taken again only to unlink closed rings.
+static void drain_rings(void)
+{
+    uint64_t dropped = 0;
+    int reaped = 0;
+    uv_mutex_lock(&log_ctx.mutex);
+    log_ring_t* ring = log_ctx.rings;
+    uv_mutex_unlock(&log_ctx.mutex);
+    for (; ring != NULL; ring = ring->next)
+    {
+        int closed = qsf_load_acquire(&ring->closed); // no more lines after close
+        dropped += drain_ring(ring);
+        if (closed)
+        {
+            ring->reaped = 1;
+            reaped++;
+        }
+    }
+    log_ring_t* freed = NULL;
+    if (reaped > 0)
+    {
+        uv_mutex_lock(&log_ctx.mutex);
+        log_ring_t** pring = &log_ctx.rings;
+        while (*pring)
+        {
+            ring = *pring;
+            if (ring->reaped)
+            {
+                *pring = ring->next;
+                ring->next = freed;
+                freed = ring;
+            }
+            else
+            {
+                pring = &ring->next;
+            }
+        }
+        uv_mutex_unlock(&log_ctx.mutex);
+    }
+    while (freed)
+    {
+        ring = freed;
+        freed = ring->next;
+        log_ctx.dropped += ring->dropped;
+        dropped -= ring->dropped; // counted in log_ctx.dropped from now on
+        qsf_free(ring);
+    }
+    dropped += log_ctx.dropped;
+    if (dropped > log_ctx.reported)
+    {
+        char line[64];
+        int size = snprintf(line, sizeof(line), "log: %llu lines dropped.\n",
+            (unsigned long long)(dropped - log_ctx.reported));
+        write_line(time(NULL), line, size);
+        log_ctx.reported = dropped;
+    }
+    if (log_ctx.fp)
+    {
+        fflush(log_ctx.fp);
+    }
+}
+
+static void writer_callback(void* args)
+{
+    uv_mutex_lock(&log_ctx.mutex);
+    while (!log_ctx.quit)
+    {
+        uv_cond_timedwait(&log_ctx.cond, &log_ctx.mutex, log_ctx.interval);
+        uv_mutex_unlock(&log_ctx.mutex);
+        uv_mutex_lock(&log_ctx.io_mutex);
+        drain_rings();
+        uv_mutex_unlock(&log_ctx.io_mutex);
+        uv_mutex_lock(&log_ctx.mutex);
+    }
+    uv_mutex_unlock(&log_ctx.mutex);
+}
+
+static void start_writer(void)
+{
+    uint32_t size = (uint32_t)qsf_getenv_int("log_ring_size", LOG_RING_SIZE);
+    qsf_assert(size >= 4096 && (size & (size - 1)) == 0,
+        "log_ring_size must be power of 2 and at least 4096, got %u.", size);
+    log_ctx.ring_size = size;
+    log_ctx.max_size = qsf_getenv_int("log_max_size", LOG_MAX_FILE_SIZE);
+    log_ctx.interval = qsf_getenv_int("log_flush_interval", LOG_FLUSH_INTERVAL) * 1000000ULL;
+    qsf_assert(uv_key_create(&log_ctx.key) == 0, "log: uv_key_create() failed.");
+    qsf_assert(uv_mutex_init(&log_ctx.mutex) == 0, "log: uv_mutex_init() failed.");
+    qsf_assert(uv_mutex_init(&log_ctx.io_mutex) == 0, "log: uv_mutex_init() failed.");
+    qsf_assert(uv_cond_init(&log_ctx.cond) == 0, "log: uv_cond_init() failed.");
+    qsf_assert(uv_thread_create(&log_ctx.writer, writer_callback, NULL) == 0,
+        "log: uv_thread_create() failed.");
+    log_ctx.started = 1;
+}
+
+// write pending lines on calling thread, called on abort so it gives up
+// rather than wait if writer is draining or this thread aborted while draining
+static void flush_logs(void)
+{
+    if (log_ctx.started && uv_mutex_trylock(&log_ctx.io_mutex) == 0)
+    {
+        drain_rings();
+        uv_mutex_unlock(&log_ctx.io_mutex);
+    }
+}
+
+void qsf_log_thread_exit(void)
+{
+    if (log_ctx.started)
+    {
+        log_ring_t* ring = uv_key_get(&log_ctx.key);
+        if (ring)
+        {
+            uv_key_set(&log_ctx.key, NULL);
+            qsf_store_release(&ring->closed, 1);
+        }
+    }
+}
+
+void qsf_log_exit(void)
+{
+    if (!log_ctx.started)
+    {
+        return;
+    }
+    qsf_enable_log_to_file = 0;
+    uv_mutex_lock(&log_ctx.mutex);
+    log_ctx.quit = 1;
+    uv_cond_signal(&log_ctx.cond);
+    uv_mutex_unlock(&log_ctx.mutex);
+    uv_thread_join(&log_ctx.writer);
+
+    uv_mutex_lock(&log_ctx.io_mutex);
+    drain_rings();
+    uv_mutex_unlock(&log_ctx.io_mutex);
+    while (log_ctx.rings)
+    {
+        log_ring_t* ring = log_ctx.rings;
+        log_ctx.rings = ring->next;
+        qsf_free(ring);
+    }
+    if (log_ctx.fp)
+    {
+        fclose(log_ctx.fp);
+        log_ctx.fp = NULL;
+    }
+    log_ctx.started = 0;
+    uv_key_delete(&log_ctx.key);
+    uv_cond_destroy(&log_ctx.cond);
+    uv_mutex_destroy(&log_ctx.io_mutex);
+    uv_mutex_destroy(&log_ctx.mutex);
 }
 
 void qsf_abort(const char* msg)
 {
 #ifdef _WIN32
+    flush_logs();
     //  Raise STATUS_FATAL_APP_EXIT.
     ULONG_PTR extra_info[1];
     extra_info[0] = (ULONG_PTR)msg;
     RaiseException(0x40000015, EXCEPTION_NONCONTINUABLE, 1, extra_info);
 #else
     (void)msg;
+    flush_logs();
     abort();
 #endif
 }
 
+// writer is started even if disabled, it formats structured records
 int qsf_log_to_file(int enable)
 {
+    if (!log_ctx.started)
+    {
+        start_writer();
+    }
 #ifdef _WIN32
     return (int)InterlockedExchange((LONG*)&qsf_enable_log_to_file, enable);
 #else
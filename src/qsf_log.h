@@ -5,6 +5,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
 #include "qsf.h"
 
 #define qsf_log(fmt, ...) \
@@ -17,11 +18,66 @@
         qsf_abort(#expr); \
     }}while(0)
 
+// levels of structured log
+#define QSF_LOG_DEBUG       0
+#define QSF_LOG_INFO        1
+#define QSF_LOG_WARN        2
+#define QSF_LOG_ERROR       3
+
+#define QSF_LOG_MAX_ARGS    16
+
+// tags of encoded arguments
+#define QSF_LOG_ARG_INT     'i'     // 8 bytes integer
+#define QSF_LOG_ARG_FLOAT   'f'     // 8 bytes double
+#define QSF_LOG_ARG_STRING  's'     // 4 bytes length and bytes
+#define QSF_LOG_ARG_POINTER 'p'     // 8 bytes address
+
+// a call site of structured log, registered on first record
+typedef struct qsf_log_site_s
+{
+    const char* file;
+    int         line;
+    int         level;
+    const char* fmt;
+    uint32_t    id;                         // 0 if not registered
+    char        types[QSF_LOG_MAX_ARGS + 1];// `va_arg` types parsed from fmt
+}qsf_log_site_t;
+
+extern volatile int qsf_log_level;
+
+// record format id and raw arguments, formatted later by log writer.
+// level is checked before any argument is evaluated.
+#define qsf_slog(level, fmt, ...) \
+    do { \
+    if ((level) >= qsf_log_level){ \
+        static qsf_log_site_t qsf_site_ = { __FILE__, __LINE__, (level), fmt, 0, "" }; \
+        qsf_slog_write(&qsf_site_, ##__VA_ARGS__); \
+    }}while(0)
+
+void qsf_slog_write(qsf_log_site_t* site, ...);
+
+// register a call site of dynamic format, `fmt` is copied
+qsf_log_site_t* qsf_log_register(const char* file, int line, int level, const char* fmt);
+
+// record arguments encoded with QSF_LOG_ARG_* tags
+void qsf_slog_encoded(qsf_log_site_t* site, const char* args, int size);
+
+void qsf_log_set_level(int level);
+
 // abort current process
 void qsf_abort(const char* msg);
 
 void qsf_vlog(const char* file, int line, const char* fmt, ...)
     PRINTF_FORMAT_ATTR(3, 4);
 
-// enable/disable `qsf_vlog` write to file
+// enable/disable `qsf_vlog` write to file, lines are queued in a ring
+// of calling thread and written by a background thread. the first call
+// starts that thread, which also formats structured records for stderr
+// when file is disabled.
 int qsf_log_to_file(int enable);
+
+// release ring of calling thread, called before a thread exits
+void qsf_log_thread_exit(void);
+
+// write pending lines and stop background writer
+void qsf_log_exit(void);
@@ -0,0 +1,448 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_mysql_pool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+#include "qsf.h"
+
+#define MAX_CONF_SIZE   1024
+
+// COM_RESET_CONNECTION keeps authentication, one round trip cheaper
+#if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50703
+#define HAVE_RESET_CONNECTION   1
+#endif
+
+// a pooled connection, `mysql` must be the first member
+typedef struct pool_conn_s
+{
+    MYSQL               mysql;
+    uint64_t            last_used;      // time of release
+    struct pool_conn_s* next;           // idle list
+}pool_conn_t;
+
+struct qsf_mysql_pool_s
+{
+    qsf_mysql_pool_t*   next;           // pool list
+    char                name[QSF_MYSQL_POOL_MAX_NAME];
+    qsf_mysql_conf_t    conf;           // strings point into `strings`
+    char                strings[MAX_CONF_SIZE];
+    uv_mutex_t          mutex;
+    uv_cond_t           cond;           // a connection is released
+    pool_conn_t*        idle;           // most recently used first
+    qsf_mysql_pool_stats_t stats;
+    uv_cond_t           job_cond;       // a job is submitted
+    qsf_mysql_job_t*    job_head;       // submitted jobs, first in first out
+    qsf_mysql_job_t*    job_tail;
+    uv_thread_t*        workers;        // `max_size` threads, started on first job
+    int                 num_workers;
+    int                 stopping;       // workers should exit
+};
+
+struct qsf_mysql_pool_context_s
+{
+    qsf_mysql_pool_t*   list;
+    uv_mutex_t          mutex;
+};
+
+static struct qsf_mysql_pool_context_s pool_ctx;
+static uv_once_t pool_once = UV_ONCE_INIT;
+
+
+static void init_pool_context(void)
+{
+    qsf_assert(uv_mutex_init(&pool_ctx.mutex) == 0, "mysql pool: uv_mutex_init() failed.");
+}
+
+// copy a configuration string into pool storage, returns -1 if full
+static int copy_string(qsf_mysql_pool_t* pool, size_t* used, const char** str)
+{
+    if (*str == NULL)
+    {
+        return 0;
+    }
+    size_t len = strlen(*str) + 1;
+    if (*used + len > sizeof(pool->strings))
+    {
+        return -1;
+    }
+    char* copy = pool->strings + *used;
+    memcpy(copy, *str, len);
+    *used += len;
+    *str = copy;
+    return 0;
+}
+
+// drop session state of borrower: open transaction, autocommit,
+// session variables, temporary tables and character set
+static int reset_session(qsf_mysql_pool_t* pool, MYSQL* conn)
+{
+#ifdef HAVE_RESET_CONNECTION
+    (void)pool;
+    return mysql_reset_connection(conn);
+#else
+    const qsf_mysql_conf_t* conf = &pool->conf;
+    return mysql_change_user(conn, conf->user, conf->passwd, conf->db);
+#endif
+}
+
+// a failed connection is left initialized and must be closed by caller
+static int connect_one(qsf_mysql_pool_t* pool, MYSQL* conn, char* err, int errlen)
+{
+    const qsf_mysql_conf_t* conf = &pool->conf;
+    if (mysql_init(conn) != conn)
+    {
+        snprintf(err, errlen, "mysql_init() failed");
+        return -1;
+    }
+    if (conf->charset)
+    {
+        mysql_options(conn, MYSQL_SET_CHARSET_NAME, conf->charset);
+    }
+    if (conf->connect_timeout > 0)
+    {
+        mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &conf->connect_timeout);
+    }
+    if (mysql_real_connect(conn, conf->host, conf->user, conf->passwd, conf->db,
+            conf->port, conf->unix_socket, conf->client_flag) != conn)
+    {
+        snprintf(err, errlen, "connect failed, %s", mysql_error(conn));
+        return -1;
+    }
+    return 0;
+}
+
+// give back a slot of a closed connection
+static void drop_slot(qsf_mysql_pool_t* pool)
+{
+    uv_mutex_lock(&pool->mutex);
+    pool->stats.size--;
+    uv_cond_signal(&pool->cond);
+    uv_mutex_unlock(&pool->mutex);
+}
+
+// caller should hold context mutex
+static qsf_mysql_pool_t* find_pool(const char* name)
+{
+    for (qsf_mysql_pool_t* pool = pool_ctx.list; pool; pool = pool->next)
+    {
+        if (strcmp(pool->name, name) == 0)
+        {
+            return pool;
+        }
+    }
+    return NULL;
+}
+
+int qsf_mysql_pool_create(const char* name, const qsf_mysql_conf_t* conf,
+                          char* err, int errlen)
+{
+    assert(name && conf && conf->host && conf->user);
+    uv_once(&pool_once, init_pool_context);
+    if (strlen(name) >= QSF_MYSQL_POOL_MAX_NAME)
+    {
+        snprintf(err, errlen, "pool name too long");
+        return -1;
+    }
+    uv_mutex_lock(&pool_ctx.mutex);
+    if (find_pool(name) != NULL)
+    {
+        uv_mutex_unlock(&pool_ctx.mutex);
+        return 0; // created by another node
+    }
+
+    qsf_mysql_pool_t* pool = qsf_malloc(sizeof(qsf_mysql_pool_t));
+    memset(pool, 0, sizeof(*pool));
+    strcpy(pool->name, name);
+    pool->conf = *conf;
+    size_t used = 0;
+    if (copy_string(pool, &used, &pool->conf.host) != 0 ||
+        copy_string(pool, &used, &pool->conf.user) != 0 ||
+        copy_string(pool, &used, &pool->conf.passwd) != 0 ||
+        copy_string(pool, &used, &pool->conf.db) != 0 ||
+        copy_string(pool, &used, &pool->conf.unix_socket) != 0 ||
+        copy_string(pool, &used, &pool->conf.charset) != 0)
+    {
+        uv_mutex_unlock(&pool_ctx.mutex);
+        qsf_free(pool);
+        snprintf(err, errlen, "configuration strings exceed %d bytes", MAX_CONF_SIZE);
+        return -1;
+    }
+    pool->conf.min_size = QSF_MAX(conf->min_size, 0);
+    pool->conf.max_size = QSF_MAX(conf->max_size, QSF_MAX(pool->conf.min_size, 1));
+    uv_mutex_init(&pool->mutex);
+    uv_cond_init(&pool->cond);
+    uv_cond_init(&pool->job_cond);
+
+    int r = 0;
+    for (int i = 0; i < pool->conf.min_size; i++)
+    {
+        pool_conn_t* pc = qsf_malloc(sizeof(pool_conn_t));
+        r = connect_one(pool, &pc->mysql, err, errlen);
+        if (r != 0)
+        {
+            mysql_close(&pc->mysql);
+            qsf_free(pc);
+            break;
+        }
+        pc->last_used = uv_hrtime();
+        pc->next = pool->idle;
+        pool->idle = pc;
+        pool->stats.size++;
+        pool->stats.idle++;
+    }
+    if (r != 0)
+    {
+        while (pool->idle)
+        {
+            pool_conn_t* pc = pool->idle;
+            pool->idle = pc->next;
+            mysql_close(&pc->mysql);
+            qsf_free(pc);
+        }
+        uv_cond_destroy(&pool->job_cond);
+        uv_cond_destroy(&pool->cond);
+        uv_mutex_destroy(&pool->mutex);
+        qsf_free(pool);
+    }
+    else
+    {
+        pool->next = pool_ctx.list;
+        pool_ctx.list = pool;
+    }
+    uv_mutex_unlock(&pool_ctx.mutex);
+    return r;
+}
+
+qsf_mysql_pool_t* qsf_mysql_pool_find(const char* name)
+{
+    assert(name);
+    uv_once(&pool_once, init_pool_context);
+    uv_mutex_lock(&pool_ctx.mutex);
+    qsf_mysql_pool_t* pool = find_pool(name);
+    uv_mutex_unlock(&pool_ctx.mutex);
+    return pool;
+}
+
+MYSQL* qsf_mysql_pool_checkout(qsf_mysql_pool_t* pool, int timeout,
+                               char* err, int errlen)
+{
+    assert(pool);
+    pool_conn_t* pc = NULL;
+    uint64_t now = uv_hrtime();
+    uint64_t deadline = now + (uint64_t)QSF_MAX(timeout, 0) * 1000000;
+    uv_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        if (pool->idle)
+        {
+            pc = pool->idle;
+            pool->idle = pc->next;
+            pool->stats.idle--;
+            break;
+        }
+        if (pool->stats.size < pool->conf.max_size)
+        {
+            pool->stats.size++; // reserve slot, connect outside lock
+            break;
+        }
+        now = uv_hrtime();
+        if (now >= deadline)
+        {
+            pool->stats.timeouts++;
+            uv_mutex_unlock(&pool->mutex);
+            snprintf(err, errlen, "checkout timeout, %d connections busy", pool->conf.max_size);
+            return NULL;
+        }
+        pool->stats.waiting++;
+        uv_cond_timedwait(&pool->cond, &pool->mutex, deadline - now);
+        pool->stats.waiting--;
+    }
+    pool->stats.checkouts++;
+    uv_mutex_unlock(&pool->mutex);
+
+    if (pc == NULL)
+    {
+        pc = qsf_malloc(sizeof(pool_conn_t));
+        if (connect_one(pool, &pc->mysql, err, errlen) != 0)
+        {
+            mysql_close(&pc->mysql);
+            qsf_free(pc);
+            drop_slot(pool);
+            return NULL;
+        }
+    }
+    else if (uv_hrtime() - pc->last_used > (uint64_t)pool->conf.ping_interval * 1000000000
+        && mysql_ping(&pc->mysql) != 0)
+    {
+        if (qsf_mysql_pool_reconnect(pool, &pc->mysql, err, errlen) != 0)
+        {
+            mysql_close(&pc->mysql);
+            qsf_free(pc);
+            drop_slot(pool);
+            return NULL;
+        }
+    }
+    return &pc->mysql;
+}
+
+void qsf_mysql_pool_release(qsf_mysql_pool_t* pool, MYSQL* conn, int mode)
+{
+    assert(pool && conn);
+    pool_conn_t* pc = (pool_conn_t*)conn;
+    int broken = (mode == QSF_MYSQL_RELEASE_BROKEN);
+    if (mode == QSF_MYSQL_RELEASE_IDLE && ((conn->server_status & SERVER_STATUS_IN_TRANS) ||
+        !(conn->server_status & SERVER_STATUS_AUTOCOMMIT)))
+    {
+        mode = QSF_MYSQL_RELEASE_RESET; // statement began a transaction
+    }
+    if (!broken && mode == QSF_MYSQL_RELEASE_RESET)
+    {
+        broken = (reset_session(pool, conn) != 0);
+    }
+    if (broken)
+    {
+        mysql_close(conn);
+        qsf_free(pc);
+        drop_slot(pool);
+        return;
+    }
+    pc->last_used = uv_hrtime();
+    uv_mutex_lock(&pool->mutex);
+    pc->next = pool->idle;
+    pool->idle = pc;
+    pool->stats.idle++;
+    uv_cond_signal(&pool->cond);
+    uv_mutex_unlock(&pool->mutex);
+}
+
+int qsf_mysql_pool_reconnect(qsf_mysql_pool_t* pool, MYSQL* conn,
+                             char* err, int errlen)
+{
+    assert(pool && conn);
+    mysql_close(conn);
+    uv_mutex_lock(&pool->mutex);
+    pool->stats.reconnects++;
+    uv_mutex_unlock(&pool->mutex);
+    return connect_one(pool, conn, err, errlen);
+}
+
+void qsf_mysql_pool_stats(qsf_mysql_pool_t* pool, qsf_mysql_pool_stats_t* stats)
+{
+    assert(pool && stats);
+    uv_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    uv_mutex_unlock(&pool->mutex);
+}
+
+static void worker_main(void* arg)
+{
+    qsf_mysql_pool_t* pool = arg;
+    mysql_thread_init();
+    uv_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        while (pool->job_head == NULL && !pool->stopping)
+        {
+            uv_cond_wait(&pool->job_cond, &pool->mutex);
+        }
+        qsf_mysql_job_t* job = pool->job_head;
+        if (job == NULL)
+        {
+            break; // stopping
+        }
+        pool->job_head = job->next;
+        if (pool->job_head == NULL)
+        {
+            pool->job_tail = NULL;
+        }
+        uv_mutex_unlock(&pool->mutex);
+        job->next = NULL;
+        job->work(job);
+        job->done(job);
+        uv_mutex_lock(&pool->mutex);
+    }
+    uv_mutex_unlock(&pool->mutex);
+    mysql_thread_end();
+}
+
+// caller should hold pool mutex
+static void start_workers(qsf_mysql_pool_t* pool)
+{
+    pool->workers = qsf_malloc(sizeof(uv_thread_t) * pool->conf.max_size);
+    for (int i = 0; i < pool->conf.max_size; i++)
+    {
+        int r = uv_thread_create(&pool->workers[i], worker_main, pool);
+        qsf_assert(r == 0, "mysql pool: uv_thread_create() failed, %s.", uv_strerror(r));
+        pool->num_workers++;
+    }
+}
+
+void qsf_mysql_pool_submit(qsf_mysql_pool_t* pool, qsf_mysql_job_t* job)
+{
+    assert(pool && job && job->work && job->done);
+    job->next = NULL;
+    uv_mutex_lock(&pool->mutex);
+    if (pool->workers == NULL)
+    {
+        start_workers(pool);
+    }
+    if (pool->job_tail)
+        pool->job_tail->next = job;
+    else
+        pool->job_head = job;
+    pool->job_tail = job;
+    uv_cond_signal(&pool->job_cond);
+    uv_mutex_unlock(&pool->mutex);
+}
+
+static void stop_workers(qsf_mysql_pool_t* pool)
+{
+    uv_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    uv_cond_broadcast(&pool->job_cond);
+    uv_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_workers; i++)
+    {
+        uv_thread_join(&pool->workers[i]);
+    }
+    qsf_free(pool->workers);
+    pool->workers = NULL;
+    pool->num_workers = 0;
+}
+
+void qsf_mysql_pool_exit(void)
+{
+    uv_once(&pool_once, init_pool_context);
+    uv_mutex_lock(&pool_ctx.mutex);
+    qsf_mysql_pool_t** pp = &pool_ctx.list;
+    while (*pp)
+    {
+        qsf_mysql_pool_t* pool = *pp;
+        stop_workers(pool);
+        if (pool->stats.size != pool->stats.idle)
+        {
+            // borrowed connections still point to pool, keep it
+            qsf_log("mysql pool [%s]: %d connections not released at exit.\n",
+                pool->name, pool->stats.size - pool->stats.idle);
+            pp = &pool->next;
+            continue;
+        }
+        *pp = pool->next;
+        while (pool->idle)
+        {
+            pool_conn_t* pc = pool->idle;
+            pool->idle = pc->next;
+            mysql_close(&pc->mysql);
+            qsf_free(pc);
+        }
+        uv_cond_destroy(&pool->job_cond);
+        uv_cond_destroy(&pool->cond);
+        uv_mutex_destroy(&pool->mutex);
+        qsf_free(pool);
+    }
+    uv_mutex_unlock(&pool_ctx.mutex);
+}
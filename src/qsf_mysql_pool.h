@@ -0,0 +1,111 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+#include <mysql.h>
+
+/**
+ *  process-wide named MySQL connection pools shared by all nodes.
+ *
+ *  a pool keeps `min_size` connections open and grows to `max_size` on
+ *  demand. connections idle longer than `ping_interval` are checked by
+ *  `mysql_ping` before checkout and reconnected if the server is gone.
+ *  a checked out connection is pinned to its borrower until released.
+ *  session of a connection released by a pinned borrower is reset by
+ *  COM_RESET_CONNECTION (COM_CHANGE_USER before MySQL 5.7.3), so open
+ *  transaction and session state are not seen by next borrower. single
+ *  statements skip the round trip unless they left a transaction open.
+ *
+ *  a thread calling checkout should have called `mysql_thread_init`,
+ *  and `mysql_thread_end` before it exits. pool workers do so.
+ *
+ *  jobs submitted to a pool run on its own `max_size` worker threads,
+ *  not on libuv threadpool. that pool is shared by fs and getaddrinfo
+ *  requests of all nodes and has only UV_THREADPOOL_SIZE (default 4)
+ *  threads, blocking there in checkout would starve other nodes.
+ */
+
+#define QSF_MYSQL_POOL_MAX_NAME     32
+#define QSF_MYSQL_POOL_MIN_SIZE     1
+#define QSF_MYSQL_POOL_MAX_SIZE     16
+#define QSF_MYSQL_PING_INTERVAL     30      // seconds
+#define QSF_MYSQL_CHECKOUT_TIMEOUT  3000    // milliseconds
+
+// how a connection is released
+#define QSF_MYSQL_RELEASE_IDLE      0       // ran single statements
+#define QSF_MYSQL_RELEASE_RESET     1       // pinned, session state may be changed
+#define QSF_MYSQL_RELEASE_BROKEN    2       // closed instead of reused
+
+struct qsf_mysql_pool_s;
+typedef struct qsf_mysql_pool_s qsf_mysql_pool_t;
+
+typedef struct qsf_mysql_conf_s
+{
+    const char*     host;
+    const char*     user;
+    const char*     passwd;
+    const char*     db;
+    const char*     unix_socket;
+    const char*     charset;
+    unsigned int    port;
+    unsigned long   client_flag;
+    unsigned int    connect_timeout;    // seconds, 0 for default
+    int             min_size;
+    int             max_size;
+    int             ping_interval;      // seconds
+}qsf_mysql_conf_t;
+
+struct qsf_mysql_job_s;
+typedef struct qsf_mysql_job_s qsf_mysql_job_t;
+typedef void (*qsf_mysql_job_cb)(qsf_mysql_job_t* job);
+
+struct qsf_mysql_job_s
+{
+    qsf_mysql_job_t*    next;       // used by pool
+    qsf_mysql_job_cb    work;       // run by a worker thread
+    qsf_mysql_job_cb    done;       // run by same worker, hands job back to its owner
+    void*               data;
+};
+
+typedef struct qsf_mysql_pool_stats_s
+{
+    int         size;           // open connections
+    int         idle;
+    int         waiting;        // borrowers blocked in checkout
+    uint64_t    checkouts;
+    uint64_t    reconnects;
+    uint64_t    timeouts;       // checkouts timed out
+}qsf_mysql_pool_stats_t;
+
+// create a pool and open `min_size` connections, an existing pool of
+// same name is kept. returns 0 on success, non-zero and `err` on failure,
+// such as strings of `conf` larger than 1KB together.
+int qsf_mysql_pool_create(const char* name, const qsf_mysql_conf_t* conf,
+                          char* err, int errlen);
+
+qsf_mysql_pool_t* qsf_mysql_pool_find(const char* name);
+
+// borrow a connection, blocks up to `timeout` milliseconds.
+// returns NULL on timeout or connect failure, with message in `err`.
+MYSQL* qsf_mysql_pool_checkout(qsf_mysql_pool_t* pool, int timeout,
+                               char* err, int errlen);
+
+// return a connection, `mode` is one of QSF_MYSQL_RELEASE_*
+void qsf_mysql_pool_release(qsf_mysql_pool_t* pool, MYSQL* conn, int mode);
+
+// run job on a worker thread of pool, jobs start in submitted order
+void qsf_mysql_pool_submit(qsf_mysql_pool_t* pool, qsf_mysql_job_t* job);
+
+// reconnect a borrowed connection after server gone, on failure it
+// should be released as broken.
+int qsf_mysql_pool_reconnect(qsf_mysql_pool_t* pool, MYSQL* conn,
+                             char* err, int errlen);
+
+void qsf_mysql_pool_stats(qsf_mysql_pool_t* pool, qsf_mysql_pool_stats_t* stats);
+
+// stop workers and close all pools, called after nodes exit.
+// a pool with connections not released is kept.
+void qsf_mysql_pool_exit(void);
@@ -11,12 +11,22 @@
 #include <lualib.h>
 #include <lauxlib.h>
 #include "qsf.h"
+#include "qsf_profile.h"
+#include "qsf_trace.h"
 
 // max dealer identity size
-#define MAX_ID_LENGTH       32
+#define MAX_ID_LENGTH       QSF_NODE_MAX_NAME
 #define MAX_ARG_LENGTH      256
 
 
+// message filter, see `qsf_node_add_filter`
+typedef struct qsf_node_filter_s
+{
+    struct qsf_node_filter_s* next;
+    msg_recv_handler    func;
+    void*               ud;
+}qsf_node_filter_t;
+
 // a node represent a OS thread running lua code
 struct qsf_node_s
 {
@@ -30,6 +40,28 @@ struct qsf_node_s
     char        path[MAX_PATH];       // file path
     char        args[MAX_ARG_LENGTH]; // arguments to pass
 
+    qsf_node_filter_t*  filters;      // messages consumed in C
+
+    uv_prepare_t        prepare;      // before loop polls
+    uv_check_t          check;        // after loop polls
+    uv_timer_t          lag_timer;    // loop lag reference
+    uint64_t            poll_start;   // time of entering poll
+    uint64_t            lag_expected; // time reference timer is due
+    uint64_t            recv_time;    // last message returned to lua
+    int                 call_depth;   // nested timed callbacks
+    int                 works;        // uv work in flight
+    int                 closing;      // node is exiting
+    qsf_node_stats_t    stats;        // instrumentation counters, node thread only
+    qsf_node_stats_t    shared;       // copy of `stats` for other threads
+    uint32_t            shared_seq;   // odd while `shared` is being written
+    qsf_profile_t*      profile;      // lua sampling profiler, lazily created
+
+    qsf_trace_ring_t*   trace_ring;   // spans of this node, NULL if tracing disabled
+    qsf_trace_ctx_t     trace;        // trace and span in progress
+    uint64_t            trace_parent; // parent of span in progress
+    uint64_t            trace_start;
+    char                trace_name[QSF_TRACE_MAX_NAME];
+
     uint32_t    tag;                  // used to check whether the object is good.
 };
 
@@ -45,6 +77,7 @@ static struct qsf_node_context_s node_ctx;
 
 // forward declaration
 extern void open_preload_libs(lua_State* L);
+static int trace_pcall(struct lua_State* L, int narg);
 
 static qsf_node_t* find_from_node_list(const char* name)
 {
@@ -94,6 +127,8 @@ static qsf_node_t* create_from_node_list(const char* name, const char* path, con
     strncpy(s->name, name, sizeof(s->name));
     strncpy(s->path, path, sizeof(s->path));
     strncpy(s->args, args, sizeof(s->args));
+    strncpy(s->stats.name, name, sizeof(s->stats.name) - 1);
+    s->shared = s->stats;
     qsf_node_t** pph = &node_ctx.list;
     while (*pph)
     {
@@ -104,6 +139,111 @@ static qsf_node_t* create_from_node_list(const char* name, const char* path, con
     return s;
 }
 
+// index of histogram bucket of `value`
+static int stats_bucket(uint64_t value)
+{
+    int bucket = 0;
+    while (value > 0 && bucket < QSF_LAG_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void record_call(qsf_node_t* s, int kind, uint64_t elapsed)
+{
+    s->stats.call_count[kind]++;
+    s->stats.call_time[kind] += elapsed;
+    if (elapsed > s->stats.call_max[kind])
+    {
+        s->stats.call_max[kind] = elapsed;
+    }
+}
+
+static void on_loop_prepare(uv_prepare_t* handle)
+{
+    qsf_node_t* s = handle->data;
+    s->poll_start = uv_hrtime();
+}
+
+static void on_loop_check(uv_check_t* handle)
+{
+    qsf_node_t* s = handle->data;
+    s->stats.loop_count++;
+    if (s->poll_start > 0)
+    {
+        s->stats.idle_time += uv_hrtime() - s->poll_start;
+        s->poll_start = 0;
+    }
+}
+
+// seqlock write side, a publish is only a struct copy so readers just spin
+static void publish_stats(qsf_node_t* s)
+{
+    uint32_t seq = s->shared_seq;
+    qsf_store_release(&s->shared_seq, seq + 1);
+    qsf_fence();
+    s->shared = s->stats;
+    qsf_store_release(&s->shared_seq, seq + 2);
+}
+
+// called with node_ctx.mutex held so `s` is not freed meanwhile
+static void read_shared_stats(qsf_node_t* s, qsf_node_stats_t* stats)
+{
+    for (;;)
+    {
+        uint32_t seq = qsf_load_acquire(&s->shared_seq);
+        if ((seq & 1) == 0)
+        {
+            *stats = s->shared;
+            qsf_fence();
+            if (qsf_load_acquire(&s->shared_seq) == seq)
+            {
+                return;
+            }
+        }
+    }
+}
+
+// a late reference timer means the loop was busy
+static void on_lag_timer(uv_timer_t* handle)
+{
+    qsf_node_t* s = handle->data;
+    uint64_t now = uv_hrtime();
+    uint64_t lag = (now > s->lag_expected ? (now - s->lag_expected) / 1000 : 0);
+    s->lag_expected = now + QSF_LAG_INTERVAL * 1000000ULL;
+    s->stats.lag_last = lag;
+    s->stats.lag_total += lag;
+    s->stats.lag_samples++;
+    s->stats.lag_histogram[stats_bucket(lag)]++;
+    if (lag > s->stats.lag_max)
+    {
+        s->stats.lag_max = lag;
+    }
+    s->stats.lua_memory = (uint64_t)lua_gc(s->L, LUA_GCCOUNT, 0) * 1024 + 
+        lua_gc(s->L, LUA_GCCOUNTB, 0);
+    publish_stats(s);
+}
+
+// probes do not keep loop alive
+static void start_probes(qsf_node_t* s)
+{
+    uv_prepare_init(&s->loop, &s->prepare);
+    uv_check_init(&s->loop, &s->check);
+    uv_timer_init(&s->loop, &s->lag_timer);
+    s->prepare.data = s;
+    s->check.data = s;
+    s->lag_timer.data = s;
+    uv_prepare_start(&s->prepare, on_loop_prepare);
+    uv_check_start(&s->check, on_loop_check);
+    uv_timer_start(&s->lag_timer, on_lag_timer, QSF_LAG_INTERVAL, QSF_LAG_INTERVAL);
+    uv_unref((uv_handle_t*)&s->prepare);
+    uv_unref((uv_handle_t*)&s->check);
+    uv_unref((uv_handle_t*)&s->lag_timer);
+    s->lag_expected = uv_hrtime() + QSF_LAG_INTERVAL * 1000000ULL;
+}
+
 // load Lua path and Lua cpath
 static void load_node_path(lua_State* L)
 {
@@ -140,16 +280,35 @@ static int init_node(qsf_node_t* s)
     load_node_path(L);
     lua_pushlightuserdata(L, s); // thus pointer `s` cannot be moved before lua_close()
     lua_setfield(L, LUA_REGISTRYINDEX, "qsf_ctx");
+    *(qsf_node_t**)lua_getextraspace(L) = s; // for timed callbacks
     lua_gc(L, LUA_GCRESTART, 0);
     s->loop.data = L;
     s->L = L;
     s->dealer = qsf_create_dealer(s->name);
+    s->trace_ring = qsf_trace_open_ring(s->name);
     s->tag = QSF_NODE_TAG_VALUE_GOOD;
+    start_probes(s);
     return 0;
 }
 
+static void close_handle(uv_handle_t* handle, void* arg)
+{
+    if (!uv_is_closing(handle))
+    {
+        uv_close(handle, NULL);
+    }
+}
+
 static void cleanup_node(qsf_node_t* s)
 {
+    uv_prepare_stop(&s->prepare);
+    uv_check_stop(&s->check);
+    uv_timer_stop(&s->lag_timer);
+    s->closing = 1;
+    while (s->works > 0) // completions still need lua state
+    {
+        uv_run(&s->loop, UV_RUN_ONCE);
+    }
     if (s->dealer)
     {
         zmq_close(s->dealer);
@@ -158,13 +317,26 @@ static void cleanup_node(qsf_node_t* s)
     {
         lua_close(s->L);
     }
-    if (uv_loop_alive(&s->loop))
+    if (s->profile)
+    {
+        qsf_profile_destroy(s->profile);
+    }
+    qsf_trace_close_ring(s->trace_ring);
+    while (s->filters)
+    {
+        qsf_node_filter_t* filter = s->filters;
+        s->filters = filter->next;
+        qsf_free(filter);
+    }
+    uv_walk(&s->loop, close_handle, NULL); // handles not closed by lua
+    uv_run(&s->loop, UV_RUN_DEFAULT);
+    int r = uv_loop_close(&s->loop);
+    if (r != 0)
     {
-        uv_stop(&s->loop);
+        qsf_log("service [%s] uv_loop_close() failed, %s.\n", s->name, uv_strerror(r));
     }
-    uv_loop_close(&s->loop);
     s->tag = QSF_NODE_TAG_VALUE_BAD;
-    qsf_log("service [%s] exit.\n", s->name);
+    qsf_slog(QSF_LOG_INFO, "service [%s] exit.", s->name);
     uv_mutex_lock(&node_ctx.mutex);
     remove_from_node_list(s);
     uv_mutex_unlock(&node_ctx.mutex);
@@ -180,7 +352,7 @@ static void node_thread_callback(void* args)
         if (r == LUA_OK)
         {
             lua_pushstring(s->L, s->args);
-            r = qsf_trace_pcall(s->L, 1);
+            r = trace_pcall(s->L, 1);
         }
         else
         {
@@ -188,6 +360,7 @@ static void node_thread_callback(void* args)
         }
     }
     cleanup_node(s);
+    qsf_log_thread_exit();
 }
 
 int qsf_create_node(const char* name, const char* path, const char* args)
@@ -225,6 +398,54 @@ int qsf_node_check_tag(qsf_node_t* s)
     return (s && s->tag == QSF_NODE_TAG_VALUE_GOOD);
 }
 
+// span of a traced message, from dispatch to handler return
+static void trace_received(qsf_node_t* s, const qsf_trace_ctx_t* ctx, const char* from, int len)
+{
+    qsf_trace_ring_t* ring = s->trace_ring;
+    uint64_t now = s->recv_time;
+    uint64_t span = qsf_trace_new_id(ring);
+    uint64_t route = (ctx->route_time > 0 ? ctx->route_time : ctx->send_time);
+    qsf_trace_span(ring, QSF_TRACE_ASYNC, "dispatch", ctx->trace_id, qsf_trace_new_id(ring),
+        span, ctx->send_time, route - ctx->send_time);
+    qsf_trace_span(ring, QSF_TRACE_ASYNC, "queue", ctx->trace_id, qsf_trace_new_id(ring),
+        span, route, now - route);
+    qsf_trace_span(ring, QSF_TRACE_FLOW_END, "send", ctx->trace_id, ctx->flow_id,
+        ctx->span_id, now, 0);
+    s->trace.trace_id = ctx->trace_id;
+    s->trace.span_id = span;
+    s->trace_parent = ctx->span_id;
+    s->trace_start = now;
+    snprintf(s->trace_name, sizeof(s->trace_name), "recv %.*s", len, from);
+}
+
+uint64_t qsf_node_trace_begin(qsf_node_t* s, const char* name)
+{
+    assert(s && name);
+    if (s->trace_ring == NULL)
+    {
+        return 0;
+    }
+    qsf_node_trace_end(s);
+    s->trace.trace_id = qsf_trace_new_id(s->trace_ring);
+    s->trace.span_id = qsf_trace_new_id(s->trace_ring);
+    s->trace_parent = 0;
+    s->trace_start = uv_hrtime();
+    strncpy(s->trace_name, name, sizeof(s->trace_name) - 1);
+    s->trace_name[sizeof(s->trace_name) - 1] = '\0';
+    return s->trace.trace_id;
+}
+
+void qsf_node_trace_end(qsf_node_t* s)
+{
+    assert(s);
+    if (s->trace.trace_id != 0)
+    {
+        qsf_trace_span(s->trace_ring, QSF_TRACE_COMPLETE, s->trace_name, s->trace.trace_id,
+            s->trace.span_id, s->trace_parent, s->trace_start, uv_hrtime() - s->trace_start);
+        s->trace.trace_id = 0;
+    }
+}
+
 void qsf_node_send(qsf_node_t* s,
                    const char* name, int len, 
                    const char* data, int size)
@@ -233,10 +454,68 @@ void qsf_node_send(qsf_node_t* s,
 
     int r = zmq_send(s->dealer, name, len, ZMQ_SNDMORE);
     qsf_assert(r == len, "send zmq dealer identity failed.");
+    if (s->trace.trace_id != 0) // sent inside a traced span
+    {
+        qsf_trace_ctx_t ctx = s->trace;
+        ctx.flow_id = qsf_trace_new_id(s->trace_ring);
+        ctx.send_time = uv_hrtime();
+        ctx.route_time = 0;
+        qsf_trace_span(s->trace_ring, QSF_TRACE_FLOW_START, "send", ctx.trace_id,
+            ctx.flow_id, ctx.span_id, ctx.send_time, 0);
+        r = zmq_send(s->dealer, &ctx, sizeof(ctx), ZMQ_SNDMORE);
+        qsf_assert(r == sizeof(ctx), "send dealer trace context failed.");
+    }
     r = zmq_send(s->dealer, data, size, 0);
     qsf_assert(r == size, "send dealer message failed.");
 }
 
+void qsf_node_add_filter(qsf_node_t* s, msg_recv_handler func, void* ud)
+{
+    assert(s && func);
+    qsf_node_filter_t* filter = qsf_malloc(sizeof(qsf_node_filter_t));
+    filter->func = func;
+    filter->ud = ud;
+    filter->next = NULL;
+    qsf_node_filter_t** pp = &s->filters;
+    while (*pp)
+    {
+        pp = &(*pp)->next;
+    }
+    *pp = filter;
+}
+
+void qsf_node_remove_filter(qsf_node_t* s, msg_recv_handler func, void* ud)
+{
+    assert(s && func);
+    qsf_node_filter_t** pp = &s->filters;
+    while (*pp)
+    {
+        qsf_node_filter_t* filter = *pp;
+        if (filter->func == func && filter->ud == ud)
+        {
+            *pp = filter->next;
+            qsf_free(filter);
+            return;
+        }
+        pp = &filter->next;
+    }
+}
+
+// first filter returns non-zero consumes the message
+static int run_filters(qsf_node_t* s, const char* name, int len, const char* data, int size)
+{
+    qsf_node_filter_t* filter = s->filters;
+    while (filter)
+    {
+        if (filter->func(filter->ud, name, len, data, size))
+        {
+            return 1;
+        }
+        filter = filter->next;
+    }
+    return 0;
+}
+
 int qsf_node_recv(struct qsf_node_s* s, 
                   msg_recv_handler func, 
                   int nowait, void* ud)
@@ -246,31 +525,66 @@ int qsf_node_recv(struct qsf_node_s* s,
     zmq_msg_t from;
     zmq_msg_t msg;
 
-    qsf_zmq_assert(zmq_msg_init(&from) == 0);
-
     int flag = (nowait != 0 ? ZMQ_DONTWAIT : 0);
-    int r = zmq_msg_recv(&from, s->dealer, flag);
-    if (r > 0)
+    if (s->recv_time > 0) // previous message is handled
     {
+        record_call(s, QSF_CALL_MESSAGE, uv_hrtime() - s->recv_time);
+        s->recv_time = 0;
+    }
+    qsf_node_trace_end(s);
+    for (;;)
+    {
+        qsf_zmq_assert(zmq_msg_init(&from) == 0);
+        int r = zmq_msg_recv(&from, s->dealer, flag);
+        if (r <= 0)
+        {
+            qsf_zmq_assert(zmq_msg_close(&from) == 0);
+            return 0;
+        }
         const char* name = zmq_msg_data(&from);
         size_t len = zmq_msg_size(&from);
         qsf_assert(len < MAX_ID_LENGTH, "invalid zmq peer name: %s", name);
 
+        int consumed = 0;
+        int traced = 0;
+        qsf_trace_ctx_t ctx;
         qsf_zmq_assert(zmq_msg_init(&msg) == 0);
         r = zmq_msg_recv(&msg, s->dealer, flag);
+        if (r >= 0 && zmq_msg_more(&msg)) // trace context precedes message
+        {
+            traced = (zmq_msg_size(&msg) == sizeof(ctx));
+            if (traced)
+            {
+                memcpy(&ctx, zmq_msg_data(&msg), sizeof(ctx));
+            }
+            r = zmq_msg_recv(&msg, s->dealer, flag);
+        }
         if (LIKELY(r > 0))
         {
             const char* data = zmq_msg_data(&msg);
             size_t size = zmq_msg_size(&msg);
-            r = func(ud, name, (int)len, data, (int)size);
+            consumed = run_filters(s, name, (int)len, data, (int)size);
+            if (!consumed)
+            {
+                r = func(ud, name, (int)len, data, (int)size);
+            }
         }
         qsf_zmq_assert(zmq_msg_close(&from) == 0);
         qsf_zmq_assert(zmq_msg_close(&msg) == 0);
-        return (r > 0 ? r : 0);
+        if (!consumed) // keep receiving till a message for handler
+        {
+            if (r > 0)
+            {
+                s->recv_time = uv_hrtime();
+                if (traced && s->trace_ring)
+                {
+                    trace_received(s, &ctx, name, (int)len);
+                }
+                return r;
+            }
+            return 0;
+        }
     }
-    
-    qsf_zmq_assert(zmq_msg_close(&from) == 0);
-    return 0;
 }
 
 uv_loop_t* qsf_node_loop(qsf_node_t* s)
@@ -284,6 +598,24 @@ const char* qsf_node_name(qsf_node_t* s)
     return s->name;
 }
 
+void qsf_node_work_begin(qsf_node_t* s)
+{
+    assert(s);
+    s->works++;
+}
+
+void qsf_node_work_end(qsf_node_t* s)
+{
+    assert(s && s->works > 0);
+    s->works--;
+}
+
+int qsf_node_closing(qsf_node_t* s)
+{
+    assert(s);
+    return s->closing;
+}
+
 int qsf_node_run(qsf_node_t* s)
 {
     return uv_run(&s->loop, UV_RUN_DEFAULT);
@@ -303,7 +635,7 @@ static int qsf_traceback(lua_State* L)
     return 1;
 }
 
-int qsf_trace_pcall(struct lua_State* L, int narg)
+static int trace_pcall(struct lua_State* L, int narg)
 {
     int base = lua_gettop(L) - narg;  // function index
     lua_pushcfunction(L, qsf_traceback);  // push traceback function
@@ -317,6 +649,83 @@ int qsf_trace_pcall(struct lua_State* L, int narg)
     return r;
 }
 
+int qsf_trace_pcall(struct lua_State* L, int narg)
+{
+    return qsf_node_pcall(L, narg, QSF_CALL_OTHER);
+}
+
+int qsf_node_pcall(struct lua_State* L, int narg, int kind)
+{
+    assert(kind >= 0 && kind < QSF_CALL_KINDS);
+    qsf_node_t* s = *(qsf_node_t**)lua_getextraspace(L);
+    if (!qsf_node_check_tag(s) || s->call_depth > 0) // outermost call only
+    {
+        return trace_pcall(L, narg);
+    }
+    s->call_depth++;
+    uint64_t start = uv_hrtime();
+    int r = trace_pcall(L, narg);
+    s->call_depth--;
+    record_call(s, kind, uv_hrtime() - start);
+    if (r != 0)
+    {
+        s->stats.call_errors++;
+    }
+    return r;
+}
+
+void qsf_node_stats(qsf_node_t* s, qsf_node_stats_t* stats)
+{
+    assert(s && stats);
+    *stats = s->stats;
+}
+
+qsf_profile_t* qsf_node_profile(qsf_node_t* s)
+{
+    assert(s);
+    if (s->profile == NULL)
+    {
+        s->profile = qsf_create_profile(QSF_PROFILE_ARENA_SIZE);
+    }
+    return s->profile;
+}
+
+int qsf_node_query_stats(const char* name, qsf_node_stats_t* stats)
+{
+    assert(name && stats);
+    uv_mutex_lock(&node_ctx.mutex);
+    qsf_node_t* s = find_from_node_list(name);
+    if (s != NULL)
+    {
+        read_shared_stats(s, stats);
+    }
+    uv_mutex_unlock(&node_ctx.mutex);
+    return (s == NULL);
+}
+
+int qsf_node_collect_stats(qsf_node_stats_t* stats, int max)
+{
+    assert(stats);
+    int count = 0;
+    uv_mutex_lock(&node_ctx.mutex);
+    qsf_node_t* s = node_ctx.list;
+    while (s && count < max)
+    {
+        read_shared_stats(s, &stats[count++]);
+        s = s->next;
+    }
+    uv_mutex_unlock(&node_ctx.mutex);
+    return count;
+}
+
+int qsf_node_count(void)
+{
+    uv_mutex_lock(&node_ctx.mutex);
+    int count = node_ctx.count;
+    uv_mutex_unlock(&node_ctx.mutex);
+    return count;
+}
+
 int qsf_node_init()
 {
     int r = uv_mutex_init(&node_ctx.mutex);
@@ -10,11 +10,46 @@
 struct qsf_node_s;
 typedef struct qsf_node_s qsf_node_t;
 typedef struct lua_State lua_State;
+typedef struct qsf_profile_s qsf_profile_t;
 
 
 #define QSF_NODE_TAG_VALUE_GOOD 0xabadcafe
 #define QSF_NODE_TAG_VALUE_BAD  0xdeadbeef
 
+#define QSF_NODE_MAX_NAME       32
+
+// kinds of timed lua callbacks
+#define QSF_CALL_OTHER          0
+#define QSF_CALL_TIMER          1
+#define QSF_CALL_NET            2
+#define QSF_CALL_MESSAGE        3   // from `node.recv` return to next call
+#define QSF_CALL_KINDS          4
+
+// buckets of loop lag histogram, bucket i counts [2^(i-1), 2^i) microseconds
+#define QSF_LAG_BUCKETS         20
+
+// interval of loop lag reference timer, in milliseconds
+#define QSF_LAG_INTERVAL        100
+
+// counters written by node thread, other threads read a snapshot
+// published by the node every QSF_LAG_INTERVAL milliseconds
+typedef struct qsf_node_stats_s
+{
+    char        name[QSF_NODE_MAX_NAME];
+    uint64_t    loop_count;         // loop iterations
+    uint64_t    idle_time;          // nanoseconds blocked in poll
+    uint64_t    lag_last;           // microseconds reference timer fired late
+    uint64_t    lag_max;
+    uint64_t    lag_total;
+    uint64_t    lag_samples;
+    uint64_t    lag_histogram[QSF_LAG_BUCKETS];
+    uint64_t    call_count[QSF_CALL_KINDS];
+    uint64_t    call_time[QSF_CALL_KINDS];  // nanoseconds
+    uint64_t    call_max[QSF_CALL_KINDS];   // nanoseconds
+    uint64_t    call_errors;        // callbacks raised an error
+    uint64_t    lua_memory;         // bytes, sampled by reference timer
+}qsf_node_stats_t;
+
 
 // message handler
 typedef int(*msg_recv_handler)(void* ud, const char*, int, const char*, int);
@@ -29,6 +64,14 @@ void qsf_node_send(qsf_node_t* s,
                    const char* name, int len, 
                    const char* data, int size);
 
+// add a filter run before `qsf_node_recv` handler, filters run in the
+// order added and a message is dropped once a filter returns non-zero.
+// filters must not add or remove filters while running.
+void qsf_node_add_filter(qsf_node_t* s, msg_recv_handler func, void* ud);
+
+// remove a filter added with the same `func` and `ud`
+void qsf_node_remove_filter(qsf_node_t* s, msg_recv_handler func, void* ud);
+
 // recv message from peer service
 int qsf_node_recv(qsf_node_t* s,
                   msg_recv_handler func, 
@@ -41,8 +84,42 @@ uv_loop_t* qsf_node_loop(qsf_node_t* s);
 // name of current service
 const char* qsf_node_name(qsf_node_t* s);
 
+// count uv work of libraries in flight, node exit runs its loop until
+// all work is done, before closing lua state.
+void qsf_node_work_begin(qsf_node_t* s);
+void qsf_node_work_end(qsf_node_t* s);
+
+// non-zero once node is exiting, completions should not call lua
+int qsf_node_closing(qsf_node_t* s);
+
 int qsf_trace_pcall(lua_State* L, int narg);
 
+// protected call of a callback, timed as `kind` of QSF_CALL_*
+int qsf_node_pcall(lua_State* L, int narg, int kind);
+
+// counters of a node, called by its own thread
+void qsf_node_stats(qsf_node_t* s, qsf_node_stats_t* stats);
+
+// lua profiler of a node, created on first use
+qsf_profile_t* qsf_node_profile(qsf_node_t* s);
+
+// begin a traced span rooted in node, ends the span in progress.
+// returns trace id, 0 if tracing is disabled.
+uint64_t qsf_node_trace_begin(qsf_node_t* s, const char* name);
+
+// end traced span in progress, done implicitly by next `qsf_node_recv`
+void qsf_node_trace_end(qsf_node_t* s);
+
+// last published snapshot of a node's counters from any thread,
+// non-zero if not found
+int qsf_node_query_stats(const char* name, qsf_node_stats_t* stats);
+
+// snapshot counters of up to `max` nodes, returns count
+int qsf_node_collect_stats(qsf_node_stats_t* stats, int max);
+
+// number of running nodes
+int qsf_node_count(void);
+
 int qsf_node_init();
 void qsf_node_exit();
 
@@ -0,0 +1,241 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_profile.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "net/uthash.h"
+#include "qsf.h"
+
+#define MAX_FRAME_LABEL     256
+#define MAX_FOLDED_SIZE     (QSF_PROFILE_MAX_DEPTH * 64)
+
+// a distinct folded stack, allocated in arena
+typedef struct profile_stack_s
+{
+    UT_hash_handle  hh;         // hash table entry
+    uint64_t        count;      // samples of this stack
+    uint32_t        len;        // size of `folded`
+    char            folded[];   // `root;caller;callee`
+}profile_stack_t;
+
+struct qsf_profile_s
+{
+    int             running;    // hook installed
+    uint64_t        interval;   // sampling period, nanoseconds
+    uint64_t        next_sample;// time of next sample
+    uint64_t        samples;    // total samples
+    uint64_t        dropped;    // samples without room in arena
+    char*           arena;      // storage of stacks
+    size_t          arena_size;
+    size_t          arena_used;
+    profile_stack_t* stacks;    // folded stack hash map
+    char            folded[MAX_FOLDED_SIZE];
+};
+
+
+qsf_profile_t* qsf_create_profile(size_t arena_size)
+{
+    qsf_profile_t* p = qsf_malloc(sizeof(qsf_profile_t));
+    memset(p, 0, sizeof(*p));
+    p->arena_size = arena_size;
+    p->arena = qsf_malloc(arena_size);
+    return p;
+}
+
+void qsf_profile_destroy(qsf_profile_t* p)
+{
+    assert(p);
+    HASH_CLEAR(hh, p->stacks);
+    qsf_free(p->arena);
+    qsf_free(p);
+}
+
+// label of one frame, `name (source:line)`
+static int frame_label(lua_Debug* ar, char* buf, int size)
+{
+    const char* name = (ar->name ? ar->name : (*ar->what == 'm' ? "main" : "?"));
+    int len = 0;
+    if (*ar->what == 'C')
+    {
+        len = snprintf(buf, size, "%s [C]", name);
+    }
+    else
+    {
+        len = snprintf(buf, size, "%s (%s:%d)", name, ar->short_src, ar->linedefined);
+    }
+    if (len < 0 || len >= size)
+    {
+        len = size - 1;
+    }
+    // separators are reserved by folded format
+    for (int i = 0; i < len; i++)
+    {
+        if (buf[i] == ';' || buf[i] == '\n')
+        {
+            buf[i] = '_';
+        }
+    }
+    return len;
+}
+
+// fold current stack from root to leaf
+static uint32_t fold_stack(qsf_profile_t* p, lua_State* L)
+{
+    lua_Debug frames[QSF_PROFILE_MAX_DEPTH];
+    int depth = 0;
+    while (depth < QSF_PROFILE_MAX_DEPTH && lua_getstack(L, depth, &frames[depth]))
+    {
+        depth++;
+    }
+    uint32_t len = 0;
+    char label[MAX_FRAME_LABEL];
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        lua_getinfo(L, "Sn", &frames[i]);
+        int n = frame_label(&frames[i], label, sizeof(label));
+        if (len + n + 1 > sizeof(p->folded))
+        {
+            break;
+        }
+        if (len > 0)
+        {
+            p->folded[len++] = ';';
+        }
+        memcpy(p->folded + len, label, n);
+        len += n;
+    }
+    return len;
+}
+
+static void record_sample(qsf_profile_t* p, lua_State* L, uint64_t weight)
+{
+    uint32_t len = fold_stack(p, L);
+    profile_stack_t* stack = NULL;
+    p->samples += weight;
+    if (len == 0)
+    {
+        return;
+    }
+    HASH_FIND(hh, p->stacks, p->folded, len, stack);
+    if (stack == NULL)
+    {
+        size_t need = (sizeof(profile_stack_t) + len + 7) & ~(size_t)7;
+        if (p->arena_used + need > p->arena_size)
+        {
+            p->dropped += weight;
+            return;
+        }
+        stack = (profile_stack_t*)(p->arena + p->arena_used);
+        p->arena_used += need;
+        stack->count = 0;
+        stack->len = len;
+        memcpy(stack->folded, p->folded, len);
+        HASH_ADD_KEYPTR(hh, p->stacks, stack->folded, len, stack);
+    }
+    stack->count += weight;
+}
+
+static void profile_hook(lua_State* L, lua_Debug* ar)
+{
+    qsf_node_t* s = *(qsf_node_t**)lua_getextraspace(L);
+    if (!qsf_node_check_tag(s))
+    {
+        return;
+    }
+    qsf_profile_t* p = qsf_node_profile(s);
+    uint64_t now = uv_hrtime();
+    if (!p->running || now < p->next_sample)
+    {
+        return;
+    }
+    // one sample however late the hook runs: periods spent inside a long C
+    // call are not sampled, as the stack seen now may no longer hold it
+    p->next_sample = now + p->interval;
+    record_sample(p, L, 1);
+}
+
+static lua_State* main_thread(lua_State* L)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State* main = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return main;
+}
+
+int qsf_profile_start(qsf_profile_t* p, lua_State* L, int hz)
+{
+    assert(p && L);
+    if (hz <= 0 || hz > 100000)
+    {
+        return -1;
+    }
+    HASH_CLEAR(hh, p->stacks);
+    p->arena_used = 0;
+    p->samples = 0;
+    p->dropped = 0;
+    p->interval = 1000000000ULL / hz;
+    p->next_sample = uv_hrtime() + p->interval;
+    p->running = 1;
+    lua_sethook(main_thread(L), profile_hook, LUA_MASKCOUNT, QSF_PROFILE_CHECK_COUNT);
+    return 0;
+}
+
+void qsf_profile_stop(qsf_profile_t* p, lua_State* L)
+{
+    assert(p && L);
+    if (p->running)
+    {
+        p->running = 0;
+        lua_sethook(main_thread(L), NULL, 0, 0);
+    }
+}
+
+int qsf_profile_running(qsf_profile_t* p)
+{
+    assert(p);
+    return p->running;
+}
+
+uint64_t qsf_profile_samples(qsf_profile_t* p, uint64_t* dropped)
+{
+    assert(p);
+    if (dropped)
+    {
+        *dropped = p->dropped;
+    }
+    return p->samples;
+}
+
+void qsf_profile_foreach(qsf_profile_t* p, profile_visit_cb visit, void* ud)
+{
+    assert(p && visit);
+    profile_stack_t* stack = NULL;
+    profile_stack_t* tmp = NULL;
+    HASH_ITER(hh, p->stacks, stack, tmp)
+    {
+        visit(stack->folded, stack->len, stack->count, ud);
+    }
+}
+
+static void write_stack(const char* stack, size_t len, uint64_t count, void* ud)
+{
+    fprintf((FILE*)ud, "%.*s %llu\n", (int)len, stack, (unsigned long long)count);
+}
+
+int qsf_profile_write(qsf_profile_t* p, const char* path)
+{
+    assert(p && path);
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    qsf_profile_foreach(p, write_stack, fp);
+    return fclose(fp);
+}
@@ -0,0 +1,49 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct qsf_profile_s;
+typedef struct qsf_profile_s qsf_profile_t;
+typedef struct lua_State lua_State;
+
+/**
+ *  sampling profiler of lua code in a node.
+ *
+ *  a count hook reads the clock every QSF_PROFILE_CHECK_COUNT instructions
+ *  and takes a stack sample when a sampling period elapsed. samples are
+ *  folded into `root;caller;callee` stacks counted in a preallocated arena,
+ *  time blocked inside C functions is not sampled.
+ */
+
+#define QSF_PROFILE_DEFAULT_HZ      1000
+#define QSF_PROFILE_CHECK_COUNT     1000
+#define QSF_PROFILE_MAX_DEPTH       64
+#define QSF_PROFILE_ARENA_SIZE      (4 * 1024 * 1024)
+
+// folded stack and its sample count
+typedef void(*profile_visit_cb)(const char* stack, size_t len, uint64_t count, void* ud);
+
+qsf_profile_t* qsf_create_profile(size_t arena_size);
+
+void qsf_profile_destroy(qsf_profile_t* p);
+
+// clear previous samples and install hook on main thread of `L`
+int qsf_profile_start(qsf_profile_t* p, lua_State* L, int hz);
+
+// remove hook of main thread of `L`
+void qsf_profile_stop(qsf_profile_t* p, lua_State* L);
+
+int qsf_profile_running(qsf_profile_t* p);
+
+// total samples, and samples dropped because arena is full
+uint64_t qsf_profile_samples(qsf_profile_t* p, uint64_t* dropped);
+
+void qsf_profile_foreach(qsf_profile_t* p, profile_visit_cb visit, void* ud);
+
+// write folded stacks to file, one `stack count` line each
+int qsf_profile_write(qsf_profile_t* p, const char* path);
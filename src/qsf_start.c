@@ -3,6 +3,8 @@
 // See accompanying files LICENSE.
 
 #include "qsf.h"
+#include "qsf_trace.h"
+#include "qsf_mysql_pool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -60,11 +62,24 @@ void* qsf_create_dealer(const char* identity)
     return dealer;
 }
 
+// stamp routing time on trace context
+static void stamp_trace(zmq_msg_t* trace)
+{
+    if (zmq_msg_size(trace) == sizeof(qsf_trace_ctx_t))
+    {
+        qsf_trace_ctx_t ctx;
+        memcpy(&ctx, zmq_msg_data(trace), sizeof(ctx));
+        ctx.route_time = uv_hrtime();
+        memcpy(zmq_msg_data(trace), &ctx, sizeof(ctx));
+    }
+}
+
 // dispatch dealer message to peer
 static int dispatch_message(void)
 {
     zmq_msg_t from;     // where does this message came from
     zmq_msg_t to;       // where is this message going to
+    zmq_msg_t trace;    // optional trace context
     zmq_msg_t msg;      // the message itself
 
     void* router = qsf_context.router;
@@ -72,8 +87,10 @@ static int dispatch_message(void)
 
     qsf_zmq_assert(zmq_msg_init(&from) == 0);
     qsf_zmq_assert(zmq_msg_init(&to) == 0);
+    qsf_zmq_assert(zmq_msg_init(&trace) == 0);
     qsf_zmq_assert(zmq_msg_init(&msg) == 0);
 
+    int traced = 0;
     int bytes = zmq_msg_recv(&from, router, 0);
     if (bytes < 0) 
         goto cleanup;
@@ -83,6 +100,15 @@ static int dispatch_message(void)
     bytes = zmq_msg_recv(&msg, router, 0);
     if (bytes < 0) 
         goto cleanup;
+    if (zmq_msg_more(&msg)) // trace context precedes message
+    {
+        traced = 1;
+        qsf_zmq_assert(zmq_msg_move(&trace, &msg) == 0);
+        stamp_trace(&trace);
+        bytes = zmq_msg_recv(&msg, router, 0);
+        if (bytes < 0)
+            goto cleanup;
+    }
 
     bytes = zmq_msg_send(&to, router, ZMQ_SNDMORE);
     if (bytes < 0) 
@@ -90,12 +116,19 @@ static int dispatch_message(void)
     bytes = zmq_msg_send(&from, router, ZMQ_SNDMORE);
     if (bytes < 0) 
         goto cleanup;
+    if (traced)
+    {
+        bytes = zmq_msg_send(&trace, router, ZMQ_SNDMORE);
+        if (bytes < 0)
+            goto cleanup;
+    }
     bytes = zmq_msg_send(&msg, router, 0);
     if (bytes < 0) 
         goto cleanup;
 
 cleanup:
     qsf_zmq_assert(zmq_msg_close(&msg) == 0);
+    qsf_zmq_assert(zmq_msg_close(&trace) == 0);
     qsf_zmq_assert(zmq_msg_close(&to) == 0);
     qsf_zmq_assert(zmq_msg_close(&from) == 0);
     return bytes;
@@ -127,6 +160,7 @@ static void qsf_init(void)
 
     int enable = (int)qsf_getenv_int("log_to_file", 0);
     qsf_log_to_file(enable);
+    qsf_log_set_level((int)qsf_getenv_int("log_level", QSF_LOG_DEBUG));
 
     qsf_context.context = ctx;
     qsf_context.router = router;
@@ -138,6 +172,9 @@ void qsf_exit(int sig)
 {
     qsf_env_exit();
     qsf_node_exit();
+    qsf_mysql_pool_exit();
+    qsf_trace_exit();
+    qsf_log_exit();
     zmq_ctx_term(qsf_context.context);
 }
 
@@ -170,6 +207,9 @@ int qsf_start(const char* file)
     qsf_assert(r == 0, "qsf_env_init() failed.");
 
     qsf_init();
+
+    r = qsf_trace_init();
+    qsf_assert(r == 0, "qsf_trace_init() failed.");
     
     r = qsf_node_init();
     qsf_assert(r == 0, "qsf_service_init() failed.");
@@ -0,0 +1,309 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "qsf_trace.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+#include "qsf.h"
+
+typedef struct trace_span_s
+{
+    char        phase;
+    char        name[QSF_TRACE_MAX_NAME];
+    uint64_t    trace_id;
+    uint64_t    span_id;
+    uint64_t    parent_id;
+    uint64_t    start;
+    uint64_t    duration;
+}trace_span_t;
+
+// single producer single consumer ring
+struct qsf_trace_ring_s
+{
+    qsf_trace_ring_t*   next;       // registry list
+    int                 tid;        // thread id in viewer
+    int                 closed;     // owner exited, guarded by mutex
+    int                 named;      // thread name event written
+    char                name[QSF_TRACE_MAX_NAME];
+    uint64_t            seq;        // id generator
+    uint64_t            dropped;
+    uint32_t            mask;       // capacity - 1
+    uint32_t            head;       // written by producer
+    uint32_t            tail;       // written by flusher
+    trace_span_t        spans[];
+};
+
+struct qsf_trace_context_s
+{
+    int                 enabled;
+    int                 quit;
+    int                 next_tid;
+    int                 events;     // events written to file
+    uint32_t            ring_size;
+    uint64_t            interval;   // flush interval, nanoseconds
+    uint64_t            dropped;    // of freed rings
+    FILE*               fp;
+    qsf_trace_ring_t*   rings;
+    uv_mutex_t          mutex;
+    uv_cond_t           cond;
+    uv_thread_t         flusher;
+};
+
+static struct qsf_trace_context_s trace_ctx;
+
+
+int qsf_trace_enabled(void)
+{
+    return trace_ctx.enabled;
+}
+
+qsf_trace_ring_t* qsf_trace_open_ring(const char* name)
+{
+    assert(name);
+    if (!trace_ctx.enabled)
+    {
+        return NULL;
+    }
+    uint32_t size = trace_ctx.ring_size;
+    qsf_trace_ring_t* ring = qsf_malloc(sizeof(qsf_trace_ring_t) + sizeof(trace_span_t) * size);
+    memset(ring, 0, sizeof(qsf_trace_ring_t));
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    ring->mask = size - 1;
+    uv_mutex_lock(&trace_ctx.mutex);
+    ring->tid = ++trace_ctx.next_tid;
+    ring->next = trace_ctx.rings;
+    trace_ctx.rings = ring;
+    uv_mutex_unlock(&trace_ctx.mutex);
+    return ring;
+}
+
+void qsf_trace_close_ring(qsf_trace_ring_t* ring)
+{
+    if (ring)
+    {
+        uv_mutex_lock(&trace_ctx.mutex);
+        ring->closed = 1;
+        uv_mutex_unlock(&trace_ctx.mutex);
+    }
+}
+
+uint64_t qsf_trace_new_id(qsf_trace_ring_t* ring)
+{
+    assert(ring);
+    return ((uint64_t)ring->tid << 40) | ++ring->seq;
+}
+
+void qsf_trace_span(qsf_trace_ring_t* ring,
+                    char phase,
+                    const char* name,
+                    uint64_t trace_id,
+                    uint64_t span_id,
+                    uint64_t parent_id,
+                    uint64_t start,
+                    uint64_t duration)
+{
+    assert(ring && name);
+    uint32_t head = ring->head;
+    if (head - qsf_load_acquire(&ring->tail) > ring->mask)
+    {
+        ring->dropped++;
+        return;
+    }
+    trace_span_t* span = &ring->spans[head & ring->mask];
+    span->phase = phase;
+    strncpy(span->name, name, sizeof(span->name) - 1);
+    span->name[sizeof(span->name) - 1] = '\0';
+    span->trace_id = trace_id;
+    span->span_id = span_id;
+    span->parent_id = parent_id;
+    span->start = start;
+    span->duration = duration;
+    qsf_store_release(&ring->head, head + 1);
+}
+
+uint64_t qsf_trace_dropped(void)
+{
+    uint64_t dropped = 0;
+    if (trace_ctx.enabled)
+    {
+        uv_mutex_lock(&trace_ctx.mutex);
+        dropped = trace_ctx.dropped;
+        for (qsf_trace_ring_t* ring = trace_ctx.rings; ring; ring = ring->next)
+        {
+            dropped += ring->dropped;
+        }
+        uv_mutex_unlock(&trace_ctx.mutex);
+    }
+    return dropped;
+}
+
+// names are node names and literals, only quote and backslash are escaped
+static void write_name(FILE* fp, const char* name)
+{
+    for (; *name; name++)
+    {
+        if (*name == '"' || *name == '\\')
+        {
+            fputc('\\', fp);
+        }
+        fputc(*name, fp);
+    }
+}
+
+static void write_header(FILE* fp, int tid, char phase, const trace_span_t* span, uint64_t ts)
+{
+    fputs(trace_ctx.events++ > 0 ? ",\n" : "\n", fp);
+    fprintf(fp, "{\"ph\":\"%c\",\"name\":\"", phase);
+    write_name(fp, span->name);
+    fprintf(fp, "\",\"cat\":\"qsf\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+        tid, ts / 1000.0);
+}
+
+static void write_args(FILE* fp, const trace_span_t* span)
+{
+    fprintf(fp, ",\"args\":{\"trace\":\"%016llx\",\"span\":\"%016llx\","
+        "\"parent\":\"%016llx\"}}", (unsigned long long)span->trace_id,
+        (unsigned long long)span->span_id, (unsigned long long)span->parent_id);
+}
+
+static void write_event(FILE* fp, int tid, const trace_span_t* span)
+{
+    switch (span->phase)
+    {
+    case QSF_TRACE_COMPLETE:
+        write_header(fp, tid, span->phase, span, span->start);
+        fprintf(fp, ",\"dur\":%.3f", span->duration / 1000.0);
+        write_args(fp, span);
+        break;
+    case QSF_TRACE_ASYNC:
+        write_header(fp, tid, 'b', span, span->start);
+        fprintf(fp, ",\"id\":\"%016llx\"", (unsigned long long)span->span_id);
+        write_args(fp, span);
+        write_header(fp, tid, 'e', span, span->start + span->duration);
+        fprintf(fp, ",\"id\":\"%016llx\"}", (unsigned long long)span->span_id);
+        break;
+    default: // flow events bind to enclosing slices
+        write_header(fp, tid, span->phase, span, span->start);
+        fprintf(fp, ",\"id\":\"%016llx\"%s}", (unsigned long long)span->span_id,
+            span->phase == QSF_TRACE_FLOW_END ? ",\"bp\":\"e\"" : "");
+        break;
+    }
+}
+
+static void write_thread_name(FILE* fp, qsf_trace_ring_t* ring)
+{
+    fputs(trace_ctx.events++ > 0 ? ",\n" : "\n", fp);
+    fprintf(fp, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+        "\"args\":{\"name\":\"", ring->tid);
+    write_name(fp, ring->name);
+    fputs("\"}}", fp);
+    ring->named = 1;
+}
+
+// drain all rings, free closed rings, mutex is held
+static void flush_rings(void)
+{
+    FILE* fp = trace_ctx.fp;
+    qsf_trace_ring_t** pring = &trace_ctx.rings;
+    while (*pring)
+    {
+        qsf_trace_ring_t* ring = *pring;
+        int closed = ring->closed;
+        uint32_t head = qsf_load_acquire(&ring->head);
+        uint32_t tail = ring->tail;
+        if (!ring->named && head != tail)
+        {
+            write_thread_name(fp, ring);
+        }
+        for (; tail != head; tail++)
+        {
+            write_event(fp, ring->tid, &ring->spans[tail & ring->mask]);
+        }
+        qsf_store_release(&ring->tail, tail);
+        if (closed)
+        {
+            *pring = ring->next;
+            trace_ctx.dropped += ring->dropped;
+            qsf_free(ring);
+        }
+        else
+        {
+            pring = &ring->next;
+        }
+    }
+    fflush(fp);
+}
+
+static void flusher_callback(void* args)
+{
+    uv_mutex_lock(&trace_ctx.mutex);
+    while (!trace_ctx.quit)
+    {
+        uv_cond_timedwait(&trace_ctx.cond, &trace_ctx.mutex, trace_ctx.interval);
+        flush_rings();
+    }
+    uv_mutex_unlock(&trace_ctx.mutex);
+}
+
+int qsf_trace_init(void)
+{
+    const char* path = qsf_getenv("trace_file", "");
+    if (path == NULL || path[0] == '\0')
+    {
+        return 0; // tracing disabled
+    }
+    uint32_t size = (uint32_t)qsf_getenv_int("trace_ring_size", QSF_TRACE_RING_SIZE);
+    int64_t interval = qsf_getenv_int("trace_flush_interval", QSF_TRACE_FLUSH_INTERVAL);
+    if (size < 16 || (size & (size - 1)) != 0 || interval <= 0)
+    {
+        qsf_log("trace: ring size must be power of 2, got %u, interval %d.\n",
+            size, (int)interval);
+        return -1;
+    }
+    trace_ctx.fp = fopen(path, "w");
+    if (trace_ctx.fp == NULL)
+    {
+        qsf_log("trace: cannot open %s.\n", path);
+        return -1;
+    }
+    fputs("[", trace_ctx.fp);
+    trace_ctx.ring_size = size;
+    trace_ctx.interval = (uint64_t)interval * 1000000;
+    trace_ctx.quit = 0;
+    qsf_assert(uv_mutex_init(&trace_ctx.mutex) == 0, "trace: uv_mutex_init() failed.");
+    qsf_assert(uv_cond_init(&trace_ctx.cond) == 0, "trace: uv_cond_init() failed.");
+    qsf_assert(uv_thread_create(&trace_ctx.flusher, flusher_callback, NULL) == 0,
+        "trace: uv_thread_create() failed.");
+    trace_ctx.enabled = 1;
+    return 0;
+}
+
+void qsf_trace_exit(void)
+{
+    if (!trace_ctx.enabled)
+    {
+        return;
+    }
+    uv_mutex_lock(&trace_ctx.mutex);
+    trace_ctx.quit = 1;
+    uv_cond_signal(&trace_ctx.cond);
+    uv_mutex_unlock(&trace_ctx.mutex);
+    uv_thread_join(&trace_ctx.flusher);
+
+    flush_rings(); // nodes are exited, no more producer
+    while (trace_ctx.rings)
+    {
+        qsf_trace_ring_t* ring = trace_ctx.rings;
+        trace_ctx.rings = ring->next;
+        qsf_free(ring);
+    }
+    fputs("\n]\n", trace_ctx.fp);
+    fclose(trace_ctx.fp);
+    trace_ctx.fp = NULL;
+    trace_ctx.enabled = 0;
+    uv_cond_destroy(&trace_ctx.cond);
+    uv_mutex_destroy(&trace_ctx.mutex);
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ *  cross-node tracing in chrome `trace_event` format.
+ *
+ *  a traced message carries a `qsf_trace_ctx_t` frame between routing
+ *  identity and message data, the router stamps `route_time` on it.
+ *  every node records spans into its own single producer ring, a flusher
+ *  thread drains all rings into `trace_file` every `trace_flush_interval`
+ *  milliseconds. tracing is disabled if `trace_file` is not configured.
+ */
+
+#define QSF_TRACE_MAX_NAME          48
+#define QSF_TRACE_RING_SIZE         8192
+#define QSF_TRACE_FLUSH_INTERVAL    1000
+
+// span phases of trace event format
+#define QSF_TRACE_COMPLETE          'X'
+#define QSF_TRACE_ASYNC             'A'     // written as overlappable `b` and `e` pair
+#define QSF_TRACE_FLOW_START        's'
+#define QSF_TRACE_FLOW_END          'f'
+
+struct qsf_trace_ring_s;
+typedef struct qsf_trace_ring_s qsf_trace_ring_t;
+
+// trace context of a message, times are `uv_hrtime()` nanoseconds
+typedef struct qsf_trace_ctx_s
+{
+    uint64_t    trace_id;
+    uint64_t    span_id;        // span of sender
+    uint64_t    flow_id;        // binds sender and receiver spans
+    uint64_t    send_time;
+    uint64_t    route_time;     // stamped by router
+}qsf_trace_ctx_t;
+
+int qsf_trace_init(void);
+void qsf_trace_exit(void);
+
+int qsf_trace_enabled(void);
+
+// ring of calling thread, named as the trace viewer thread
+qsf_trace_ring_t* qsf_trace_open_ring(const char* name);
+
+// ring is freed by flusher after its spans are written
+void qsf_trace_close_ring(qsf_trace_ring_t* ring);
+
+// new span or trace id, unique in process
+uint64_t qsf_trace_new_id(qsf_trace_ring_t* ring);
+
+// record a span, dropped if ring is full
+void qsf_trace_span(qsf_trace_ring_t* ring,
+                    char phase,
+                    const char* name,
+                    uint64_t trace_id,
+                    uint64_t span_id,
+                    uint64_t parent_id,
+                    uint64_t start,
+                    uint64_t duration);
+
+// spans dropped by full rings
+uint64_t qsf_trace_dropped(void);
@@ -0,0 +1,82 @@
+--
+-- Net server side of the load benchmark, drive it by tools/netbench:
+--
+--   netbench -p 10086 -c 100 -s 64 -w 4 -d 10
+--   netbench -p 10086 -c 20 -s 64 -r 100 -d 10     (broadcast mode)
+--
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+
+
+local host = '127.0.0.1'
+local port = 10086
+local config =
+{
+    mode = 'echo',              -- 'echo' or 'broadcast'
+    framing = 'stream',         -- netbench speaks the 2-byte length framing only
+    max_connections = 5000,
+    heartbeat = 60,
+    heartbeat_check = 15,
+    report_interval = 5000,     -- milliseconds
+}
+
+-- exclusive upper bound of histogram entry `i`
+local function bucket_bound(i)
+    return 1 << (i - 1)
+end
+
+local function percentile(histogram, p)
+    local total = 0
+    for _, count in ipairs(histogram) do
+        total = total + count
+    end
+    local rank = total * p
+    local seen = 0
+    for i, count in ipairs(histogram) do
+        seen = seen + count
+        if count > 0 and seen >= rank then
+            return bucket_bound(i)
+        end
+    end
+    return 0
+end
+
+local function report(server, seconds)
+    local stats = server:stats()
+    server:resetStats()
+    print(string.format('sessions %d, in %.0f msg/s %.2f MB/s, out %.0f msg/s %.2f MB/s, ' ..
+        'pending %d bytes, handler p50 < %dus p99 < %dus',
+        stats.sessions,
+        stats.framesIn / seconds, stats.bytesIn / seconds / 1048576,
+        stats.framesOut / seconds, stats.bytesOut / seconds / 1048576,
+        stats.pendingBytes,
+        percentile(stats.readLatency, 0.5), percentile(stats.readLatency, 0.99)))
+end
+
+local function main()
+    local server = net.createServer(config.max_connections, config.heartbeat,
+        config.heartbeat_check, config.framing)
+    server:start(host, port, function(err, serial, data)
+        if err then
+            return
+        end
+        if config.mode == 'broadcast' then
+            server:broadcast(data)
+        else
+            server:write(serial, data)
+        end
+    end)
+    print(string.format('bench server %s on %s:%d', config.mode, host, port))
+
+    local function tick()
+        report(server, config.report_interval / 1000)
+        uv.createTimer(config.report_interval, 0, tick)
+    end
+    uv.createTimer(config.report_interval, 0, tick)
+    while true do
+        node.run()
+    end
+end
+
+main()
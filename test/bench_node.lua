@@ -0,0 +1,136 @@
+--
+-- Inter-node messaging benchmark, started by `qsf config_bench_node`.
+--
+-- each run launches worker nodes of one topology and payload size, then
+-- prints one JSON line with throughput and round trip percentiles.
+-- a round trip is one request and its reply, both routed by `sys`.
+--
+local uv = require 'luv'
+local node = require 'node'
+
+
+local config =
+{
+    worker = '../test/bench_node_worker.lua',
+    topologies = { 'pingpong', 'fanout', 'fanin', 'alltoall' },
+    sizes = { 16, 256, 4096, 65536 },
+    nodes = 4,          -- pairs of pingpong, peers of the other topologies
+    count = 10000,      -- requests per driver and target
+    window = 1,         -- in-flight requests per driver and target
+}
+
+local run_index = 0
+
+-- worker name to target list
+local function build_topology(topology, n)
+    local prefix = string.format('b%d_', run_index)
+    local workers = {}
+    local function name(i)
+        return prefix .. i
+    end
+    if topology == 'pingpong' then
+        for i = 1, n do
+            workers[name(2 * i - 1)] = { name(2 * i) }
+            workers[name(2 * i)] = {}
+        end
+    elseif topology == 'fanout' then
+        local targets = {}
+        for i = 1, n do
+            targets[i] = name(i + 1)
+            workers[name(i + 1)] = {}
+        end
+        workers[name(1)] = targets
+    elseif topology == 'fanin' then
+        workers[name(1)] = {}
+        for i = 1, n do
+            workers[name(i + 1)] = { name(1) }
+        end
+    elseif topology == 'alltoall' then
+        for i = 1, n do
+            local targets = {}
+            for j = 1, n do
+                if j ~= i then
+                    targets[#targets + 1] = name(j)
+                end
+            end
+            workers[name(i)] = targets
+        end
+    else
+        error('unknown topology ' .. topology)
+    end
+    return workers
+end
+
+-- wait `count` messages starting with `prefix`, returns their bodies
+local function collect(prefix, count)
+    local bodies = {}
+    while #bodies < count do
+        local from, msg = node.recv()
+        if msg:sub(1, #prefix) == prefix then
+            bodies[#bodies + 1] = msg:sub(#prefix + 1)
+        end
+    end
+    return bodies
+end
+
+local function percentile(samples, p)
+    if #samples == 0 then
+        return 0
+    end
+    return samples[math.floor(p * (#samples - 1) + 0.5) + 1]
+end
+
+local function run(topology, size)
+    run_index = run_index + 1
+    local master = node.name()
+    local workers = build_topology(topology, config.nodes)
+    local total, drivers = 0, {}
+    for name, targets in pairs(workers) do
+        local args = string.format('master=%s targets=%s size=%d count=%d window=%d',
+            master, table.concat(targets, ','), size, config.count, config.window)
+        assert(node.launch(name, config.worker, args))
+        total = total + 1
+        if #targets > 0 then
+            drivers[#drivers + 1] = name
+        end
+    end
+    collect('ready', total)
+
+    local start = uv.hrtime()
+    for _, name in ipairs(drivers) do
+        node.send(name, 'go')
+    end
+    local results = collect('done', #drivers)
+    local seconds = (uv.hrtime() - start) / 1e9
+
+    local samples = {}
+    for _, data in ipairs(results) do
+        for i = 1, #data, 4 do
+            samples[#samples + 1] = string.unpack('<I4', data, i)
+        end
+    end
+    table.sort(samples)
+    for name in pairs(workers) do
+        node.send(name, 'stop')
+    end
+    collect('bye', total)
+
+    local trips = #samples
+    print(string.format('{"topology":"%s","nodes":%d,"size":%d,"window":%d,' ..
+        '"round_trips":%d,"seconds":%.3f,"msgs_per_sec":%.0f,"bytes_per_sec":%.0f,' ..
+        '"rtt_us":{"p50":%d,"p99":%d,"p999":%d,"max":%d}}',
+        topology, total, size, config.window, trips, seconds,
+        2 * trips / seconds, 2 * trips * size / seconds,
+        percentile(samples, 0.5), percentile(samples, 0.99),
+        percentile(samples, 0.999), samples[#samples] or 0))
+end
+
+local function main()
+    for _, topology in ipairs(config.topologies) do
+        for _, size in ipairs(config.sizes) do
+            run(topology, size)
+        end
+    end
+end
+
+main()
@@ -0,0 +1,93 @@
+--
+-- Worker node of bench_node.lua, arguments are `key=value` pairs:
+--
+--   master     name of coordinator node
+--   targets    comma separated nodes to send requests, may be empty
+--   size       message bytes
+--   count      requests per target
+--   window     in-flight requests per target
+--
+-- every worker answers requests of other workers until `stop` is received.
+--
+local uv = require 'luv'
+local node = require 'node'
+
+
+local KIND_REQUEST = 'Q'
+local KIND_REPLY = 'R'
+local HEADER = 9        -- kind and send time
+
+local function parse_args(text)
+    local args = {}
+    for key, value in string.gmatch(text or '', '(%w+)=(%S*)') do
+        args[key] = value
+    end
+    local targets = {}
+    for name in string.gmatch(args.targets or '', '[^,]+') do
+        targets[#targets + 1] = name
+    end
+    args.targets = targets
+    args.size = math.max(tonumber(args.size) or 64, HEADER)
+    args.count = tonumber(args.count) or 1000
+    args.window = tonumber(args.window) or 1
+    return args
+end
+
+-- sorted samples as little-endian uint32 array
+local function pack_samples(samples)
+    table.sort(samples)
+    local chunks = {}
+    for i = 1, #samples, 1024 do
+        local last = math.min(i + 1023, #samples)
+        local format = '<' .. string.rep('I4', last - i + 1)
+        chunks[#chunks + 1] = string.pack(format, table.unpack(samples, i, last))
+    end
+    return table.concat(chunks)
+end
+
+local function main(text)
+    local args = parse_args(text)
+    local padding = string.rep('x', args.size - HEADER)
+    local function request()
+        return KIND_REQUEST .. string.pack('<I8', uv.hrtime()) .. padding
+    end
+
+    local sent = {}
+    local replied = {}
+    local samples = {}
+    local pending = #args.targets
+    node.send(args.master, 'ready')
+    while true do
+        local from, msg = node.recv()
+        local kind = msg:sub(1, 1)
+        if kind == KIND_REQUEST then
+            node.send(from, KIND_REPLY .. msg:sub(2))
+        elseif kind == KIND_REPLY then
+            local start = string.unpack('<I8', msg, 2)
+            samples[#samples + 1] = (uv.hrtime() - start) // 1000
+            replied[from] = replied[from] + 1
+            if sent[from] < args.count then
+                sent[from] = sent[from] + 1
+                node.send(from, request())
+            elseif replied[from] == args.count then
+                pending = pending - 1
+                if pending == 0 then
+                    node.send(args.master, 'done' .. pack_samples(samples))
+                end
+            end
+        elseif msg == 'go' then
+            for _, target in ipairs(args.targets) do
+                sent[target] = math.min(args.window, args.count)
+                replied[target] = 0
+                for _ = 1, sent[target] do
+                    node.send(target, request())
+                end
+            end
+        elseif msg == 'stop' then
+            node.send(args.master, 'bye')
+            break
+        end
+    end
+end
+
+main(...)
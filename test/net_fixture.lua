@@ -0,0 +1,49 @@
+-- shared setup of net tests: a server and a client on loopback, the first
+-- writes once the client is connected, and a guard against hanging tests
+
+local uv = require 'luv'
+local net = require 'net'
+
+local fixture = {}
+
+fixture.host = '127.0.0.1'
+
+-- server listening on `port`, `on_read(err, serial, data)` gets frames and errors
+function fixture.server(port, on_read)
+    local server = net.createServer()
+    server:start(fixture.host, port, on_read)
+    return server
+end
+
+-- client of `port` which does not reconnect, `options` override defaults
+function fixture.connect(port, callback, options)
+    local config = {
+        reconnect = false,
+        callback = callback or function(err, index, data) end,
+    }
+    for k, v in pairs(options or {}) do
+        config[k] = v
+    end
+    return net.connect(fixture.host, port, config)
+end
+
+-- run `fn` when connections of a client are established
+function fixture.ready(fn, delay)
+    return uv.createTimer(delay or 200, 0, fn)
+end
+
+-- errors in callbacks are only logged, so a broken test would hang.
+-- `on_expire` should stop every handle, the test then checks `expired`.
+function fixture.guard(timeout, on_expire)
+    local guard = { expired = false }
+    local timer = uv.createTimer(timeout, 0, function()
+        guard.expired = true
+        on_expire()
+    end)
+    function guard.stop()
+        timer:stop()
+    end
+    return guard
+end
+
+return fixture
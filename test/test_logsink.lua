@@ -0,0 +1,62 @@
+local uv = require 'luv'
+local node = require 'node'
+local lfs = require 'lfs'
+local logsink = require 'logsink'
+
+
+local function read_all(path)
+    local fp = assert(io.open(path, 'r'))
+    local text = fp:read('a')
+    fp:close()
+    return text
+end
+
+local function test_write()
+    local dir = 'test_logsink'
+    lfs.mkdir(dir)
+    local path = string.format('%s/app_%s.log', dir, os.date('%Y-%m-%d'))
+    os.remove(path)
+
+    local sink = logsink.open(dir, 256)
+    for i = 1, 100 do
+        sink:write('app', 'line ', i)
+    end
+    local lines, flushes = sink:stats()
+    assert(lines == 100)
+    assert(flushes > 0 and flushes < 100, flushes) -- batched by flush size
+    sink:close()
+
+    local count = 0
+    for stamp, n in read_all(path):gmatch('(%d%d:%d%d:%d%d) line (%d+)\n') do
+        count = count + 1
+        assert(tonumber(n) == count)
+    end
+    assert(count == 100, count)
+    os.remove(path)
+    lfs.rmdir(dir)
+end
+
+-- a file failed to open is retried later instead of failing every write
+local function test_reopen()
+    local dir = 'test_logsink_missing'
+    local path = string.format('%s/app_%s.log', dir, os.date('%Y-%m-%d'))
+    local sink = logsink.open(dir)
+    sink:write('app', 'dropped')
+    assert(lfs.mkdir(dir))
+    uv.createTimer(2100, 0, function() -- first retry is 1 second later
+        sink:write('app', 'kept')
+        sink:close()
+    end)
+    node.run()
+    assert(read_all(path):find('kept'))
+    os.remove(path)
+    lfs.rmdir(dir)
+end
+
+local function main()
+    test_write()
+    test_reopen()
+    print('logsink passed')
+end
+
+main()
@@ -42,15 +42,34 @@ local function test_insert()
     local r = client:execute(stmt)
 
     local total = 10000
+    local rows = {}
     for n=1, total do
-        local fmt = [[insert into mytest values(%d, '%s', %d)]]
-        local stmt = string.format(fmt, n, 'nn' .. n, math.random(100))
-        assert(client:execute(stmt) == 1)
-        print(stmt)
+        rows[n] = {n, 'nn' .. n, math.random(100)}
+    end
+    local counts, affected = client:batchInsert('mytest', {'id', 'name', 'score'}, rows)
+    assert(affected == total)
+    print('insert statements:', #counts)
+    r = client:execute('delete from mytest')
+    assert(r == total)
+
+    -- small statements pipelined in one packet
+    counts, affected = client:batchInsert('mytest', {'id', 'name', 'score'}, rows,
+        { chunk_rows = 1000, multi = true })
+    assert(affected == total and #counts == 10)
+    for _, n in ipairs(counts) do
+        assert(n == 1000)
     end
 
     r = client:execute('delete from mytest')
     assert(r == total)
+
+    -- qualified table name, a row over packet size is rejected
+    counts, affected = client:batchInsert(db .. '.mytest', {'id', 'name', 'score'}, {rows[1]})
+    assert(affected == 1)
+    local ok, err = pcall(client.batchInsert, client, 'mytest', {'id', 'name', 'score'},
+        {{2, string.rep('n', 1000), 0}}, { max_packet = 1024 })
+    assert(not ok and err:find('row 1 exceeds max_allowed_packet'))
+    client:execute('delete from mytest')
 end
 
 local stmt = [[select * from country where continent='asia' limit 2]]
@@ -119,8 +138,103 @@ local function query_store_result_alpha_index()
     print('-----------------------')
 end
 
+local function query_store_result_columns()
+    print('query_store_result_columns:')
+    local client = mysql.createClient()
+    client:connect(conf)
+    local cur = client:execute(stmt)
+    local columns, n = cur:fetchAll('c') -- one array per column
+    assert(n == 2)
+    for i = 1, n do
+        print(columns.Code[i], columns.Name[i], columns.Population[i])
+    end
+    print('-----------------------')
+end
+
+local function query_async()
+    print('query_async:')
+    local node = require 'node'
+    local client = mysql.createClient()
+    client:connect(conf)
+    local done = 0
+    client:executeAsync(stmt, function(err, rows)
+        assert(err == nil, err)
+        assert(#rows == 2)
+        done = done + 1
+    end, 'a')
+    client:executeAsync('select no_such_column from country', function(err, rows)
+        assert(err and rows == nil)
+        done = done + 1
+    end)
+    node.run()
+    assert(done == 2)
+    client:close()
+end
+
+local function query_prepared()
+    print('query_prepared:')
+    local client = mysql.createClient()
+    client:connect(conf)
+    local st = client:prepare('select Code, Name, Population, LifeExpectancy from country where Continent=? and Population > ? limit ?', 'a')
+    local rows = st:execute('Asia', 1000000, 2)
+    assert(#rows == 2)
+    for _, row in ipairs(rows) do
+        assert(math.type(row.Population) == 'integer')
+        assert(row.LifeExpectancy == nil or math.type(row.LifeExpectancy) == 'float')
+        print(row.Code, row.Name, row.Population, row.LifeExpectancy)
+    end
+    assert(#st:execute('Nowhere', 0, 10) == 0)
+    assert(not pcall(st.execute, st, 'Asia'))
+    st:close()
+
+    -- BIGINT UNSIGNED above 2^63 comes back as float
+    local big = client:prepare('select cast(? as unsigned), cast(1 as unsigned)')
+    local row = big:execute('18446744073709551615')[1]
+    assert(math.type(row[1]) == 'float' and row[1] == 2.0^64 - 1)
+    assert(math.type(row[2]) == 'integer' and row[2] == 1)
+    big:close()
+
+    local up = client:prepare('update country set Population = Population where Code = ?')
+    assert(up:execute('CHN') == 0)
+    client:close()
+    assert(not pcall(up.execute, up, 'CHN')) -- closed with connection
+end
+
+local function query_pool()
+    print('query_pool:')
+    local node = require 'node'
+    local pool = mysql.createPool('world', {
+        host = host, user = user, passwd = pwd, db = db,
+        min_size = 1, max_size = 4,
+    })
+    assert(mysql.pool('world'))
+    local done = 0
+    for i = 1, 8 do
+        pool:executeAsync(stmt, function(err, rows)
+            assert(err == nil, err)
+            assert(#rows == 2)
+            done = done + 1
+        end)
+    end
+    node.run()
+    assert(done == 8)
+
+    -- pinned connection, unfinished transaction is rolled back on close
+    local conn = assert(pool:checkout(1000))
+    conn:execute('START TRANSACTION')
+    conn:execute(stmt)
+    conn:close()
+    local stats = pool:stats()
+    assert(stats.size <= 4 and stats.idle == stats.size)
+    assert(stats.checkouts == 9)
+end
+
 test_option()
 query_use_result()
 query_use_result_alpha_index()
 query_store_result()
 query_store_result_alpha_index()
+query_store_result_columns()
+query_async()
+query_prepared()
+query_pool()
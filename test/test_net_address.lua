@@ -0,0 +1,40 @@
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+
+
+local endpoints = {
+    { host = 'unix:/tmp/qsf_test_net.sock', port = 0 },
+    { host = '::1', port = 10090 },
+}
+
+local function echo_over(host, port)
+    local server = net.createServer()
+    server:start(host, port, function(err, serial, data)
+        if not err then
+            print(host, 'session', serial, server:addressOf(serial))
+            server:write(serial, data)
+        end
+    end)
+    local received
+    local client
+    client = net.connect(host, port, {
+        reconnect = false,
+        callback = function(err, index, data)
+            assert(not err, data)
+            received = data
+            client:close()
+            server:stop()
+        end,
+    })
+    uv.createTimer(200, 0, function()
+        assert(client:write('hello ' .. host))
+    end)
+    node.run()
+    assert(received == 'hello ' .. host)
+end
+
+for _, endpoint in ipairs(endpoints) do
+    echo_over(endpoint.host, endpoint.port)
+end
+print('net address passed')
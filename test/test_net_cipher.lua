@@ -0,0 +1,91 @@
+local node = require 'node'
+local net = require 'net'
+local fixture = require 'net_fixture'
+
+
+local port = 10096
+local ERR_BAD_FRAME = 100005        -- NET_ERR_BAD_FRAME
+local key = string.rep('k', 16)
+local iv = string.rep('v', 16)
+
+-- frames pass in both directions, and never share a key stream
+local function test_loopback(mode)
+    local server = net.createCipher(key, iv, mode, true)
+    local client = net.createCipher(key, iv, mode)
+    for n = 1, 10 do
+        local plain = string.rep('frame' .. n, n)
+        local up = client:encrypt(plain)
+        local down = server:encrypt(plain)
+        assert(up ~= plain and down ~= plain)
+        assert(up ~= down, 'directions share key stream')
+        assert(server:decrypt(up) == plain)
+        assert(client:decrypt(down) == plain)
+    end
+end
+
+-- a frame with a modified tag or body is rejected
+local function test_tamper()
+    local server = net.createCipher(key, iv, 'gcm', true)
+    local client = net.createCipher(key, iv, 'gcm')
+    local sealed = client:encrypt('hello')
+    assert(#sealed == #'hello' + 16)
+    local last = sealed:byte(-1) ~ 1
+    assert(server:decrypt(sealed:sub(1, -2) .. string.char(last)) == nil)
+
+    server = net.createCipher(key, iv, 'gcm', true)
+    client = net.createCipher(key, iv, 'gcm')
+    sealed = client:encrypt('hello')
+    local first = sealed:byte(1) ~ 1
+    assert(server:decrypt(string.char(first) .. sealed:sub(2)) == nil)
+end
+
+-- session switches to cipher after 'hello', a forged frame kicks it
+local function test_session()
+    local cipher = net.createCipher(key, iv, 'gcm')
+    local client
+    local server
+    local kicked = false
+    server = fixture.server(port, function(err, serial, data)
+        if err then
+            assert(err == ERR_BAD_FRAME, data)
+            kicked = true
+            client:close()
+            server:stop()
+        elseif data == 'hello' then
+            assert(server:setCipher(serial, key, iv, 'gcm'))
+            server:write(serial, 'ready')
+        else
+            assert(data == 'ping')
+            server:write(serial, 'pong')
+        end
+    end)
+    client = fixture.connect(port, function(err, index, data)
+        if err then
+            return
+        end
+        local plain = cipher:decrypt(data)
+        if plain == 'ready' then
+            assert(client:write(cipher:encrypt('ping')))
+        else
+            assert(plain == 'pong')
+            local forged = cipher:encrypt('ping')
+            local last = forged:byte(-1) ~ 1
+            assert(client:write(forged:sub(1, -2) .. string.char(last)))
+        end
+    end)
+    fixture.ready(function()
+        assert(client:write('hello'))
+    end)
+    node.run()
+    assert(kicked)
+end
+
+local function main()
+    test_loopback('ctr')
+    test_loopback('gcm')
+    test_tamper()
+    test_session()
+    print('net cipher passed')
+end
+
+main()
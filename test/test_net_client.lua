@@ -0,0 +1,52 @@
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+
+
+local host = '127.0.0.1'
+local port = 10087
+local total = 1000
+
+local function start_echo_server()
+    local server = net.createServer()
+    server:start(host, port, function(err, serial, data)
+        if not err then
+            server:write(serial, data)
+        end
+    end)
+    return server
+end
+
+local function main()
+    local server = start_echo_server()
+    local count = 0
+    local client
+    client = net.connect(host, port, {
+        pool = 4,
+        min_backoff = 100,
+        callback = function(err, index, data)
+            if err then
+                print('client error', index, data)
+                return
+            end
+            count = count + 1
+            if count == total then
+                print('client received', count)
+                client:close()
+                server:stop()
+            end
+        end,
+    })
+    uv.createTimer(500, 0, function()
+        assert(client:size() == 4)
+        for n=1, total do
+            assert(client:write('hello' .. n, n % 4 + 1))
+        end
+    end)
+    while count < total do
+        node.run()
+    end
+    print('net client passed')
+end
+
+main()
@@ -0,0 +1,62 @@
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+local zlib = require 'zlib'
+
+
+local host = '127.0.0.1'
+local port = 10088
+local window_bits = 12 -- NET_COMPRESS_WINDOW_BITS
+local threshold = 64
+
+local FRAME_RAW = string.char(0)
+local FRAME_DEFLATED = string.char(1)
+
+local messages = {
+    'short frame',
+    string.rep('state sync payload ', 20),
+    string.rep('state sync payload ', 20), -- shares dictionary with previous frame
+}
+
+local function main()
+    local server = net.createServer()
+    server:setCompress(true, threshold)
+    server:start(host, port, function(err, serial, data)
+        if not err then
+            server:write(serial, data)
+        end
+    end)
+
+    local inflate = zlib.inflate(window_bits)
+    local received = {}
+    local client
+    client = net.connect(host, port, {
+        reconnect = false,
+        callback = function(err, index, data)
+            assert(not err, data)
+            local flag, body = data:sub(1, 1), data:sub(2)
+            if flag == FRAME_DEFLATED then
+                body = inflate(body, 'sync')
+            else
+                assert(flag == FRAME_RAW)
+            end
+            received[#received + 1] = body
+            if #received == #messages then
+                client:close()
+                server:stop()
+            end
+        end,
+    })
+    uv.createTimer(200, 0, function()
+        for _, msg in ipairs(messages) do
+            assert(client:write(FRAME_RAW .. msg))
+        end
+    end)
+    node.run()
+    for i, msg in ipairs(messages) do
+        assert(received[i] == msg)
+    end
+    print('net compress passed')
+end
+
+main()
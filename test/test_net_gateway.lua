@@ -0,0 +1,107 @@
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+local fixture = require 'net_fixture'
+
+
+local ports = {10089, 10095}    -- two servers, their serials collide
+local gateway_name = 'test'
+local backend_name = 'gateway_backend'
+local total = 100
+
+-- echo forwarded frames back through the gateway
+local function run_backend()
+    local closed = 0
+    while true do
+        local from, msg = node.recv()
+        local kind, session, data = net.unpackForward(msg)
+        assert(from == gateway_name and kind)
+        if kind == 'data' then
+            net.forward(from, session, data)
+        else
+            closed = closed + 1
+            if closed == #ports then
+                break
+            end
+        end
+    end
+end
+
+local function start_server(port)
+    local server
+    server = fixture.server(port, function(err, serial, data)
+        if not err then
+            assert(data == 'bind')
+            assert(server:bindSession(serial, backend_name))
+            server:write(serial, 'bound')
+        end
+    end)
+    return server
+end
+
+-- frames echoed by backend must come back to the client that sent them
+local function start_client(port, on_done)
+    local count = 0
+    local client
+    local prefix = 'frame' .. port .. '_'
+    client = fixture.connect(port, function(err, index, data)
+        assert(not err, data)
+        if data == 'bound' then
+            for n=1, total do
+                assert(client:write(prefix .. n))
+            end
+            return
+        end
+        count = count + 1
+        assert(data == prefix .. count)
+        if count == total then
+            client:close()
+            on_done()
+        end
+    end)
+    fixture.ready(function()
+        assert(client:write('bind'))
+    end)
+end
+
+local function run_gateway()
+    assert(node.launch(backend_name, '../test/test_net_gateway.lua') == true)
+    local servers = {}
+    for i, port in ipairs(ports) do
+        servers[i] = start_server(port)
+    end
+
+    -- drain write requests of backend, handled in C
+    local done = false
+    local function poll()
+        assert(node.recv('nowait') == nil)
+        if not done then
+            uv.createTimer(10, 0, poll)
+        end
+    end
+    poll()
+
+    local finished = 0
+    for _, port in ipairs(ports) do
+        start_client(port, function()
+            finished = finished + 1
+            if finished == #ports then
+                uv.createTimer(200, 0, function()
+                    done = true
+                    for _, server in ipairs(servers) do
+                        server:stop()
+                    end
+                end)
+            end
+        end)
+    end
+    node.run()
+    assert(finished == #ports)
+    print('net gateway passed')
+end
+
+if node.name() == backend_name then
+    run_backend()
+else
+    run_gateway()
+end
@@ -0,0 +1,116 @@
+local node = require 'node'
+local net = require 'net'
+local fixture = require 'net_fixture'
+
+
+local port = 10097
+local gid = 7
+local key = string.rep('k', 16)
+local iv = string.rep('v', 16)
+local FRAME_RAW = string.char(0)
+
+-- connection 1 leaves group, 2 is closed mid-group, 3 is compressed and
+-- 4 is encrypted, the last two take private copies of shared frames
+local PLAIN, CLOSED, COMPRESSED, ENCRYPTED = 1, 2, 3, 4
+local total = 4
+
+local function main()
+    local server
+    local members = {}
+    local joined = 0
+    local sent = false
+    server = fixture.server(port, function(err, serial, data)
+        if err then
+            return
+        end
+        local index = tonumber(data:match('^join(%d)$'))
+        if index then
+            members[index] = serial
+            assert(server:joinGroup(serial, gid))
+            if index == COMPRESSED then
+                assert(server:compress(serial, true))
+            elseif index == ENCRYPTED then
+                assert(server:setCipher(serial, key, iv, 'gcm'))
+            end
+            joined = joined + 1
+            if joined == total then
+                assert(server:groupSize(gid) == total)
+                server:multicast(gid, 'm1')
+            end
+            return
+        end
+        if data == 'leave' then
+            assert(server:leaveGroup(members[PLAIN], gid))
+        else
+            assert(data == 'bye')
+            server:kick(members[CLOSED])
+        end
+        if server:groupSize(gid) == 2 and not sent then
+            sent = true
+            server:multicast(gid, 'm2')
+            -- a leaver gets this without any multicast frame before it
+            server:write(members[PLAIN], 'direct')
+        end
+    end)
+
+    local cipher = net.createCipher(key, iv, 'gcm')
+    local received = {}
+    local client
+    local guard
+    local function count(index)
+        return (received[index] and #received[index] or 0)
+    end
+    local function decode(index, data)
+        if index == COMPRESSED then
+            assert(data:sub(1, 1) == FRAME_RAW)
+            return data:sub(2)
+        elseif index == ENCRYPTED then
+            return assert(cipher:decrypt(data))
+        end
+        return data
+    end
+    local function on_frame(index, data)
+        local list = received[index] or {}
+        received[index] = list
+        list[#list + 1] = decode(index, data)
+        if #list == 1 then
+            assert(list[1] == 'm1')
+            if count(PLAIN) > 0 and count(CLOSED) > 0 and
+                count(COMPRESSED) > 0 and count(ENCRYPTED) > 0 then
+                assert(client:write('leave', PLAIN))
+                assert(client:write('bye', CLOSED))
+            end
+        elseif index == PLAIN then
+            assert(list[2] == 'direct', list[2])
+        else
+            assert(index ~= CLOSED)
+            assert(list[2] == 'm2', list[2])
+        end
+        if count(PLAIN) == 2 and count(COMPRESSED) == 2 and count(ENCRYPTED) == 2 then
+            guard:stop()
+            client:close()
+            server:stop()
+        end
+    end
+    client = fixture.connect(port, function(err, index, data)
+        if not err then
+            on_frame(index, data)
+        end
+    end, { pool = total })
+    fixture.ready(function()
+        assert(client:size() == total)
+        for index = 1, total do
+            assert(client:write('join' .. index, index))
+        end
+    end, 500)
+    guard = fixture.guard(10000, function()
+        client:close()
+        server:stop()
+    end)
+    node.run()
+    assert(not guard.expired, 'net multicast timed out')
+    assert(server:groupSize(gid) == 0)
+    print('net multicast passed')
+end
+
+main()
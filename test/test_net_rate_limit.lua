@@ -0,0 +1,75 @@
+local uv = require 'luv'
+local node = require 'node'
+local fixture = require 'net_fixture'
+
+
+local ERR_RATE_LIMIT = 100006       -- NET_ERR_RATE_LIMIT
+local rate = 100                    -- frames per second, also the burst
+local total = 150
+
+-- frames beyond one second of tokens kick the session
+local function test_kick(port, on_done)
+    local count = 0
+    local client
+    local server
+    server = fixture.server(port, function(err, serial, data)
+        if err then
+            assert(err == ERR_RATE_LIMIT, data)
+            assert(count >= 1 and count < total)
+            client:close()
+            server:stop()
+            on_done()
+        else
+            count = count + 1
+        end
+    end)
+    server:setRateLimit(rate, 0, 'kick')
+    client = fixture.connect(port)
+    fixture.ready(function()
+        for n = 1, total do
+            client:write('frame' .. n)
+        end
+    end)
+end
+
+-- reading is paused till tokens are paid back, no frame is lost
+local function test_pause(port, on_done)
+    local count = 0
+    local start
+    local client
+    local server
+    server = fixture.server(port, function(err, serial, data)
+        assert(not err, data)
+        count = count + 1
+        assert(data == 'frame' .. count)
+        if count == total then
+            local elapsed = (uv.hrtime() - start) / 1e6
+            assert(elapsed >= (total - rate) * 1000 / rate / 2, elapsed)
+            client:close()
+            server:stop()
+            on_done()
+        end
+    end)
+    server:setRateLimit(rate, 0, 'pause')
+    client = fixture.connect(port)
+    fixture.ready(function()
+        start = uv.hrtime()
+        for n = 1, total do
+            assert(client:write('frame' .. n))
+        end
+    end)
+end
+
+local function main()
+    local done = 0
+    local function on_done()
+        done = done + 1
+    end
+    test_kick(10093, on_done)
+    test_pause(10094, on_done)
+    node.run()
+    assert(done == 2)
+    print('net rate limit passed')
+end
+
+main()
@@ -0,0 +1,56 @@
+local node = require 'node'
+local fixture = require 'net_fixture'
+
+
+local port = 10092
+local ERR_SEND_OVERFLOW = 100004    -- NET_ERR_SEND_OVERFLOW
+local soft_limit = 256 * 1024
+local hard_limit = 1024 * 1024
+local frame = string.rep('x', 60000)
+local burst = 200                   -- far more than socket buffers take at once
+
+local function main()
+    local client
+    local server
+    local writing = false
+    local kicked = false
+    local peak = 0
+    server = fixture.server(port, function(err, serial, data)
+        if err then
+            assert(not writing, 'kick reported inside write')
+            assert(err == ERR_SEND_OVERFLOW, data)
+            assert(server:pending(serial) == nil)
+            kicked = true
+            client:close()
+            server:stop()
+            return
+        end
+        assert(data == 'go')
+        writing = true
+        -- droppable frames above soft limit are discarded
+        for n = 1, burst do
+            server:write(serial, frame, true)
+            peak = math.max(peak, server:pending(serial))
+        end
+        assert(peak > 0 and peak <= soft_limit)
+        -- a frame not droppable beyond hard limit kicks the session
+        for n = 1, burst do
+            server:write(serial, frame)
+            if not server:pending(serial) then
+                break
+            end
+        end
+        writing = false
+    end)
+    server:setSendLimit(soft_limit, hard_limit, 'drop_newest')
+
+    client = fixture.connect(port)
+    fixture.ready(function()
+        assert(client:write('go'))
+    end)
+    node.run()
+    assert(kicked)
+    print('net send limit passed')
+end
+
+main()
@@ -0,0 +1,57 @@
+local uv = require 'luv'
+local node = require 'node'
+local net = require 'net'
+
+
+local host = '127.0.0.1'
+local port = 10091
+local messages = { 'first', 'second', 'third' }
+
+local function main()
+    local server = net.createServer()
+    server:start(host, port, function(err, serial, data)
+        if not err then
+            server:write(serial, data)
+        end
+    end)
+
+    local count = 0
+    local client
+    client = net.connect(host, port, {
+        reconnect = false,
+        callback = function(err, index, data)
+            assert(not err, data)
+            count = count + 1
+            if count == #messages then
+                client:close()
+                server:stop()
+            end
+        end,
+    })
+    uv.createTimer(200, 0, function()
+        for _, msg in ipairs(messages) do
+            assert(client:write(msg))
+        end
+    end)
+    node.run()
+
+    local stats = server:stats()
+    local bytes = 0
+    for _, msg in ipairs(messages) do
+        bytes = bytes + #msg + 2
+    end
+    assert(stats.accepted == 1 and stats.rejected == 0)
+    assert(stats.framesIn == #messages and stats.framesOut == #messages)
+    assert(stats.bytesIn == bytes and stats.bytesOut == bytes)
+    local timed = 0
+    for i = 1, #stats.readLatency do
+        timed = timed + stats.readLatency[i]
+    end
+    assert(timed == #messages)
+
+    server:resetStats()
+    assert(server:stats().framesIn == 0)
+    print('net stats passed')
+end
+
+main()
@@ -0,0 +1,56 @@
+local node = require 'node'
+local net = require 'net'
+local fixture = require 'net_fixture'
+
+
+local host = '127.0.0.1'
+local port = 10091
+local total = 200
+local loss = 20 -- percent of datagrams dropped on both sides
+
+local function make_frame(n)
+    if n % 10 == 0 then
+        return string.rep(tostring(n), 2000) -- split into fragments
+    end
+    return 'frame' .. n
+end
+
+local function main()
+    local server = net.createUdp()
+    server:setNoDelay(true, 10, 2, true)
+    server:setLoss(loss)
+    server:start(host, port, function(err, serial, data)
+        if not err then
+            server:write(serial, data)
+        end
+    end)
+
+    local client = net.createUdp()
+    client:setNoDelay(true, 10, 2, true)
+    client:setLoss(loss)
+    local count = 0
+    local serial
+    local guard = fixture.guard(10000, function()
+        client:stop()
+        server:stop()
+    end)
+    serial = client:connect(host, port, function(err, serial, data)
+        assert(not err, data)
+        count = count + 1
+        assert(data == make_frame(count), 'frame out of order')
+        if count == total then
+            guard:stop()
+            client:stop()
+            server:stop()
+        end
+    end)
+    for n=1, total do
+        assert(client:write(serial, make_frame(n)))
+    end
+    node.run()
+    assert(not guard.expired, string.format('net udp timed out: %d/%d', count, total))
+    assert(count == total)
+    print('net udp passed')
+end
+
+main()
@@ -0,0 +1,14 @@
+local node = require 'node'
+
+
+local function main()
+    node.log(node.INFO, 'structured %s %d %.2f', 'log', 42, 3.14159)
+    node.log(node.DEBUG, 'table %s, missing %d', {})
+
+    local previous = node.logLevel(node.WARN)
+    node.log(node.INFO, 'filtered %s', 'line')
+    assert(node.logLevel(previous) == node.WARN)
+    print('node log passed')
+end
+
+main()
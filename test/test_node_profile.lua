@@ -0,0 +1,32 @@
+local uv = require 'luv'
+local node = require 'node'
+
+
+local function spin(ms)
+    local deadline = uv.hrtime() + ms * 1000000
+    local n = 0
+    while uv.hrtime() < deadline do
+        n = n + 1
+    end
+    return n
+end
+
+local function main()
+    node.profile('start', 1000)
+    spin(200)
+    local samples, dropped = node.profile('stop')
+    assert(samples > 0 and dropped == 0, samples)
+
+    local folded = node.profile('dump')
+    assert(folded:find('spin %(', 1) ~= nil, folded)
+    for line in folded:gmatch('[^\n]+') do
+        assert(line:match('^.+ %d+$'), line)
+    end
+
+    -- hook removed, no more samples taken
+    spin(50)
+    assert(select(1, node.profile('stop')) == samples)
+    print('node profile passed')
+end
+
+main()
@@ -0,0 +1,37 @@
+local uv = require 'luv'
+local node = require 'node'
+
+
+local function busy(ms)
+    local deadline = uv.hrtime() + ms * 1000000
+    while uv.hrtime() < deadline do end
+end
+
+local function main()
+    local ticks = 0
+    local function tick()
+        ticks = ticks + 1
+        if ticks == 2 then
+            busy(150) -- reference timer fires late
+        end
+        if ticks < 5 then
+            uv.createTimer(100, 0, tick)
+        end
+    end
+    uv.createTimer(100, 0, tick)
+    node.run()
+
+    local stats = node.stats()
+    assert(stats.name == node.name())
+    assert(stats.calls.timer.count == ticks)
+    assert(stats.calls.timer.max >= 150000)
+    assert(stats.loops > 0 and stats.memory > 0)
+    assert(stats.lag.max >= 50000, stats.lag.max)
+
+    local all = node.allStats()
+    assert(all[node.name()] ~= nil)
+    assert(node.stats('no_such_node') == nil)
+    print('node stats passed')
+end
+
+main()
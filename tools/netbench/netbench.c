@@ -0,0 +1,389 @@
+// Copyright (C) 2014-2015 chenqiang@chaoyuehudong.com. All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+// load generator of qsf net server, speaking the 2-byte length framing.
+//
+// each message carries its send time, replies are matched by content so
+// the same tool measures echo and broadcast servers, see test/bench_net.lua.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <uv.h>
+
+#define RECV_BUF_SIZE       (2 * (2 + UINT16_MAX)) // room for a max frame behind a partial one
+#define MSG_HEADER_SIZE     12      // send time and connection index
+#define TICK_MS             1
+#define REPORT_MS           1000
+#define MAX_BATCH           64      // frames coalesced in one write
+
+typedef struct bench_options_s
+{
+    const char* host;
+    int         port;
+    int         connections;    // concurrent connections
+    int         size;           // content bytes per message
+    int         rate;           // messages per second per connection, 0 for closed loop
+    int         window;         // in-flight messages per connection of closed loop
+    int         duration;       // measured seconds
+    int         warmup;         // seconds before measuring
+}bench_options_t;
+
+typedef struct bench_conn_s
+{
+    uv_tcp_t    handle;
+    uv_connect_t connect_req;
+    int         index;
+    int         connected;
+    uint64_t    sent;           // messages sent
+    char*       buf;            // unparsed inbound bytes
+    uint32_t    size;           // bytes in `buf`
+}bench_conn_t;
+
+typedef struct bench_write_s
+{
+    uv_write_t  req;
+    uv_buf_t    buf;
+    char        data[];
+}bench_write_t;
+
+typedef struct bench_s
+{
+    bench_options_t opts;
+    uv_loop_t*  loop;
+    uv_timer_t  tick_timer;
+    uv_timer_t  report_timer;
+    bench_conn_t* conns;
+    int         connected;
+    uint64_t    start_time;     // all connected, nanoseconds
+    uint64_t    measure_time;   // warm up finished
+    uint64_t    stop_time;
+    int         measuring;
+    int         stopping;
+    uint64_t    received;       // messages received while measuring
+    uint64_t    received_bytes;
+    uint64_t    interval_received;
+    uint32_t*   samples;        // round trip times, microseconds
+    size_t      sample_count;
+    size_t      sample_capacity;
+}bench_t;
+
+static bench_t bench;
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: netbench [-h host] [-p port] [-c connections] [-s size] [-r rate]\n"
+        "                [-w window] [-d duration] [-W warmup]\n"
+        "  -r  messages per second per connection, 0 keeps `window` messages in flight\n");
+    exit(1);
+}
+
+static void parse_options(int argc, char* argv[], bench_options_t* opts)
+{
+    opts->host = "127.0.0.1";
+    opts->port = 10086;
+    opts->connections = 100;
+    opts->size = 64;
+    opts->rate = 0;
+    opts->window = 1;
+    opts->duration = 10;
+    opts->warmup = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+        {
+            usage();
+        }
+        const char* value = argv[++i];
+        switch (arg[1])
+        {
+        case 'h': opts->host = value; break;
+        case 'p': opts->port = atoi(value); break;
+        case 'c': opts->connections = atoi(value); break;
+        case 's': opts->size = atoi(value); break;
+        case 'r': opts->rate = atoi(value); break;
+        case 'w': opts->window = atoi(value); break;
+        case 'd': opts->duration = atoi(value); break;
+        case 'W': opts->warmup = atoi(value); break;
+        default: usage();
+        }
+    }
+    if (opts->connections <= 0 || opts->size < MSG_HEADER_SIZE || opts->size > UINT16_MAX ||
+        opts->rate < 0 || opts->window <= 0 || opts->duration <= 0 || opts->warmup < 0)
+    {
+        usage();
+    }
+}
+
+static void record_sample(uint32_t rtt)
+{
+    if (bench.sample_count == bench.sample_capacity)
+    {
+        bench.sample_capacity = (bench.sample_capacity ? bench.sample_capacity * 2 : 65536);
+        bench.samples = realloc(bench.samples, bench.sample_capacity * sizeof(uint32_t));
+        assert(bench.samples);
+    }
+    bench.samples[bench.sample_count++] = rtt;
+}
+
+static void on_write(uv_write_t* req, int err)
+{
+    free(req->data);
+}
+
+// write `count` messages in one request
+static void conn_send(bench_conn_t* conn, int count)
+{
+    uint32_t frame = sizeof(uint16_t) + bench.opts.size;
+    bench_write_t* w = malloc(sizeof(bench_write_t) + frame * count);
+    uint64_t now = uv_hrtime();
+    char* p = w->data;
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t size = (uint16_t)bench.opts.size;
+        uint32_t index = (uint32_t)conn->index;
+        p[0] = (char)(size >> 8);
+        p[1] = (char)size;
+        memcpy(p + 2, &now, sizeof(now));
+        memcpy(p + 2 + sizeof(now), &index, sizeof(index));
+        memset(p + 2 + MSG_HEADER_SIZE, 'x', size - MSG_HEADER_SIZE);
+        p += frame;
+    }
+    w->req.data = w;
+    w->buf = uv_buf_init(w->data, frame * count);
+    if (uv_write(&w->req, (uv_stream_t*)&conn->handle, &w->buf, 1, on_write) < 0)
+    {
+        free(w);
+        return;
+    }
+    conn->sent += count;
+}
+
+static void on_message(bench_conn_t* conn, const char* data, uint16_t size)
+{
+    if (size < MSG_HEADER_SIZE)
+    {
+        return;
+    }
+    uint64_t sent_time;
+    uint32_t index;
+    memcpy(&sent_time, data, sizeof(sent_time));
+    memcpy(&index, data + sizeof(sent_time), sizeof(index));
+    if (bench.measuring && !bench.stopping)
+    {
+        record_sample((uint32_t)((uv_hrtime() - sent_time) / 1000));
+        bench.received++;
+        bench.received_bytes += size + sizeof(uint16_t);
+    }
+    bench.interval_received++;
+    // closed loop, own message comes back
+    if (bench.opts.rate == 0 && index == (uint32_t)conn->index && !bench.stopping)
+    {
+        conn_send(conn, 1);
+    }
+}
+
+static void on_alloc(uv_handle_t* handle, size_t suggested, uv_buf_t* buf)
+{
+    bench_conn_t* conn = handle->data;
+    buf->base = conn->buf + conn->size;
+    buf->len = RECV_BUF_SIZE - conn->size;
+}
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    bench_conn_t* conn = stream->data;
+    if (nread < 0)
+    {
+        if (!bench.stopping)
+        {
+            fprintf(stderr, "connection %d closed: %s\n", conn->index, uv_strerror((int)nread));
+        }
+        uv_close((uv_handle_t*)stream, NULL);
+        return;
+    }
+    conn->size += (uint32_t)nread;
+    uint32_t offset = 0;
+    while (conn->size - offset >= sizeof(uint16_t))
+    {
+        const uint8_t* p = (const uint8_t*)conn->buf + offset;
+        uint16_t size = (uint16_t)((p[0] << 8) | p[1]);
+        if (conn->size - offset < sizeof(uint16_t) + size)
+        {
+            break;
+        }
+        on_message(conn, (const char*)p + sizeof(uint16_t), size);
+        offset += sizeof(uint16_t) + size;
+    }
+    conn->size -= offset;
+    memmove(conn->buf, conn->buf + offset, conn->size);
+}
+
+static int compare_sample(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(double p)
+{
+    if (bench.sample_count == 0)
+    {
+        return 0;
+    }
+    size_t rank = (size_t)(p * (bench.sample_count - 1) + 0.5);
+    return bench.samples[rank];
+}
+
+static void report_final(void)
+{
+    double seconds = (bench.stop_time - bench.measure_time) / 1e9;
+    qsort(bench.samples, bench.sample_count, sizeof(uint32_t), compare_sample);
+    printf("connections %d, size %d, rate %d, window %d\n", bench.opts.connections,
+        bench.opts.size, bench.opts.rate, bench.opts.window);
+    printf("messages    %llu in %.2fs\n", (unsigned long long)bench.received, seconds);
+    printf("throughput  %.0f msg/s, %.2f MB/s\n", bench.received / seconds,
+        bench.received_bytes / seconds / (1024 * 1024));
+    printf("rtt(us)     p50 %u, p99 %u, p999 %u, max %u\n", percentile(0.5),
+        percentile(0.99), percentile(0.999),
+        (bench.sample_count ? bench.samples[bench.sample_count - 1] : 0));
+}
+
+static void stop_bench(void)
+{
+    bench.stopping = 1;
+    bench.stop_time = uv_hrtime();
+    uv_timer_stop(&bench.tick_timer);
+    uv_timer_stop(&bench.report_timer);
+    uv_close((uv_handle_t*)&bench.tick_timer, NULL);
+    uv_close((uv_handle_t*)&bench.report_timer, NULL);
+    for (int i = 0; i < bench.opts.connections; i++)
+    {
+        uv_handle_t* handle = (uv_handle_t*)&bench.conns[i].handle;
+        if (!uv_is_closing(handle))
+        {
+            uv_close(handle, NULL);
+        }
+    }
+    report_final();
+}
+
+// open loop, send messages due since start
+static void on_tick(uv_timer_t* timer)
+{
+    uint64_t elapsed = uv_hrtime() - bench.start_time;
+    for (int i = 0; i < bench.opts.connections; i++)
+    {
+        bench_conn_t* conn = &bench.conns[i];
+        uint64_t due = elapsed * bench.opts.rate / 1000000000 - conn->sent;
+        while (due > 0)
+        {
+            int count = (int)(due > MAX_BATCH ? MAX_BATCH : due);
+            conn_send(conn, count);
+            due -= count;
+        }
+    }
+}
+
+static void on_report(uv_timer_t* timer)
+{
+    uint64_t now = uv_hrtime();
+    if (!bench.measuring && now - bench.start_time >= (uint64_t)bench.opts.warmup * 1000000000)
+    {
+        bench.measuring = 1;
+        bench.measure_time = now;
+    }
+    printf("%s %llu msg/s\n", (bench.measuring ? "measure" : "warmup "),
+        (unsigned long long)bench.interval_received * 1000 / REPORT_MS);
+    fflush(stdout);
+    bench.interval_received = 0;
+    if (bench.measuring && now - bench.measure_time >= (uint64_t)bench.opts.duration * 1000000000)
+    {
+        stop_bench();
+    }
+}
+
+static void start_traffic(void)
+{
+    bench.start_time = uv_hrtime();
+    if (bench.opts.warmup == 0)
+    {
+        bench.measuring = 1;
+        bench.measure_time = bench.start_time;
+    }
+    uv_timer_start(&bench.report_timer, on_report, REPORT_MS, REPORT_MS);
+    if (bench.opts.rate > 0)
+    {
+        uv_timer_start(&bench.tick_timer, on_tick, TICK_MS, TICK_MS);
+        return;
+    }
+    for (int i = 0; i < bench.opts.connections; i++)
+    {
+        conn_send(&bench.conns[i], bench.opts.window);
+    }
+}
+
+static void on_connect(uv_connect_t* req, int err)
+{
+    bench_conn_t* conn = req->data;
+    if (err < 0)
+    {
+        fprintf(stderr, "connect %s:%d failed: %s\n", bench.opts.host, bench.opts.port,
+            uv_strerror(err));
+        exit(1);
+    }
+    uv_tcp_nodelay(&conn->handle, 1);
+    uv_read_start((uv_stream_t*)&conn->handle, on_alloc, on_read);
+    conn->connected = 1;
+    if (++bench.connected == bench.opts.connections)
+    {
+        start_traffic();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_in addr;
+    parse_options(argc, argv, &bench.opts);
+    bench.loop = uv_default_loop();
+    int r = uv_ip4_addr(bench.opts.host, bench.opts.port, &addr);
+    if (r < 0)
+    {
+        fprintf(stderr, "invalid address %s: %s\n", bench.opts.host, uv_strerror(r));
+        return 1;
+    }
+    uv_timer_init(bench.loop, &bench.tick_timer);
+    uv_timer_init(bench.loop, &bench.report_timer);
+    bench.conns = calloc(bench.opts.connections, sizeof(bench_conn_t));
+    for (int i = 0; i < bench.opts.connections; i++)
+    {
+        bench_conn_t* conn = &bench.conns[i];
+        conn->index = i;
+        conn->buf = malloc(RECV_BUF_SIZE);
+        uv_tcp_init(bench.loop, &conn->handle);
+        conn->handle.data = conn;
+        conn->connect_req.data = conn;
+        r = uv_tcp_connect(&conn->connect_req, &conn->handle,
+            (const struct sockaddr*)&addr, on_connect);
+        if (r < 0)
+        {
+            fprintf(stderr, "connect failed: %s\n", uv_strerror(r));
+            return 1;
+        }
+    }
+    uv_run(bench.loop, UV_RUN_DEFAULT);
+    for (int i = 0; i < bench.opts.connections; i++)
+    {
+        free(bench.conns[i].buf);
+    }
+    free(bench.conns);
+    free(bench.samples);
+    return 0;
+}